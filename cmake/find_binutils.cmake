@@ -12,6 +12,7 @@
 #  BINUTILS_HAVE_BFD_SECTION_FLAGS - support bfd_section_flags()
 #  BINUTILS_HAVE_BFD_SECTION_NAME - support bfd_section_name(asect)
 #  BINUTILS_HAVE_BFD_SECTION_NAME2 - support bfd_section_name(abfd, asect)
+#  BINUTILS_HAVE_BFD_THREAD_INIT - support bfd_thread_init()
 
 find_path(BINUTILS_INCLUDE_DIRS
 	NAMES bfd.h
@@ -73,6 +74,13 @@ int main(void) {
 	(void)bfd_section_name((struct bfd *)NULL, (asection *)NULL);
 	return 0;
 }" BINUTILS_HAVE_BFD_SECTION_NAME2)
+CHECK_C_SOURCE_COMPILES("
+#include <stddef.h>
+#include <bfd.h>
+int main(void) {
+	(void)bfd_thread_init(NULL, NULL, NULL);
+	return 0;
+}" BINUTILS_HAVE_BFD_THREAD_INIT)
 SET(CMAKE_REQUIRED_LIBRARIES)
 
 mark_as_advanced(
@@ -84,5 +92,6 @@ mark_as_advanced(
 	BINUTILS_HAVE_BFD_SECTION_FLAGS
 	BINUTILS_HAVE_BFD_SECTION_NAME
 	BINUTILS_HAVE_BFD_SECTION_NAME2
+	BINUTILS_HAVE_BFD_THREAD_INIT
 )
 
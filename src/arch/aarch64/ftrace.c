@@ -2,6 +2,7 @@
 /* Copyright (C) 2022-2025 Rong Tao */
 #include <errno.h>
 #include <stdint.h>
+#include <string.h>
 #include <stdbool.h>
 
 #include <utils/util.h>
@@ -46,3 +47,38 @@ int ftrace_modify_code(struct task_struct *task, unsigned long pc, uint32_t old,
 	return 0;
 }
 
+
+/**
+ * Decode the "bl _mcount" at @ip, @code is the text copied from @ip.
+ *
+ * @return: length of the instruction, 0 if it's not a bl. @target is the
+ * callee, never @indirect.
+ */
+int ftrace_decode_call(const void *code, size_t len, unsigned long ip,
+		       unsigned long *target, bool *indirect)
+{
+	uint32_t insn;
+	unsigned long imm;
+
+	*indirect = false;
+
+	if (len < AARCH64_INSN_SIZE)
+		return 0;
+
+	memcpy(&insn, code, sizeof(insn));
+	if (!aarch64_insn_is_bl(insn))
+		return 0;
+
+	/* imm26 is signed, in instructions */
+	imm = aarch64_insn_decode_immediate(AARCH64_INSN_IMM_26, insn);
+	*target = ip + (((long)(imm << 38)) >> 36);
+	return AARCH64_INSN_SIZE;
+}
+
+/* NOP which has the same length as the call, NULL if not support */
+const char *ftrace_nop_insn(size_t len)
+{
+	if (len != AARCH64_INSN_SIZE)
+		return NULL;
+	return (const char *)ideal_nop4_arm64;
+}
@@ -2,9 +2,13 @@
 /* Copyright (C) 2022-2025 Rong Tao */
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 
 struct task_struct;
 
 int ftrace_modify_code(struct task_struct *task, unsigned long pc, uint32_t old,
 		       uint32_t new, bool validate);
+int ftrace_decode_call(const void *code, size_t len, unsigned long ip,
+		       unsigned long *target, bool *indirect);
+const char *ftrace_nop_insn(size_t len);
@@ -24,3 +24,15 @@ struct mcount_regs {
 #define ARG7(a) ((a)->x6)
 #define ARG8(a) ((a)->x7)
 
+/**
+ * Key of a hooked frame in shadow stack. The return address is saved in the
+ * frame record of child {fp, lr}, the slot is gone when child returns, but
+ * its epilogue restores the fp of parent, it's unique of each live frame.
+ */
+#define MCOUNT_FRAME_KEY(parent_loc) ((parent_loc)[-1])
+
+/**
+ * _ftrace_mcount_return() passes the fp right after child returns to
+ * mcount_exit(), see mcount.S.
+ */
+#define MCOUNT_RETURN_KEY(retval, fp) (fp)
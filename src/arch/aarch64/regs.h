@@ -18,3 +18,7 @@
 
 #define SYSCALL_RET(_regs)	_regs.regs[0]
 #define SYSCALL_IP(_regs)	_regs.pc
+#define CALL_ARG1(_regs)	_regs.regs[0]
+#define FRAME_POINTER(_regs)	_regs.regs[29]
+#define STACK_POINTER(_regs)	_regs.sp
+#define LINK_REGISTER(_regs)	_regs.regs[30]
@@ -2,6 +2,7 @@
 /* Copyright (C) 2022-2025 Rong Tao */
 #include <errno.h>
 #include <stdint.h>
+#include <string.h>
 #include <stdbool.h>
 
 #include <utils/util.h>
@@ -12,6 +13,15 @@
 #include <arch/x86_64/ftrace.h>
 #include <arch/x86_64/nops.h>
 
+/* addr32 prefix, ld relaxes "call *GOT(%rip)" to "addr32 call rel32" */
+#define INST_ADDR32	0x67
+/* call *disp32(%rip) */
+#define INST_CALL_RIP	0xff, 0x15
+#define CALL_RIP_INSN_SIZE	6
+
+/* The single instruction 6 bytes NOP */
+static const unsigned char ftrace_nop6[CALL_RIP_INSN_SIZE] = { P6_NOP6 };
+
 const char *ftrace_nop_replace(void)
 {
 	return (const char *)ideal_nops[NOP_ATOMIC5];
@@ -23,3 +33,51 @@ const char *ftrace_call_replace(union text_poke_insn *insn, unsigned long ip,
 	return text_gen_insn(insn, INST_CALL, (void *)ip, (void *)addr);
 }
 
+
+/**
+ * Decode the call of mcount at @ip, @code is the text copied from @ip. gcc
+ * -pg calls mcount with "call rel32", or "call *GOT(%rip)" if PIC, and ld
+ * may relax the later to "addr32 call rel32".
+ *
+ * @return: length of the instruction, 0 if it's not a call. @target is the
+ * callee, or the GOT slot of callee if @indirect.
+ */
+int ftrace_decode_call(const void *code, size_t len, unsigned long ip,
+		       unsigned long *target, bool *indirect)
+{
+	static const uint8_t call_rip[] = { INST_CALL_RIP };
+	const uint8_t *p = code;
+	int32_t disp;
+	int size;
+
+	*indirect = false;
+
+	if (len >= CALL_INSN_SIZE && p[0] == INST_CALLQ) {
+		size = CALL_INSN_SIZE;
+	} else if (len >= CALL_INSN_SIZE + 1 && p[0] == INST_ADDR32 &&
+		   p[1] == INST_CALLQ) {
+		size = CALL_INSN_SIZE + 1;
+	} else if (len >= CALL_RIP_INSN_SIZE &&
+		   !memcmp(p, call_rip, sizeof(call_rip))) {
+		size = CALL_RIP_INSN_SIZE;
+		*indirect = true;
+	} else
+		return 0;
+
+	memcpy(&disp, p + size - sizeof(disp), sizeof(disp));
+	*target = ip + size + disp;
+	return size;
+}
+
+/* NOP which has the same length as the call, NULL if not support */
+const char *ftrace_nop_insn(size_t len)
+{
+	switch (len) {
+	case CALL_INSN_SIZE:
+		return ftrace_nop_replace();
+	case CALL_RIP_INSN_SIZE:
+		return (const char *)ftrace_nop6;
+	default:
+		return NULL;
+	}
+}
@@ -2,9 +2,13 @@
 /* Copyright (C) 2022-2025 Rong Tao */
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 
 const char *ftrace_nop_replace(void);
 const char *ftrace_call_replace(union text_poke_insn *insn, unsigned long ip,
 				unsigned long addr);
 
+int ftrace_decode_call(const void *code, size_t len, unsigned long ip,
+		       unsigned long *target, bool *indirect);
+const char *ftrace_nop_insn(size_t len);
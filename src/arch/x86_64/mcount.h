@@ -20,3 +20,15 @@ struct mcount_regs {
 #define ARG5(a) ((a)->r8)
 #define ARG6(a) ((a)->r9)
 
+/**
+ * Key of a hooked frame in shadow stack, the hooked return address itself
+ * is unique on the stack.
+ */
+#define MCOUNT_FRAME_KEY(parent_loc) ((unsigned long)(parent_loc))
+
+/**
+ * _ftrace_mcount_return() passes the saved return values to mcount_exit(),
+ * the hooked return address was 40 bytes above them, see mcount.S. @fp is
+ * not used.
+ */
+#define MCOUNT_RETURN_KEY(retval, fp) ((unsigned long)(retval) + 40)
@@ -20,7 +20,7 @@ const char *ulpatch_jmpq_replace(union text_poke_insn *insn, unsigned long ip,
 	return text_gen_insn(insn, INST_JMPQ, (void *)ip, (void *)addr);
 }
 
-static long target_off = 0L;
+static __thread long target_off = 0L;
 static inline void *debug_memcpy(void *dst, const void *src, size_t n)
 {
 	int i;
@@ -17,3 +17,6 @@
 
 #define SYSCALL_RET(regs)	regs.rax
 #define SYSCALL_IP(regs)	regs.rip
+#define CALL_ARG1(regs)	regs.rdi
+#define FRAME_POINTER(regs)	regs.rbp
+#define STACK_POINTER(regs)	regs.rsp
@@ -157,6 +157,9 @@ const char *phdr_type_str(GElf_Phdr *pphdr);
 
 /* ELF Sections api */
 int handle_sections(struct elf_file *elf);
+int elf_read_needed(const char *filepath, char ***needed);
+int elf_read_mcount(const char *filepath, const char *mcount,
+		    GElf_Shdr *mcount_loc);
 
 /* ELF Symbol api */
 const char *st_bind_string(const GElf_Sym *sym);
@@ -199,6 +202,7 @@ int handle_notes(struct elf_file *elf, GElf_Shdr *shdr, Elf_Scn *scn);
 int print_elf_build_id(FILE *fp, uint8_t *build_id, size_t descsz);
 const char *elf_strbuildid(uint8_t *bid, size_t descsz, char *buf,
 			   size_t buf_len);
+int elf_read_build_id(const char *filepath, uint8_t *bid, size_t blen);
 
 /* ELF Rela api */
 int handle_relocs(struct elf_file *elf, GElf_Shdr *shdr, Elf_Scn *scn);
@@ -214,10 +218,25 @@ int auxv_type_info(GElf_Xword a_type, const char **name, const char **format);
 struct bfd_elf_file;
 struct bfd_sym;
 
+/**
+ * Symbol reader of bfd_elf_open(), libelf is the default, BFD is used as
+ * fallback for machines whose PLT layout is unknown.
+ */
+enum bfd_elf_backend {
+	BFD_ELF_BACKEND_LIBELF,
+	BFD_ELF_BACKEND_BFD,
+};
+
+void bfd_elf_set_backend(enum bfd_elf_backend backend);
+void bfd_elf_set_symcache(bool enable);
+
 struct bfd_elf_file* bfd_elf_open(const char *elf_file);
 int bfd_elf_file_refcount(struct bfd_elf_file *file);
 const char *bfd_elf_file_name(struct bfd_elf_file *file);
+bool bfd_elf_file_cached(struct bfd_elf_file *file);
+enum bfd_elf_backend bfd_elf_file_backend(struct bfd_elf_file *file);
 int bfd_elf_close(struct bfd_elf_file *file);
+int bfd_elf_uncache(const char *elf_file);
 
 unsigned long bfd_elf_plt_sym_addr(struct bfd_elf_file *file, const char *sym);
 struct bfd_sym *bfd_next_plt_sym(struct bfd_elf_file *file,
@@ -231,6 +250,7 @@ struct bfd_sym *bfd_next_data_sym(struct bfd_elf_file *file,
 
 unsigned long bfd_sym_addr(struct bfd_sym *symbol);
 const char *bfd_sym_name(struct bfd_sym *symbol);
+unsigned long bfd_sym_size(struct bfd_sym *symbol);
 
 const struct bfd_build_id *bfd_elf_bid(struct bfd_elf_file *file);
 const char *bfd_strbid(const struct bfd_build_id *bid, char *buf, int blen);
@@ -2,6 +2,8 @@
 /* Copyright (C) 2022-2025 Rong Tao */
 #include <stdint.h>
 #include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <libelf.h>
 #include <stdbool.h>
 #include <errno.h>
@@ -244,6 +246,65 @@ const char *elf_strbuildid(uint8_t *bid, size_t descsz, char *buf,
 	return buf;
 }
 
+/**
+ * Read NT_GNU_BUILD_ID of ELF file to @bid, return the length of Build ID,
+ * or -errno. Unlike elf_file_open(), only the note sections are read.
+ */
+int elf_read_build_id(const char *filepath, uint8_t *bid, size_t blen)
+{
+	int fd, ret = -ENOENT;
+	Elf *elf;
+	Elf_Scn *scn = NULL;
+
+	fd = open(filepath, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	elf_version(EV_CURRENT);
+
+	elf = elf_begin(fd, ELF_C_READ_MMAP, NULL);
+	if (!elf) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	while (ret == -ENOENT && (scn = elf_nextscn(elf, scn)) != NULL) {
+		GElf_Shdr shdr;
+		GElf_Nhdr nhdr;
+		Elf_Data *data;
+		size_t offset = 0, name_offset, desc_offset;
+
+		if (!gelf_getshdr(scn, &shdr) || shdr.sh_type != SHT_NOTE)
+			continue;
+
+		data = elf_getdata(scn, NULL);
+		if (!data)
+			continue;
+
+		while (offset < data->d_size &&
+			(offset = gelf_getnote(data, offset, &nhdr, &name_offset,
+					       &desc_offset)) > 0) {
+			if (nhdr.n_type != NT_GNU_BUILD_ID ||
+			    nhdr.n_namesz != sizeof("GNU") ||
+			    memcmp(data->d_buf + name_offset, "GNU",
+				   sizeof("GNU")))
+				continue;
+
+			if (nhdr.n_descsz == 0 || nhdr.n_descsz > blen) {
+				ret = -ENOSPC;
+				break;
+			}
+			memcpy(bid, data->d_buf + desc_offset, nhdr.n_descsz);
+			ret = nhdr.n_descsz;
+			break;
+		}
+	}
+
+	elf_end(elf);
+	close(fd);
+	return ret;
+}
+
 int print_elf_build_id(FILE *fp, uint8_t *build_id, size_t descsz)
 {
 	char buf[128];
@@ -16,6 +16,156 @@
 #include <utils/compiler.h>
 
 
+/**
+ * Read DT_NEEDED entries of ELF file in order without elf_file_open(),
+ * @needed is a malloced array of malloced names, return the number of
+ * entries or -errno.
+ */
+int elf_read_needed(const char *filepath, char ***needed)
+{
+	int fd, n = 0;
+	Elf *elf;
+	Elf_Scn *scn = NULL;
+	char **names = NULL;
+
+	fd = open(filepath, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	elf_version(EV_CURRENT);
+
+	elf = elf_begin(fd, ELF_C_READ_MMAP, NULL);
+	if (!elf) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	while ((scn = elf_nextscn(elf, scn)) != NULL) {
+		GElf_Shdr shdr;
+		Elf_Data *data;
+		size_t i;
+
+		if (!gelf_getshdr(scn, &shdr) || shdr.sh_type != SHT_DYNAMIC)
+			continue;
+
+		data = elf_getdata(scn, NULL);
+		if (!data || !shdr.sh_entsize)
+			break;
+
+		for (i = 0; i < shdr.sh_size / shdr.sh_entsize; i++) {
+			GElf_Dyn dyn;
+			const char *name;
+			char **tmp;
+
+			if (!gelf_getdyn(data, i, &dyn) || dyn.d_tag == DT_NULL)
+				break;
+			if (dyn.d_tag != DT_NEEDED)
+				continue;
+
+			name = elf_strptr(elf, shdr.sh_link, dyn.d_un.d_val);
+			if (!name)
+				continue;
+
+			tmp = realloc(names, (n + 1) * sizeof(char *));
+			if (!tmp)
+				break;
+			names = tmp;
+			names[n] = strdup(name);
+			if (!names[n])
+				break;
+			n++;
+		}
+		/* Only one dynamic section */
+		break;
+	}
+
+	elf_end(elf);
+	close(fd);
+
+	*needed = names;
+	return n;
+}
+
+static bool elf_scn_undef_sym(Elf *elf, Elf_Scn *scn, GElf_Shdr *shdr,
+			      const char *name)
+{
+	size_t i;
+	Elf_Data *data;
+
+	data = elf_getdata(scn, NULL);
+	if (!data || !shdr->sh_entsize)
+		return false;
+
+	for (i = 0; i < shdr->sh_size / shdr->sh_entsize; i++) {
+		GElf_Sym sym;
+		const char *symname;
+
+		if (!gelf_getsym(data, i, &sym) || sym.st_shndx != SHN_UNDEF)
+			continue;
+
+		symname = elf_strptr(elf, shdr->sh_link, sym.st_name);
+		if (symname && !strcmp(symname, name))
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Check whether ELF file calls @mcount without elf_file_open(), that is,
+ * @mcount is undefined in .dynsym. @mcount_loc is the __mcount_loc section
+ * header if compiled with -mrecord-mcount, sh_size is zero if not exist.
+ *
+ * @return: 1 if calls @mcount, 0 if not, or -errno.
+ */
+int elf_read_mcount(const char *filepath, const char *mcount,
+		    GElf_Shdr *mcount_loc)
+{
+	int fd, ret = 0;
+	Elf *elf;
+	Elf_Scn *scn = NULL;
+	size_t shstrndx;
+
+	memset(mcount_loc, 0, sizeof(*mcount_loc));
+
+	fd = open(filepath, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	elf_version(EV_CURRENT);
+
+	elf = elf_begin(fd, ELF_C_READ_MMAP, NULL);
+	if (!elf) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	if (elf_getshdrstrndx(elf, &shstrndx)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	while ((scn = elf_nextscn(elf, scn)) != NULL) {
+		GElf_Shdr shdr;
+		const char *name;
+
+		if (!gelf_getshdr(scn, &shdr))
+			continue;
+
+		name = elf_strptr(elf, shstrndx, shdr.sh_name);
+		if (name && !strcmp(name, "__mcount_loc")) {
+			*mcount_loc = shdr;
+			ret = 1;
+		} else if (shdr.sh_type == SHT_DYNSYM && !ret) {
+			ret = elf_scn_undef_sym(elf, scn, &shdr, mcount);
+		}
+	}
+
+out:
+	elf_end(elf);
+	close(fd);
+	return ret;
+}
+
 int handle_sections(struct elf_file *elf)
 {
 	int i, ret = 0;
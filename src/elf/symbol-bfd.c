@@ -1,11 +1,16 @@
 // SPDX-License-Identifier: GPL-2.0-or-later
 /* Copyright (C) 2022-2025 Rong Tao */
 #include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <malloc.h>
 #include <assert.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <bfd.h>
 
 #include <elf/elf-api.h>
@@ -49,11 +54,25 @@ struct bfd_elf_file {
 	struct list_head node;
 
 	struct rb_root rb_tree_syms[BFD_ELF_SYM_TYPE_NUM];
+
+	/**
+	 * If loaded from symbol cache, bfd is NULL, symbols are in cache_syms
+	 * array and names point to the mmapped cache file.
+	 */
+	struct mmap_struct *cache;
+	struct bfd_sym *cache_syms;
+	/* Build ID if bfd is NULL, loaded by libelf backend or cache */
+	struct bfd_build_id *bid;
+
+	/* Backend that read the symbols, the cache doesn't record it */
+	enum bfd_elf_backend backend;
 };
 
 struct bfd_sym {
 	char *name;
 	unsigned long addr;
+	/* ELF st_size, 0 if unknown, such as synthetic @plt symbols */
+	unsigned long size;
 	enum bfd_sym_type type;
 
 	/* Point to struct bfd_elf_file syms, no need to free */
@@ -63,8 +82,59 @@ struct bfd_sym {
 	struct rb_node node;
 };
 
-/* We just open few elf files, link list is ok. */
+/**
+ * We just open few elf files, link list is ok. bfd_elf_open() could be called
+ * from workers concurrently, the list and refcount are protected by
+ * bfd_elf_file_lock.
+ */
 static LIST_HEAD(bfd_elf_file_list);
+static pthread_mutex_t bfd_elf_file_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * libbfd global state, such as the open file cache, is not thread safe
+ * unless bfd_thread_init() (binutils 2.42+) succeeds, if not, all BFD
+ * calls are serialized by bfd_serial_lock.
+ */
+static pthread_mutex_t bfd_serial_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool bfd_thread_safe = false;
+
+#if defined(BINUTILS_HAVE_BFD_THREAD_INIT)
+static pthread_mutex_t bfd_global_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static pthread_once_t bfd_thread_once = PTHREAD_ONCE_INIT;
+
+static bool bfd_lock_fn(void *data)
+{
+	return pthread_mutex_lock(data) == 0;
+}
+
+static bool bfd_unlock_fn(void *data)
+{
+	return pthread_mutex_unlock(data) == 0;
+}
+
+static void bfd_thread_setup(void)
+{
+	bfd_thread_safe = bfd_thread_init(bfd_lock_fn, bfd_unlock_fn,
+					  &bfd_global_lock);
+	ulp_debug("Bfd_sym: bfd is%s thread safe.\n",
+		  bfd_thread_safe ? "" : " not");
+}
+#endif
+
+static void free_bfd_elf_file(struct bfd_elf_file *file);
+
+static void bfd_serialize(bool lock)
+{
+#if defined(BINUTILS_HAVE_BFD_THREAD_INIT)
+	pthread_once(&bfd_thread_once, bfd_thread_setup);
+#endif
+	if (bfd_thread_safe)
+		return;
+	if (lock)
+		pthread_mutex_lock(&bfd_serial_lock);
+	else
+		pthread_mutex_unlock(&bfd_serial_lock);
+}
 
 /**
  * The following is the BFD-SYM symbol related public function interface.
@@ -81,8 +151,31 @@ static inline int __cmp_bfd_sym(struct rb_node *n1, unsigned long key)
 	return strcmp(s1->name, s2->name);
 }
 
+/**
+ * The head of elf_symbol_type in bfd's elf-bfd.h, which is not installed. An
+ * ELF flavour asymbol is the first member of elf_symbol_type, followed by
+ * Elf_Internal_Sym, which starts with st_value and st_size.
+ */
+struct elf_symbol_type_head {
+	asymbol symbol;
+	struct {
+		bfd_vma st_value;
+		bfd_vma st_size;
+	} internal_elf_sym;
+};
+
+static unsigned long asymbol_size(asymbol *sym)
+{
+	/* Synthetic symbols are plain asymbol array */
+	if (sym->flags & BSF_SYNTHETIC ||
+	    bfd_asymbol_flavour(sym) != bfd_target_elf_flavour)
+		return 0;
+	return ((struct elf_symbol_type_head *)sym)->internal_elf_sym.st_size;
+}
+
 static struct bfd_sym *alloc_bfd_sym(const char *name, unsigned long addr,
-				     enum bfd_sym_type type, asymbol *asym)
+				     unsigned long size, enum bfd_sym_type type,
+				     asymbol *asym)
 {
 	struct bfd_sym *s = malloc(sizeof(struct bfd_sym));
 
@@ -90,6 +183,7 @@ static struct bfd_sym *alloc_bfd_sym(const char *name, unsigned long addr,
 
 	s->name = strdup(name);
 	s->addr = addr;
+	s->size = size;
 	s->type = type;
 	s->bfd_asym = asym;
 
@@ -127,6 +221,32 @@ static struct bfd_sym *next_bfd_sym(struct rb_root *root, struct bfd_sym *prev)
 	return next ? rb_entry(next, struct bfd_sym, node) : NULL;
 }
 
+/* Add symbol to each type it belongs to, the first one wins on same name */
+static void add_bfd_sym(struct bfd_elf_file *file, const char *name,
+			unsigned long addr, unsigned long size, bool is_plt,
+			bool is_text, bool is_data, asymbol *asym)
+{
+	int t;
+	bool types[BFD_ELF_SYM_TYPE_NUM] = {
+		[BFD_ELF_SYM_TEXT] = is_text,
+		[BFD_ELF_SYM_PLT] = is_plt,
+		[BFD_ELF_SYM_DATA] = is_data,
+	};
+
+	for (t = 0; t < BFD_ELF_SYM_TYPE_NUM; t++) {
+		struct bfd_sym *symbol;
+
+		if (!types[t])
+			continue;
+
+		symbol = alloc_bfd_sym(name, addr, size, t, asym);
+		if (link_bfd_sym(&file->rb_tree_syms[t], symbol))
+			free_bfd_sym(symbol);
+		else
+			ulp_debug("Bfd_sym: %#016lx %s type %d\n", addr, name, t);
+	}
+}
+
 unsigned long bfd_sym_addr(struct bfd_sym *symbol)
 {
 	return symbol ? symbol->addr : 0;
@@ -137,6 +257,11 @@ const char *bfd_sym_name(struct bfd_sym *symbol)
 	return symbol ? symbol->name : NULL;
 }
 
+unsigned long bfd_sym_size(struct bfd_sym *symbol)
+{
+	return symbol ? symbol->size : 0;
+}
+
 /**
  * The following is the TEXT related function interface.
  */
@@ -250,6 +375,7 @@ unsigned long bfd_elf_data_sym_addr(struct bfd_elf_file *file, const char *name)
  * Common load functions
  */
 
+/* Caller must hold bfd_elf_file_lock */
 static struct bfd_elf_file *file_already_load(const char *filename)
 {
 	struct bfd_elf_file *f, *tmp, *ret = NULL;
@@ -325,26 +451,32 @@ static asymbol **slurp_dynamic_symtab(struct bfd_elf_file *file)
 	return sy;
 }
 
-static const char *asymbol_pure_name(asymbol *sym, char *buf, int blen)
+/* Strip version and @plt suffix, such as printf@GLIBC_2.2.5@plt */
+static const char *pure_name(const char *sym_name, char *buf, int blen)
 {
 	unsigned int len;
 	char *name;
 
-	name = strstr(sym->name, "@");
+	name = strstr(sym_name, "@");
 	if (!name)
-		return sym->name;
+		return sym_name;
 
-	len = name - sym->name;
-	if (len > blen) {
+	len = name - sym_name;
+	if (len >= blen) {
 		ulp_error("bfd-sym: Too short buffer length.\n");
 		return NULL;
 	}
 
-	strncpy(buf, sym->name, len);
+	strncpy(buf, sym_name, len);
 	buf[len] = '\0';
 	return buf;
 }
 
+static const char *asymbol_pure_name(asymbol *sym, char *buf, int blen)
+{
+	return pure_name(sym->name, buf, blen);
+}
+
 static bool is_significant_symbol_name(const char *name)
 {
 	return ulp_startswith(name, ".plt") || ulp_startswith(name, ".got");
@@ -384,6 +516,7 @@ static struct bfd_elf_file *file_load(const char *filename)
 	memset(file, 0, sizeof(struct bfd_elf_file));
 
 	file->refcount = 1;
+	file->backend = BFD_ELF_BACKEND_BFD;
 	strncpy(file->name, filename, PATH_MAX - 1);
 
 	for (i = 0; i < BFD_ELF_SYM_TYPE_NUM; i++)
@@ -438,49 +571,813 @@ static struct bfd_elf_file *file_load(const char *filename)
 		const char *name = asymbol_pure_name(s, buf, sizeof(buf));
 		unsigned long value = bfd_asymbol_value(s);
 
-		if (asymbol_is_plt(s)) {
-			struct bfd_sym *symbol;
-			symbol = alloc_bfd_sym(name, value, BFD_ELF_SYM_PLT, s);
-			link_bfd_sym(&file->rb_tree_syms[BFD_ELF_SYM_PLT], symbol);
-			ulp_debug("Bfd_sym: %#016lx %s @plt\n", value, name);
+		if (!name)
+			continue;
+
+		add_bfd_sym(file, name, value, asymbol_size(s),
+			    asymbol_is_plt(s), asymbol_is_text(s),
+			    asymbol_is_data(s), s);
+	}
+
+	return file;
+
+close:
+	bfd_close(file->bfd);
+	return NULL;
+}
+
+/**
+ * libelf backend
+ *
+ * Read .symtab (or .dynsym) directly from a read-only mmap of the ELF file,
+ * and compute PLT entry addresses from the PLT relocations and .plt layout,
+ * without canonicalizing every asymbol and bfd_get_synthetic_symtab(). The
+ * result is the same as file_load(), BFD is only used as fallback when the
+ * PLT layout of the machine is unknown.
+ */
+enum {
+	SEC_CLASS_NONE,
+	SEC_CLASS_TEXT,
+	SEC_CLASS_DATA,
+};
+
+struct elf_plt_ctx {
+	Elf *elf;
+	GElf_Ehdr ehdr;
+	size_t shnum;
+	const char **sec_names;
+	int *sec_class;
+	/* Dynamic symbol table, used to name PLT entries */
+	Elf_Data *dynsym;
+	size_t dynsym_str;
+};
+
+static enum bfd_elf_backend bfd_elf_backend = BFD_ELF_BACKEND_LIBELF;
+static bool bfd_symcache_enabled = true;
+
+void bfd_elf_set_backend(enum bfd_elf_backend backend)
+{
+	bfd_elf_backend = backend;
+}
+
+void bfd_elf_set_symcache(bool enable)
+{
+	bfd_symcache_enabled = enable;
+}
+
+/* Same as BFD's SEC_CODE and SEC_DATA section flags */
+static int elf_section_class(const GElf_Shdr *shdr, const char *name)
+{
+	if ((shdr->sh_flags & SHF_EXECINSTR) || !strcmp(name, ".text"))
+		return SEC_CLASS_TEXT;
+
+	if (((shdr->sh_flags & SHF_ALLOC) && shdr->sh_type != SHT_NOBITS) ||
+	    !strcmp(name, ".data") || !strcmp(name, ".data.rel.ro") ||
+	    !strcmp(name, ".bss"))
+		return SEC_CLASS_DATA;
+
+	return SEC_CLASS_NONE;
+}
+
+static Elf_Scn *elf_find_scn(struct elf_plt_ctx *ctx, const char *name,
+			     GElf_Shdr *shdr)
+{
+	size_t i;
+
+	for (i = 1; i < ctx->shnum; i++) {
+		Elf_Scn *scn;
+
+		if (strcmp(ctx->sec_names[i], name))
+			continue;
+
+		scn = elf_getscn(ctx->elf, i);
+		if (scn && gelf_getshdr(scn, shdr))
+			return scn;
+	}
+	return NULL;
+}
+
+/* Add a synthetic PLT symbol, named like BFD does, without @plt suffix */
+static void add_plt_sym(struct bfd_elf_file *file, struct elf_plt_ctx *ctx,
+			GElf_Rela *rela, unsigned long addr)
+{
+	char buf[256], name[256];
+	const char *sname = "*ABS*", *pname;
+	int len;
+	size_t sidx = GELF_R_SYM(rela->r_info);
+
+	if (sidx && ctx->dynsym) {
+		GElf_Sym sym;
+
+		if (!gelf_getsym(ctx->dynsym, sidx, &sym))
+			return;
+
+		sname = elf_strptr(ctx->elf, ctx->dynsym_str, sym.st_name);
+		if (!sname)
+			return;
+	}
+
+	pname = pure_name(sname, buf, sizeof(buf));
+	if (!pname)
+		return;
+
+	if (rela->r_addend)
+		len = snprintf(name, sizeof(name), "%s+0x%lx", pname,
+			       (unsigned long)rela->r_addend);
+	else
+		len = snprintf(name, sizeof(name), "%s", pname);
+
+	/* BFD backend drops too long @plt names as well */
+	if (len >= sizeof(name))
+		return;
+
+	add_bfd_sym(file, name, addr, 0, true, true, false, NULL);
+}
+
+static int __cmp_rela_offset(const void *a, const void *b)
+{
+	const GElf_Rela *r1 = a, *r2 = b;
+
+	if (r1->r_offset < r2->r_offset)
+		return -1;
+	return r1->r_offset > r2->r_offset;
+}
+
+/**
+ * x86_64 PLT entries, lazy, non-lazy, IBT or BND, all jump via
+ * 'ff 25 disp32' (maybe with prefix) to the GOT slot of the relocation. The
+ * lazy PLT entries of IBT jump to .plt.sec, which has no 'ff 25' and is
+ * ignored, same as PLT0.
+ */
+static int x86_64_plt_syms(struct bfd_elf_file *file, struct elf_plt_ctx *ctx)
+{
+	static const char *plt_names[] = {
+		".plt", ".plt.sec", ".plt.got", ".plt.bnd",
+	};
+	static const int jmp_pos[] = { 0, 1, 4, 5 };
+	GElf_Rela *relas = NULL;
+	size_t i, nr_relas = 0;
+	int p;
+
+	for (i = 1; i < ctx->shnum; i++) {
+		Elf_Scn *scn = elf_getscn(ctx->elf, i);
+		GElf_Shdr shdr;
+		Elf_Data *data;
+		GElf_Rela *tmp;
+		size_t j, n;
+
+		if (!scn || !gelf_getshdr(scn, &shdr) ||
+		    shdr.sh_type != SHT_RELA || !(shdr.sh_flags & SHF_ALLOC) ||
+		    !shdr.sh_entsize)
+			continue;
+
+		data = elf_getdata(scn, NULL);
+		if (!data)
+			continue;
+
+		n = shdr.sh_size / shdr.sh_entsize;
+		tmp = realloc(relas, (nr_relas + n) * sizeof(GElf_Rela) ?: 1);
+		if (!tmp) {
+			free(relas);
+			return -ENOMEM;
 		}
+		relas = tmp;
+
+		for (j = 0; j < n; j++)
+			if (gelf_getrela(data, j, &relas[nr_relas]))
+				nr_relas++;
+	}
+
+	if (!nr_relas) {
+		free(relas);
+		return 0;
+	}
+
+	qsort(relas, nr_relas, sizeof(GElf_Rela), __cmp_rela_offset);
+
+	for (p = 0; p < ARRAY_SIZE(plt_names); p++) {
+		GElf_Shdr shdr;
+		Elf_Scn *scn = elf_find_scn(ctx, plt_names[p], &shdr);
+		Elf_Data *data;
+		size_t ent, off;
+
+		if (!scn || shdr.sh_type != SHT_PROGBITS)
+			continue;
+
+		data = elf_getdata(scn, NULL);
+		if (!data || !data->d_buf)
+			continue;
 
-		if (asymbol_is_text(s)) {
-			struct bfd_sym *symbol;
-			symbol = alloc_bfd_sym(name, value, BFD_ELF_SYM_TEXT, s);
-			link_bfd_sym(&file->rb_tree_syms[BFD_ELF_SYM_TEXT], symbol);
-			ulp_debug("Bfd_sym: %#016lx %s .text\n", value, name);
+		ent = shdr.sh_entsize ?: (strcmp(plt_names[p], ".plt.got") ? 16 : 8);
+
+		for (off = 0; off + ent <= data->d_size; off += ent) {
+			const uint8_t *insn = data->d_buf + off;
+			GElf_Rela key, *rela;
+			int32_t disp;
+			int k;
+
+			for (k = 0; k < ARRAY_SIZE(jmp_pos); k++) {
+				if (off + jmp_pos[k] + 6 > data->d_size)
+					break;
+				if (insn[jmp_pos[k]] == 0xff &&
+				    insn[jmp_pos[k] + 1] == 0x25)
+					break;
+			}
+			if (k == ARRAY_SIZE(jmp_pos) ||
+			    off + jmp_pos[k] + 6 > data->d_size)
+				continue;
+
+			memcpy(&disp, insn + jmp_pos[k] + 2, sizeof(disp));
+			key.r_offset = shdr.sh_addr + off + jmp_pos[k] + 6 + disp;
+
+			rela = bsearch(&key, relas, nr_relas, sizeof(GElf_Rela),
+				       __cmp_rela_offset);
+			if (rela)
+				add_plt_sym(file, ctx, rela, shdr.sh_addr + off);
 		}
+	}
+
+	free(relas);
+	return 0;
+}
+
+/**
+ * aarch64 PLT is 32 bytes PLT0, then one entry per .rela.plt relocation in
+ * order, 16 bytes, or 24 bytes with BTI and PAC. Maybe with 32 bytes TLSDESC
+ * trampoline at the end.
+ */
+static int aarch64_plt_syms(struct bfd_elf_file *file, struct elf_plt_ctx *ctx)
+{
+	GElf_Shdr plt_shdr, rela_shdr;
+	Elf_Scn *plt_scn, *rela_scn;
+	Elf_Data *data;
+	size_t i, n, ent = 0;
+
+	rela_scn = elf_find_scn(ctx, ".rela.plt", &rela_shdr);
+	if (!rela_scn || !rela_shdr.sh_entsize)
+		return 0;
+
+	plt_scn = elf_find_scn(ctx, ".plt", &plt_shdr);
+	if (!plt_scn)
+		return 0;
+
+	data = elf_getdata(rela_scn, NULL);
+	if (!data)
+		return 0;
+
+	n = rela_shdr.sh_size / rela_shdr.sh_entsize;
+	if (!n)
+		return 0;
+
+	if (plt_shdr.sh_size == 32 + n * 16 || plt_shdr.sh_size == 64 + n * 16)
+		ent = 16;
+	else if (plt_shdr.sh_size == 32 + n * 24 ||
+		 plt_shdr.sh_size == 64 + n * 24)
+		ent = 24;
+	else
+		return -ENOTSUP;
 
-		if (asymbol_is_data(s)) {
-			struct bfd_sym *symbol;
-			symbol = alloc_bfd_sym(name, value, BFD_ELF_SYM_DATA, s);
-			link_bfd_sym(&file->rb_tree_syms[BFD_ELF_SYM_DATA], symbol);
-			ulp_debug("Bfd_sym: %#016lx %s .data\n", value, name);
+	for (i = 0; i < n; i++) {
+		GElf_Rela rela;
+
+		if (gelf_getrela(data, i, &rela))
+			add_plt_sym(file, ctx, &rela,
+				    plt_shdr.sh_addr + 32 + i * ent);
+	}
+
+	return 0;
+}
+
+static int elf_load_syms(struct bfd_elf_file *file, struct elf_plt_ctx *ctx,
+			 Elf_Scn *symscn, GElf_Shdr *symshdr)
+{
+	size_t i, n;
+	Elf_Data *data, *xdata = NULL;
+	Elf_Scn *scn = NULL;
+
+	data = elf_getdata(symscn, NULL);
+	if (!data || !symshdr->sh_entsize)
+		return -EINVAL;
+
+	/* Extended section indexes of symbols, if too many sections */
+	while ((scn = elf_nextscn(ctx->elf, scn)) != NULL) {
+		GElf_Shdr shdr;
+
+		if (gelf_getshdr(scn, &shdr) &&
+		    shdr.sh_type == SHT_SYMTAB_SHNDX &&
+		    shdr.sh_link == elf_ndxscn(symscn)) {
+			xdata = elf_getdata(scn, NULL);
+			break;
 		}
 	}
 
-	list_add(&file->node, &bfd_elf_file_list);
+	n = symshdr->sh_size / symshdr->sh_entsize;
 
-	return file;
+	for (i = 1; i < n; i++) {
+		GElf_Sym sym;
+		Elf32_Word xndx = 0;
+		size_t shndx;
+		const char *sname, *name;
+		char buf[256];
+		int type, class;
 
+		if (!gelf_getsymshndx(data, xdata, i, &sym, &xndx))
+			continue;
+
+		if (sym.st_shndx == SHN_UNDEF || sym.st_shndx == SHN_COMMON)
+			continue;
+
+		/* SHN_ABS and other reserved indexes have no section */
+		shndx = sym.st_shndx == SHN_XINDEX ? xndx : sym.st_shndx;
+		if ((sym.st_shndx != SHN_XINDEX &&
+		     sym.st_shndx >= SHN_LORESERVE) || shndx >= ctx->shnum)
+			shndx = 0;
+
+		type = GELF_ST_TYPE(sym.st_info);
+		class = ctx->sec_class[shndx];
+
+		sname = elf_strptr(ctx->elf, symshdr->sh_link, sym.st_name);
+		if ((!sname || !sname[0]) && type == STT_SECTION && shndx)
+			sname = ctx->sec_names[shndx];
+
+		if (sym.st_value == 0 || !sname || !sname[0])
+			continue;
+
+		if ((type == STT_FILE || type == STT_SECTION) &&
+		    !is_significant_symbol_name(sname))
+			continue;
+
+		name = pure_name(sname, buf, sizeof(buf));
+		if (!name)
+			continue;
+
+		add_bfd_sym(file, name, sym.st_value, sym.st_size,
+			    strstr(sname, "@plt") != NULL,
+			    class == SEC_CLASS_TEXT, class == SEC_CLASS_DATA,
+			    NULL);
+	}
+
+	return 0;
+}
+
+static struct bfd_elf_file *file_load_libelf(const char *filename,
+					     const uint8_t *bid, int bid_size)
+{
+	int fd, i, err = -EINVAL;
+	size_t shstrndx, s;
+	struct bfd_elf_file *file = NULL;
+	struct elf_plt_ctx ctx = {};
+	Elf_Scn *scn, *symscn = NULL, *dynscn = NULL;
+	GElf_Shdr symshdr, dynshdr;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+
+	elf_version(EV_CURRENT);
+
+	ctx.elf = elf_begin(fd, ELF_C_READ_MMAP, NULL);
+	if (!ctx.elf)
+		goto close;
+
+	if (!gelf_getehdr(ctx.elf, &ctx.ehdr) ||
+	    (ctx.ehdr.e_type != ET_EXEC && ctx.ehdr.e_type != ET_DYN) ||
+	    (ctx.ehdr.e_machine != EM_X86_64 &&
+	     ctx.ehdr.e_machine != EM_AARCH64))
+		goto end;
+
+	if (elf_getshdrnum(ctx.elf, &ctx.shnum) ||
+	    elf_getshdrstrndx(ctx.elf, &shstrndx))
+		goto end;
+
+	ctx.sec_names = calloc(ctx.shnum ?: 1, sizeof(char *));
+	ctx.sec_class = calloc(ctx.shnum ?: 1, sizeof(int));
+	if (!ctx.sec_names || !ctx.sec_class)
+		goto end;
+
+	for (s = 0; s < ctx.shnum; s++) {
+		GElf_Shdr shdr;
+		const char *name = NULL;
+
+		scn = elf_getscn(ctx.elf, s);
+		if (scn && gelf_getshdr(scn, &shdr)) {
+			name = elf_strptr(ctx.elf, shstrndx, shdr.sh_name);
+			if (!name)
+				name = "";
+			ctx.sec_class[s] = elf_section_class(&shdr, name);
+
+			if (shdr.sh_type == SHT_SYMTAB && !symscn) {
+				symscn = scn;
+				symshdr = shdr;
+			} else if (shdr.sh_type == SHT_DYNSYM && !dynscn) {
+				dynscn = scn;
+				dynshdr = shdr;
+			}
+		}
+		ctx.sec_names[s] = name ?: "";
+	}
+
+	if (dynscn) {
+		ctx.dynsym = elf_getdata(dynscn, NULL);
+		ctx.dynsym_str = dynshdr.sh_link;
+	}
+
+	file = malloc(sizeof(struct bfd_elf_file));
+	if (!file)
+		goto end;
+	memset(file, 0, sizeof(struct bfd_elf_file));
+
+	file->refcount = 1;
+	file->backend = BFD_ELF_BACKEND_LIBELF;
+	strncpy(file->name, filename, PATH_MAX - 1);
+
+	for (i = 0; i < BFD_ELF_SYM_TYPE_NUM; i++)
+		rb_init(&file->rb_tree_syms[i]);
+
+	if (bid_size > 0) {
+		file->bid = malloc(sizeof(struct bfd_build_id) + bid_size);
+		if (!file->bid)
+			goto free;
+		file->bid->size = bid_size;
+		memcpy(file->bid->data, bid, bid_size);
+	}
+
+	if (symscn)
+		err = elf_load_syms(file, &ctx, symscn, &symshdr);
+	else if (dynscn)
+		err = elf_load_syms(file, &ctx, dynscn, &dynshdr);
+	else
+		err = 0;
+	if (err)
+		goto free;
+
+	switch (ctx.ehdr.e_machine) {
+	case EM_X86_64:
+		err = x86_64_plt_syms(file, &ctx);
+		break;
+	case EM_AARCH64:
+		err = aarch64_plt_syms(file, &ctx);
+		break;
+	}
+
+free:
+	if (err) {
+		ulp_debug("Bfd_sym: libelf load %s failed, %s\n", filename,
+			  strerror(-err));
+		free_bfd_elf_file(file);
+		file = NULL;
+	}
+end:
+	free(ctx.sec_names);
+	free(ctx.sec_class);
+	elf_end(ctx.elf);
 close:
-	bfd_close(file->bfd);
+	close(fd);
+	return file;
+}
+
+/**
+ * Symbol cache
+ *
+ * The symbols of an ELF file never change for a given Build ID, save them
+ * to ULP_SYMCACHE_DIR/<Build ID> after the first BFD load, and the next
+ * bfd_elf_open() mmap the cache file and skip BFD entirely. The file is
+ * pointer free:
+ *
+ *   [struct symcache_hdr]
+ *   [struct symcache_sym] * nr_syms, TEXT first, then PLT, then DATA,
+ *                           each type sorted by name
+ *   [strtab]               '\0' terminated names
+ */
+#define SYMCACHE_MAGIC		"ULPSYMC"
+#define SYMCACHE_VERSION	1
+#define SYMCACHE_BID_MAX	64
+
+struct symcache_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t bid_size;
+	uint8_t bid[SYMCACHE_BID_MAX];
+	uint64_t nr_syms[BFD_ELF_SYM_TYPE_NUM];
+	uint64_t syms_off;
+	uint64_t strtab_off;
+	uint64_t strtab_size;
+};
+
+struct symcache_sym {
+	/* offset in strtab */
+	uint64_t name;
+	uint64_t addr;
+	uint64_t size;
+};
+
+static int symcache_path(const uint8_t *bid, int bid_size, char *buf,
+			 int blen)
+{
+	char strbid[SYMCACHE_BID_MAX * 2 + 1];
+
+	if (!elf_strbuildid((uint8_t *)bid, bid_size, strbid, sizeof(strbid)))
+		return -EINVAL;
+	snprintf(buf, blen, ULP_SYMCACHE_DIR "/%s", strbid);
+	return 0;
+}
+
+/**
+ * Cache directory is under world writable ULP_PROC_ROOT_DIR, only trust the
+ * cache file written by ourself or root.
+ */
+static bool symcache_trusted(const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+		return false;
+	if (st.st_uid != geteuid() && st.st_uid != 0)
+		return false;
+	if (st.st_mode & (S_IWGRP | S_IWOTH))
+		return false;
+	return true;
+}
+
+static struct bfd_elf_file *symcache_load(const char *filename,
+					  const uint8_t *bid, int bid_size)
+{
+	int t;
+	uint64_t i, nr = 0, n;
+	char path[PATH_MAX];
+	const char *strtab;
+	struct mmap_struct *mem;
+	struct symcache_hdr *hdr;
+	struct symcache_sym *csyms;
+	struct bfd_elf_file *file;
+
+	if (symcache_path(bid, bid_size, path, sizeof(path)))
+		return NULL;
+
+	if (!symcache_trusted(path))
+		return NULL;
+
+	mem = fmmap_rdonly(path);
+	if (!mem)
+		return NULL;
+
+	hdr = mem->mem;
+	if (mem->size < sizeof(*hdr) ||
+	    memcmp(hdr->magic, SYMCACHE_MAGIC, sizeof(hdr->magic)) ||
+	    hdr->version != SYMCACHE_VERSION ||
+	    hdr->bid_size != bid_size || memcmp(hdr->bid, bid, bid_size))
+		goto invalid;
+
+	for (t = 0; t < BFD_ELF_SYM_TYPE_NUM; t++) {
+		if (hdr->nr_syms[t] > mem->size / sizeof(struct symcache_sym))
+			goto invalid;
+		nr += hdr->nr_syms[t];
+	}
+
+	if (hdr->syms_off > mem->size ||
+	    nr > (mem->size - hdr->syms_off) / sizeof(struct symcache_sym) ||
+	    hdr->strtab_off > mem->size || hdr->strtab_size == 0 ||
+	    hdr->strtab_size > mem->size - hdr->strtab_off)
+		goto invalid;
+
+	csyms = mem->mem + hdr->syms_off;
+	strtab = mem->mem + hdr->strtab_off;
+
+	/* Every name is terminated if strtab is */
+	if (strtab[hdr->strtab_size - 1] != '\0')
+		goto invalid;
+
+	file = malloc(sizeof(struct bfd_elf_file));
+	if (!file)
+		goto unmap;
+	memset(file, 0, sizeof(struct bfd_elf_file));
+
+	file->refcount = 1;
+	strncpy(file->name, filename, PATH_MAX - 1);
+	file->cache = mem;
+	file->cache_syms = calloc(nr ?: 1, sizeof(struct bfd_sym));
+	file->bid = malloc(sizeof(struct bfd_build_id) + bid_size);
+	if (!file->cache_syms || !file->bid) {
+		free(file->cache_syms);
+		free(file->bid);
+		free(file);
+		goto unmap;
+	}
+
+	file->bid->size = bid_size;
+	memcpy(file->bid->data, bid, bid_size);
+
+	for (n = 0, t = 0; t < BFD_ELF_SYM_TYPE_NUM; t++) {
+		rb_init(&file->rb_tree_syms[t]);
+
+		for (i = 0; i < hdr->nr_syms[t]; i++, n++) {
+			struct bfd_sym *s = &file->cache_syms[n];
+
+			if (csyms[n].name >= hdr->strtab_size) {
+				free(file->cache_syms);
+				free(file->bid);
+				free(file);
+				goto invalid;
+			}
+
+			s->name = (char *)strtab + csyms[n].name;
+			s->addr = csyms[n].addr;
+			s->size = csyms[n].size;
+			s->type = t;
+			link_bfd_sym(&file->rb_tree_syms[t], s);
+		}
+	}
+
+	ulp_debug("Bfd_sym: %s load %ld syms from cache %s\n", filename,
+		  (long)nr, path);
+	return file;
+
+invalid:
+	ulp_warning("Bfd_sym: invalid symbol cache %s, ignore it.\n", path);
+unmap:
+	fmunmap(mem);
 	return NULL;
 }
 
+static int write_full(int fd, const void *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static int symcache_store(struct bfd_elf_file *file, const uint8_t *bid,
+			  int bid_size)
+{
+	int t, fd, err;
+	uint64_t n = 0, strtab_size = 0;
+	char path[PATH_MAX], tmp[PATH_MAX];
+	struct symcache_hdr hdr;
+	struct symcache_sym *csyms;
+	struct bfd_sym *s;
+	char *strtab;
+
+	if (bid_size > SYMCACHE_BID_MAX)
+		return -EINVAL;
+
+	if (symcache_path(bid, bid_size, path, sizeof(path)))
+		return -EINVAL;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SYMCACHE_MAGIC, sizeof(hdr.magic));
+	hdr.version = SYMCACHE_VERSION;
+	hdr.bid_size = bid_size;
+	memcpy(hdr.bid, bid, bid_size);
+
+	for (t = 0; t < BFD_ELF_SYM_TYPE_NUM; t++) {
+		for (s = next_bfd_sym(&file->rb_tree_syms[t], NULL); s;
+		     s = next_bfd_sym(&file->rb_tree_syms[t], s)) {
+			hdr.nr_syms[t]++;
+			strtab_size += strlen(s->name) + 1;
+		}
+		n += hdr.nr_syms[t];
+	}
+
+	hdr.syms_off = sizeof(hdr);
+	hdr.strtab_off = hdr.syms_off + n * sizeof(struct symcache_sym);
+	hdr.strtab_size = strtab_size ?: 1;
+
+	csyms = calloc(n ?: 1, sizeof(struct symcache_sym));
+	strtab = calloc(1, hdr.strtab_size);
+	if (!csyms || !strtab) {
+		err = -ENOMEM;
+		goto free;
+	}
+
+	for (n = 0, strtab_size = 0, t = 0; t < BFD_ELF_SYM_TYPE_NUM; t++) {
+		for (s = next_bfd_sym(&file->rb_tree_syms[t], NULL); s;
+		     s = next_bfd_sym(&file->rb_tree_syms[t], s), n++) {
+			csyms[n].name = strtab_size;
+			csyms[n].addr = s->addr;
+			csyms[n].size = s->size;
+			strcpy(strtab + strtab_size, s->name);
+			strtab_size += strlen(s->name) + 1;
+		}
+	}
+
+	if (mkdir(ULP_SYMCACHE_DIR, 0755) != 0 && errno != EEXIST) {
+		err = -errno;
+		goto free;
+	}
+
+	/* Write a private temp file and rename, readers never see half */
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_EXCL, 0644);
+	if (fd < 0) {
+		err = -errno;
+		goto free;
+	}
+
+	err = write_full(fd, &hdr, sizeof(hdr));
+	if (!err)
+		err = write_full(fd, csyms, n * sizeof(struct symcache_sym));
+	if (!err)
+		err = write_full(fd, strtab, hdr.strtab_size);
+	close(fd);
+
+	if (!err && rename(tmp, path) != 0)
+		err = -errno;
+	if (err)
+		unlink(tmp);
+	else
+		ulp_debug("Bfd_sym: %s save %ld syms to cache %s\n",
+			  file->name, (long)n, path);
+
+free:
+	free(csyms);
+	free(strtab);
+	return err;
+}
+
+/* Remove symbol cache of ELF file, next bfd_elf_open() will use BFD */
+int bfd_elf_uncache(const char *elf_file)
+{
+	int bid_size;
+	uint8_t bid[SYMCACHE_BID_MAX];
+	char path[PATH_MAX];
+
+	bid_size = elf_read_build_id(elf_file, bid, sizeof(bid));
+	if (bid_size < 0)
+		return bid_size;
+
+	if (symcache_path(bid, bid_size, path, sizeof(path)))
+		return -EINVAL;
+
+	if (unlink(path) != 0 && errno != ENOENT)
+		return -errno;
+	return 0;
+}
+
 struct bfd_elf_file *bfd_elf_open(const char *elf_file)
 {
-	struct bfd_elf_file *file = NULL;
+	struct bfd_elf_file *file = NULL, *exist;
+	int bid_size;
+	uint8_t bid[SYMCACHE_BID_MAX];
 
 	if (!fexist(elf_file)) {
 		errno = EEXIST;
 		return NULL;
 	}
 
+	pthread_mutex_lock(&bfd_elf_file_lock);
 	file = file_already_load(elf_file);
-	if (!file)
+	pthread_mutex_unlock(&bfd_elf_file_lock);
+	if (file)
+		return file;
+
+	/* No Build ID, no cache */
+	bid_size = elf_read_build_id(elf_file, bid, sizeof(bid));
+	if (bid_size > 0 && bfd_symcache_enabled)
+		file = symcache_load(elf_file, bid, bid_size);
+	if (file)
+		goto publish;
+
+	if (bfd_elf_backend == BFD_ELF_BACKEND_LIBELF)
+		file = file_load_libelf(elf_file, bid, bid_size);
+
+	/* BFD backend, or fallback if libelf backend can't handle it */
+	if (!file) {
+		bfd_serialize(true);
 		file = file_load(elf_file);
+		bfd_serialize(false);
+	}
+
+	if (!file)
+		return NULL;
+
+	if (bid_size > 0 && bfd_symcache_enabled &&
+	    symcache_store(file, bid, bid_size))
+		ulp_debug("Bfd_sym: failed to save symbol cache of %s\n",
+			  elf_file);
+
+publish:
+
+	/* Someone else loaded the same file meanwhile, use that one */
+	pthread_mutex_lock(&bfd_elf_file_lock);
+	exist = file_already_load(elf_file);
+	if (!exist)
+		list_add(&file->node, &bfd_elf_file_list);
+	pthread_mutex_unlock(&bfd_elf_file_lock);
+
+	if (exist) {
+		free_bfd_elf_file(file);
+		file = exist;
+	}
 
 	return file;
 }
@@ -501,18 +1398,19 @@ const char *bfd_elf_file_name(struct bfd_elf_file *file)
 	return file ? file->name : NULL;
 }
 
-int bfd_elf_close(struct bfd_elf_file *file)
+bool bfd_elf_file_cached(struct bfd_elf_file *file)
 {
-	int i;
+	return file && file->cache;
+}
 
-	if (!file)
-		return -1;
+enum bfd_elf_backend bfd_elf_file_backend(struct bfd_elf_file *file)
+{
+	return file->backend;
+}
 
-	file->refcount--;
-	if (file->refcount >= 1) {
-		ulp_debug("Could not close used bfd_elf_file.\n");
-		return 0;
-	}
+static void free_bfd_elf_file(struct bfd_elf_file *file)
+{
+	int i;
 
 	if (file->syms) {
 		free(file->syms);
@@ -538,14 +1436,43 @@ int bfd_elf_close(struct bfd_elf_file *file)
 	file->synthcount = 0;
 	file->sorted_symcount = 0;
 
-	list_del(&file->node);
+	if (file->cache) {
+		free(file->cache_syms);
+		free(file->bid);
+		fmunmap(file->cache);
+		free(file);
+		return;
+	}
 
 	/* Destroy all type symbols rb tree */
 	for (i = 0; i < BFD_ELF_SYM_TYPE_NUM; i++)
 		rb_destroy(&file->rb_tree_syms[i], __rb_free_bfd_sym);
 
-	bfd_close(file->bfd);
+	if (file->bfd) {
+		bfd_serialize(true);
+		bfd_close(file->bfd);
+		bfd_serialize(false);
+	}
+	free(file->bid);
 	free(file);
+}
+
+int bfd_elf_close(struct bfd_elf_file *file)
+{
+	if (!file)
+		return -1;
+
+	pthread_mutex_lock(&bfd_elf_file_lock);
+	file->refcount--;
+	if (file->refcount >= 1) {
+		pthread_mutex_unlock(&bfd_elf_file_lock);
+		ulp_debug("Could not close used bfd_elf_file.\n");
+		return 0;
+	}
+	list_del(&file->node);
+	pthread_mutex_unlock(&bfd_elf_file_lock);
+
+	free_bfd_elf_file(file);
 	return 0;
 }
 
@@ -561,7 +1488,7 @@ int bfd_elf_destroy(void)
 
 const struct bfd_build_id *bfd_elf_bid(struct bfd_elf_file *file)
 {
-	return file->bfd->build_id;
+	return file->bfd ? file->bfd->build_id : file->bid;
 }
 
 const char *bfd_strbid(const struct bfd_build_id *bid, char *buf, int blen)
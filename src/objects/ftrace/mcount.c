@@ -2,6 +2,9 @@
 /* Copyright (C) 2022-2025 Rong Tao */
 #include <stdio.h>
 #include <patch/patch.h>
+#include <patch/asm.h>
+#include <patch/ftrace.h>
+#include <utils/compiler.h>
 
 #if defined(__x86_64__)
 #include <arch/x86_64/mcount.h>
@@ -11,18 +14,319 @@
 
 
 /**
- * The ULPATCH_TEST macro just for test in elftoos_test target. it'll not
- * compile into ftrace-object file.
+ * This object is injected into target task, it must not call any function
+ * outside of it, because the patch may be mapped far away from libc, see
+ * __ulp_builtin_xxx() in patch/asm.h.
+ *
+ * ulftrace set this pointer after the shared memory mapped into target task,
+ * and clear it before unmap, see ftrace_open() and ftrace_close(). It must be
+ * initialized data, because .bss is not supported.
  */
-#if defined(ULPATCH_TEST)
+struct ulftrace_shm *ulftrace_shm __attribute__((section(".data"))) = NULL;
 
-#include <task/task.h>
-#include <utils/log.h>
+/* Set before ulftrace_shm, never cleared, see ULFTRACE_LOCAL_SYMBOL */
+struct ulftrace_local *ulftrace_local __attribute__((section(".data"))) = NULL;
 
-extern int try_to_wake_up(struct task_struct *task, int mode, int wake_flags);
+/**
+ * Hidden symbol is addressed PC relative, otherwise, gcc loads the address
+ * from GOT, the object has no GOT.
+ */
+extern void _ftrace_mcount_return(void) __attribute__((visibility("hidden")));
+
+/* First slot to probe of @tp */
+static inline unsigned int tp_hash(unsigned long tp)
+{
+	return (unsigned int)((tp >> 12) ^ (tp >> 24));
+}
+
+/**
+ * The pid of current process, the page is wiped in fork(2)ed child, then
+ * the child gets its own pid, once.
+ */
+static int this_pid(struct ulftrace_local *local)
+{
+	int pid = __atomic_load_n(&local->proc->pid, __ATOMIC_RELAXED);
+
+	if (!pid) {
+		pid = __ulp_builtin_getpid();
+		__atomic_store_n(&local->proc->pid, pid, __ATOMIC_RELAXED);
+	}
+	return pid;
+}
+
+/**
+ * Find the ring of current thread, or claim a free one. The hash of thread
+ * pointer is the first slot to probe, thus, most lookups cost one load.
+ *
+ * A fork(2)ed child has the same thread pointer as its parent, so the pid
+ * must match too.
+ */
+static struct ulftrace_ring *this_ring(struct ulftrace_shm *shm, int pid)
+{
+	unsigned int i, idx, mask = shm->nr_rings - 1;
+	unsigned long tp = __ulp_builtin_thread_pointer();
+	unsigned long owner;
+	struct ulftrace_ring *ring;
+
+	idx = tp_hash(tp) & mask;
+
+	for (i = 0; i <= mask; i++, idx = (idx + 1) & mask) {
+		ring = ulftrace_ring(shm, idx);
+		owner = __atomic_load_n(&ring->owner, __ATOMIC_RELAXED);
+		if (owner == tp && ring->pid == pid)
+			goto found;
+		if (owner)
+			continue;
+
+		if (__atomic_compare_exchange_n(&ring->owner, &owner, tp, false,
+						__ATOMIC_ACQ_REL,
+						__ATOMIC_RELAXED)) {
+			ring->pid = pid;
+			/* Consumer reads tid after the head released */
+			ring->tid = __ulp_builtin_gettid();
+			return ring;
+		}
+		if (owner == tp && ring->pid == pid)
+			goto found;
+	}
+
+	return NULL;
+
+found:
+	/* The thread pointer is reused by a new thread, see ftrace_consume() */
+	if (!__atomic_load_n(&ring->tid, __ATOMIC_RELAXED))
+		__atomic_store_n(&ring->tid, __ulp_builtin_gettid(),
+				 __ATOMIC_RELAXED);
+	return ring;
+}
+
+/* Find the shadow stack of current thread, or claim a free one */
+static struct ulftrace_stack *this_stack(struct ulftrace_local *local)
+{
+	unsigned int i, idx, mask = ULFTRACE_NR_STACKS - 1;
+	unsigned long tp = __ulp_builtin_thread_pointer();
+	unsigned long owner;
+	struct ulftrace_stack *stack;
+
+	idx = tp_hash(tp) & mask;
+
+	for (i = 0; i <= mask; i++, idx = (idx + 1) & mask) {
+		stack = &local->stacks[idx];
+		owner = __atomic_load_n(&stack->owner, __ATOMIC_RELAXED);
+		if (owner == tp)
+			return stack;
+		if (owner)
+			continue;
+
+		if (__atomic_compare_exchange_n(&stack->owner, &owner, tp,
+						false, __ATOMIC_RELAXED,
+						__ATOMIC_RELAXED) ||
+		    owner == tp)
+			return stack;
+	}
+
+	return NULL;
+}
+
+/* First slot to probe in open addressing tables */
+static inline unsigned long child_hash(unsigned long child)
+{
+	return (child >> 4) ^ (child >> 16);
+}
+
+/* Find the function of @child, or claim a free slot */
+static unsigned long this_func(struct ulftrace_shm *shm, unsigned long child)
+{
+	unsigned long i, idx, mask = shm->nr_funcs - 1;
+	unsigned long old;
+	struct ulftrace_func *func;
+
+	idx = child_hash(child) & mask;
+
+	for (i = 0; i <= mask; i++, idx = (idx + 1) & mask) {
+		func = ulftrace_func(shm, idx);
+		old = __atomic_load_n(&func->child, __ATOMIC_RELAXED);
+		if (old == child)
+			return idx;
+		if (old)
+			continue;
+
+		if (__atomic_compare_exchange_n(&func->child, &old, child,
+						false, __ATOMIC_RELAXED,
+						__ATOMIC_RELAXED) ||
+		    old == child)
+			return idx;
+	}
+
+	return -1UL;
+}
+
+/**
+ * The table of current CPU, a thread may migrate at any time, so it only
+ * avoids contention, the counters are still atomic. aarch64 has no user
+ * readable CPU number, use the thread pointer instead of a syscall.
+ */
+static struct ulftrace_agg *this_agg(struct ulftrace_shm *shm)
+{
+#if defined(__x86_64__)
+	unsigned int cpu = __ulp_builtin_getcpu();
+#else
+	unsigned int cpu = tp_hash(__ulp_builtin_thread_pointer());
+#endif
+
+	return ulftrace_agg(shm, cpu & (shm->nr_cpus - 1));
+}
+
+/* Count a call of @child, no lock, no allocation */
+static void agg_entry(struct ulftrace_shm *shm, unsigned long child)
+{
+	unsigned long i, idx, mask = shm->agg_slots - 1;
+	unsigned long old;
+	struct ulftrace_agg *agg = this_agg(shm);
+
+	idx = child_hash(child) & mask;
+
+	for (i = 0; i <= mask; i++, idx = (idx + 1) & mask) {
+		old = __atomic_load_n(&agg[idx].child, __ATOMIC_RELAXED);
+		if (old == child)
+			goto found;
+		if (old)
+			continue;
+
+		if (__atomic_compare_exchange_n(&agg[idx].child, &old, child,
+						false, __ATOMIC_RELAXED,
+						__ATOMIC_RELAXED) ||
+		    old == child)
+			goto found;
+	}
+
+	/* Table is full */
+	__atomic_fetch_add(&shm->lost, 1, __ATOMIC_RELAXED);
+	return;
+
+found:
+	__atomic_fetch_add(&agg[idx].count, 1, __ATOMIC_RELAXED);
+}
+
+static void atomic_max(unsigned long *p, unsigned long val)
+{
+	unsigned long old = __atomic_load_n(p, __ATOMIC_RELAXED);
+
+	while (old < val &&
+	       !__atomic_compare_exchange_n(p, &old, val, true,
+					    __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED))
+		;
+}
+
+/* The slot is free, see graph_entry() */
+static void graph_clear(struct ulftrace_frame *frame)
+{
+	frame->parent_loc = 0;
+	frame->key = 0;
+	compiler_barrier();
+}
 
-#endif /* ULPATCH_TEST */
+/**
+ * Save the return address of child into shadow stack, and hook it, thus,
+ * _ftrace_mcount_return() is called when child returns.
+ *
+ * A signal handler may call traced functions at any point of this, on the
+ * same stack. The slot is reserved before it's filled, thus, the handler
+ * pushes above it. Slots not filled yet are zero, their parent_loc stops
+ * the longjmp(3) check below, and their key matches no return, see
+ * graph_return_depth().
+ */
+static void graph_entry(struct ulftrace_shm *shm, struct ulftrace_ring *ring,
+			unsigned long *parent_loc, unsigned long child)
+{
+	unsigned long depth, idx;
+	struct ulftrace_frame *frame;
+	struct ulftrace_stack *stack = this_stack(ulftrace_local);
 
+	if (!stack) {
+		__atomic_store_n(&ring->lost, ring->lost + 1, __ATOMIC_RELAXED);
+		return;
+	}
+	depth = stack->depth;
+
+	/**
+	 * Frames not above this one on the stack were skipped by longjmp(3)
+	 * or exceptions, if the return address was overwritten, they never
+	 * return. A frame on other stack, such as sigaltstack(2), is still
+	 * hooked, keep it.
+	 */
+	while (depth && stack->frames[depth - 1].parent_loc &&
+	       stack->frames[depth - 1].parent_loc <=
+		(unsigned long)parent_loc &&
+	       *(unsigned long *)stack->frames[depth - 1].parent_loc !=
+		(unsigned long)_ftrace_mcount_return)
+		graph_clear(&stack->frames[--depth]);
+
+	if (depth >= ULFTRACE_MAX_DEPTH) {
+		stack->depth = depth;
+		__atomic_store_n(&ring->lost, ring->lost + 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	idx = this_func(shm, child);
+	if (idx == -1UL) {
+		__atomic_fetch_add(&shm->lost, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	frame = &stack->frames[depth];
+	stack->depth = depth + 1;
+	compiler_barrier();
+
+	frame->parent = *parent_loc;
+	frame->func = idx;
+	frame->key = MCOUNT_FRAME_KEY(parent_loc);
+	compiler_barrier();
+	frame->parent_loc = (unsigned long)parent_loc;
+	compiler_barrier();
+
+	atomic_max(&ulftrace_func(shm, idx)->max_depth, depth + 1);
+
+	*parent_loc = (unsigned long)_ftrace_mcount_return;
+
+	/* The last one, don't count the overhead above */
+	frame->cycles = __ulp_builtin_cycles();
+}
+
+/* Keep the slowest calls of this thread, only for the producer */
+static void graph_slow(struct ulftrace_ring *ring, struct ulftrace_frame *frame,
+		       unsigned long child, unsigned long duration,
+		       unsigned long depth)
+{
+	unsigned int i, min = 0;
+	unsigned long seq = ring->slow_seq;
+	struct ulftrace_slow *slow;
+
+	for (i = 1; i < ULFTRACE_NR_SLOW; i++) {
+		if (ring->slow[i].duration < ring->slow[min].duration)
+			min = i;
+	}
+
+	__atomic_store_n(&ring->slow_seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	slow = &ring->slow[min];
+	slow->cycles = frame->cycles;
+	slow->duration = duration;
+	slow->child = child;
+	slow->parent = frame->parent;
+	slow->tid = ring->tid;
+	slow->depth = depth;
+
+	__atomic_store_n(&ring->slow_seq, seq + 2, __ATOMIC_RELEASE);
+
+	ring->slow_min = -1UL;
+	for (i = 0; i < ULFTRACE_NR_SLOW; i++) {
+		if (ring->slow[i].duration < ring->slow_min)
+			ring->slow_min = ring->slow[i].duration;
+	}
+}
 
 /* for example:
  * main()
@@ -32,47 +336,175 @@ extern int try_to_wake_up(struct task_struct *task, int mode, int wake_flags);
 int mcount_entry(unsigned long *parent_loc, unsigned long child,
 		 struct mcount_regs *regs)
 {
-#if defined(ULPATCH_TEST)
-
-	ulp_warning("parent: %p, child: %lx, args: %ld %ld %ld %ld %ld %ld.\n",
-		parent_loc,
-		child,
-		ARG1(regs),
-		ARG2(regs),
-		ARG3(regs),
-		ARG4(regs),
-		ARG5(regs),
-		ARG6(regs)
-	);
-
-	/* This is try_to_wake_up() ftrace, here 0x26 is a emulate value, you can
-	 * check the offset with 'objdump -d' command.
-	 */
-	if (child - (unsigned long)try_to_wake_up > 0x0 &&
-		child - (unsigned long)try_to_wake_up < 0x26) {
-		struct task_struct *task = (void *)ARG1(regs);
-		ulp_warning("COMM: %s, PID %d\n", task->comm, task->pid);
+	unsigned long head;
+	unsigned int mode;
+	int pid;
+	struct ulftrace_shm *shm;
+	struct ulftrace_ring *ring;
+	struct ulftrace_record *rec;
+
+	shm = __atomic_load_n(&ulftrace_shm, __ATOMIC_ACQUIRE);
+	if (!shm)
+		return 0;
+
+	if (shm->filter_end &&
+	    (child < shm->filter_start || child >= shm->filter_end))
+		return 0;
+
+	mode = __atomic_load_n(&shm->mode, __ATOMIC_RELAXED);
+
+	/* No ring needed */
+	if (mode == ULFTRACE_MODE_AGGREGATE) {
+		agg_entry(shm, child);
+		return 0;
+	}
+
+	pid = this_pid(ulftrace_local);
+
+	/* Children return with the copy of shadow stack, but never hook */
+	if (mode == ULFTRACE_MODE_GRAPH && pid != shm->pid)
+		return 0;
+
+	ring = this_ring(shm, pid);
+	if (!ring) {
+		__atomic_fetch_add(&shm->lost, 1, __ATOMIC_RELAXED);
+		return 0;
 	}
 
-#endif /* ULPATCH_TEST */
+	if (mode == ULFTRACE_MODE_GRAPH) {
+		graph_entry(shm, ring, parent_loc, child);
+		return 0;
+	}
+
+	head = ring->head;
+	if (head - ring->tail_cache >= shm->nr_records) {
+		ring->tail_cache = __atomic_load_n(&ring->tail,
+						   __ATOMIC_ACQUIRE);
+		if (head - ring->tail_cache >= shm->nr_records) {
+			__atomic_store_n(&ring->lost, ring->lost + 1,
+					 __ATOMIC_RELAXED);
+			return 0;
+		}
+	}
 
-	/* TODO */
+	rec = &ring->records[head & (shm->nr_records - 1)];
+	rec->cycles = __ulp_builtin_cycles();
+	rec->child = child;
+	rec->parent = *parent_loc;
+	rec->args[0] = ARG1(regs);
+	rec->args[1] = ARG2(regs);
+	rec->args[2] = ARG3(regs);
+	rec->args[3] = ARG4(regs);
+	rec->args[4] = ARG5(regs);
+	rec->args[5] = ARG6(regs);
+	rec->tid = ring->tid;
+	rec->flags = 0;
+
+	/* Publish the record */
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
 	return 0;
 }
 
-unsigned long mcount_exit(long *retval)
+/**
+ * Frames above the returning one were skipped by longjmp(3) or exceptions,
+ * drop them.
+ *
+ * @return: the depth of returning frame, 0 if not found.
+ */
+static unsigned long graph_return_depth(struct ulftrace_stack *stack,
+					unsigned long key)
 {
-#if defined(ULPATCH_TEST)
-	printf("CALL mcount_exit.\n");
-#endif /* ULPATCH_TEST */
+	unsigned long i;
 
-	/* TODO */
+	for (i = MIN(stack->depth, ULFTRACE_MAX_DEPTH); i > 0; i--) {
+		if (stack->frames[i - 1].key == key)
+			return i;
+	}
 	return 0;
 }
 
+/**
+ * The original return address is lost, no frame matches the returning one,
+ * nothing but die, like a corrupted stack.
+ */
+static void graph_corrupted(void)
+{
+	char msg[] = "ulftrace: shadow stack corrupted, abort\n";
+
+	__ulp_builtin_write(2, msg, sizeof(msg) - 1);
+	__ulp_builtin_abort();
+}
+
+/**
+ * Called by _ftrace_mcount_return() when a hooked function returns, pop the
+ * shadow stack, and return the original return address.
+ *
+ * ulftrace restores all hooked return addresses of target task before
+ * clearing the ulftrace_shm pointer, but a fork(2)ed child keeps its hooked
+ * frames, thus, the shm may be gone, only the shadow stack is always here.
+ * The calls of children are not measured.
+ *
+ * @fp: the frame pointer, see MCOUNT_RETURN_KEY().
+ */
+unsigned long mcount_exit(long *retval, unsigned long fp)
+{
+	unsigned long depth, top, duration;
+	struct ulftrace_shm *shm;
+	struct ulftrace_ring *ring;
+	struct ulftrace_stack *stack;
+	struct ulftrace_frame frame;
+	struct ulftrace_func *func;
+	int pid;
+
+	duration = __ulp_builtin_cycles();
+
+	stack = this_stack(ulftrace_local);
+	depth = stack ? graph_return_depth(stack,
+					   MCOUNT_RETURN_KEY(retval, fp)) : 0;
+	if (!depth)
+		graph_corrupted();
+
+	/**
+	 * Copy the frame before freeing the slot, a signal handler may reuse
+	 * it as soon as the depth is published, see graph_entry().
+	 */
+	frame = stack->frames[--depth];
+	compiler_barrier();
+	for (top = MIN(stack->depth, ULFTRACE_MAX_DEPTH); top > depth; top--)
+		graph_clear(&stack->frames[top - 1]);
+	stack->depth = depth;
+
+	shm = __atomic_load_n(&ulftrace_shm, __ATOMIC_ACQUIRE);
+	if (!shm)
+		return frame.parent;
+
+	pid = this_pid(ulftrace_local);
+	if (pid != shm->pid)
+		return frame.parent;
+
+	ring = this_ring(shm, pid);
+	if (!ring) {
+		__atomic_fetch_add(&shm->lost, 1, __ATOMIC_RELAXED);
+		return frame.parent;
+	}
+
+	duration -= frame.cycles;
+	func = ulftrace_func(shm, frame.func);
+
+	__atomic_fetch_add(&func->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&func->total, duration, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&func->hist[ulftrace_hist_bucket(duration)], 1,
+			   __ATOMIC_RELAXED);
+	atomic_max(&func->max, duration);
+
+	if (duration > ring->slow_min)
+		graph_slow(ring, &frame, func->child, duration, depth + 1);
+
+	return frame.parent;
+}
+
 #if defined(__x86_64__)
-ULPATCH_INFO(mcount, _ftrace_mcount, "Rong Tao");
+ULPATCH_INFO(_ftrace_mcount, mcount, "Rong Tao");
 #elif defined(__aarch64__)
-ULPATCH_INFO(_mcount, _ftrace_mcount, "Rong Tao");
+ULPATCH_INFO(_ftrace_mcount, _mcount, "Rong Tao");
 #endif
-
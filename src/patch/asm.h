@@ -173,3 +173,210 @@
 # error "__ulp_builtin_write() or __ulp_builtin_write_hello() is not support on this architecture"
 #endif
 
+
+
+/**
+ * SYNOPSIS: pid_t gettid(void);
+ */
+#define __ulp_builtin_gettid_x86_64() ({	\
+	long ____ret;				\
+	__asm__ __volatile__("syscall \n\t"	\
+		: "=a"(____ret)			\
+		: "0"(186)			\
+		: "rcx", "r11", "memory");	\
+	(int)____ret;				\
+})
+
+#define __ulp_builtin_gettid_aarch64() ({		\
+	register long ____x0 __asm__("x0");		\
+	register long ____x8 __asm__("x8") = 178;	\
+	__asm__ __volatile__("svc #0 \n\t"		\
+		: "=r"(____x0)				\
+		: "r"(____x8)				\
+		: "memory");				\
+	(int)____x0;					\
+})
+
+#if defined(__x86_64__)
+# define __ulp_builtin_gettid() __ulp_builtin_gettid_x86_64()
+#elif defined(__aarch64__)
+# define __ulp_builtin_gettid() __ulp_builtin_gettid_aarch64()
+#else
+# error "__ulp_builtin_gettid() is not support on this architecture"
+#endif
+
+
+/**
+ * SYNOPSIS: pid_t getpid(void);
+ */
+#define __ulp_builtin_getpid_x86_64() ({	\
+	long ____ret;				\
+	__asm__ __volatile__("syscall \n\t"	\
+		: "=a"(____ret)			\
+		: "0"(39)			\
+		: "rcx", "r11", "memory");	\
+	(int)____ret;				\
+})
+
+#define __ulp_builtin_getpid_aarch64() ({		\
+	register long ____x0 __asm__("x0");		\
+	register long ____x8 __asm__("x8") = 172;	\
+	__asm__ __volatile__("svc #0 \n\t"		\
+		: "=r"(____x0)				\
+		: "r"(____x8)				\
+		: "memory");				\
+	(int)____x0;					\
+})
+
+#if defined(__x86_64__)
+# define __ulp_builtin_getpid() __ulp_builtin_getpid_x86_64()
+#elif defined(__aarch64__)
+# define __ulp_builtin_getpid() __ulp_builtin_getpid_aarch64()
+#else
+# error "__ulp_builtin_getpid() is not support on this architecture"
+#endif
+
+
+/**
+ * Like abort(3), SIGABRT current thread, if the signal is blocked, ignored,
+ * or handled, exit_group(2) with the status of a SIGABRT killed shell job.
+ */
+#define __ulp_builtin_abort_x86_64() ({				\
+	long ____pid = __ulp_builtin_getpid();			\
+	long ____tid = __ulp_builtin_gettid();			\
+	long ____ret;						\
+	register long ____rdi __asm__("rdi") = ____pid;		\
+	register long ____rsi __asm__("rsi") = ____tid;		\
+	register long ____rdx __asm__("rdx") = 6;		\
+	__asm__ __volatile__("syscall \n\t"			\
+		: "=a"(____ret)					\
+		: "0"(234), "r"(____rdi), "r"(____rsi),		\
+		  "r"(____rdx)					\
+		: "rcx", "r11", "memory");			\
+	____rdi = 128 + 6;					\
+	__asm__ __volatile__("syscall \n\t"			\
+		: "=a"(____ret)					\
+		: "0"(231), "r"(____rdi)			\
+		: "rcx", "r11", "memory");			\
+})
+
+#define __ulp_builtin_abort_aarch64() ({			\
+	long ____pid = __ulp_builtin_getpid();			\
+	long ____tid = __ulp_builtin_gettid();			\
+	register long ____x0 __asm__("x0") = ____pid;		\
+	register long ____x1 __asm__("x1") = ____tid;		\
+	register long ____x2 __asm__("x2") = 6;			\
+	register long ____x8 __asm__("x8") = 131;		\
+	__asm__ __volatile__("svc #0 \n\t"			\
+		: "+r"(____x0)					\
+		: "r"(____x1), "r"(____x2), "r"(____x8)		\
+		: "memory");					\
+	____x0 = 128 + 6;					\
+	____x8 = 94;						\
+	__asm__ __volatile__("svc #0 \n\t"			\
+		: "+r"(____x0)					\
+		: "r"(____x8)					\
+		: "memory");					\
+})
+
+#if defined(__x86_64__)
+# define __ulp_builtin_abort() __ulp_builtin_abort_x86_64()
+#elif defined(__aarch64__)
+# define __ulp_builtin_abort() __ulp_builtin_abort_aarch64()
+#else
+# error "__ulp_builtin_abort() is not support on this architecture"
+#endif
+
+
+/**
+ * Thread pointer, it's unique of each living thread. On x86_64, %fs:0 is the
+ * TCB itself, see the x86_64 TLS ABI.
+ */
+#define __ulp_builtin_thread_pointer_x86_64() ({	\
+	unsigned long ____tp;				\
+	__asm__("movq %%fs:0, %0 \n\t"			\
+		: "=r"(____tp));			\
+	____tp;						\
+})
+
+#define __ulp_builtin_thread_pointer_aarch64() ({	\
+	unsigned long ____tp;				\
+	__asm__("mrs %0, tpidr_el0 \n\t"		\
+		: "=r"(____tp));			\
+	____tp;						\
+})
+
+#if defined(__x86_64__)
+# define __ulp_builtin_thread_pointer() __ulp_builtin_thread_pointer_x86_64()
+#elif defined(__aarch64__)
+# define __ulp_builtin_thread_pointer() __ulp_builtin_thread_pointer_aarch64()
+#else
+# error "__ulp_builtin_thread_pointer() is not support on this architecture"
+#endif
+
+
+/**
+ * The CPU current thread is running on, like sched_getcpu(3). On x86_64,
+ * Linux stores the CPU number in the low 12 bits of TSC_AUX, read it with
+ * rdtscp like vDSO does. aarch64 has no user readable CPU number, it's a
+ * getcpu(2) syscall.
+ */
+#define __ulp_builtin_getcpu_x86_64() ({		\
+	unsigned int ____lo, ____hi, ____aux;		\
+	__asm__ __volatile__("rdtscp \n\t"		\
+		: "=a"(____lo), "=d"(____hi),		\
+		  "=c"(____aux));			\
+	____aux & 0xfff;				\
+})
+
+#define __ulp_builtin_getcpu_aarch64() ({		\
+	register long ____x0 __asm__("x0") = 0;		\
+	register long ____x1 __asm__("x1") = 0;		\
+	register long ____x2 __asm__("x2") = 0;		\
+	register long ____x8 __asm__("x8") = 168;	\
+	unsigned int ____cpu = 0;			\
+	____x0 = (long)&____cpu;			\
+	__asm__ __volatile__("svc #0 \n\t"		\
+		: "+r"(____x0)				\
+		: "r"(____x1), "r"(____x2), "r"(____x8)	\
+		: "memory");				\
+	____cpu;					\
+})
+
+#if defined(__x86_64__)
+# define __ulp_builtin_getcpu() __ulp_builtin_getcpu_x86_64()
+#elif defined(__aarch64__)
+# define __ulp_builtin_getcpu() __ulp_builtin_getcpu_aarch64()
+#else
+# error "__ulp_builtin_getcpu() is not support on this architecture"
+#endif
+
+
+/**
+ * Counter of CPU, it's cheap and without syscall, the frequency is unknown,
+ * calibrate it with clock_gettime(2) if you need nanoseconds.
+ */
+#define __ulp_builtin_cycles_x86_64() ({		\
+	unsigned int ____lo, ____hi;			\
+	__asm__ __volatile__("rdtsc \n\t"		\
+		: "=a"(____lo), "=d"(____hi));		\
+	((unsigned long)____hi << 32) | ____lo;		\
+})
+
+#define __ulp_builtin_cycles_aarch64() ({		\
+	unsigned long ____cnt;				\
+	__asm__ __volatile__("isb \n\t"			\
+		"mrs %0, cntvct_el0 \n\t"		\
+		: "=r"(____cnt)				\
+		:					\
+		: "memory");				\
+	____cnt;					\
+})
+
+#if defined(__x86_64__)
+# define __ulp_builtin_cycles() __ulp_builtin_cycles_x86_64()
+#elif defined(__aarch64__)
+# define __ulp_builtin_cycles() __ulp_builtin_cycles_aarch64()
+#else
+# error "__ulp_builtin_cycles() is not support on this architecture"
+#endif
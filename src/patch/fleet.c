@@ -0,0 +1,181 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#include <errno.h>
+#include <string.h>
+
+#include <utils/log.h>
+#include <utils/util.h>
+#include <utils/workpool.h>
+#include <task/task.h>
+#include <patch/patch.h>
+
+/**
+ * Patch many processes, such as all workers of the same executable. The
+ * patch file is prepared once, see prepare_patch(), each process is opened,
+ * patched and closed by one worker, thus, all ptrace(2) requests of a
+ * process are issued from the same thread.
+ */
+struct fleet {
+	const struct prepared_patch *pp;
+	struct fleet_result *results;
+};
+
+static void fleet_patch_one(size_t idx, void *arg)
+{
+	struct fleet *fleet = arg;
+	struct fleet_result *res = &fleet->results[idx];
+	struct task_struct *task;
+	unsigned long start = usecs();
+
+	task = open_task(res->pid, FTO_ALL);
+	if (!task) {
+		res->err = errno ? -errno : -ENOENT;
+		goto done;
+	}
+
+	if (fleet->pp)
+		res->err = init_patch_prepared(task, fleet->pp);
+	else
+		res->err = delete_patch(task);
+
+	close_task(task);
+done:
+	res->us = usecs() - start;
+	if (res->err)
+		ulp_error("%s %d failed, %s\n", fleet->pp ? "Patch" : "Unpatch",
+			  res->pid, strerror(-res->err));
+}
+
+static void fleet_rollback_one(size_t idx, void *arg)
+{
+	struct fleet *fleet = arg;
+	struct fleet_result *res = &fleet->results[idx];
+	struct task_struct *task;
+
+	if (res->err)
+		return;
+
+	task = open_task(res->pid, FTO_ALL);
+	if (!task || delete_patch(task)) {
+		ulp_error("Rollback %d failed, it's still patched.\n", res->pid);
+		goto done;
+	}
+	res->rollback = true;
+done:
+	if (task)
+		close_task(task);
+}
+
+static void fleet_reset_results(struct fleet_result *results, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		results[i].err = 0;
+		results[i].us = 0;
+		results[i].rollback = false;
+	}
+}
+
+static int fleet_nr_failed(const struct fleet_result *results, int nr)
+{
+	int i, n = 0;
+
+	for (i = 0; i < nr; i++)
+		if (results[i].err)
+			n++;
+	return n;
+}
+
+/**
+ * Patch all processes of @results, all or none. The first process is the
+ * canary, it's patched alone, if it failed, others are not touched. Then
+ * others are patched by @nr_workers workers concurrently, if any one failed,
+ * the patched ones are unpatched.
+ *
+ * The canary task is kept open until all done, thus, the ELF files of the
+ * shared executable and libraries are loaded only once, see bfd_elf_open().
+ *
+ * @return: 0 if all patched, or the number of failed processes, or negative
+ *          errno.
+ */
+int fleet_patch(const struct prepared_patch *pp, struct fleet_result *results,
+		int nr, unsigned int nr_workers)
+{
+	int i, nr_failed;
+	unsigned long start;
+	struct task_struct *canary;
+	struct fleet fleet = {
+		.pp = pp,
+		.results = results,
+	};
+	/* All processes except the canary */
+	struct fleet others = {
+		.pp = pp,
+		.results = results + 1,
+	};
+
+	if (!pp || !results || nr <= 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	fleet_reset_results(results, nr);
+
+	start = usecs();
+	canary = open_task(results[0].pid, FTO_ALL);
+	if (!canary)
+		results[0].err = errno ? -errno : -ENOENT;
+	else
+		results[0].err = init_patch_prepared(canary, pp);
+	results[0].us = usecs() - start;
+
+	if (results[0].err) {
+		ulp_error("Patch canary %d failed, skip others.\n",
+			  results[0].pid);
+		for (i = 1; i < nr; i++)
+			results[i].err = -ECANCELED;
+		goto done;
+	}
+
+	if (nr > 1)
+		workpool_run(nr_workers, nr - 1, fleet_patch_one, &others);
+
+	if (fleet_nr_failed(results, nr)) {
+		ulp_warning("Rollback patched processes.\n");
+		workpool_run(nr_workers, nr, fleet_rollback_one, &fleet);
+	}
+
+done:
+	if (canary)
+		close_task(canary);
+
+	nr_failed = fleet_nr_failed(results, nr);
+	ulp_debug("Patch %d processes, %d failed.\n", nr, nr_failed);
+	return nr_failed;
+}
+
+/**
+ * Unpatch the latest patch of all processes of @results concurrently.
+ *
+ * @return: 0 if all unpatched, or the number of failed processes, or
+ *          negative errno.
+ */
+int fleet_unpatch(struct fleet_result *results, int nr,
+		  unsigned int nr_workers)
+{
+	struct fleet fleet = {
+		.pp = NULL,
+		.results = results,
+	};
+
+	if (!results || nr <= 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	fleet_reset_results(results, nr);
+	workpool_run(nr_workers, nr, fleet_patch_one, &fleet);
+
+	return fleet_nr_failed(results, nr);
+}
@@ -0,0 +1,1063 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#include <errno.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+
+#include <elf/elf-api.h>
+#include <utils/log.h>
+#include <utils/list.h>
+#include <utils/util.h>
+#include <task/task.h>
+#include <patch/patch.h>
+#include <patch/asm.h>
+#include <patch/ftrace.h>
+
+#if defined(__x86_64__)
+#include <arch/x86_64/ftrace.h>
+#elif defined(__aarch64__)
+#include <arch/aarch64/ftrace.h>
+#endif
+
+/**
+ * Data path of ulftrace
+ *
+ * The shared file is mapped into target task with
+ * task_create_mmap_vma_file(), like the patch itself, and the ftrace object
+ * is patched to mcount(). The object writes a record into the ring of current
+ * thread for each traced function entry, we read the records in place.
+ *
+ * The pointer in the object is only changed when no thread is executing the
+ * object, thus, the object never sees a torn pointer, and never touches the
+ * shared memory after it's cleared.
+ *
+ * Every call of mcount is a call site, the sites of functions not traced are
+ * replaced with NOP, thus, the untraced functions run at near-native speed,
+ * and enable a function costs one text write, see ftrace_select_sites().
+ */
+
+/* Calibrate __ulp_builtin_cycles() for at least this long */
+#define FTRACE_CLOCK_CALIBRATE_NS	(10 * 1000 * 1000UL)
+
+/* Check whether the threads owning rings exited at most this often */
+#define FTRACE_REAP_INTERVAL_NS		(100 * 1000 * 1000UL)
+
+/* Since Linux 4.14, glibc 2.27 */
+#ifndef MADV_WIPEONFORK
+# define MADV_WIPEONFORK	18
+#endif
+
+/* Where mcount is in target task, PLT entries and the definition */
+struct mcount_ctx {
+	unsigned long *addrs;
+	size_t nr_addrs;
+	/* The ELF being loaded */
+	struct vm_area_struct *leader;
+	/* The last GOT slot of indirect call, and its value */
+	unsigned long got, got_val;
+};
+
+static unsigned long mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void ftrace_clock_calibrate(struct ftrace_session *fs)
+{
+	unsigned long cycles, ns;
+
+	ns = mono_ns();
+	if (ns - fs->ns0 < FTRACE_CLOCK_CALIBRATE_NS) {
+		usleep((FTRACE_CLOCK_CALIBRATE_NS - (ns - fs->ns0)) / 1000);
+		ns = mono_ns();
+	}
+	cycles = __ulp_builtin_cycles();
+
+	if (cycles > fs->cycles0)
+		fs->ns_per_cycle = (double)(ns - fs->ns0) /
+				   (cycles - fs->cycles0);
+	else
+		fs->ns_per_cycle = 1.0;
+
+	ulp_debug("ftrace clock: %.4f ns per cycle\n", fs->ns_per_cycle);
+}
+
+unsigned long ftrace_cycles_to_ns(const struct ftrace_session *fs,
+				  unsigned long cycles)
+{
+	return fs->ns0 + (long)((long)(cycles - fs->cycles0) *
+				fs->ns_per_cycle);
+}
+
+/* Find @name in the ftrace object we just patched */
+static unsigned long ftrace_find_ulp_sym(struct ftrace_session *fs,
+					 struct vm_area_struct *vma,
+					 const char *name)
+{
+	size_t i, nr_extras = 0;
+	struct task_sym *tsym;
+	const struct task_sym **extras = NULL;
+
+	tsym = find_task_sym(fs->task, name, &extras, &nr_extras);
+	for (i = 0; tsym && tsym->vma != vma; i++)
+		tsym = i < nr_extras ? (struct task_sym *)extras[i] : NULL;
+	free((void *)extras);
+
+	if (!tsym) {
+		ulp_error("Not found %s in ftrace object.\n", name);
+		return 0;
+	}
+	return tsym->addr;
+}
+
+/* Find the ftrace object we just patched, and the pointer in it */
+static int ftrace_find_shm_ptr(struct ftrace_session *fs)
+{
+	struct vma_ulp *ulp, *found = NULL;
+	struct task_struct *task = fs->task;
+
+	list_for_each_entry(ulp, &task->ulp_list, node) {
+		if (ulp->nr_info && ulp->info[0].ulp_id == task->max_ulp_id) {
+			found = ulp;
+			break;
+		}
+	}
+	if (!found) {
+		ulp_error("Not found ftrace object in %d.\n", task->pid);
+		return -ENOENT;
+	}
+
+	fs->ulp_start = found->vma->vm_start;
+	fs->ulp_end = found->vma->vm_end;
+
+	fs->target_shm_ptr = ftrace_find_ulp_sym(fs, found->vma,
+						 ULFTRACE_SHM_SYMBOL);
+	fs->target_local_ptr = ftrace_find_ulp_sym(fs, found->vma,
+						   ULFTRACE_LOCAL_SYMBOL);
+	fs->target_return = ftrace_find_ulp_sym(fs, found->vma,
+						"_ftrace_mcount_return");
+	if (!fs->target_shm_ptr || !fs->target_local_ptr ||
+	    !fs->target_return)
+		return -ENOENT;
+
+	return 0;
+}
+
+/**
+ * Map the private memory of shadow stacks into target task, the page of
+ * struct ulftrace_proc is wiped on fork(2), see struct ulftrace_local.
+ */
+static int ftrace_create_local(struct ftrace_session *fs)
+{
+	int err;
+	unsigned long proc, addr;
+	struct task_struct *task = fs->task;
+	int pid = task->pid;
+
+	proc = PAGE_UP(sizeof(struct ulftrace_local));
+	fs->local_size = proc + PAGE_SIZE;
+
+	/* Zero filled, all shadow stacks are free */
+	addr = task_mmap(task, 0UL, fs->local_size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (REMOTE_MMAP_FAILED(addr)) {
+		ulp_error("Map shadow stacks into %d failed.\n", task->pid);
+		return -ENOMEM;
+	}
+	fs->target_local = addr;
+	proc += addr;
+
+	/* Needs Linux 4.14, children can't be told from target task without */
+	err = task_madvise(task, proc, PAGE_SIZE, MADV_WIPEONFORK);
+	if (err) {
+		ulp_error("madvise(MADV_WIPEONFORK) in %d failed, %s.\n",
+			  task->pid, strerror(-err));
+		return err;
+	}
+
+	if (memcpy_to_task(task, addr + offsetof(struct ulftrace_local, proc),
+			   &proc, sizeof(proc)) != sizeof(proc) ||
+	    memcpy_to_task(task, proc + offsetof(struct ulftrace_proc, pid),
+			   &pid, sizeof(pid)) != sizeof(pid))
+		return -EFAULT;
+
+	return 0;
+}
+
+/**
+ * Restore the return addresses hooked in function graph mode, the world
+ * must be stopped, and no thread is executing the ftrace object, thus, the
+ * shadow stacks are stable. Children of target task keep their copies.
+ */
+static void ftrace_graph_unhook(struct ftrace_session *fs)
+{
+	unsigned int i;
+	unsigned long d, nr, val, addr;
+	struct ulftrace_stack *stack;
+	struct ulftrace_frame *frame;
+	size_t hdr = offsetof(struct ulftrace_stack, frames);
+
+	if (!fs->target_local)
+		return;
+
+	stack = malloc(sizeof(*stack));
+	if (!stack) {
+		ulp_error("Unhook %d failed, no memory.\n", fs->task->pid);
+		return;
+	}
+
+	for (i = 0; i < ULFTRACE_NR_STACKS; i++) {
+		addr = fs->target_local +
+			offsetof(struct ulftrace_local, stacks) +
+			i * sizeof(*stack);
+
+		if (memcpy_from_task(fs->task, stack, addr, hdr) != hdr ||
+		    !stack->owner || !stack->depth)
+			continue;
+
+		nr = MIN(stack->depth, ULFTRACE_MAX_DEPTH);
+		if (memcpy_from_task(fs->task, stack->frames, addr + hdr,
+				     nr * sizeof(*frame)) != nr * sizeof(*frame))
+			continue;
+
+		for (d = nr; d > 0; d--) {
+			frame = &stack->frames[d - 1];
+			/* The thread may exited, or the frame was skipped */
+			if (memcpy_from_task(fs->task, &val, frame->parent_loc,
+					     sizeof(val)) != sizeof(val) ||
+			    val != fs->target_return)
+				continue;
+			memcpy_to_task(fs->task, frame->parent_loc,
+				       &frame->parent, sizeof(frame->parent));
+		}
+
+		/* Free slots are zero, see graph_entry() */
+		memset(stack->frames, 0, nr * sizeof(*frame));
+		memcpy_to_task(fs->task, addr + hdr, stack->frames,
+			       nr * sizeof(*frame));
+
+		stack->depth = 0;
+		memcpy_to_task(fs->task,
+			       addr + offsetof(struct ulftrace_stack, depth),
+			       &stack->depth, sizeof(stack->depth));
+	}
+
+	free(stack);
+}
+
+/**
+ * Set the pointer in ftrace object when no thread is executing the object.
+ */
+static int ftrace_set_shm(struct ftrace_session *fs, unsigned long shm)
+{
+	int n, err;
+	struct task_struct *task = fs->task;
+	struct addr_range range = {
+		.start = fs->ulp_start,
+		.end = fs->ulp_end,
+	};
+
+	err = task_stop_world_safe_ranges(task, &range, 1, ULP_STW_BUDGET_US,
+					  ULP_SAFE_POINT_DEADLINE_US);
+	if (err) {
+		ulp_error("Stop the world of %d at safe point failed.\n",
+			  task->pid);
+		return err;
+	}
+
+	/* No hooked return address left when tracing is off */
+	if (!shm)
+		ftrace_graph_unhook(fs);
+	/* Stays after tracing is off, see ULFTRACE_LOCAL_SYMBOL */
+	else if (memcpy_to_task(task, fs->target_local_ptr, &fs->target_local,
+				sizeof(fs->target_local)) !=
+		 sizeof(fs->target_local)) {
+		task_resume_world(task);
+		return -EFAULT;
+	}
+
+	n = memcpy_to_task(task, fs->target_shm_ptr, &shm, sizeof(shm));
+
+	task_resume_world(task);
+
+	return n == sizeof(shm) ? 0 : -EFAULT;
+}
+
+/**
+ * Map @nr_rings rings with @nr_records records each into target task, and
+ * patch the ftrace object @obj_file. Only child in the range set by
+ * ftrace_set_filter() is traced, all by default.
+ *
+ * The task must be opened with FTO_PROC and FTO_THREADS, such as
+ * FTO_ULFTRACE.
+ */
+int ftrace_open(struct ftrace_session *fs, struct task_struct *task,
+		const char *obj_file, unsigned int nr_rings,
+		unsigned int nr_records)
+{
+	int err;
+	size_t size;
+	unsigned int nr_cpus = 1;
+	char seed[PATH_MAX], buf[PATH_MAX];
+	struct ulftrace_shm *shm;
+
+	memset(fs, 0, sizeof(*fs));
+	fs->task = task;
+
+	if (!nr_rings || nr_rings > ULFTRACE_MAX_RINGS ||
+	    (nr_rings & (nr_rings - 1)) || nr_records < 64 ||
+	    nr_records > ULFTRACE_MAX_RECORDS ||
+	    (nr_records & (nr_records - 1))) {
+		ulp_error("Invalid rings %u or records %u.\n", nr_rings,
+			  nr_records);
+		return -EINVAL;
+	}
+
+	if ((task->fto_flag & (FTO_PROC | FTO_THREADS)) !=
+	    (FTO_PROC | FTO_THREADS)) {
+		ulp_error("Need FTO_PROC and FTO_THREADS task flag.\n");
+		return -EINVAL;
+	}
+
+	fs->cycles0 = __ulp_builtin_cycles();
+	fs->ns0 = mono_ns();
+	fs->reap_ns = fs->ns0;
+
+	/* ULP_PROC_ROOT_DIR/PID/TASK_PROC_MAP_FILES/ulftrace-XXXXXX */
+	snprintf(seed, sizeof(seed), ULP_PROC_ROOT_DIR "/%d/"
+		 TASK_PROC_MAP_FILES "/" ULFTRACE_VMA_TEMP_PREFIX "XXXXXX",
+		 task->pid);
+	if (!fmktempfile(buf, sizeof(buf), seed))
+		return -errno ?: -EEXIST;
+
+	fs->path = strdup(buf);
+	if (!fs->path) {
+		fremove(buf);
+		return -ENOMEM;
+	}
+
+	/* Power of 2, thus, the object masks CPU number without division */
+	while (nr_cpus < get_nprocs_conf() && nr_cpus < ULFTRACE_MAX_CPUS)
+		nr_cpus <<= 1;
+
+	size = ulftrace_shm_size(nr_rings, nr_records, nr_cpus);
+	fs->mmap = fmmap_shmem_create(fs->path, size);
+	if (!fs->mmap) {
+		err = -ENOMEM;
+		goto failed;
+	}
+
+	/* ftruncate(2) filled zero, all rings are free */
+	shm = fs->shm = fs->mmap->mem;
+	shm->magic = ULFTRACE_SHM_MAGIC;
+	shm->version = ULFTRACE_SHM_VERSION;
+	shm->nr_rings = nr_rings;
+	shm->nr_records = nr_records;
+	shm->ring_size = ulftrace_ring_size(nr_records);
+	shm->mode = ULFTRACE_MODE_RECORD;
+	shm->nr_funcs = ULFTRACE_NR_FUNCS;
+	shm->funcs_offset = sizeof(struct ulftrace_shm);
+	shm->nr_cpus = nr_cpus;
+	shm->agg_slots = ULFTRACE_AGG_SLOTS;
+	shm->aggs_offset = shm->funcs_offset +
+			   ULFTRACE_NR_FUNCS * sizeof(struct ulftrace_func);
+	shm->rings_offset = shm->aggs_offset + (unsigned long)nr_cpus *
+			    ULFTRACE_AGG_SLOTS * sizeof(struct ulftrace_agg);
+	shm->pid = task->pid;
+
+	/* Target task will open it, see init_patch_prepared() */
+	err = chown(fs->path, task->status.uid, task->status.gid);
+	if (err) {
+		ulp_error("chown %s failed.\n", fs->path);
+		err = -errno;
+		goto failed;
+	}
+
+	err = task_create_mmap_vma_file(task, fs->path, size, 0,
+					&fs->target_shm);
+	if (err)
+		goto failed;
+
+	err = init_patch(task, obj_file);
+	if (err) {
+		ulp_error("Patch %s failed.\n", obj_file);
+		goto failed;
+	}
+	fs->patched = true;
+
+	err = ftrace_find_shm_ptr(fs);
+	if (err)
+		goto failed;
+
+	err = ftrace_create_local(fs);
+	if (err)
+		goto failed;
+
+	err = ftrace_set_shm(fs, fs->target_shm);
+	if (err)
+		goto failed;
+
+	ftrace_clock_calibrate(fs);
+
+	ulp_debug("ftrace %d: %u rings x %u records, shm %lx\n", task->pid,
+		  nr_rings, nr_records, fs->target_shm);
+	return 0;
+
+failed:
+	ftrace_close(fs);
+	return err;
+}
+
+/* Trace child in [start, end) only, 0 means all, it's effective at once. */
+void ftrace_set_filter(struct ftrace_session *fs, unsigned long start,
+		       unsigned long end)
+{
+	__atomic_store_n(&fs->shm->filter_start, start, __ATOMIC_RELAXED);
+	__atomic_store_n(&fs->shm->filter_end, end, __ATOMIC_RELEASE);
+}
+
+/**
+ * Write records, measure duration of calls, or count calls, see enum
+ * ulftrace_mode, it's effective at once.
+ */
+void ftrace_set_mode(struct ftrace_session *fs, enum ulftrace_mode mode)
+{
+	__atomic_store_n(&fs->shm->mode, mode, __ATOMIC_RELAXED);
+}
+
+static int cmp_slow(const void *a, const void *b)
+{
+	const struct ulftrace_slow *sa = a, *sb = b;
+
+	if (sa->duration == sb->duration)
+		return 0;
+	return sa->duration > sb->duration ? -1 : 1;
+}
+
+/**
+ * Copy the slowest calls of all threads into @slow, the slowest first.
+ *
+ * @return: number of calls copied, at most @n.
+ */
+int ftrace_slowest(struct ftrace_session *fs, struct ulftrace_slow *slow,
+		   int n)
+{
+	int nr = 0;
+	unsigned int i;
+	unsigned long seq;
+	struct ulftrace_ring *ring;
+	struct ulftrace_shm *shm = fs->shm;
+	struct ulftrace_slow *all;
+
+	all = malloc(shm->nr_rings * sizeof(ring->slow));
+	if (!all)
+		return -ENOMEM;
+
+	for (i = 0; i < shm->nr_rings; i++) {
+		ring = ulftrace_ring(shm, i);
+		if (!__atomic_load_n(&ring->owner, __ATOMIC_RELAXED))
+			continue;
+
+		/* Retry if the producer is writing */
+		do {
+			seq = __atomic_load_n(&ring->slow_seq,
+					      __ATOMIC_ACQUIRE);
+			memcpy(&all[nr], ring->slow, sizeof(ring->slow));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		} while ((seq & 1) ||
+			 seq != __atomic_load_n(&ring->slow_seq,
+						__ATOMIC_RELAXED));
+
+		nr += ULFTRACE_NR_SLOW;
+	}
+
+	qsort(all, nr, sizeof(*all), cmp_slow);
+
+	/* Unused entries are zero, at the end */
+	for (i = 0; i < nr && i < n && all[i].duration; i++)
+		slow[i] = all[i];
+
+	free(all);
+	return i;
+}
+
+static int cmp_agg_child(const void *a, const void *b)
+{
+	const struct ulftrace_agg *aa = a, *ab = b;
+
+	if (aa->child == ab->child)
+		return 0;
+	return aa->child < ab->child ? -1 : 1;
+}
+
+static int cmp_agg_count(const void *a, const void *b)
+{
+	const struct ulftrace_agg *aa = a, *ab = b;
+
+	if (aa->count == ab->count)
+		return 0;
+	return aa->count > ab->count ? -1 : 1;
+}
+
+/**
+ * Sum the counters of all CPUs by child, reset them to zero if @reset, no
+ * call is lost between two resets. @aggs is malloced, need free, the most
+ * called first.
+ *
+ * @return: number of functions called, or -errno.
+ */
+long ftrace_aggregate(struct ftrace_session *fs, struct ulftrace_agg **aggs,
+		      bool reset)
+{
+	long nr = 0, alloc = 0, i, n;
+	unsigned int cpu, s;
+	unsigned long count;
+	struct ulftrace_shm *shm = fs->shm;
+	struct ulftrace_agg *agg, *all = NULL, *tmp;
+
+	for (cpu = 0; cpu < shm->nr_cpus; cpu++) {
+		agg = ulftrace_agg(shm, cpu);
+
+		for (s = 0; s < shm->agg_slots; s++) {
+			if (!__atomic_load_n(&agg[s].child, __ATOMIC_RELAXED))
+				continue;
+
+			if (reset)
+				count = __atomic_exchange_n(&agg[s].count, 0,
+							    __ATOMIC_RELAXED);
+			else
+				count = __atomic_load_n(&agg[s].count,
+							__ATOMIC_RELAXED);
+			if (!count)
+				continue;
+
+			if (nr == alloc) {
+				alloc = alloc ? alloc * 2 : 256;
+				tmp = realloc(all, alloc * sizeof(*all));
+				if (!tmp) {
+					free(all);
+					return -ENOMEM;
+				}
+				all = tmp;
+			}
+			all[nr].child = agg[s].child;
+			all[nr].count = count;
+			nr++;
+		}
+	}
+
+	*aggs = all;
+	if (!nr)
+		return 0;
+
+	/* Merge the same child of different CPUs */
+	qsort(all, nr, sizeof(*all), cmp_agg_child);
+	for (i = 0, n = 0; i < nr; i++) {
+		if (n && all[n - 1].child == all[i].child)
+			all[n - 1].count += all[i].count;
+		else
+			all[n++] = all[i];
+	}
+
+	qsort(all, n, sizeof(*all), cmp_agg_count);
+
+	return n;
+}
+
+/**
+ * A new thread may reuse the thread pointer of an exited one, and its ring,
+ * clear the tid of exited threads, then the producer gets its own, see
+ * this_ring() in the ftrace object. Records written before that carry the
+ * old tid.
+ */
+static void ftrace_reap_rings(struct ftrace_session *fs)
+{
+	int tid;
+	unsigned int i;
+	unsigned long ns = mono_ns();
+	struct ulftrace_shm *shm = fs->shm;
+	struct ulftrace_ring *ring;
+
+	if (ns - fs->reap_ns < FTRACE_REAP_INTERVAL_NS)
+		return;
+	fs->reap_ns = ns;
+
+	for (i = 0; i < shm->nr_rings; i++) {
+		ring = ulftrace_ring(shm, i);
+		if (!__atomic_load_n(&ring->owner, __ATOMIC_RELAXED))
+			continue;
+
+		tid = __atomic_load_n(&ring->tid, __ATOMIC_RELAXED);
+		if (!tid || !ring->pid || syscall(SYS_tgkill, ring->pid, tid, 0) == 0 ||
+		    errno != ESRCH)
+			continue;
+
+		ulp_debug("ftrace: thread %d of %d exited.\n", tid, ring->pid);
+		/* The producer may set it already */
+		__atomic_compare_exchange_n(&ring->tid, &tid, 0, false,
+					    __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Call @fn for all records published, the record points to the shared
+ * memory, it's valid until @fn returns. Records of each thread are in order.
+ * If @fn returns non-zero, stop after that record.
+ *
+ * @return: number of records consumed.
+ */
+long ftrace_consume(struct ftrace_session *fs, ftrace_record_fn fn,
+		    void *arg)
+{
+	long n = 0;
+	int stop = 0;
+	unsigned int i;
+	unsigned long head, tail, mask;
+	struct ulftrace_shm *shm = fs->shm;
+	struct ulftrace_ring *ring;
+
+	ftrace_reap_rings(fs);
+
+	mask = shm->nr_records - 1;
+
+	for (i = 0; i < shm->nr_rings && !stop; i++) {
+		ring = ulftrace_ring(shm, i);
+		if (!__atomic_load_n(&ring->owner, __ATOMIC_RELAXED))
+			continue;
+
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		tail = ring->tail;
+
+		while (tail != head && !stop) {
+			if (fn)
+				stop = fn(&ring->records[tail & mask], arg);
+			tail++;
+			n++;
+		}
+
+		/* Give the slots back to producer */
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+	}
+
+	return n;
+}
+
+/* Number of records dropped */
+unsigned long ftrace_lost(const struct ftrace_session *fs)
+{
+	unsigned int i;
+	unsigned long lost;
+	struct ulftrace_shm *shm = fs->shm;
+
+	lost = __atomic_load_n(&shm->lost, __ATOMIC_RELAXED);
+	for (i = 0; i < shm->nr_rings; i++)
+		lost += __atomic_load_n(&ulftrace_ring(shm, i)->lost,
+					__ATOMIC_RELAXED);
+	return lost;
+}
+
+static int mcount_ctx_init(struct task_struct *task, struct mcount_ctx *ctx)
+{
+	size_t i, nr_extras = 0;
+	const struct task_sym **extras = NULL;
+	struct task_sym *tsym;
+
+	memset(ctx, 0, sizeof(*ctx));
+
+	tsym = find_task_sym(task, MCOUNT_NAME, &extras, &nr_extras);
+	if (!tsym) {
+		ulp_warning("Not found %s in %d, not compiled with -pg?\n",
+			    MCOUNT_NAME, task->pid);
+		return -ENOENT;
+	}
+
+	ctx->addrs = malloc((nr_extras + 1) * sizeof(*ctx->addrs));
+	if (!ctx->addrs) {
+		free((void *)extras);
+		return -ENOMEM;
+	}
+
+	ctx->addrs[ctx->nr_addrs++] = tsym->addr;
+	for (i = 0; i < nr_extras; i++)
+		ctx->addrs[ctx->nr_addrs++] = extras[i]->addr;
+	free((void *)extras);
+
+	return 0;
+}
+
+static bool is_mcount(struct task_struct *task, struct mcount_ctx *ctx,
+		      unsigned long target, bool indirect)
+{
+	size_t i;
+	unsigned long val;
+	struct vm_area_struct *vma;
+
+	if (indirect) {
+		if (target != ctx->got) {
+			/* GOT slot must be in the same ELF */
+			vma = find_vma(task, target);
+			if (!vma || vma->leader != ctx->leader)
+				return false;
+			if (memcpy_from_task(task, &val, target, sizeof(val)) !=
+			    sizeof(val))
+				return false;
+			ctx->got = target;
+			ctx->got_val = val;
+		}
+		target = ctx->got_val;
+	}
+
+	for (i = 0; i < ctx->nr_addrs; i++) {
+		if (ctx->addrs[i] == target)
+			return true;
+	}
+	return false;
+}
+
+static int ftrace_add_site(struct ftrace_session *fs, unsigned long ip,
+			   const void *code, int len)
+{
+	struct ftrace_site *site, *sites;
+
+	if (!ftrace_nop_insn(len)) {
+		ulp_debug("No NOP for %d bytes call at %lx.\n", len, ip);
+		return 0;
+	}
+
+	/* Double the array when nr_sites is power of 2 */
+	if (!(fs->nr_sites & (fs->nr_sites - 1))) {
+		sites = realloc(fs->sites, MAX(fs->nr_sites * 2, 64UL) *
+				sizeof(*sites));
+		if (!sites)
+			return -ENOMEM;
+		fs->sites = sites;
+	}
+
+	site = &fs->sites[fs->nr_sites++];
+	site->ip = ip;
+	site->len = len;
+	site->enabled = true;
+	memcpy(site->insn, code, len);
+
+	return 0;
+}
+
+/* -mrecord-mcount: the address of every call is in __mcount_loc */
+static int ftrace_load_mcount_loc(struct ftrace_session *fs,
+				  struct mcount_ctx *ctx, GElf_Shdr *loc)
+{
+	int len, err = 0;
+	size_t i, n = loc->sh_size / sizeof(unsigned long);
+	unsigned long *ips, target;
+	unsigned char code[MCOUNT_INSN_MAX];
+	bool indirect;
+	struct task_struct *task = fs->task;
+
+	ips = malloc(n * sizeof(*ips));
+	if (!ips)
+		return -ENOMEM;
+
+	/* Read from memory, it's relocated if PIE */
+	if (memcpy_from_task(task, ips, ctx->leader->vma_elf->load_addr +
+			     loc->sh_addr, n * sizeof(*ips)) !=
+	    n * sizeof(*ips)) {
+		err = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!find_vma(task, ips[i]))
+			continue;
+		if (memcpy_from_task(task, code, ips[i], sizeof(code)) !=
+		    sizeof(code))
+			continue;
+
+		len = ftrace_decode_call(code, sizeof(code), ips[i], &target,
+					 &indirect);
+		if (!len || !is_mcount(task, ctx, target, indirect)) {
+			ulp_debug("%lx is not call of %s.\n", ips[i],
+				  MCOUNT_NAME);
+			continue;
+		}
+
+		err = ftrace_add_site(fs, ips[i], code, len);
+		if (err)
+			break;
+	}
+
+out:
+	free(ips);
+	return err;
+}
+
+/* Without __mcount_loc, scan the front of every function of the ELF */
+static int ftrace_scan_sites(struct ftrace_session *fs, struct mcount_ctx *ctx)
+{
+	int len, err = 0;
+	size_t n, off;
+	unsigned long target;
+	unsigned char code[MCOUNT_SCAN_BYTES + MCOUNT_INSN_MAX];
+	bool indirect;
+	struct task_struct *task = fs->task;
+	struct vm_area_struct *vma;
+	struct task_sym *tsym;
+
+	for (tsym = next_task_addr(task, NULL); tsym && !err;
+	     tsym = next_task_addr(task, tsym)) {
+		if (tsym->vma != ctx->leader || !tsym->size)
+			continue;
+
+		vma = find_vma(task, tsym->addr);
+		if (!vma || !(vma->prot & PROT_EXEC))
+			continue;
+
+		n = MIN(tsym->size, sizeof(code));
+		n = MIN(n, vma->vm_end - tsym->addr);
+		if (memcpy_from_task(task, code, tsym->addr, n) != n)
+			continue;
+
+		for (off = 0; off < MCOUNT_SCAN_BYTES && off < n;
+		     off += MCOUNT_INSN_ALIGN) {
+			len = ftrace_decode_call(code + off, n - off,
+						 tsym->addr + off, &target,
+						 &indirect);
+			if (!len || !is_mcount(task, ctx, target, indirect))
+				continue;
+
+			err = ftrace_add_site(fs, tsym->addr + off, code + off,
+					      len);
+			break;
+		}
+	}
+
+	return err;
+}
+
+static int cmp_site(const void *a, const void *b)
+{
+	const struct ftrace_site *sa = a, *sb = b;
+
+	if (sa->ip == sb->ip)
+		return 0;
+	return sa->ip < sb->ip ? -1 : 1;
+}
+
+/**
+ * Find all calls of mcount in ELFs which call mcount, the addresses are in
+ * __mcount_loc if compiled with -mrecord-mcount, otherwise, scan the front of
+ * every function. All sites are enabled after loading, it's the original
+ * text.
+ */
+int ftrace_load_sites(struct ftrace_session *fs)
+{
+	int err = 0;
+	size_t nr;
+	GElf_Shdr loc;
+	struct mcount_ctx ctx;
+	struct vm_area_struct *vma;
+	struct task_struct *task = fs->task;
+
+	err = mcount_ctx_init(task, &ctx);
+	if (err)
+		return err;
+
+	list_for_each_entry(vma, &task->vma_list, node_list) {
+		if (vma->leader != vma || !vma->is_elf || !vma->vma_elf ||
+		    vma->type == VMA_ULPATCH || vma->type == VMA_VDSO)
+			continue;
+
+		if (elf_read_mcount(vma->name_, MCOUNT_NAME, &loc) <= 0)
+			continue;
+
+		nr = fs->nr_sites;
+		ctx.leader = vma;
+		ctx.got = 0;
+
+		if (loc.sh_size && (loc.sh_flags & SHF_ALLOC))
+			err = ftrace_load_mcount_loc(fs, &ctx, &loc);
+		else
+			err = ftrace_scan_sites(fs, &ctx);
+		if (err)
+			break;
+
+		ulp_debug("%s: %zu call sites of %s%s\n", vma->name_,
+			  fs->nr_sites - nr, MCOUNT_NAME,
+			  loc.sh_size ? " from __mcount_loc" : "");
+	}
+
+	free(ctx.addrs);
+
+	if (err) {
+		free(fs->sites);
+		fs->sites = NULL;
+		fs->nr_sites = 0;
+		return err;
+	}
+
+	qsort(fs->sites, fs->nr_sites, sizeof(*fs->sites), cmp_site);
+	return 0;
+}
+
+/* The first site whose ip >= @addr */
+static size_t ftrace_site_lower_bound(struct ftrace_session *fs,
+				      unsigned long addr)
+{
+	size_t lo = 0, hi = fs->nr_sites, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (fs->sites[mid].ip < addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/**
+ * Enable the call sites in @ranges, and replace all others with NOP, in one
+ * stop-the-world. If @ranges is NULL, enable all, it's the original text.
+ * All instructions are replaced with the same length instruction, thus, it's
+ * safe even if a thread stopped just at the site.
+ *
+ * @return: number of sites enabled, or -errno.
+ */
+int ftrace_select_sites(struct ftrace_session *fs,
+			const struct addr_range *ranges, int nr_ranges)
+{
+	int i, err = 0;
+	size_t s, nr_enabled = 0, nr_changed = 0;
+	bool *want;
+	const char *insn;
+	struct ftrace_site *site;
+	struct task_struct *task = fs->task;
+
+	if (!fs->nr_sites)
+		return 0;
+
+	want = calloc(fs->nr_sites, sizeof(*want));
+	if (!want)
+		return -ENOMEM;
+
+	for (s = 0; !ranges && s < fs->nr_sites; s++)
+		want[s] = true;
+
+	for (i = 0; ranges && i < nr_ranges; i++) {
+		for (s = ftrace_site_lower_bound(fs, ranges[i].start);
+		     s < fs->nr_sites && fs->sites[s].ip < ranges[i].end; s++)
+			want[s] = true;
+	}
+
+	for (s = 0; s < fs->nr_sites; s++) {
+		nr_enabled += want[s];
+		nr_changed += want[s] != fs->sites[s].enabled;
+	}
+
+	/* No need to stop the world */
+	if (!nr_changed)
+		goto out;
+
+	err = task_stop_world(task, ULP_STW_BUDGET_US);
+	if (err) {
+		ulp_error("Stop the world of %d failed.\n", task->pid);
+		goto out;
+	}
+
+	for (s = 0; s < fs->nr_sites; s++) {
+		site = &fs->sites[s];
+		if (want[s] == site->enabled)
+			continue;
+
+		insn = want[s] ? (const char *)site->insn :
+				 ftrace_nop_insn(site->len);
+		if (memcpy_to_task(task, site->ip, (void *)insn, site->len) !=
+		    site->len) {
+			ulp_error("Modify call site %lx failed.\n", site->ip);
+			err = -EFAULT;
+			break;
+		}
+		site->enabled = want[s];
+	}
+
+	task_resume_world(task);
+
+	ulp_debug("%d: %zu call sites changed, %zu enabled\n", task->pid,
+		  nr_changed, nr_enabled);
+
+out:
+	free(want);
+	return err ?: (int)nr_enabled;
+}
+
+/**
+ * Stop tracing, unpatch the ftrace object, and unmap the shared memory from
+ * target task.
+ */
+int ftrace_close(struct ftrace_session *fs)
+{
+	int err = 0;
+	struct task_struct *task = fs->task;
+
+	if (fs->sites) {
+		if (ftrace_select_sites(fs, NULL, 0) < 0)
+			ulp_error("Restore call sites of %d failed.\n",
+				  task->pid);
+		free(fs->sites);
+		fs->sites = NULL;
+		fs->nr_sites = 0;
+	}
+
+	if (fs->target_shm_ptr) {
+		err = ftrace_set_shm(fs, 0);
+		if (err)
+			ulp_error("Stop ftrace of %d failed.\n", task->pid);
+		fs->target_shm_ptr = 0;
+	}
+
+	if (fs->patched) {
+		if (delete_patch(task))
+			err = err ?: -ENOENT;
+		fs->patched = false;
+	}
+
+	/* Children of target task have their own copies */
+	if (fs->target_local && !err) {
+		task_munmap(task, fs->target_local, fs->local_size);
+		fs->target_local = 0;
+	}
+
+	/**
+	 * If the pointer is not cleared, the object may still be running,
+	 * keep the shared memory in target task.
+	 */
+	if (fs->target_shm && !err) {
+		task_delete_mmap_vma_file(task, fs->target_shm,
+					  fs->mmap->size);
+		fs->target_shm = 0;
+	}
+
+	if (fs->mmap) {
+		fmunmap(fs->mmap);
+		fs->mmap = NULL;
+		fs->shm = NULL;
+	}
+
+	if (fs->path) {
+		fremove(fs->path);
+		free(fs->path);
+		fs->path = NULL;
+	}
+
+	return err;
+}
@@ -0,0 +1,312 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#pragma once
+
+/**
+ * This header describes the memory shared by ulftrace and the ftrace object
+ * injected into target process, the ftrace object writes records, ulftrace
+ * reads them in place.
+ *
+ * ulftrace creates a file under ULP_PROC_ROOT_DIR/PID/map_files/, both of
+ * target task and ulftrace map it with MAP_SHARED:
+ *
+ *   +----------------------+ 0
+ *   | struct ulftrace_shm  |
+ *   +----------------------+ funcs_offset
+ *   | func[nr_funcs]       | struct ulftrace_func, function graph only
+ *   +----------------------+ aggs_offset
+ *   | agg[nr_cpus][slots]  | struct ulftrace_agg, aggregation only
+ *   +----------------------+ rings_offset
+ *   | ring[0]              | struct ulftrace_ring and nr_records records
+ *   +----------------------+ rings_offset + ring_size
+ *   | ring[1]              |
+ *   +----------------------+
+ *   | ...                  |
+ *   +----------------------+ rings_offset + ring_size * nr_rings
+ *
+ * Each thread of target task claims a ring with its thread pointer and pid,
+ * it's the only producer of the ring, and ulftrace is the only consumer,
+ * thus, no lock is needed. If the ring is full, the record is dropped and
+ * counted.
+ *
+ * A ring is never released, a new thread may reuse the thread pointer of an
+ * exited one, and its ring, ulftrace clears the tid of the ring when it finds
+ * the thread exited, then the producer gets the tid again. If a process
+ * creates more than nr_rings threads with different thread pointers in one
+ * session, records of the later ones are dropped and counted.
+ *
+ * The mapping is shared with the children fork(2)ed by target task, a child
+ * finds itself a new process by struct ulftrace_proc, and claims new rings.
+ *
+ * In function graph mode (ULFTRACE_MODE_GRAPH), no record is written, the
+ * return address of traced function is hooked to _ftrace_mcount_return(),
+ * the original one is saved in the shadow stack of the thread. The duration
+ * of each call is aggregated into the log2 histogram of the function, and
+ * the slowest calls of each thread are kept in its ring.
+ *
+ * The shadow stacks are private memory of target task, see struct
+ * ulftrace_local, thus, a fork(2)ed child returns to its own copy of the
+ * hooked frames. The child never hooks new calls.
+ *
+ * In aggregation mode (ULFTRACE_MODE_AGGREGATE), no record is written
+ * either, each call increases the counter of the child in the table of
+ * current CPU, ulftrace reads and resets the counters periodically. The
+ * memory of tables is not touched in other modes, thus, it costs nothing.
+ *
+ * No other header files can be included in this source file, this is pure C
+ * code, see meta.h.
+ */
+
+#define ULFTRACE_SHM_MAGIC	0x54464c55	/* "ULFT" */
+#define ULFTRACE_SHM_VERSION	5
+
+#define ULFTRACE_CACHELINE	64
+
+/* Must be power of 2 */
+#define ULFTRACE_MAX_RINGS	256
+#define ULFTRACE_DEF_RINGS	64
+#define ULFTRACE_DEF_RECORDS	(1U << 14)
+#define ULFTRACE_MAX_RECORDS	(1U << 24)
+
+/* Function graph */
+#define ULFTRACE_MAX_DEPTH	128
+/* Must be power of 2 */
+#define ULFTRACE_NR_STACKS	256
+/* Must be power of 2 */
+#define ULFTRACE_NR_FUNCS	1024
+/* Bucket i counts durations in [2^(i-1), 2^i) cycles */
+#define ULFTRACE_HIST_BUCKETS	48
+/* The slowest calls of each thread */
+#define ULFTRACE_NR_SLOW	16
+
+/* Aggregation, both must be power of 2 */
+#define ULFTRACE_MAX_CPUS	1024
+#define ULFTRACE_AGG_SLOTS	2048
+
+enum ulftrace_mode {
+	/* Write a record for each function entry */
+	ULFTRACE_MODE_RECORD,
+	/* Aggregate duration of each call, see struct ulftrace_func */
+	ULFTRACE_MODE_GRAPH,
+	/* Count calls of each function, see struct ulftrace_agg */
+	ULFTRACE_MODE_AGGREGATE,
+};
+
+/**
+ * The ftrace object defines a pointer with this name, ulftrace set it to
+ * the address of struct ulftrace_shm in target task, NULL means tracing is
+ * off.
+ */
+#define ULFTRACE_SHM_SYMBOL	"ulftrace_shm"
+
+/**
+ * The ftrace object defines a pointer with this name, ulftrace set it to
+ * the address of struct ulftrace_local in target task before the shm, and
+ * never clears it, because a fork(2)ed child may still return to hooked
+ * frames after ulftrace exits.
+ */
+#define ULFTRACE_LOCAL_SYMBOL	"ulftrace_local"
+
+/**
+ * Record of each function entry, fixed size.
+ *
+ * @cycles: __ulp_builtin_cycles() when function entry
+ * @child: the address in traced function, right after the mcount call
+ * @parent: return address of traced function, in caller
+ * @args: arguments of traced function, see struct mcount_regs
+ */
+struct ulftrace_record {
+	unsigned long cycles;
+	unsigned long child;
+	unsigned long parent;
+	unsigned long args[6];
+	int tid;
+	unsigned int flags;
+};
+
+/* A hooked call in shadow stack */
+struct ulftrace_frame {
+	/* The original return address, and where it is on the stack */
+	unsigned long parent;
+	unsigned long parent_loc;
+	/* Matched when the call returns, see MCOUNT_FRAME_KEY() */
+	unsigned long key;
+	unsigned long cycles;
+	/* Index of struct ulftrace_func */
+	unsigned long func;
+};
+
+/* One of the slowest calls */
+struct ulftrace_slow {
+	unsigned long cycles;
+	unsigned long duration;
+	unsigned long child;
+	unsigned long parent;
+	int tid;
+	/* Nested depth, 1 is the outermost traced call */
+	unsigned int depth;
+};
+
+struct ulftrace_ring {
+	/* Thread pointer of the producer, 0 if the ring is free */
+	unsigned long owner;
+	/* Process of the producer, the owner is unique in it */
+	int pid;
+	/* 0 if ulftrace finds the thread exited, the producer gets it again */
+	int tid;
+
+	/* Only written by producer */
+	unsigned long head __attribute__((aligned(ULFTRACE_CACHELINE)));
+	/* Producer's copy of tail, reload it only if ring seems full */
+	unsigned long tail_cache;
+	/* Dropped events because ring or shadow stack is full */
+	unsigned long lost;
+	/* Shortest duration in slow[] */
+	unsigned long slow_min;
+
+	/* Only written by consumer */
+	unsigned long tail __attribute__((aligned(ULFTRACE_CACHELINE)));
+
+	/* Odd when producer is writing slow[] */
+	unsigned long slow_seq __attribute__((aligned(ULFTRACE_CACHELINE)));
+	struct ulftrace_slow slow[ULFTRACE_NR_SLOW];
+
+	struct ulftrace_record records[]
+		__attribute__((aligned(ULFTRACE_CACHELINE)));
+};
+
+/* Statistics of a function, all threads update it atomically */
+struct ulftrace_func {
+	/* The child address of mcount, 0 if the slot is free */
+	unsigned long child;
+	unsigned long count;
+	/* Cycles */
+	unsigned long total;
+	unsigned long max;
+	unsigned long max_depth;
+	unsigned long hist[ULFTRACE_HIST_BUCKETS];
+} __attribute__((aligned(ULFTRACE_CACHELINE)));
+
+/* Slot of per-CPU open addressing table */
+struct ulftrace_agg {
+	/* The child address of mcount, 0 if the slot is free, never freed */
+	unsigned long child;
+	/* Calls since last reset, see ftrace_aggregate() */
+	unsigned long count;
+};
+
+struct ulftrace_shm {
+	/* Must be ULFTRACE_SHM_MAGIC and ULFTRACE_SHM_VERSION */
+	unsigned int magic;
+	unsigned int version;
+
+	/* Both are power of 2 */
+	unsigned int nr_rings;
+	unsigned int nr_records;
+
+	/* Bytes of each ring, include records */
+	unsigned long ring_size;
+	unsigned long rings_offset;
+
+	/* See enum ulftrace_mode */
+	unsigned int mode;
+	/* Power of 2 */
+	unsigned int nr_funcs;
+	unsigned long funcs_offset;
+
+	/* Both are power of 2, tables of CPUs >= nr_cpus are shared */
+	unsigned int nr_cpus;
+	unsigned int agg_slots;
+	unsigned long aggs_offset;
+
+	/* Only trace child in [filter_start, filter_end), 0 means all */
+	unsigned long filter_start;
+	unsigned long filter_end;
+
+	/* Dropped records because all rings are owned by other threads */
+	unsigned long lost;
+
+	/* The traced process, fork(2)ed children have other pid */
+	int pid;
+	unsigned int pad;
+} __attribute__((aligned(ULFTRACE_CACHELINE)));
+
+/**
+ * The page is madvise(MADV_WIPEONFORK), a fork(2)ed child reads zero, then
+ * it gets its own pid.
+ */
+struct ulftrace_proc {
+	int pid;
+};
+
+/* Shadow stack of a thread, only the thread itself touches it */
+struct ulftrace_stack {
+	/* Thread pointer of the thread, 0 if the stack is free */
+	unsigned long owner;
+	/**
+	 * Frames in the stack, ulftrace only touches it when the world is
+	 * stopped, see ftrace_close(). Free slots are zero, see graph_entry().
+	 */
+	unsigned long depth;
+	struct ulftrace_frame frames[ULFTRACE_MAX_DEPTH];
+};
+
+/**
+ * Private anonymous memory mapped by ulftrace into target task, it's copied
+ * into fork(2)ed children, except the page of proc:
+ *
+ *   +------------------------+ 0
+ *   | struct ulftrace_local  |
+ *   +------------------------+ page aligned
+ *   | struct ulftrace_proc   | MADV_WIPEONFORK
+ *   +------------------------+
+ */
+struct ulftrace_local {
+	struct ulftrace_proc *proc;
+	struct ulftrace_stack stacks[ULFTRACE_NR_STACKS];
+};
+
+static inline unsigned long ulftrace_ring_size(unsigned int nr_records)
+{
+	return sizeof(struct ulftrace_ring) +
+		nr_records * sizeof(struct ulftrace_record);
+}
+
+static inline unsigned long ulftrace_shm_size(unsigned int nr_rings,
+					      unsigned int nr_records,
+					      unsigned int nr_cpus)
+{
+	return sizeof(struct ulftrace_shm) +
+		ULFTRACE_NR_FUNCS * sizeof(struct ulftrace_func) +
+		nr_cpus * ULFTRACE_AGG_SLOTS * sizeof(struct ulftrace_agg) +
+		nr_rings * ulftrace_ring_size(nr_records);
+}
+
+static inline struct ulftrace_ring *ulftrace_ring(struct ulftrace_shm *shm,
+						  unsigned int idx)
+{
+	return (struct ulftrace_ring *)((char *)shm + shm->rings_offset +
+					idx * shm->ring_size);
+}
+
+static inline struct ulftrace_func *ulftrace_func(struct ulftrace_shm *shm,
+						  unsigned long idx)
+{
+	return (struct ulftrace_func *)((char *)shm + shm->funcs_offset) + idx;
+}
+
+/* Bucket of histogram of @cycles */
+static inline unsigned int ulftrace_hist_bucket(unsigned long cycles)
+{
+	unsigned int b = cycles ? 64 - __builtin_clzl(cycles) : 0;
+
+	return b < ULFTRACE_HIST_BUCKETS ? b : ULFTRACE_HIST_BUCKETS - 1;
+}
+
+/* The table of @cpu */
+static inline struct ulftrace_agg *ulftrace_agg(struct ulftrace_shm *shm,
+						unsigned int cpu)
+{
+	return (struct ulftrace_agg *)((char *)shm + shm->aggs_offset) +
+		(unsigned long)cpu * shm->agg_slots;
+}
@@ -19,7 +19,7 @@
  * Use to check ulp file is support version or not. If any changes occur to the
  * metadata structure, we should increase this version number.
  */
-#define ULPATCH_FILE_VERSION	3
+#define ULPATCH_FILE_VERSION	4
 
 #define SEC_ULPATCH_MAGIC	".ULPATCH"
 #define SEC_ULPATCH_STRTAB	".ulpatch.strtab"
@@ -37,8 +37,12 @@
  * @dst_func: the destination function in target task
  * @author: who wrote this patch code
  *
- * FIXME: We should split author to a single macro like ULPATCH_AUTHOR(), maybe
- * one ulp file has multi ULPATCH_INFO()
+ * One ulp file could have multi ULPATCH_INFO(), each one appends a record to
+ * SEC_ULPATCH_STRTAB and an entry to SEC_ULPATCH_INFO in the same order, the
+ * number of entries is size of SEC_ULPATCH_INFO / sizeof(ulpatch_info). All
+ * entries are applied and removed together.
+ *
+ * FIXME: We should split author to a single macro like ULPATCH_AUTHOR()
  */
 #define ULPATCH_INFO(src_func, dst_func, author) \
 __asm__ (								\
@@ -78,7 +82,7 @@ struct ulpatch_strtab {
 };
 
 /**
- * SEC_ULPATCH_INFO section
+ * SEC_ULPATCH_INFO section, an array of entries
  */
 struct ulpatch_info {
 #define ULP_ID_NONE	0
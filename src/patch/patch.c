@@ -128,10 +128,17 @@ void release_load_info(struct load_info *info)
 		info->str_build_id = NULL;
 	}
 
+	if (info->ulp_strtab) {
+		free(info->ulp_strtab);
+		info->ulp_strtab = NULL;
+	}
+
 	if (info->ulp_name) {
 		free(info->ulp_name);
 		info->ulp_name = NULL;
 	}
+
+	strhash_destroy(&info->symtab_names);
 }
 
 /* Make ulp file name. */
@@ -173,23 +180,20 @@ static int __chk_load_info_len(struct load_info *info)
 	return 0;
 }
 
-/* see linux:kernel/module.c */
-int alloc_patch_file(const char *obj_from, const char *ulp_file,
-		     struct load_info *info)
+/**
+ * Create @ulp_file, and copy the patch from @mem if not NULL, otherwise, from
+ * @obj_from file.
+ */
+static int __alloc_patch_file(const char *obj_from, const void *mem,
+			      size_t len, const char *ulp_file,
+			      struct load_info *info)
 {
 	int err = 0;
 
-	/* source object file must exist. */
-	if (!fexist(obj_from)) {
-		ulp_error("%s not exist, command 'make install' is needed.\n",
-			  obj_from);
-		return -EEXIST;
-	}
-
 	info->ulp_name = strdup(obj_from);
 	info->patch.path = strdup(ulp_file);
 
-	info->len = fsize(obj_from);
+	info->len = len;
 	if (info->len < sizeof(*(info->hdr))) {
 		ulp_error("%s truncated.\n", obj_from);
 		err = -ENOEXEC;
@@ -204,8 +208,11 @@ int alloc_patch_file(const char *obj_from, const char *ulp_file,
 		goto out;
 	}
 
-	/* copy from file */
-	if (fmemcpy(info->patch.mmap->mem, info->len, obj_from) != info->len) {
+	/* copy from memory, or from file */
+	if (mem)
+		memcpy(info->patch.mmap->mem, mem, info->len);
+	else if (fmemcpy(info->patch.mmap->mem, info->len, obj_from) !=
+		 info->len) {
 		ulp_error("copy chunk failed.\n");
 		err = -EFAULT;
 		goto out;
@@ -230,6 +237,21 @@ free_out:
 	return err;
 }
 
+/* see linux:kernel/module.c */
+int alloc_patch_file(const char *obj_from, const char *ulp_file,
+		     struct load_info *info)
+{
+	/* source object file must exist. */
+	if (!fexist(obj_from)) {
+		ulp_error("%s not exist, command 'make install' is needed.\n",
+			  obj_from);
+		return -EEXIST;
+	}
+
+	return __alloc_patch_file(obj_from, NULL, fsize(obj_from), ulp_file,
+				  info);
+}
+
 /**
  * Get load_info from ULPatch vma
  */
@@ -254,7 +276,9 @@ int load_ulp_info_from_vma(struct vm_area_struct *vma, struct load_info *info)
 	if (ret)
 		return ret;
 
-	setup_load_info(info);
+	ret = setup_load_info(info);
+	if (ret)
+		return ret;
 
 	GElf_Shdr *symsec = &info->sechdrs[info->index.sym];
 	GElf_Sym *sym = (void *)info->hdr + symsec->sh_addr - info->target_hdr;
@@ -265,7 +289,7 @@ int load_ulp_info_from_vma(struct vm_area_struct *vma, struct load_info *info)
 		/* skip undefined symbols */
 		if (is_undef_symbol(&sym[i])) {
 			ulp_debug("%s undef symbol: %s %lx\n",
-				  basename(vma->name_), name, sym[i].st_value);
+				  basename((char *)vma->name_), name, sym[i].st_value);
 			/* Skip undefined symbol */
 			continue;
 		}
@@ -274,12 +298,18 @@ int load_ulp_info_from_vma(struct vm_area_struct *vma, struct load_info *info)
 		 * Record ULP symbols
 		 */
 		struct task_sym *tsym;
-		tsym = alloc_task_sym(name, sym[i].st_value, vma);
+		tsym = alloc_task_sym(name, sym[i].st_value,
+				      sym[i].st_size, vma);
+		if (!tsym)
+			return -ENOMEM;
 		link_task_sym(task, tsym);
 	}
 
+	/* Move strtab to ulp, info points to ulp->elf_mem */
+	ulp->nr_info = info->nr_ulp;
+	ulp->info = info->ulp_info;
 	ulp->strtab = info->ulp_strtab;
-	memcpy(&ulp->info, info->ulp_info, sizeof(struct ulpatch_info));
+	info->ulp_strtab = NULL;
 	ulp->str_build_id = strdup(info->str_build_id);
 
 	ulp_debug("%s build id %s\n", vma->name_, ulp->str_build_id);
@@ -287,30 +317,132 @@ int load_ulp_info_from_vma(struct vm_area_struct *vma, struct load_info *info)
 	return 0;
 }
 
-static int create_mmap_vma_file(struct task_struct *task,
-				struct load_info *info)
+/**
+ * Create a shared mapping of @path in target task, the file is opened,
+ * truncated to @map_len, mapped and closed in one ptrace stop, thus, both of
+ * target task and us could access the memory of the file.
+ *
+ * @hint: the address hint of mmap(2), 0 means anywhere.
+ * @addr: return the mapped address in target task.
+ */
+int task_create_mmap_vma_file(struct task_struct *task, const char *path,
+			      size_t map_len, unsigned long hint,
+			      unsigned long *addr)
 {
 	int ret = 0;
-	ssize_t map_len = info->len;
-	unsigned long map_v, addr;
-	int map_fd;
+	unsigned long map_v;
 	int prot;
+	int op_open, op_ftruncate, op_mmap, op_close;
+	struct task_syscall_batch batch;
+
+	prot = PROT_READ | PROT_WRITE | PROT_EXEC;
+
+	/**
+	 * open, ftruncate, mmap and close in one ptrace stop, the fd that
+	 * open(2) returned is used by later syscalls.
+	 */
+	task_syscall_batch_init(&batch);
+	op_open = task_syscall_batch_open(&batch, path, O_RDWR, 0644);
+	op_ftruncate = task_syscall_batch_add(&batch, __NR_ftruncate, 0,
+					      map_len, 0, 0, 0, 0);
+	op_mmap = task_syscall_batch_add(&batch, __NR_mmap, hint, map_len,
+					 prot, MAP_SHARED, 0, 0);
+	op_close = task_syscall_batch_add(&batch, __NR_close, 0, 0, 0, 0, 0,
+					  0);
+	/* Nothing runs in target task yet, no fd to close */
+	if (op_open < 0 || op_ftruncate < 0 || op_mmap < 0 || op_close < 0 ||
+	    task_syscall_batch_ref(&batch, op_ftruncate, 0, op_open) ||
+	    task_syscall_batch_ref(&batch, op_mmap, 4, op_open) ||
+	    task_syscall_batch_ref(&batch, op_close, 0, op_open)) {
+		ulp_error("Build remote syscall batch failed.\n");
+		task_syscall_batch_free(&batch);
+		return -EINVAL;
+	}
 
 	/* attach target task */
 	task_attach(task->pid);
 
-	map_fd = task_open(task, (char *)info->patch.path, O_RDWR, 0644);
-	if (map_fd <= 0) {
-		ulp_error("remote open failed.\n");
-		return -1;
+	ret = task_syscall_batch(task, &batch);
+	if (batch.nr_done <= op_mmap) {
+		if (batch.nr_done <= op_open)
+			ulp_error("remote open failed.\n");
+		else if (batch.nr_done <= op_ftruncate)
+			ulp_error("remote ftruncate failed.\n");
+		else
+			ulp_error("remote mmap failed.\n");
+
+		/* The stub stop before close(2), close the fd */
+		if (batch.nr_done > op_open)
+			task_close(task, batch.ops[op_open].ret);
+
+		ret = batch.nr_done <= op_open ? -1 : -EFAULT;
+		goto detach;
 	}
+	if (ret)
+		ulp_warning("remote close failed.\n");
+	ret = 0;
 
-	ret = task_ftruncate(task, map_fd, map_len);
-	if (ret != 0) {
-		ulp_error("remote ftruncate failed.\n");
-		ret = -EFAULT;
-		goto close_ret;
-	}
+	map_v = batch.ops[op_mmap].ret;
+	*addr = map_v;
+
+	refresh_task_vmas(task, map_v, map_v + map_len);
+	ulp_debug("Done to create vma of %s, addr 0x%lx\n", path, map_v);
+
+detach:
+	task_syscall_batch_free(&batch);
+	task_detach(task->pid);
+	return ret;
+}
+
+void task_delete_mmap_vma_file(struct task_struct *task, unsigned long addr,
+			       size_t len)
+{
+	task_attach(task->pid);
+	task_munmap(task, addr, len);
+	refresh_task_vmas(task, addr, addr + len);
+	task_detach(task->pid);
+}
+
+/**
+ * Reach of the PC relative relocations from patch to target, rel32 of x86_64
+ * and CALL26 of aarch64.
+ */
+#if defined(__x86_64__)
+# define PATCH_NEAR_RANGE	(1UL << 31)
+#elif defined(__aarch64__)
+# define PATCH_NEAR_RANGE	(1UL << 27)
+#endif
+
+/**
+ * The patch is placed near the first target function, thus, the PC relative
+ * relocations of the patch could reach it, and the target module, where the
+ * other symbols the patch calls most likely live.
+ */
+static unsigned long patch_near_area(struct task_struct *task,
+				     struct load_info *info)
+{
+	struct task_sym *tsym;
+	unsigned long addr;
+
+	tsym = find_task_sym(task, info->ulp_strtab[0].dst_func, NULL, NULL);
+	if (!tsym || info->len >= PATCH_NEAR_RANGE)
+		return 0;
+
+	/* The whole patch must be in range, not only the start */
+	addr = find_vma_gap_near(task, info->len, tsym->addr,
+				 PATCH_NEAR_RANGE - info->len);
+	ulp_debug("Patch area near %s %#lx: %#lx\n", tsym->name, tsym->addr,
+		  addr);
+	return addr;
+}
+
+/* The info must be set up already, see setup_load_info() */
+static int create_mmap_vma_file(struct task_struct *task,
+				struct load_info *info)
+{
+	unsigned long addr;
+
+	addr = patch_near_area(task, info);
 
 	/**
 	 * TODO: This patch can't map to the area that address bigger than
@@ -322,40 +454,25 @@ static int create_mmap_vma_file(struct task_struct *task,
 	 *    $ cat /proc/$(pidof hello)/maps
 	 *    5583490000-5583491000 r-xp 00000000 b3:02 1061933 /hello
 	 */
-	addr = find_vma_span_area(task, map_len, MIN_ULP_START_VMA_ADDR);
-	if ((addr & 0x00000000FFFFFFFFUL) != addr) {
-		ulp_warning("Not found 4 bytes length address span area in memory space.\n"\
-			"please: cat /proc/%d/maps\n", task->pid);
-	}
-
-	prot = PROT_READ | PROT_WRITE | PROT_EXEC;
-	map_v = task_mmap(task, addr, map_len, prot, MAP_SHARED, map_fd, 0);
-	if (!map_v) {
-		ulp_error("remote mmap failed.\n");
-		ret = -EFAULT;
-		goto close_ret;
+	if (!addr) {
+		addr = find_vma_span_area(task, info->len,
+					  MIN_ULP_START_VMA_ADDR);
+		if ((addr & 0x00000000FFFFFFFFUL) != addr) {
+			ulp_warning("Not found 4 bytes length address span area in memory space.\n"\
+				"please: cat /proc/%d/maps\n", task->pid);
+		}
 	}
 
 	/* save the target mmap address */
-	info->target_hdr = map_v;
-
-	update_task_vmas_ulp(task);
-	ulp_debug("Done to create patch vma, addr 0x%lx\n", map_v);
-
-close_ret:
-	task_close(task, map_fd);
-	task_detach(task->pid);
-	return ret;
+	return task_create_mmap_vma_file(task, info->patch.path, info->len,
+					 addr, &info->target_hdr);
 }
 
 static void delete_mmap_vma_file(struct task_struct *task,
 				 struct load_info *info)
 {
 	ulp_warning("munmap ulpatch.\n");
-	task_attach(task->pid);
-	task_munmap(task, info->target_hdr, info->len);
-	update_task_vmas_ulp(task);
-	task_detach(task->pid);
+	task_delete_mmap_vma_file(task, info->target_hdr, info->len);
 }
 
 static unsigned int find_sec(const struct load_info *info, const char *name)
@@ -372,27 +489,36 @@ static unsigned int find_sec(const struct load_info *info, const char *name)
 	return 0;
 }
 
-static int parse_ulpatch_strtab(struct ulpatch_strtab *s, const char *strtab)
+/**
+ * Parse one record of SEC_ULPATCH_STRTAB, see ULPATCH_INFO().
+ *
+ * @return: length of the record, or negative errno.
+ */
+static int parse_ulpatch_strtab(struct ulpatch_strtab *s, const char *strtab,
+				size_t size)
 {
-	const char *p = strtab;
+	int i;
+	const char *p = strtab, *end = strtab + size, *nul;
+	const char **strs[] = {
+		&s->magic, &s->src_func, &s->dst_func, &s->author,
+	};
 
-	s->magic = p;
+	for (i = 0; i < ARRAY_SIZE(strs); i++) {
+		nul = memchr(p, '\0', end - p);
+		if (!nul) {
+			ulp_error("Truncated %s.\n", SEC_ULPATCH_STRTAB);
+			return -ENOENT;
+		}
+		*strs[i] = p;
+		p = nul + 1;
+	}
 
 	if (strcmp(s->magic, SEC_ULPATCH_MAGIC)) {
 		ulp_error("No magic %s found.\n", SEC_ULPATCH_MAGIC);
 		return -ENOENT;
 	}
 
-	while (*(p++));
-	s->src_func = p;
-
-	while (*(p++));
-	s->dst_func = p;
-
-	while (*(p++));
-	s->author = p;
-
-	return 0;
+	return p - strtab;
 }
 
 /**
@@ -409,7 +535,7 @@ int setup_load_info(struct load_info *info)
 	GElf_Shdr *shdr;
 	GElf_Nhdr *nhdr;
 	void *bid;
-	size_t strlen_bid;
+	size_t strlen_bid, off, size;
 
 	info->sechdrs = (void *)info->hdr + info->hdr->e_shoff;
 
@@ -423,14 +549,24 @@ int setup_load_info(struct load_info *info)
 		return -EEXIST;
 	}
 
-	info->ulp_info = (void *)info->hdr
-		+ info->sechdrs[info->index.info].sh_offset;
+	shdr = &info->sechdrs[info->index.info];
+	if (!shdr->sh_size || shdr->sh_size % sizeof(struct ulpatch_info)) {
+		ulp_error("Bad %s section size %ld.\n", SEC_ULPATCH_INFO,
+			  shdr->sh_size);
+		return -EINVAL;
+	}
+
+	info->nr_ulp = shdr->sh_size / sizeof(struct ulpatch_info);
+	info->ulp_info = (void *)info->hdr + shdr->sh_offset;
 
 	/* Check ULP file version, must match to ulpatch software version */
-	if (info->ulp_info->version != ULPATCH_FILE_VERSION) {
-		ulp_error("ULPatch version (%d) != %d\n",
-			  info->ulp_info->version, ULPATCH_FILE_VERSION);
-		return -EINVAL;
+	for (i = 0; i < info->nr_ulp; i++) {
+		if (info->ulp_info[i].version != ULPATCH_FILE_VERSION) {
+			ulp_error("ULPatch version (%d) != %d\n",
+				  info->ulp_info[i].version,
+				  ULPATCH_FILE_VERSION);
+			return -EINVAL;
+		}
 	}
 
 	/* found ".ulpatch.strtab" */
@@ -463,6 +599,7 @@ int setup_load_info(struct load_info *info)
 	case NT_GNU_BUILD_ID:
 		bid = (void *)nhdr + sizeof(*nhdr) + nhdr->n_namesz;
 		strlen_bid = nhdr->n_descsz * 2 + 1;
+		free(info->str_build_id);
 		info->str_build_id = malloc(strlen_bid);
 		elf_strbuildid(bid, nhdr->n_descsz, info->str_build_id,
 			       strlen_bid);
@@ -474,9 +611,28 @@ int setup_load_info(struct load_info *info)
 		break;
 	}
 
-	err = parse_ulpatch_strtab(&info->ulp_strtab, ulp_strtab);
-	if (err) {
-		ulp_error("Failed parse ulpatch_strtab.\n");
+	/* Each ULPATCH_INFO() has a record in strtab, in the same order */
+	free(info->ulp_strtab);
+	info->ulp_strtab = calloc(info->nr_ulp, sizeof(struct ulpatch_strtab));
+	if (!info->ulp_strtab)
+		return -ENOMEM;
+
+	off = 0;
+	size = info->sechdrs[info->index.ulp_strtab].sh_size;
+	for (i = 0; i < info->nr_ulp; i++) {
+		err = parse_ulpatch_strtab(&info->ulp_strtab[i],
+					   ulp_strtab + off, size - off);
+		if (err < 0) {
+			ulp_error("Failed parse ulpatch_strtab #%d.\n", i);
+			return -ENOENT;
+		}
+		off += err;
+	}
+	err = 0;
+
+	if (off != size) {
+		ulp_error("%s has more records than %d %s entries.\n",
+			  SEC_ULPATCH_STRTAB, info->nr_ulp, SEC_ULPATCH_INFO);
 		return -ENOENT;
 	}
 
@@ -742,88 +898,182 @@ static int post_relocation(const struct load_info *info)
 	return 0;
 }
 
+/**
+ * Find symbol in the patch's own symtab, the name index is built at the first
+ * call. If names are duplicated, the last one wins. If the index can't be
+ * built, scan the symtab instead.
+ */
+static GElf_Sym *find_patch_sym(struct load_info *info, const char *name)
+{
+	GElf_Shdr *symsec = &info->sechdrs[info->index.sym];
+	GElf_Sym *syms = (void *)info->hdr + symsec->sh_offset;
+	unsigned int i, nr = symsec->sh_size / sizeof(GElf_Sym);
+	struct strhash_slot *slot;
+
+	if (!info->symtab_names.nr) {
+		for (i = 0; i < nr; i++) {
+			const char *s = info->strtab + syms[i].st_name;
+
+			slot = strhash_add(&info->symtab_names, s, gnu_hash(s),
+					   i);
+			if (!slot) {
+				ulp_warning("Index patch symtab failed.\n");
+				strhash_destroy(&info->symtab_names);
+				goto scan;
+			}
+			slot->value = i;
+		}
+	}
+
+	slot = strhash_find(&info->symtab_names, name, gnu_hash(name));
+	return slot ? &syms[slot->value] : NULL;
+
+scan:
+	/* The last one wins, the same as the index */
+	for (i = nr; i-- > 0;) {
+		if (!strcmp(info->strtab + syms[i].st_name, name))
+			return &syms[i];
+	}
+	return NULL;
+}
+
 static int solve_patch_symbols(struct load_info *info)
 {
-	int i;
+	unsigned int i, j;
 	struct task_struct *task = info->target_task;
 	struct task_sym *tsym;
+	struct ulpatch_info *inf;
 	const char *dst_func, *src_func;
 	GElf_Sym *sym_src_func = NULL;
+	const size_t insn_sz = sizeof(struct jmp_table_entry);
+
+	for (i = 0; i < info->nr_ulp; i++) {
+		inf = &info->ulp_info[i];
+		dst_func = info->ulp_strtab[i].dst_func;
+		src_func = info->ulp_strtab[i].src_func;
+
+		tsym = find_task_sym(task, dst_func, NULL, NULL);
+		if (!tsym) {
+			ulp_error("Couldn't found %s in target process, maybe %s is "
+				  "stripped, or you could load symbol-file.\n",
+				  dst_func, task->exe);
+			return -ENOENT;
+		}
 
-	dst_func = info->ulp_strtab.dst_func;
-	src_func = info->ulp_strtab.src_func;
+		sym_src_func = find_patch_sym(info, src_func);
+		if (!sym_src_func) {
+			ulp_error("Couldn't found %s in %s.\n", src_func,
+				  info->ulp_name);
+			return -ENOENT;
+		}
 
-	tsym = find_task_sym(task, dst_func, NULL, NULL);
-	if (!tsym) {
-		ulp_error("Couldn't found %s in target process, maybe %s is "
-			  "stripped, or you could load symbol-file.\n",
-			  dst_func, task->exe);
-		return -ENOENT;
+		inf->target_func_addr = tsym->addr;
+		inf->patch_func_addr = sym_src_func->st_value;
+		/* Replace from start of target function */
+		inf->virtual_addr = inf->target_func_addr;
+
+		ulp_debug("Found %s symbol address %#016lx.\n", dst_func,
+			  inf->target_func_addr);
+		ulp_debug("Found %s symbol address %#016lx.\n", src_func,
+			  inf->patch_func_addr);
+
+		/* The jmp table entries must not overwrite each other */
+		for (j = 0; j < i; j++) {
+			unsigned long a = info->ulp_info[j].virtual_addr;
+
+			if (inf->virtual_addr < a + insn_sz &&
+			    a < inf->virtual_addr + insn_sz) {
+				ulp_error("%s and %s overlap in target process.\n",
+					  dst_func, info->ulp_strtab[j].dst_func);
+				return -EINVAL;
+			}
+		}
 	}
 
-	GElf_Shdr *symsec = (GElf_Shdr *)&info->sechdrs[info->index.sym];
-	GElf_Sym *syms = (GElf_Sym *)((void *)info->hdr + symsec->sh_offset);
+	/* All entries are one patch, share the same ID */
+	task->max_ulp_id++;
+	for (i = 0; i < info->nr_ulp; i++) {
+		info->ulp_info[i].ulp_id = task->max_ulp_id;
+		info->ulp_info[i].time = secs();
+	}
 
-	for (i = 0; i < symsec->sh_size / sizeof(GElf_Sym); i++) {
-		GElf_Sym *sym = &syms[i];
-		char *name = info->strtab + sym->st_name;
-		ulp_debug("patch: %s, %d\n", name, sym->st_name);
+	return 0;
+}
 
-		if (!strcmp(src_func, name))
-			sym_src_func = sym;
-	}
+/**
+ * Write the jmp table entry of all ulp entries, the world of task must be
+ * stopped. If any one failed, restore the written ones, thus, all or none
+ * of entries are patched.
+ */
+static int write_jmp_entries(struct task_struct *task,
+			     const struct load_info *info)
+{
+	int n;
+	unsigned int i;
+	struct ulpatch_info *inf;
+	struct jmp_table_entry jmp_entry;
+	const size_t insn_sz = sizeof(struct jmp_table_entry);
 
-	if (!sym_src_func) {
-		ulp_error("Couldn't found %s in %s.\n", src_func,
-			  info->ulp_name);
-		return -ENOENT;
-	}
+	jmp_entry.jmp = arch_jmp_table_jmp();
 
-	info->ulp_info->ulp_id = ++task->max_ulp_id;
-	info->ulp_info->target_func_addr = tsym->addr;
-	info->ulp_info->patch_func_addr = sym_src_func->st_value;
-	/* Replace from start of target function */
-	info->ulp_info->virtual_addr = info->ulp_info->target_func_addr;
+	for (i = 0; i < info->nr_ulp; i++) {
+		inf = &info->ulp_info[i];
+		jmp_entry.addr = inf->patch_func_addr;
 
-	info->ulp_info->time = secs();
+		n = memcpy_to_task(task, inf->virtual_addr, (void *)&jmp_entry,
+				   insn_sz);
+		if (n == -1 || n < insn_sz)
+			goto restore;
+	}
 
-	ulp_debug("Found %s symbol address %#016lx.\n", dst_func,
-		  info->ulp_info->target_func_addr);
-	ulp_debug("Found %s symbol address %#016lx.\n", src_func,
-		  info->ulp_info->patch_func_addr);
 	return 0;
+
+restore:
+	ulp_error("Write jmp table of %s failed.\n",
+		  info->ulp_strtab[i].dst_func);
+	while (i--) {
+		inf = &info->ulp_info[i];
+		memcpy_to_task(task, inf->virtual_addr, (void *)inf->orig_code,
+			       insn_sz);
+	}
+	return -ENOEXEC;
 }
 
 static int kick_target_process(const struct load_info *info)
 {
 	int n;
 	int err = 0;
+	unsigned int i;
 	struct task_struct *task = info->target_task;
 	unsigned long target_hdr = info->target_hdr;
-	size_t insn_sz = 0;
-	const char *new_insn = NULL;
-	struct jmp_table_entry jmp_entry;
+	struct ulpatch_info *inf;
+	struct addr_range *ranges;
+	const size_t insn_sz = sizeof(struct jmp_table_entry);
 
-	jmp_entry.jmp = arch_jmp_table_jmp();
-	jmp_entry.addr = info->ulp_info->patch_func_addr;
-	new_insn = (void *)&jmp_entry;
-	insn_sz = sizeof(struct jmp_table_entry);
-
-	n = memcpy_from_task(task, info->ulp_info->orig_code,
-			     info->ulp_info->virtual_addr, insn_sz);
-	if (n == -1 || n < insn_sz) {
-		ulp_error("Backup original instructions failed.\n");
-		err = -ENOEXEC;
-		goto done;
-	}
+	ranges = malloc(sizeof(struct addr_range) * info->nr_ulp);
+	if (!ranges)
+		return -ENOMEM;
+
+	for (i = 0; i < info->nr_ulp; i++) {
+		inf = &info->ulp_info[i];
+
+		n = memcpy_from_task(task, inf->orig_code, inf->virtual_addr,
+				     insn_sz);
+		if (n == -1 || n < insn_sz) {
+			ulp_error("Backup original instructions failed.\n");
+			err = -ENOEXEC;
+			goto done;
+		}
 
-	ulp_debug("Copy ulpatch to target process. Jmp table: from %s(%lx) jump to %s(%lx)\n",
-		info->ulp_strtab.dst_func,
-		info->ulp_info->target_func_addr,
-		info->ulp_strtab.src_func,
-		info->ulp_info->patch_func_addr);
+		ranges[i].start = inf->virtual_addr;
+		ranges[i].end = inf->virtual_addr + insn_sz;
 
-	/* copy patch to target address space */
+		ulp_debug("Jmp table: from %s(%lx) jump to %s(%lx)\n",
+			  info->ulp_strtab[i].dst_func, inf->target_func_addr,
+			  info->ulp_strtab[i].src_func, inf->patch_func_addr);
+	}
+
+	/* copy patch to target address space, with all backups */
 	n = memcpy_to_task(task, target_hdr, info->hdr, info->len);
 	if (n == -1 || n < info->len) {
 		ulp_error("failed kick target process.\n");
@@ -831,37 +1081,43 @@ static int kick_target_process(const struct load_info *info)
 		goto done;
 	}
 
-	task_attach(task->pid);
-
 	/**
-	 * FIXME: Make sure safety.
+	 * Stop all threads, not only the thread group leader, and make sure
+	 * no thread is executing the instructions we are overwriting, or will
+	 * return into them. All entries are patched in one stop.
 	 */
-
-	n = memcpy_to_task(task, info->ulp_info->virtual_addr,
-			   (void *)new_insn, insn_sz);
-	if (n == -1 || n < insn_sz) {
-		ulp_error("failed kick target process.\n");
-		err = -ENOEXEC;
+	err = task_stop_world_safe_ranges(task, ranges, info->nr_ulp,
+					  ULP_STW_BUDGET_US,
+					  ULP_SAFE_POINT_DEADLINE_US);
+	if (err) {
+		ulp_error("Stop the world of %d at safe point failed.\n",
+			  task->pid);
+		goto done;
 	}
 
-	task_detach(task->pid);
+	err = write_jmp_entries(task, info);
+
+	task_resume_world(task);
+
+	if (task->stw_max_pause_us > ULP_STW_BUDGET_US)
+		ulp_warning("Pause %d %ldus, over budget %dus.\n", task->pid,
+			    task->stw_max_pause_us, ULP_STW_BUDGET_US);
 
 done:
+	free(ranges);
 	if (err)
 		ulp_error("Kick target process failed.\n");
 	return err;
 }
 
+/* The info must be set up already, see setup_load_info() */
 static int load_patch(struct load_info *info)
 {
 	long err = 0;
 	struct vma_ulp *ulp, *tmpulp;
+	struct vm_area_struct *vma;
 	struct task_struct *task = info->target_task;
 
-	err = setup_load_info(info);
-	if (err)
-		goto free_copy;
-
 	/**
 	 * Check the Build ID exist or not.
 	 */
@@ -903,13 +1159,157 @@ static int load_patch(struct load_info *info)
 	if (err < 0)
 		goto free_copy;
 
+	vma = find_vma(task, info->target_hdr);
+	if (vma && vma->ulp)
+		vma_reload_ulp(vma);
+
 free_copy:
 	release_load_info(info);
 	return err;
 }
 
+/**
+ * Read and check the patch file once, the relocation independent part is
+ * shared by all tasks that init_patch_prepared() patches.
+ */
+int prepare_patch(const char *obj_file, struct prepared_patch *pp)
+{
+	int err;
+	struct load_info *info = &pp->info;
+
+	memset(pp, 0, sizeof(*pp));
+
+	if (!fexist(obj_file)) {
+		ulp_error("%s not exist.\n", obj_file);
+		return -EEXIST;
+	}
+
+	pp->obj_file = strdup(obj_file);
+	pp->len = fsize(obj_file);
+	if (pp->len < sizeof(GElf_Ehdr)) {
+		ulp_error("%s truncated.\n", obj_file);
+		err = -ENOEXEC;
+		goto failed;
+	}
+
+	pp->mem = malloc(pp->len);
+	if (!pp->obj_file || !pp->mem) {
+		err = -ENOMEM;
+		goto failed;
+	}
+
+	if (fmemcpy(pp->mem, pp->len, obj_file) != pp->len) {
+		ulp_error("Read %s failed.\n", obj_file);
+		err = -EFAULT;
+		goto failed;
+	}
+
+	info->hdr = pp->mem;
+	info->len = pp->len;
+	if (!ehdr_magic_ok(info->hdr)) {
+		ulp_error("Invalid ELF format: %s\n", obj_file);
+		err = -ENOEXEC;
+		goto failed;
+	}
+
+	err = __chk_load_info_len(info);
+	if (err)
+		goto failed;
+
+	err = setup_load_info(info);
+	if (err)
+		goto failed;
+
+	return 0;
+
+failed:
+	release_prepared_patch(pp);
+	return err;
+}
+
+void release_prepared_patch(struct prepared_patch *pp)
+{
+	release_load_info(&pp->info);
+	free(pp->obj_file);
+	free(pp->mem);
+	memset(pp, 0, sizeof(*pp));
+}
+
+/* Rebase a pointer into pp->mem to the same place of task's copy */
+#define REBASE_PREPARED(info, pp, ptr)	\
+	((void *)(info)->hdr + ((void *)(ptr) - (pp)->mem))
+
+/**
+ * Set up the task's copy of patch from the prepared one, instead of parse it
+ * again, the copy is the same bytes of pp->mem, only pointers are rebased.
+ */
+static int setup_load_info_prepared(struct load_info *info,
+				    const struct prepared_patch *pp)
+{
+	unsigned int i;
+	const struct load_info *from = &pp->info;
+
+	info->sechdrs = REBASE_PREPARED(info, pp, from->sechdrs);
+	info->secstrings = REBASE_PREPARED(info, pp, from->secstrings);
+	info->strtab = REBASE_PREPARED(info, pp, from->strtab);
+	info->ulp_info = REBASE_PREPARED(info, pp, from->ulp_info);
+	info->nr_ulp = from->nr_ulp;
+	info->index = from->index;
+	info->name = from->name;
+
+	info->str_build_id = strdup(from->str_build_id);
+	info->ulp_strtab = calloc(info->nr_ulp, sizeof(struct ulpatch_strtab));
+	if (!info->str_build_id || !info->ulp_strtab)
+		return -ENOMEM;
+
+	for (i = 0; i < info->nr_ulp; i++) {
+		struct ulpatch_strtab *s = &info->ulp_strtab[i];
+		const struct ulpatch_strtab *f = &from->ulp_strtab[i];
+
+		s->magic = REBASE_PREPARED(info, pp, f->magic);
+		s->src_func = REBASE_PREPARED(info, pp, f->src_func);
+		s->dst_func = REBASE_PREPARED(info, pp, f->dst_func);
+		s->author = REBASE_PREPARED(info, pp, f->author);
+	}
+
+	return 0;
+}
+
+/**
+ * Check the patch could be applied to the task or not, before modify the
+ * target task.
+ */
+static int check_prepared_patch(struct task_struct *task,
+				const struct prepared_patch *pp)
+{
+	unsigned int i;
+	struct vma_ulp *ulp;
+
+	list_for_each_entry(ulp, &task->ulp_list, node) {
+		if (ulp->str_build_id &&
+		    !strcmp(ulp->str_build_id, pp->info.str_build_id)) {
+			ulp_error("Build ID %s already exist in %d.\n",
+				  pp->info.str_build_id, task->pid);
+			return -EALREADY;
+		}
+	}
+
+	for (i = 0; i < pp->info.nr_ulp; i++) {
+		const char *dst_func = pp->info.ulp_strtab[i].dst_func;
+
+		if (!find_task_sym(task, dst_func, NULL, NULL)) {
+			ulp_error("Couldn't found %s in %d.\n", dst_func,
+				  task->pid);
+			return -ENOENT;
+		}
+	}
+
+	return 0;
+}
+
 /* looks like init_module() in kernel */
-int init_patch(struct task_struct *task, const char *obj_file)
+int init_patch_prepared(struct task_struct *task,
+			const struct prepared_patch *pp)
 {
 	int err;
 	char buffer[PATH_MAX];
@@ -925,11 +1325,16 @@ int init_patch(struct task_struct *task, const char *obj_file)
 		return -1;
 	}
 
+	err = check_prepared_patch(task, pp);
+	if (err)
+		return err;
+
 	ulp_file = __make_pid_ulpname(task->pid, buffer, sizeof(buffer));
 
-	err = alloc_patch_file(obj_file, ulp_file, &info);
+	err = __alloc_patch_file(pp->obj_file, pp->mem, pp->len, ulp_file,
+				 &info);
 	if (err) {
-		ulp_error("Parse %s failed.\n", obj_file);
+		ulp_error("Parse %s failed.\n", pp->obj_file);
 		goto err;
 	}
 
@@ -940,6 +1345,14 @@ int init_patch(struct task_struct *task, const char *obj_file)
 	err = chown(ulp_file, task->status.uid, task->status.gid);
 	if (err) {
 		ulp_error("chown %s failed.\n", ulp_file);
+		release_load_info(&info);
+		goto err;
+	}
+
+	/* Parsed once by prepare_patch(), only relocate and mmap per task */
+	err = setup_load_info_prepared(&info, pp);
+	if (err) {
+		release_load_info(&info);
 		goto err;
 	}
 
@@ -973,43 +1386,91 @@ err:
 	return err;
 }
 
+int init_patch(struct task_struct *task, const char *obj_file)
+{
+	int err;
+	struct prepared_patch pp;
+
+	err = prepare_patch(obj_file, &pp);
+	if (err) {
+		ulp_error("Parse %s failed.\n", obj_file);
+		return err;
+	}
+
+	err = init_patch_prepared(task, &pp);
+	release_prepared_patch(&pp);
+	return err;
+}
+
 /* delete last patched patch, so, don't need any other arguments */
 int delete_patch(struct task_struct *task)
 {
 	int n, err;
+	unsigned int i;
 	size_t insn_sz;
-	struct vma_ulp *ulp, *tmpulp;
+	struct vma_ulp *ulp, *tmpulp, *last;
 	struct ulpatch_info *ulp_info;
+	struct addr_range *ranges;
 	struct vm_area_struct *vma;
 
 	err = 0;
-	ulp_info = NULL;
+	last = NULL;
 
 	list_for_each_entry_safe(ulp, tmpulp, &task->ulp_list, node) {
-		if (task->max_ulp_id == ulp->info.ulp_id) {
+		if (task->max_ulp_id == ulp->info[0].ulp_id) {
 			ulp_info("Found last ulpatch vma.\n");
-			ulp_info = &ulp->info;
+			last = ulp;
 			break;
 		}
 	}
 
-	if (!ulp_info) {
+	if (!last) {
 		ulp_error("Not found any ulp.\n");
 		return -ENOENT;
 	}
 
-	insn_sz = sizeof(ulp_info->orig_code);
+	ulp = last;
+	insn_sz = sizeof(ulp->info[0].orig_code);
 	vma = ulp->vma;
 
-	task_attach(task->pid);
+	ranges = malloc(sizeof(struct addr_range) * ulp->nr_info);
+	if (!ranges)
+		return -ENOMEM;
 
-	n = memcpy_to_task(task, ulp_info->virtual_addr, (void *)ulp_info->orig_code, insn_sz);
-	if (n == -1 || n < insn_sz) {
-		ulp_error("failed kick target process.\n");
-		err = -ENOEXEC;
-		goto exit;
+	for (i = 0; i < ulp->nr_info; i++) {
+		ranges[i].start = ulp->info[i].virtual_addr;
+		ranges[i].end = ulp->info[i].virtual_addr + insn_sz;
 	}
 
+	/* Restore all entries in one stop, like kick_target_process() */
+	err = task_stop_world_safe_ranges(task, ranges, ulp->nr_info,
+					  ULP_STW_BUDGET_US,
+					  ULP_SAFE_POINT_DEADLINE_US);
+	free(ranges);
+	if (err) {
+		ulp_error("Stop the world of %d at safe point failed.\n",
+			  task->pid);
+		return err;
+	}
+
+	for (i = 0; i < ulp->nr_info; i++) {
+		ulp_info = &ulp->info[i];
+		n = memcpy_to_task(task, ulp_info->virtual_addr,
+				   (void *)ulp_info->orig_code, insn_sz);
+		if (n == -1 || n < insn_sz) {
+			ulp_error("failed kick target process.\n");
+			err = -ENOEXEC;
+			break;
+		}
+	}
+
+	task_resume_world(task);
+	if (err)
+		return err;
+
+	task_attach(task->pid);
+
+	/* Only munmap(2), a syscall batch costs more ptrace stops */
 	err = task_munmap(task, vma->vm_start, vma->vm_end - vma->vm_start);
 	if (err) {
 		print_vma(stdout, true, vma, false);
@@ -5,15 +5,18 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/types.h>
 #include <gelf.h>
 
 #include <utils/util.h>
 #include <utils/compiler.h>
+#include <utils/strhash.h>
 
 #ifndef __ULP_DEV
 #define __ULP_DEV
 #endif
 #include <patch/meta.h>
+#include <patch/ftrace.h>
 
 
 #if defined(__x86_64__)
@@ -49,8 +52,13 @@ struct load_info {
 	char *secstrings, *strtab;
 	unsigned long symoffs, stroffs, init_typeoffs, core_typeoffs;
 
+	/**
+	 * Entries of ULPATCH_INFO(), ulp_info points to SEC_ULPATCH_INFO
+	 * section, ulp_strtab is malloc, need free.
+	 */
+	unsigned int nr_ulp;
 	struct ulpatch_info *ulp_info;
-	struct ulpatch_strtab ulp_strtab;
+	struct ulpatch_strtab *ulp_strtab;
 	/* Store Build ID if exist. malloc, need free */
 	char *str_build_id;
 
@@ -63,19 +71,45 @@ struct load_info {
 			info,
 			build_id;
 	} index;
+
+	/* Name index of the patch's own symtab, value is symbol index */
+	struct strhash symtab_names;
 };
 
 
 /* ftrace */
 #if defined(__x86_64__)
 # define MCOUNT_INSN_SIZE	CALL_INSN_SIZE
+# define MCOUNT_NAME		"mcount"
+/* Call of mcount could be at any byte */
+# define MCOUNT_INSN_ALIGN	1
 #elif defined(__aarch64__)
 /* A64 instructions are always 32 bits. */
 # define MCOUNT_INSN_SIZE	BL_INSN_SIZE
+# define MCOUNT_NAME		"_mcount"
+# define MCOUNT_INSN_ALIGN	BL_INSN_SIZE
 #endif
+/* The longest call of mcount, such as "call *GOT(%rip)" */
+#define MCOUNT_INSN_MAX		8
+/* Call of mcount is in the prologue, scan the front of function only */
+#define MCOUNT_SCAN_BYTES	32
 
 
 #define PATCH_VMA_TEMP_PREFIX	"ulp-"
+/* Shared memory of ulftrace, see struct ftrace_session */
+#define ULFTRACE_VMA_TEMP_PREFIX	"ulftrace-"
+
+/**
+ * Pause budget of all threads when patching, if stop all threads takes
+ * longer than it, give up.
+ */
+#define ULP_STW_BUDGET_US	(100 * 1000)
+
+/**
+ * If any thread is in the patched instructions, retry until the deadline,
+ * see task_stop_world_safe().
+ */
+#define ULP_SAFE_POINT_DEADLINE_US	(5 * 1000 * 1000)
 
 struct jmp_table_entry {
 	unsigned long jmp;
@@ -83,13 +117,14 @@ struct jmp_table_entry {
 };
 
 struct task_struct;
+struct addr_range;
 
 extern void _ftrace_mcount(void);
 extern void _ftrace_mcount_return(void);
 
 int mcount_entry(unsigned long *parent_loc, unsigned long child,
 			struct mcount_regs *regs);
-unsigned long mcount_exit(long *retval);
+unsigned long mcount_exit(long *retval, unsigned long fp);
 
 void print_ulp_strtab(FILE *fp, const char *pfx, struct ulpatch_strtab *strtab);
 void print_ulp_info(FILE *fp, const char *pfx, struct ulpatch_info *inf);
@@ -101,9 +136,126 @@ int load_ulp_info_from_vma(struct vm_area_struct *vma, struct load_info *info);
 int setup_load_info(struct load_info *info);
 void release_load_info(struct load_info *info);
 
+int task_create_mmap_vma_file(struct task_struct *task, const char *path,
+			      size_t map_len, unsigned long hint,
+			      unsigned long *addr);
+void task_delete_mmap_vma_file(struct task_struct *task, unsigned long addr,
+			       size_t len);
+
+/**
+ * The patch file is read and checked once, and could be used to patch many
+ * tasks, such as all processes of the same executable.
+ */
+struct prepared_patch {
+	/* malloc, need free */
+	char *obj_file;
+	void *mem;
+	size_t len;
+
+	/**
+	 * Set up from mem once, the pointers point to mem, each task's copy
+	 * of patch is rebased from it, see setup_load_info_prepared().
+	 */
+	struct load_info info;
+};
+
+int prepare_patch(const char *obj_file, struct prepared_patch *pp);
+void release_prepared_patch(struct prepared_patch *pp);
+int init_patch_prepared(struct task_struct *task,
+			const struct prepared_patch *pp);
+
 int init_patch(struct task_struct *task, const char *obj_file);
 int delete_patch(struct task_struct *task);
 
+/* Result of each process, see fleet_patch() */
+struct fleet_result {
+	pid_t pid;
+	/* 0 or negative errno */
+	int err;
+	/* Time of open the task and patch or unpatch it */
+	unsigned long us;
+	/* Patched, but unpatched again because other process failed */
+	bool rollback;
+};
+
+int fleet_patch(const struct prepared_patch *pp, struct fleet_result *results,
+		int nr, unsigned int nr_workers);
+int fleet_unpatch(struct fleet_result *results, int nr,
+		  unsigned int nr_workers);
+
+/**
+ * A call of mcount in a function compiled with -pg, it's replaced with NOP
+ * if the function is not traced, see ftrace_select_sites().
+ */
+struct ftrace_site {
+	unsigned long ip;
+	unsigned char len;
+	bool enabled;
+	/* The original instruction */
+	unsigned char insn[MCOUNT_INSN_MAX];
+};
+
+/**
+ * Tracing session of ulftrace, the ftrace object is patched into target task,
+ * and writes records into the memory shared with us, see patch/ftrace.h.
+ */
+struct ftrace_session {
+	struct task_struct *task;
+
+	/* The shared file, malloc, need free */
+	char *path;
+	struct mmap_struct *mmap;
+	struct ulftrace_shm *shm;
+	/* Address of shm in target task */
+	unsigned long target_shm;
+	/* Address of ULFTRACE_SHM_SYMBOL in target task */
+	unsigned long target_shm_ptr;
+	/* Shadow stacks in target task, see struct ulftrace_local */
+	unsigned long target_local;
+	size_t local_size;
+	/* Address of ULFTRACE_LOCAL_SYMBOL in target task */
+	unsigned long target_local_ptr;
+	/* Address of _ftrace_mcount_return() in target task */
+	unsigned long target_return;
+	/* The ftrace object's VMA */
+	bool patched;
+	unsigned long ulp_start, ulp_end;
+
+	/* Call sites of all ELFs which call mcount, sorted by ip */
+	struct ftrace_site *sites;
+	size_t nr_sites;
+
+	/* Convert __ulp_builtin_cycles() to CLOCK_MONOTONIC nanoseconds */
+	unsigned long cycles0;
+	unsigned long ns0;
+	double ns_per_cycle;
+
+	/* Last time checking exited threads, see ftrace_consume() */
+	unsigned long reap_ns;
+};
+
+typedef int (*ftrace_record_fn)(const struct ulftrace_record *rec, void *arg);
+
+int ftrace_open(struct ftrace_session *fs, struct task_struct *task,
+		const char *obj_file, unsigned int nr_rings,
+		unsigned int nr_records);
+void ftrace_set_filter(struct ftrace_session *fs, unsigned long start,
+		       unsigned long end);
+void ftrace_set_mode(struct ftrace_session *fs, enum ulftrace_mode mode);
+int ftrace_slowest(struct ftrace_session *fs, struct ulftrace_slow *slow,
+		   int n);
+long ftrace_aggregate(struct ftrace_session *fs, struct ulftrace_agg **aggs,
+		      bool reset);
+long ftrace_consume(struct ftrace_session *fs, ftrace_record_fn fn,
+		    void *arg);
+unsigned long ftrace_lost(const struct ftrace_session *fs);
+unsigned long ftrace_cycles_to_ns(const struct ftrace_session *fs,
+				  unsigned long cycles);
+int ftrace_close(struct ftrace_session *fs);
+int ftrace_load_sites(struct ftrace_session *fs);
+int ftrace_select_sites(struct ftrace_session *fs,
+			const struct addr_range *ranges, int nr_ranges);
+
 int arch_apply_relocate_add(const struct load_info *info, GElf_Shdr *sechdrs,
 			    const char *strtab, unsigned int symindex,
 			    unsigned int relsec);
@@ -8,6 +8,7 @@
 #include <sys/ptrace.h>
 #include <sys/user.h>
 #include <sys/wait.h>
+#include <sys/uio.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <elf.h>
@@ -16,6 +17,7 @@
 #include <elf/elf-api.h>
 
 #include <utils/log.h>
+#include <utils/workpool.h>
 #include <task/task.h>
 
 #if defined(__x86_64__)
@@ -115,8 +117,8 @@ static int match_vma_phdr(struct vm_area_struct *vma, GElf_Phdr *phdr,
 
 int alloc_ulp(struct vm_area_struct *vma)
 {
-	int ret;
 	void *mem;
+	struct remote_iov riov;
 	struct vma_ulp *ulp;
 	size_t ulp_size = vma->vm_end - vma->vm_start;
 	struct task_struct *task = vma->task;
@@ -137,10 +139,17 @@ int alloc_ulp(struct vm_area_struct *vma)
 	ulp->elf_mem = mem;
 	ulp->vma = vma;
 	ulp->str_build_id = NULL;
+	ulp->nr_info = 0;
+	ulp->strtab = NULL;
+	ulp->info = NULL;
+	list_init(&ulp->node);
 
 	/* Copy VMA from target task memory space */
-	ret = memcpy_from_task(task, ulp->elf_mem, vma->vm_start, ulp_size);
-	if (ret == -1 || ret < ulp_size) {
+	riov.local = ulp->elf_mem;
+	riov.remote = vma->vm_start;
+	riov.len = ulp_size;
+	memcpy_from_task_v(task, &riov, 1);
+	if (riov.ret < (ssize_t)ulp_size) {
 		ulp_error("Failed read %lx:%s\n", vma->vm_start, vma->name_);
 		free_ulp(vma);
 		errno = EAGAIN;
@@ -166,15 +175,15 @@ void free_ulp(struct vm_area_struct *vma)
 	if (ulp->str_build_id)
 		free(ulp->str_build_id);
 
+	free(ulp->strtab);
 	free(ulp->elf_mem);
 	free(ulp);
 	vma->ulp = NULL;
 }
 
-int vma_load_ulp(struct vm_area_struct *vma)
+static int vma_load_ulp(struct vm_area_struct *vma, const GElf_Ehdr *ehdr)
 {
 	int ret;
-	GElf_Ehdr ehdr = {};
 	struct task_struct *task = vma->task;
 	struct load_info info = {
 		.target_task = task,
@@ -182,15 +191,7 @@ int vma_load_ulp(struct vm_area_struct *vma)
 
 	ulp_debug("Load ulpatch vma %s.\n", vma->name_);
 
-	ret = memcpy_from_task(task, &ehdr, vma->vm_start, sizeof(ehdr));
-	if (ret == -1 || ret < sizeof(ehdr)) {
-		ulp_error("Failed read from %lx:%s\n", vma->vm_start,
-			  vma->name_);
-		errno = EAGAIN;
-		return -EAGAIN;
-	}
-
-	if (!ehdr_magic_ok(&ehdr)) {
+	if (!ehdr_magic_ok(ehdr)) {
 		ulp_error("VMA %s(%lx) is ULPATCH, but it's not ELF.",
 			  vma->name_, vma->vm_start);
 		errno = ENOENT;
@@ -198,45 +199,72 @@ int vma_load_ulp(struct vm_area_struct *vma)
 	}
 
 	vma->is_elf = true;
-	alloc_ulp(vma);
+	ret = alloc_ulp(vma);
+	if (ret)
+		return ret;
 
-	load_ulp_info_from_vma(vma, &info);
+	ret = load_ulp_info_from_vma(vma, &info);
+	if (ret) {
+		ulp_error("Load ulpatch vma %s failed.\n", vma->name_);
+		free_ulp(vma);
+		release_load_info(&info);
+		return ret;
+	}
 
-	if (task->max_ulp_id < info.ulp_info->ulp_id)
-		task->max_ulp_id = info.ulp_info->ulp_id;
+	/* All entries of one ulp share the same ID */
+	if (task->max_ulp_id < vma->ulp->info[0].ulp_id)
+		task->max_ulp_id = vma->ulp->info[0].ulp_id;
 
+	release_load_info(&info);
 	return 0;
 }
 
-/* Only FTO_VMA_ELF flag will load VMA ELF */
-static int vma_peek_elf_hdrs(struct vm_area_struct *vma)
+/**
+ * The ulp VMA is loaded when it's mapped, before the patch relocated and
+ * written, load it again, thus, ulp_id and symbols are the patched ones, and
+ * delete_patch() could find it without reopen the task.
+ */
+int vma_reload_ulp(struct vm_area_struct *vma)
 {
-	GElf_Ehdr ehdr = {};
-	struct task_struct *task = vma->task;
-	unsigned long phaddr;
-	unsigned int phsz = 0;
-	int ret;
-	int i;
-	bool is_share_lib = true;
-	unsigned long lowest_vaddr = ULONG_MAX;
-	GElf_Phdr *gnu_relro_phdr = NULL;
+	GElf_Ehdr ehdr;
+	int n;
 
+	if (vma->type != VMA_ULPATCH || !vma->ulp) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	n = memcpy_from_task(vma->task, &ehdr, vma->vm_start, sizeof(ehdr));
+	if (n < (int)sizeof(ehdr)) {
+		ulp_error("Failed read ELF header of %s.\n", vma->name_);
+		return -EFAULT;
+	}
+
+	unlink_vma_task_syms(vma);
+	free_ulp(vma);
+
+	return vma_load_ulp(vma, &ehdr);
+}
+
+/* Only FTO_VMA_ELF flag will load VMA ELF */
+static bool vma_need_peek_elf(struct vm_area_struct *vma)
+{
 	/* Check VMA type, and skip it */
 	switch (vma->type) {
 	case VMA_VVAR:
 	case VMA_STACK:
 	case VMA_VSYSCALL:
 		ulp_debug("skip %s\n", vma_type_name(vma->type));
-		return 0;
+		return false;
 	case VMA_ULPATCH:
-		return vma_load_ulp(vma);
+		return true;
 	default:
 		break;
 	}
 
 	/* Just skip already peeked ELF */
 	if (vma->vma_elf != NULL || vma->is_elf)
-		return 0;
+		return false;
 
 	/**
 	 * Add more check here, skip some VMA peek, because some vma pread()
@@ -245,25 +273,23 @@ static int vma_peek_elf_hdrs(struct vm_area_struct *vma)
 	if (!strncmp(vma->name_, "/etc", 4) ||
 	    !strncmp(vma->name_, "/sys", 4)) {
 		ulp_debug("Skip peek vma %s\n", vma->name_);
-		return 0;
+		return false;
 	}
 
-	ulp_debug("Try peek elf hdr from %s, addr %lx\n", vma->name_,
-		  vma->vm_start);
+	return true;
+}
 
-	/**
-	 * Read the ELF header from target task memory.
-	 */
-	ret = memcpy_from_task(task, &ehdr, vma->vm_start, sizeof(ehdr));
-	if (ret < sizeof(ehdr)) {
-		ulp_error("Failed read from %lx:%s\n", vma->vm_start,
-			  vma->name_);
-		errno = EAGAIN;
-		return -EAGAIN;
-	}
+/**
+ * Handle the ELF header that already read from target task memory, if VMA is
+ * ELF and has program headers, vma_elf_mem::phdrs is allocated, and need to
+ * be filled by caller.
+ */
+static int vma_peek_elf_ehdr(struct vm_area_struct *vma, const GElf_Ehdr *ehdr)
+{
+	struct task_struct *task = vma->task;
 
 	/* If it's not ELF, return success, skip the non-ELF VMAs */
-	if (!ehdr_ok(&ehdr)) {
+	if (!ehdr_ok(ehdr)) {
 		errno = ENOENT;
 		return 0;
 	}
@@ -284,7 +310,7 @@ static int vma_peek_elf_hdrs(struct vm_area_struct *vma)
 		 *
 		 * [0] https://sourceware.org/git/binutils-gdb.git
 		 */
-		if (ehdr.e_type == ET_DYN) {
+		if (ehdr->e_type == ET_DYN) {
 			ulp_debug("%s is PIE.\n", vma->name_);
 			task->is_pie = true;
 		}  else {
@@ -301,44 +327,38 @@ static int vma_peek_elf_hdrs(struct vm_area_struct *vma)
 	memset(vma->vma_elf, 0x00, sizeof(struct vma_elf_mem));
 
 	/* Copy ehdr from load var */
-	memcpy(&vma->vma_elf->ehdr, &ehdr, sizeof(ehdr));
-
-	if (vma->vma_elf->ehdr.e_phnum == 0) {
-		ulp_debug("%s has no phdr\n", vma->name_);
-		vma->vma_elf->phdrs = NULL;
-		goto peek_phdrs_done;
-	}
-
-	phaddr = vma->vm_start + vma->vma_elf->ehdr.e_phoff;
-	phsz = vma->vma_elf->ehdr.e_phnum * sizeof(GElf_Phdr);
+	memcpy(&vma->vma_elf->ehdr, ehdr, sizeof(*ehdr));
 
 	/**
-	 * If no program headers, just return. we don't need it, such as:
+	 * If no program headers, we don't need it, such as:
 	 * /usr/lib64/ld-linux-x86-64.so.2 has '.ELF' magic, but it's no phdr.
 	 */
-	if (phsz == 0) {
-		ulp_warning("%s: no phdr, e_phoff %lx, skip it.\n",
-			 vma->name_, vma->vma_elf->ehdr.e_phoff);
-		free(vma->vma_elf);
+	if (vma->vma_elf->ehdr.e_phnum == 0) {
+		ulp_debug("%s has no phdr\n", vma->name_);
+		vma->vma_elf->phdrs = NULL;
 		return 0;
 	}
 
-	vma->vma_elf->phdrs = malloc(phsz);
+	vma->vma_elf->phdrs = malloc(vma->vma_elf->ehdr.e_phnum *
+				     sizeof(GElf_Phdr));
 	if (!vma->vma_elf->phdrs) {
 		free(vma->vma_elf);
+		vma->vma_elf = NULL;
 		return -ENOMEM;
 	}
 
-	/* Read all program headers from target task memory space */
-	ulp_debug("peek phdr from target addr %lx, len %d\n", phaddr, phsz);
-	if (memcpy_from_task(task, vma->vma_elf->phdrs, phaddr, phsz) < phsz) {
-		free(vma->vma_elf->phdrs);
-		free(vma->vma_elf);
-		ulp_error("Failed to read %s program header.\n", vma->name_);
-		return -EAGAIN;
-	}
+	return 0;
+}
 
-peek_phdrs_done:
+/**
+ * Handle the program headers that already read from target task memory.
+ */
+static int vma_peek_elf_phdrs(struct vm_area_struct *vma)
+{
+	int i;
+	bool is_share_lib = true;
+	unsigned long lowest_vaddr = ULONG_MAX;
+	GElf_Phdr *gnu_relro_phdr = NULL;
 
 	/**
 	 * If type of the ELF is not ET_DYN, this is definitely not a shared
@@ -466,7 +486,104 @@ set_share_lib:
 	return 0;
 }
 
-static int vma_load_elf_file(struct vm_area_struct *vma)
+/**
+ * Peek ELF headers of all VMAs. Instead of two or more pread(2) for each VMA,
+ * all ELF headers are read in one vectored copy, and then all program headers
+ * are read in another one.
+ */
+static int task_peek_vmas_elf_hdrs(struct task_struct *task)
+{
+	int i, n, nr_vmas = 0;
+	struct vm_area_struct *vma, **vmas;
+	struct remote_iov *riov;
+	GElf_Ehdr *ehdrs;
+
+	task_for_each_vma(vma, task)
+		nr_vmas++;
+
+	vmas = malloc(nr_vmas * sizeof(*vmas));
+	riov = malloc(nr_vmas * sizeof(*riov));
+	ehdrs = malloc(nr_vmas * sizeof(*ehdrs));
+	if (!vmas || !riov || !ehdrs) {
+		ulp_error("malloc failed.\n");
+		free(vmas);
+		free(riov);
+		free(ehdrs);
+		return -ENOMEM;
+	}
+
+	n = 0;
+	task_for_each_vma(vma, task) {
+		if (!vma_need_peek_elf(vma))
+			continue;
+		vmas[n] = vma;
+		riov[n].local = &ehdrs[n];
+		riov[n].remote = vma->vm_start;
+		riov[n].len = sizeof(GElf_Ehdr);
+		n++;
+	}
+
+	ulp_debug("Try peek elf hdr from %d vmas\n", n);
+
+	/* Read the ELF header from target task memory. */
+	memcpy_from_task_v(task, riov, n);
+
+	nr_vmas = n;
+	for (i = 0, n = 0; i < nr_vmas; i++) {
+		vma = vmas[i];
+
+		if (riov[i].ret < (ssize_t)sizeof(GElf_Ehdr)) {
+			ulp_error("Failed read from %lx:%s\n", vma->vm_start,
+				  vma->name_);
+			continue;
+		}
+
+		if (vma->type == VMA_ULPATCH) {
+			vma_load_ulp(vma, &ehdrs[i]);
+			continue;
+		}
+
+		if (vma_peek_elf_ehdr(vma, &ehdrs[i]) || !vma->vma_elf)
+			continue;
+
+		if (!vma->vma_elf->phdrs) {
+			vma_peek_elf_phdrs(vma);
+			continue;
+		}
+
+		vmas[n] = vma;
+		riov[n].local = vma->vma_elf->phdrs;
+		riov[n].remote = vma->vm_start + vma->vma_elf->ehdr.e_phoff;
+		riov[n].len = vma->vma_elf->ehdr.e_phnum * sizeof(GElf_Phdr);
+		n++;
+	}
+
+	/* Read all program headers from target task memory space */
+	memcpy_from_task_v(task, riov, n);
+
+	for (i = 0; i < n; i++) {
+		vma = vmas[i];
+
+		if (riov[i].ret < (ssize_t)riov[i].len) {
+			ulp_error("Failed to read %s program header.\n",
+				  vma->name_);
+			free(vma->vma_elf->phdrs);
+			free(vma->vma_elf);
+			vma->vma_elf = NULL;
+			vma->is_elf = false;
+			continue;
+		}
+
+		vma_peek_elf_phdrs(vma);
+	}
+
+	free(vmas);
+	free(riov);
+	free(ehdrs);
+	return 0;
+}
+
+int vma_load_elf_file(struct vm_area_struct *vma)
 {
 	struct task_struct *task = vma->task;
 
@@ -500,6 +617,47 @@ static int vma_load_elf_file(struct vm_area_struct *vma)
 	return 0;
 }
 
+static void __vma_load_elf_file(size_t idx, void *arg)
+{
+	struct vm_area_struct **vmas = arg;
+	vma_load_elf_file(vmas[idx]);
+}
+
+/**
+ * Open ELF files of all ELF VMAs which are not opened yet. Files are
+ * independent, open them concurrently with a worker pool, bfd_elf_open()
+ * is safe for that.
+ */
+int task_open_vmas_elf_files(struct task_struct *task)
+{
+	size_t n = 0;
+	struct vm_area_struct *vma, **vmas;
+
+	task_for_each_vma(vma, task) {
+		if (vma->is_elf && !vma->bfd_elf_file &&
+		    vma->type != VMA_ULPATCH)
+			n++;
+	}
+	if (!n)
+		return 0;
+
+	vmas = malloc(n * sizeof(*vmas));
+	if (!vmas)
+		return -ENOMEM;
+
+	n = 0;
+	task_for_each_vma(vma, task) {
+		if (vma->is_elf && !vma->bfd_elf_file &&
+		    vma->type != VMA_ULPATCH)
+			vmas[n++] = vma;
+	}
+
+	workpool_run(workpool_nr_workers(), n, __vma_load_elf_file, vmas);
+
+	free(vmas);
+	return 0;
+}
+
 void vma_free_elf(struct vm_area_struct *vma)
 {
 	if (!vma->is_elf || vma->type == VMA_ULPATCH) {
@@ -513,7 +671,7 @@ void vma_free_elf(struct vm_area_struct *vma)
 
 int update_task_vmas_ulp(struct task_struct *task)
 {
-	return read_task_vmas(task, true);
+	return refresh_task_vmas(task, 0, ULONG_MAX);
 }
 
 void print_task(FILE *fp, const struct task_struct *task, bool detail)
@@ -540,7 +698,8 @@ void print_task(FILE *fp, const struct task_struct *task, bool detail)
 
 void print_thread(FILE *fp, struct task_struct *task, struct thread *thread)
 {
-	fprintf(fp, "pid %d, tid %d\n", task->pid, thread->tid);
+	fprintf(fp, "pid %d, tid %d, pause %ldus\n", task->pid, thread->tid,
+		thread->pause_us);
 }
 
 void print_fd(FILE *fp, struct task_struct *task, struct fd *fd)
@@ -576,6 +735,9 @@ int dump_task_addr_to_file(const char *ofile, struct task_struct *task,
 			   unsigned long addr, unsigned long size)
 {
 	void *mem = NULL;
+	struct remote_iov *riov = NULL;
+	unsigned long off;
+	int nr_riov;
 
 	/* default is stdout */
 	int nbytes;
@@ -598,8 +760,46 @@ int dump_task_addr_to_file(const char *ofile, struct task_struct *task,
 	}
 
 	mem = malloc(size);
+	if (!mem) {
+		ulp_error("malloc failed.\n");
+		return -1;
+	}
+
+	/**
+	 * The range may cross several VMAs, split it at VMA boundaries and
+	 * read them all with one vectored copy.
+	 */
+	nr_riov = 0;
+	for (off = 0; off < size; nr_riov++) {
+		struct remote_iov *tmp;
+
+		tmp = realloc(riov, (nr_riov + 1) * sizeof(*riov));
+		if (!tmp) {
+			ulp_error("realloc failed.\n");
+			free(riov);
+			free(mem);
+			return -1;
+		}
+		riov = tmp;
+
+		riov[nr_riov].local = mem + off;
+		riov[nr_riov].remote = addr + off;
+		riov[nr_riov].len = size - off;
+
+		vma = find_vma(task, addr + off);
+		if (vma && vma->vm_end - (addr + off) < size - off)
+			riov[nr_riov].len = vma->vm_end - (addr + off);
 
-	memcpy_from_task(task, mem, addr, size);
+		off += riov[nr_riov].len;
+	}
+
+	if (memcpy_from_task_v(task, riov, nr_riov) != size) {
+		ulp_error("read %lx-%lx from task failed.\n", addr, addr + size);
+		free(riov);
+		free(mem);
+		return -1;
+	}
+	free(riov);
 
 	/* write to file or stdout */
 	nbytes = write(fd, mem, size);
@@ -665,14 +865,17 @@ void dump_task_fds(FILE *fp, struct task_struct *task, bool detail)
 
 int free_task_vmas(struct task_struct *task)
 {
-	struct vm_area_struct *vma, *tmpvma;
+	struct vma_ulp *ulp, *tmpulp;
 
-	list_for_each_entry_safe(vma, tmpvma, &task->vma_list, node_list) {
-		unlink_vma(task, vma);
-		free_vma(vma);
-	}
+	/**
+	 * The vmas are in task arena, only the ulpatch ones own memory out
+	 * of it.
+	 */
+	list_for_each_entry_safe(ulp, tmpulp, &task->ulp_list, node)
+		free_ulp(ulp->vma);
 
 	list_init(&task->vma_list);
+	list_init(&task->vma_free_list);
 	list_init(&task->ulp_list);
 	list_init(&task->threads_list);
 	list_init(&task->fds_list);
@@ -721,6 +924,127 @@ char *get_proc_pid_cwd(pid_t pid, char *buf, size_t bufsz)
 	return buf;
 }
 
+/* One for each different executable file, see proc_find_pids() */
+struct exe_build_id {
+	dev_t dev;
+	ino_t ino;
+	bool match;
+};
+
+static bool exe_build_id_match(const char *path, const char *build_id,
+			       struct exe_build_id **exes, int *nr_exes)
+{
+	int i, n;
+	struct stat st;
+	uint8_t bid[64];
+	char str_bid[sizeof(bid) * 2 + 1];
+	const char *s;
+	struct exe_build_id *e;
+
+	if (stat(path, &st))
+		return false;
+
+	/* Workers of the same executable share the file, read it once */
+	for (i = 0; i < *nr_exes; i++) {
+		e = &(*exes)[i];
+		if (e->dev == st.st_dev && e->ino == st.st_ino)
+			return e->match;
+	}
+
+	e = realloc(*exes, sizeof(struct exe_build_id) * (*nr_exes + 1));
+	if (!e)
+		return false;
+	*exes = e;
+	e = &e[(*nr_exes)++];
+
+	e->dev = st.st_dev;
+	e->ino = st.st_ino;
+
+	n = elf_read_build_id(path, bid, sizeof(bid));
+	s = n > 0 ? elf_strbuildid(bid, n, str_bid, sizeof(str_bid)) : NULL;
+	e->match = s && !strcasecmp(s, build_id);
+
+	return e->match;
+}
+
+/**
+ * Find all processes of executable @exe, and/or whose executable has Build
+ * ID @build_id (hex string). The caller itself is skipped.
+ *
+ * @pids: malloc, need free
+ * @return: the number of processes, or negative errno.
+ */
+int proc_find_pids(const char *exe, const char *build_id, pid_t **pids)
+{
+	DIR *dir;
+	ssize_t n;
+	struct dirent *entry;
+	pid_t pid, self = getpid(), *p;
+	int nr = 0, size = 0, nr_exes = 0;
+	struct exe_build_id *exes = NULL;
+	char path[PATH_MAX], link[PATH_MAX], real_exe[PATH_MAX];
+
+	if ((!exe && !build_id) || !pids) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	if (exe && !realpath(exe, real_exe)) {
+		ulp_error("realpath %s failed, %m\n", exe);
+		return -errno;
+	}
+
+	dir = opendir("/proc");
+	if (!dir) {
+		ulp_error("opendir /proc failed, %m\n");
+		return -errno;
+	}
+
+	*pids = NULL;
+
+	while ((entry = readdir(dir)) != NULL) {
+		pid = atoi(entry->d_name);
+		if (pid <= 0 || pid == self)
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/%d/exe", pid);
+
+		/* Kernel threads and no permission processes are skipped */
+		if (exe) {
+			n = readlink(path, link, sizeof(link) - 1);
+			if (n < 0)
+				continue;
+			link[n] = '\0';
+			if (strcmp(link, real_exe))
+				continue;
+		}
+
+		if (build_id &&
+		    !exe_build_id_match(path, build_id, &exes, &nr_exes))
+			continue;
+
+		if (nr == size) {
+			size = size ? size * 2 : 64;
+			p = realloc(*pids, sizeof(pid_t) * size);
+			if (!p) {
+				free(*pids);
+				*pids = NULL;
+				nr = -ENOMEM;
+				break;
+			}
+			*pids = p;
+		}
+		(*pids)[nr++] = pid;
+	}
+
+	closedir(dir);
+	free(exes);
+
+	ulp_debug("Found %d processes of %s %s.\n", nr, exe ?: "",
+		  build_id ?: "");
+	return nr;
+}
+
 static int __get_comm(struct task_struct *task)
 {
 	char path[PATH_MAX];
@@ -973,6 +1297,8 @@ struct task_struct *open_task(pid_t pid, int flag)
 	struct task_struct *task = NULL;
 	int o_flags;
 	struct vm_area_struct *tmp_vma;
+	bool lazy_syms = (flag & FTO_VMA_ELF_SYMBOLS_LAZY) ==
+			 FTO_VMA_ELF_SYMBOLS_LAZY;
 
 	if (!proc_pid_exist(pid)) {
 		ulp_error("pid %d is not exist.\n", pid);
@@ -991,13 +1317,20 @@ struct task_struct *open_task(pid_t pid, int flag)
 	task->fto_flag = flag;
 	task->pid = pid;
 
+	arena_init(&task->arena, 0);
+
 	list_init(&task->vma_list);
+	list_init(&task->vma_free_list);
 	list_init(&task->ulp_list);
 	list_init(&task->threads_list);
 	list_init(&task->fds_list);
 	rb_init(&task->vmas_rb);
 	task_syms_init(&task->tsyms);
 
+	err = str_pool_init(&task->vma_names);
+	if (err)
+		goto free_task;
+
 	if (flag & FTO_AUXV) {
 		err = load_task_auxv(pid, &task->auxv);
 		if (err)
@@ -1026,7 +1359,7 @@ struct task_struct *open_task(pid_t pid, int flag)
 
 	task->proc_mem_fd = task->proc_mem_fd;
 
-	err = read_task_vmas(task, false);
+	err = read_task_vmas(task);
 	if (err)
 		goto free_task;
 
@@ -1036,14 +1369,14 @@ struct task_struct *open_task(pid_t pid, int flag)
 	}
 
 	if (flag & FTO_VMA_ELF) {
-		task_for_each_vma(tmp_vma, task) {
-			vma_peek_elf_hdrs(tmp_vma);
-			if (tmp_vma->is_elf)
-				vma_load_elf_file(tmp_vma);
-		}
+		task_peek_vmas_elf_hdrs(task);
+		/* Lazy mode opens ELF file when loading symbols */
+		if (!lazy_syms)
+			task_open_vmas_elf_files(task);
 	}
 
-	if (flag & FTO_VMA_ELF_SYMBOLS) {
+	/* Merge all symbols into task in one single-threaded pass */
+	if ((flag & FTO_VMA_ELF_SYMBOLS) && !lazy_syms) {
 		task_for_each_vma(tmp_vma, task) {
 			if (tmp_vma->is_elf)
 				task_load_vma_elf_syms(tmp_vma);
@@ -1113,8 +1446,13 @@ struct task_struct *open_task(pid_t pid, int flag)
 			 */
 			if (child == task->pid)
 				ulp_debug("Thread %s (pid)\n", entry->d_name);
-			thread = malloc(sizeof(struct thread));
+			thread = arena_alloc(&task->arena, sizeof(struct thread));
+			if (!thread) {
+				closedir(dir);
+				goto free_task;
+			}
 			thread->tid = child;
+			thread->no_fp = false;
 			list_init(&thread->node);
 			list_add(&thread->node, &task->threads_list);
 		}
@@ -1142,8 +1480,11 @@ struct task_struct *open_task(pid_t pid, int flag)
 			ulp_debug("FD %s\n", entry->d_name);
 			ifd = atoi(entry->d_name);
 
-			fd = malloc(sizeof(struct fd));
-			memset(fd, 0x00, sizeof(struct fd));
+			fd = arena_alloc(&task->arena, sizeof(struct fd));
+			if (!fd) {
+				closedir(dir);
+				goto free_task;
+			}
 
 			fd->fd = ifd;
 
@@ -1233,6 +1574,10 @@ int close_task(struct task_struct *task)
 		return -EINVAL;
 	}
 
+	/* Must before close proc_mem_fd */
+	if (task->syscall_trampoline)
+		task_syscall_trampoline(task, false);
+
 	if (task->proc_mem_fd > STDERR_FILENO)
 		close(task->proc_mem_fd);
 
@@ -1248,26 +1593,22 @@ int close_task(struct task_struct *task)
 		}
 	}
 
-	if (task->fto_flag & FTO_VMA_ELF_SYMBOLS)
-		free_task_syms(task);
+	/* ULP symbols are linked without FTO_VMA_ELF_SYMBOLS too */
+	free_task_syms(task);
 
 	if (task->fto_flag & FTO_PROC)
 		__check_and_free_task_proc(task);
 
-	if (task->fto_flag & FTO_THREADS) {
-		struct thread *thread, *tmpthread;
-		list_for_each_entry_safe(thread, tmpthread, &task->threads_list,
-			   node)
-			free(thread);
-	}
-
-	if (task->fto_flag & FTO_FD) {
-		struct fd *fd, *tmpfd;
-		list_for_each_entry_safe(fd, tmpfd, &task->fds_list, node)
-			free(fd);
-	}
+	/* task_stop_world() may add threads without FTO_THREADS */
+	if (task->world_stopped)
+		task_resume_world(task);
+	/* Threads interrupted by a task_stop_world() over budget */
+	task_release_threads(task);
 
+	/* Threads, fds, task_syms and vmas are released with the arena */
 	free_task_vmas(task);
+	str_pool_destroy(&task->vma_names);
+	arena_destroy(&task->arena);
 	free(task->exe);
 	free(task);
 
@@ -1409,17 +1750,215 @@ int memcpy_to_task(struct task_struct *task, unsigned long task_dst, void *src,
 	return ret;
 }
 
+/* process_vm_readv(2) accept at most IOV_MAX iovecs at once */
+#define REMOTE_IOV_BATCH	IOV_MAX
+
+/**
+ * process_vm_readv(2) and process_vm_writev(2) honor the protection of target
+ * VMA, which is different from /proc/PID/mem, thus, if the range is not
+ * readable(writable), we should use /proc/PID/mem directly. All VMAs of the
+ * range must be contiguous and accessible, a hole or an inaccessible VMA in
+ * the middle fails process_vm_readv(2) partway.
+ */
+static bool riov_vm_accessible(struct task_struct *task,
+			       const struct remote_iov *riov, unsigned int prot)
+{
+	struct vm_area_struct *vma;
+	unsigned long addr = riov->remote;
+	unsigned long end = riov->remote + riov->len;
+
+	if (task->no_process_vm)
+		return false;
+
+	task_for_each_vma_overlap(vma, task, addr, end) {
+		if (vma->vm_start > addr || !(vma->prot & prot))
+			return false;
+		addr = vma->vm_end;
+		if (addr >= end)
+			return true;
+	}
+
+	return false;
+}
+
+static ssize_t riov_proc_mem_copy(struct task_struct *task,
+				  struct remote_iov *riov, bool write)
+{
+	if (write)
+		riov->ret = memcpy_to_task(task, riov->remote, riov->local,
+					   riov->len);
+	else
+		riov->ret = memcpy_from_task(task, riov->local, riov->remote,
+					     riov->len);
+	return riov->ret > 0 ? riov->ret : 0;
+}
+
+static ssize_t __memcpy_task_v(struct task_struct *task,
+			       struct remote_iov *riov, int n, bool write)
+{
+	struct iovec liov[REMOTE_IOV_BATCH], rmiov[REMOTE_IOV_BATCH];
+	unsigned int prot = write ? PROT_WRITE : PROT_READ;
+	ssize_t ret, total = 0;
+	int i = 0, j, nr;
+
+	while (i < n) {
+		if (riov[i].len == 0) {
+			riov[i++].ret = 0;
+			continue;
+		}
+
+		if (!riov_vm_accessible(task, &riov[i], prot)) {
+			total += riov_proc_mem_copy(task, &riov[i++], write);
+			continue;
+		}
+
+		/* Gather the accessible ranges as many as possible */
+		for (nr = 0; i + nr < n && nr < REMOTE_IOV_BATCH; nr++) {
+			struct remote_iov *r = &riov[i + nr];
+
+			if (nr && (r->len == 0 ||
+				   !riov_vm_accessible(task, r, prot)))
+				break;
+
+			liov[nr].iov_base = r->local;
+			liov[nr].iov_len = r->len;
+			rmiov[nr].iov_base = (void *)r->remote;
+			rmiov[nr].iov_len = r->len;
+		}
+
+		if (write)
+			ret = process_vm_writev(task->pid, liov, nr, rmiov, nr, 0);
+		else
+			ret = process_vm_readv(task->pid, liov, nr, rmiov, nr, 0);
+		if (ret == -1) {
+			if (errno == ENOSYS || errno == EPERM) {
+				ulp_debug("process_vm_%sv: %m, use %s.\n",
+					  write ? "write" : "read",
+					  "/proc/PID/mem");
+				task->no_process_vm = true;
+			}
+			total += riov_proc_mem_copy(task, &riov[i++], write);
+			continue;
+		}
+
+		/**
+		 * Partial transfers apply at the granularity of iovec elements,
+		 * and no further transfer will be attempted beyond the failed
+		 * element.
+		 */
+		for (j = 0; j < nr && ret >= riov[i + j].len; j++) {
+			riov[i + j].ret = riov[i + j].len;
+			ret -= riov[i + j].len;
+			total += riov[i + j].len;
+		}
+		i += j;
+
+		/* Try the failed element again with /proc/PID/mem */
+		if (j < nr)
+			total += riov_proc_mem_copy(task, &riov[i++], write);
+	}
+
+	return total;
+}
+
+/**
+ * Copy many ranges from target task with as few syscalls as possible, the
+ * result of each range is stored in remote_iov::ret.
+ *
+ * @return: total bytes copied.
+ */
+ssize_t memcpy_from_task_v(struct task_struct *task, struct remote_iov *riov,
+			   int n)
+{
+	if (!task || !riov || n < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	return __memcpy_task_v(task, riov, n, false);
+}
+
+ssize_t memcpy_to_task_v(struct task_struct *task, struct remote_iov *riov,
+			 int n)
+{
+	if (!task || !riov || n < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	return __memcpy_task_v(task, riov, n, true);
+}
+
 #define MAX_STR_LEN	1024
 
+/* Bytes could be read from @addr without crossing the page boundary */
+static inline size_t page_remain(unsigned long addr)
+{
+	return PAGE_SIZE - (addr & (PAGE_SIZE - 1));
+}
+
+/**
+ * Read NUL terminated string from target task. The string is read in chunks,
+ * and each chunk never cross the page boundary, thus, we never touch the next
+ * page before the NUL is not found, which may be not mapped at all.
+ *
+ * @size: size of @dst, @dst is always NUL terminated.
+ * @return: length of string, or -1 if failed.
+ */
+ssize_t strncpy_from_task(struct task_struct *task, char *dst,
+			  unsigned long task_src, size_t size)
+{
+	size_t off = 0, chunk;
+	char *nul;
+	int ret;
+
+	if (!task || !dst || size == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	while (off < size - 1) {
+		chunk = MIN(page_remain(task_src + off), size - 1 - off);
+
+		ret = memcpy_from_task(task, dst + off, task_src + off, chunk);
+		if (ret <= 0) {
+			dst[off] = '\0';
+			errno = EFAULT;
+			return -1;
+		}
+
+		nul = memchr(dst + off, '\0', ret);
+		if (nul)
+			return nul - dst;
+
+		off += ret;
+		if (ret < chunk) {
+			dst[off] = '\0';
+			errno = EFAULT;
+			return -1;
+		}
+	}
+
+	dst[off] = '\0';
+	return off;
+}
+
+/**
+ * Read string from target task, at most MAX_STR_LEN bytes.
+ */
 char *strcpy_from_task(struct task_struct *task, char *dst,
 		       unsigned long task_src)
 {
-	int i;
-	for (i = 0;; i++) {
-		memcpy_from_task(task, &dst[i], task_src + i, 1);
-		if (dst[i] == '\0' || i >= MAX_STR_LEN)
-			break;
-	}
+	char buf[MAX_STR_LEN + 1];
+	ssize_t len;
+
+	/**
+	 * Caller's @dst size is unknown, read into local buffer, and then
+	 * copy the string only.
+	 */
+	len = strncpy_from_task(task, buf, task_src, sizeof(buf));
+	if (len < 0)
+		len = strlen(buf);
+
+	memcpy(dst, buf, len + 1);
 	return dst;
 }
 
@@ -23,8 +23,11 @@
  * We should implement the current macro because sometimes we cannot directly
  * pass the task_struct structure as a function parameter. At the same time,
  * this can also be unified with the kernel.
+ *
+ * Per thread, the workers of fleet_patch() open and close their own tasks
+ * concurrently.
  */
-static struct task_struct *current_task = NULL;
+static __thread struct task_struct *current_task = NULL;
 static struct task_struct fallback_task = {
 	.pid = 0,
 	.fto_flag = 0,
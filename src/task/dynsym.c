@@ -0,0 +1,340 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <elf.h>
+
+#include <elf/elf-api.h>
+
+#include <utils/log.h>
+#include <task/task.h>
+
+/**
+ * Remote dynamic symbol resolver
+ *
+ * If the ELF file of a VMA can't be opened, such as [vdso], a library that was
+ * deleted or replaced by package upgrade, or a file in another mount
+ * namespace, resolve the name with .gnu.hash and .dynsym of the ELF mapped in
+ * target memory, the same way as the dynamic linker does.
+ *
+ * The DT_GNU_HASH bloom filter and buckets are copied once, a lookup then
+ * costs one vectored read of the chain, the symbols and their versions, and
+ * one read of the candidate name.
+ */
+struct vma_dynsym {
+	/* Remote addresses, relocated */
+	unsigned long symtab;
+	unsigned long strtab;
+	unsigned long strsz;
+	unsigned long versym;
+	unsigned long chains;
+
+	uint32_t nbuckets;
+	uint32_t symoffset;
+	uint32_t bloom_size;
+	uint32_t bloom_shift;
+	uint64_t *bloom;
+	uint32_t *buckets;
+};
+
+/* Number of chain entries read at once, most chains are shorter */
+#define DYNSYM_CHAIN_BATCH	8
+
+/* Bit of .gnu.version entry, the version is not default, like foo@VER */
+#define DYNSYM_VERSYM_HIDDEN	0x8000
+
+/* Sanity limit of remote DT_GNU_HASH header */
+#define DYNSYM_GNU_HASH_MAX	(1U << 24)
+
+static int read_task(struct task_struct *task, void *dst, unsigned long src,
+		     size_t len)
+{
+	struct remote_iov riov = {
+		.local = dst,
+		.remote = src,
+		.len = len,
+	};
+
+	memcpy_from_task_v(task, &riov, 1);
+	return riov.ret == (ssize_t)len ? 0 : -EFAULT;
+}
+
+/**
+ * glibc relocates d_ptr of writable PT_DYNAMIC in place, but not the
+ * readonly one, like [vdso]'s.
+ */
+static unsigned long dyn_ptr(struct vm_area_struct *vma, unsigned long ptr)
+{
+	if (ptr < vma->vm_start)
+		ptr += vma->vma_elf->load_addr;
+	return ptr;
+}
+
+static struct vma_dynsym *vma_dynsym_init(struct vm_area_struct *vma)
+{
+	int i, nr_dyn;
+	size_t dyn_size = 0;
+	unsigned long dyn_addr = 0, gnu_hash = 0;
+	uint32_t hdr[4];
+	GElf_Dyn *dyns;
+	struct remote_iov riov[2];
+	struct task_struct *task = vma->task;
+	struct vma_dynsym *ds;
+
+	if (!vma->vma_elf || !vma->vma_elf->phdrs ||
+	    vma->vma_elf->ehdr.e_ident[EI_CLASS] != ELFCLASS64)
+		return NULL;
+
+	for (i = 0; i < vma->vma_elf->ehdr.e_phnum; i++) {
+		GElf_Phdr *phdr = &vma->vma_elf->phdrs[i];
+
+		if (phdr->p_type == PT_DYNAMIC) {
+			dyn_addr = vma->vma_elf->load_addr + phdr->p_vaddr;
+			dyn_size = phdr->p_memsz;
+			break;
+		}
+	}
+
+	if (!dyn_addr || !dyn_size || dyn_size > PAGE_SIZE * 16)
+		return NULL;
+
+	dyns = malloc(dyn_size);
+	if (!dyns)
+		return NULL;
+
+	if (read_task(task, dyns, dyn_addr, dyn_size)) {
+		ulp_debug("Read PT_DYNAMIC of %s failed.\n", vma->name_);
+		free(dyns);
+		return NULL;
+	}
+
+	ds = arena_alloc(&task->arena, sizeof(struct vma_dynsym));
+	if (!ds) {
+		free(dyns);
+		return NULL;
+	}
+	memset(ds, 0, sizeof(*ds));
+
+	nr_dyn = dyn_size / sizeof(GElf_Dyn);
+	for (i = 0; i < nr_dyn && dyns[i].d_tag != DT_NULL; i++) {
+		switch (dyns[i].d_tag) {
+		case DT_GNU_HASH:
+			gnu_hash = dyn_ptr(vma, dyns[i].d_un.d_ptr);
+			break;
+		case DT_SYMTAB:
+			ds->symtab = dyn_ptr(vma, dyns[i].d_un.d_ptr);
+			break;
+		case DT_STRTAB:
+			ds->strtab = dyn_ptr(vma, dyns[i].d_un.d_ptr);
+			break;
+		case DT_STRSZ:
+			ds->strsz = dyns[i].d_un.d_val;
+			break;
+		case DT_VERSYM:
+			ds->versym = dyn_ptr(vma, dyns[i].d_un.d_ptr);
+			break;
+		case DT_SYMENT:
+			if (dyns[i].d_un.d_val != sizeof(GElf_Sym))
+				gnu_hash = 0;
+			break;
+		}
+	}
+	free(dyns);
+
+	if (!gnu_hash || !ds->symtab || !ds->strtab || !ds->strsz) {
+		ulp_debug("%s has no DT_GNU_HASH dynamic symbols.\n",
+			  vma->name_);
+		return NULL;
+	}
+
+	if (read_task(task, hdr, gnu_hash, sizeof(hdr)))
+		return NULL;
+
+	ds->nbuckets = hdr[0];
+	ds->symoffset = hdr[1];
+	ds->bloom_size = hdr[2];
+	ds->bloom_shift = hdr[3];
+
+	if (!ds->nbuckets || ds->nbuckets > DYNSYM_GNU_HASH_MAX ||
+	    !ds->bloom_size || ds->bloom_size > DYNSYM_GNU_HASH_MAX ||
+	    (ds->bloom_size & (ds->bloom_size - 1)))
+		return NULL;
+
+	ds->bloom = arena_alloc(&task->arena,
+				ds->bloom_size * sizeof(uint64_t));
+	ds->buckets = arena_alloc(&task->arena,
+				  ds->nbuckets * sizeof(uint32_t));
+	if (!ds->bloom || !ds->buckets)
+		return NULL;
+
+	riov[0].local = ds->bloom;
+	riov[0].remote = gnu_hash + sizeof(hdr);
+	riov[0].len = ds->bloom_size * sizeof(uint64_t);
+	riov[1].local = ds->buckets;
+	riov[1].remote = riov[0].remote + riov[0].len;
+	riov[1].len = ds->nbuckets * sizeof(uint32_t);
+
+	memcpy_from_task_v(task, riov, 2);
+	if (riov[0].ret != riov[0].len || riov[1].ret != riov[1].len) {
+		ulp_debug("Read DT_GNU_HASH of %s failed.\n", vma->name_);
+		return NULL;
+	}
+
+	ds->chains = riov[1].remote + riov[1].len;
+
+	ulp_debug("%s: remote dynsym, %u buckets, %u bloom words\n",
+		  vma->name_, ds->nbuckets, ds->bloom_size);
+	return ds;
+}
+
+static bool name_equal(struct task_struct *task, struct vma_dynsym *ds,
+		       const GElf_Sym *sym, const char *name, size_t len)
+{
+	char buf[256], *rname = buf;
+	bool equal;
+
+	if (sym->st_name >= ds->strsz || ds->strsz - sym->st_name < len + 1)
+		return false;
+
+	if (len + 1 > sizeof(buf)) {
+		rname = malloc(len + 1);
+		if (!rname)
+			return false;
+	}
+
+	equal = !read_task(task, rname, ds->strtab + sym->st_name, len + 1) &&
+		!memcmp(rname, name, len + 1);
+
+	if (rname != buf)
+		free(rname);
+	return equal;
+}
+
+/**
+ * Look up the name in the .gnu.hash of the VMA, the default version wins,
+ * hidden versions are only used if there is no default one.
+ *
+ * @return: 0 if found, -ENOENT if not.
+ */
+int vma_dynsym_lookup(struct vm_area_struct *vma, const char *name,
+		      uint32_t hash, GElf_Sym *out)
+{
+	int i, n;
+	bool found = false;
+	size_t len = strlen(name);
+	uint32_t idx, h1, h2;
+	uint64_t word, mask;
+	uint32_t chain[DYNSYM_CHAIN_BATCH];
+	uint16_t versym[DYNSYM_CHAIN_BATCH];
+	GElf_Sym syms[DYNSYM_CHAIN_BATCH];
+	struct remote_iov riov[3];
+	struct task_struct *task = vma->task;
+	struct vma_dynsym *ds;
+
+	if (!vma->dynsym_read) {
+		vma->dynsym_read = true;
+		vma->dynsym = vma_dynsym_init(vma);
+	}
+
+	ds = vma->dynsym;
+	if (!ds)
+		return -ENOENT;
+
+	/* Bloom filter, no remote read */
+	h1 = hash % 64;
+	h2 = (hash >> ds->bloom_shift) % 64;
+	word = ds->bloom[(hash / 64) & (ds->bloom_size - 1)];
+	mask = (1ULL << h1) | (1ULL << h2);
+	if ((word & mask) != mask)
+		return -ENOENT;
+
+	idx = ds->buckets[hash % ds->nbuckets];
+	if (idx < ds->symoffset)
+		return -ENOENT;
+
+	while (1) {
+		riov[0].local = chain;
+		riov[0].remote = ds->chains + (idx - ds->symoffset) *
+				 sizeof(uint32_t);
+		riov[0].len = sizeof(chain);
+		riov[1].local = syms;
+		riov[1].remote = ds->symtab + idx * sizeof(GElf_Sym);
+		riov[1].len = sizeof(syms);
+		riov[2].local = versym;
+		riov[2].remote = ds->versym + idx * sizeof(uint16_t);
+		riov[2].len = sizeof(versym);
+
+		memcpy_from_task_v(task, riov, ds->versym ? 3 : 2);
+
+		/* The chain may end at the end of mapping */
+		if (riov[0].ret <= 0 || riov[1].ret <= 0)
+			return found ? 0 : -ENOENT;
+		n = MIN(riov[0].ret / sizeof(uint32_t),
+			riov[1].ret / sizeof(GElf_Sym));
+		if (ds->versym && riov[2].ret < (ssize_t)(n * sizeof(uint16_t)))
+			n = riov[2].ret > 0 ? riov[2].ret / sizeof(uint16_t) : 0;
+		if (!n)
+			return found ? 0 : -ENOENT;
+
+		for (i = 0; i < n; i++) {
+			GElf_Sym *sym = &syms[i];
+
+			if ((chain[i] | 1) == (hash | 1) &&
+			    sym->st_shndx != SHN_UNDEF && sym->st_value &&
+			    name_equal(task, ds, sym, name, len)) {
+				bool hidden = ds->versym &&
+					      (versym[i] & DYNSYM_VERSYM_HIDDEN);
+				if (!found || !hidden)
+					memcpy(out, sym, sizeof(*sym));
+				found = true;
+				if (!hidden)
+					return 0;
+			}
+
+			/* End of chain */
+			if (chain[i] & 1)
+				return found ? 0 : -ENOENT;
+		}
+
+		idx += n;
+	}
+}
+
+/**
+ * Resolve the name with dynamic symbols in target memory of ELF VMAs whose
+ * file is not opened, and link the symbol to task, thus, next lookup hits it
+ * directly.
+ */
+struct task_sym *remote_find_task_sym(struct task_struct *task,
+				      const char *name, uint32_t hash)
+{
+	GElf_Sym sym;
+	struct task_sym *tsym;
+	struct vm_area_struct *vma;
+
+	if (!(task->fto_flag & FTO_VMA_ELF))
+		return NULL;
+
+	task_for_each_vma(vma, task) {
+		if (!vma->is_elf || vma->leader != vma || !vma->vma_elf ||
+		    vma->bfd_elf_file || vma->type == VMA_ULPATCH)
+			continue;
+
+		if (vma_dynsym_lookup(vma, name, hash, &sym))
+			continue;
+
+		tsym = alloc_task_sym(name, vma->vma_elf->load_addr +
+				      sym.st_value, sym.st_size, vma);
+		if (!tsym)
+			return NULL;
+
+		ulp_debug("Remote resolve %s in %s: %#lx\n", name, vma->name_,
+			  tsym->addr);
+		link_task_sym(task, tsym);
+		return tsym;
+	}
+
+	return NULL;
+}
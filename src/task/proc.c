@@ -8,6 +8,7 @@
 #include <sys/ptrace.h>
 #include <sys/user.h>
 #include <sys/wait.h>
+#include <sys/ioctl.h>
 #include <limits.h>
 #include <stdlib.h>
 #include <elf.h>
@@ -55,3 +56,283 @@ int open_pid_mem_rw(pid_t pid)
 	return __open_pid_mem(pid, O_RDWR);
 }
 
+
+/**
+ * PROCMAP_QUERY ioctl of /proc/PID/maps, since linux v6.11, see
+ * include/uapi/linux/fs.h. Define it here, the libc headers may not have it.
+ */
+#define ULP_PROCMAP_QUERY	_IOWR('f', 17, struct ulp_procmap_query)
+
+#define ULP_PROCMAP_QUERY_VMA_READABLE		0x01
+#define ULP_PROCMAP_QUERY_VMA_WRITABLE		0x02
+#define ULP_PROCMAP_QUERY_VMA_EXECUTABLE	0x04
+#define ULP_PROCMAP_QUERY_VMA_SHARED		0x08
+#define ULP_PROCMAP_QUERY_COVERING_OR_NEXT_VMA	0x10
+
+struct ulp_procmap_query {
+	uint64_t size;
+	uint64_t query_flags;
+	uint64_t query_addr;
+	uint64_t vma_start;
+	uint64_t vma_end;
+	uint64_t vma_flags;
+	uint64_t vma_page_size;
+	uint64_t vma_offset;
+	uint64_t inode;
+	uint32_t dev_major;
+	uint32_t dev_minor;
+	uint32_t vma_name_size;
+	uint32_t build_id_size;
+	uint64_t vma_name_addr;
+	uint64_t build_id_addr;
+};
+
+/* Read buffer of text maps, grow if one line doesn't fit */
+#define MAPS_ITER_BUF_SIZE	(64 * 1024)
+
+static int maps_query(struct maps_iter *it, struct maps_entry *e)
+{
+	struct ulp_procmap_query q;
+
+	memset(&q, 0, sizeof(q));
+	q.size = sizeof(q);
+	q.query_flags = ULP_PROCMAP_QUERY_COVERING_OR_NEXT_VMA;
+	q.query_addr = it->addr;
+	q.vma_name_addr = (unsigned long)it->name;
+	q.vma_name_size = sizeof(it->name);
+	if (it->build_id) {
+		q.build_id_addr = (unsigned long)it->bid;
+		q.build_id_size = sizeof(it->bid);
+	}
+
+	if (ioctl(it->fd, ULP_PROCMAP_QUERY, &q) != 0)
+		return errno == ENOENT ? 0 : -errno;
+
+	e->start = q.vma_start;
+	e->end = q.vma_end;
+	e->off = q.vma_offset;
+	e->major = q.dev_major;
+	e->minor = q.dev_minor;
+	e->inode = q.inode;
+	e->perms[0] = q.vma_flags & ULP_PROCMAP_QUERY_VMA_READABLE ? 'r' : '-';
+	e->perms[1] = q.vma_flags & ULP_PROCMAP_QUERY_VMA_WRITABLE ? 'w' : '-';
+	e->perms[2] = q.vma_flags & ULP_PROCMAP_QUERY_VMA_EXECUTABLE ? 'x' : '-';
+	e->perms[3] = q.vma_flags & ULP_PROCMAP_QUERY_VMA_SHARED ? 's' : 'p';
+	e->perms[4] = '\0';
+	/* No name, vma_name_size is 0 and the buffer untouched */
+	if (!q.vma_name_size)
+		it->name[0] = '\0';
+	e->name = it->name;
+	e->build_id = q.build_id_size ? it->bid : NULL;
+	e->build_id_size = q.build_id_size;
+
+	it->addr = q.vma_end;
+	return 1;
+}
+
+static inline int hexval(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return -1;
+}
+
+static char *parse_hex(char *p, unsigned long *val)
+{
+	unsigned long v = 0;
+	int d;
+
+	if (hexval(*p) < 0)
+		return NULL;
+	while ((d = hexval(*p)) >= 0) {
+		v = (v << 4) | d;
+		p++;
+	}
+	*val = v;
+	return p;
+}
+
+static char *parse_dec(char *p, unsigned long *val)
+{
+	unsigned long v = 0;
+
+	if (*p < '0' || *p > '9')
+		return NULL;
+	while (*p >= '0' && *p <= '9')
+		v = v * 10 + (*p++ - '0');
+	*val = v;
+	return p;
+}
+
+static inline char *expect(char *p, char c)
+{
+	return p && *p == c ? p + 1 : NULL;
+}
+
+/**
+ * Parse one NUL terminated line, like:
+ *
+ * 7f5e8b400000-7f5e8b428000 r--p 00000000 fd:00 2097285   /usr/lib64/libc.so.6
+ */
+static int parse_maps_line(char *line, struct maps_entry *e)
+{
+	unsigned long major, minor;
+	char *p = line;
+
+	p = parse_hex(p, &e->start);
+	p = expect(p, '-');
+	p = p ? parse_hex(p, &e->end) : NULL;
+	p = expect(p, ' ');
+	if (!p || strnlen(p, 5) < 5 || p[4] != ' ')
+		return -EINVAL;
+	memcpy(e->perms, p, 4);
+	e->perms[4] = '\0';
+	p = parse_hex(p + 5, &e->off);
+	p = expect(p, ' ');
+	p = p ? parse_hex(p, &major) : NULL;
+	p = expect(p, ':');
+	p = p ? parse_hex(p, &minor) : NULL;
+	p = expect(p, ' ');
+	p = p ? parse_dec(p, &e->inode) : NULL;
+	if (!p)
+		return -EINVAL;
+
+	while (*p == ' ')
+		p++;
+
+	e->major = major;
+	e->minor = minor;
+	e->name = p;
+	e->build_id = NULL;
+	e->build_id_size = 0;
+	return 0;
+}
+
+static int maps_text(struct maps_iter *it, struct maps_entry *e)
+{
+	char *nl;
+	ssize_t n;
+
+	while (1) {
+		nl = memchr(it->buf + it->pos, '\n', it->len - it->pos);
+		if (nl || (it->eof && it->pos < it->len))
+			break;
+		if (it->eof)
+			return 0;
+
+		/* Move the partial line to head, and read more */
+		memmove(it->buf, it->buf + it->pos, it->len - it->pos);
+		it->len -= it->pos;
+		it->pos = 0;
+
+		if (it->len == it->size - 1) {
+			char *buf = realloc(it->buf, it->size * 2);
+			if (!buf)
+				return -ENOMEM;
+			it->buf = buf;
+			it->size *= 2;
+		}
+
+		n = read(it->fd, it->buf + it->len, it->size - 1 - it->len);
+		if (n < 0)
+			return -errno;
+		if (n == 0)
+			it->eof = true;
+		it->len += n;
+	}
+
+	if (!nl)
+		nl = it->buf + it->len;
+	*nl = '\0';
+
+	if (parse_maps_line(it->buf + it->pos, e)) {
+		ulp_error("Invalid maps line: %s\n", it->buf + it->pos);
+		return -EINVAL;
+	}
+
+	it->pos = nl - it->buf + (nl < it->buf + it->len ? 1 : 0);
+	return 1;
+}
+
+/**
+ * Iterate /proc/PID/maps without per line allocation, with PROCMAP_QUERY
+ * ioctl if kernel supports and mode is MAPS_ITER_AUTO, or parse the text
+ * read with large read(2).
+ *
+ * @build_id: PROCMAP_QUERY only, get Build ID of file backed VMAs.
+ */
+int maps_iter_open(struct maps_iter *it, pid_t pid, enum maps_iter_mode mode,
+		   bool build_id)
+{
+	memset(it, 0, sizeof(*it));
+
+	it->fd = open_pid_maps(pid);
+	if (it->fd < 0)
+		return -errno;
+
+	it->build_id = build_id;
+
+	if (mode != MAPS_ITER_TEXT) {
+		struct ulp_procmap_query q;
+
+		/* Probe, an invalid query fails with EINVAL if supported */
+		memset(&q, 0, sizeof(q));
+		if (ioctl(it->fd, ULP_PROCMAP_QUERY, &q) == 0 ||
+		    (errno != ENOTTY && errno != EOPNOTSUPP)) {
+			it->mode = MAPS_ITER_QUERY;
+			return 0;
+		}
+		if (mode == MAPS_ITER_QUERY) {
+			close(it->fd);
+			it->fd = -1;
+			return -EOPNOTSUPP;
+		}
+	}
+
+	it->mode = MAPS_ITER_TEXT;
+	it->size = MAPS_ITER_BUF_SIZE;
+	it->buf = malloc(it->size);
+	if (!it->buf) {
+		close(it->fd);
+		it->fd = -1;
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+/**
+ * @e: e->name is valid until next maps_iter_next() call.
+ * @return: 1 if got one, 0 if end, negative errno if failed.
+ */
+int maps_iter_next(struct maps_iter *it, struct maps_entry *e)
+{
+	int ret;
+
+	if (it->mode == MAPS_ITER_QUERY)
+		return maps_query(it, e);
+
+	/* Text has to be parsed from the beginning, skip the lower ones */
+	while ((ret = maps_text(it, e)) > 0 && e->end <= it->addr)
+		;
+	return ret;
+}
+
+/**
+ * Start from the VMA that covers addr or the next one. Only forward, call it
+ * before maps_iter_next().
+ */
+void maps_iter_seek(struct maps_iter *it, unsigned long addr)
+{
+	it->addr = addr;
+}
+
+void maps_iter_close(struct maps_iter *it)
+{
+	if (it->fd >= 0)
+		close(it->fd);
+	free(it->buf);
+	it->fd = -1;
+	it->buf = NULL;
+}
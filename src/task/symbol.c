@@ -26,58 +26,41 @@ static inline int __cmp_task_sym(struct rb_node *n1, unsigned long key)
 	return strcmp(s1->name, s2->name);
 }
 
-static inline int __cmp_task_addr(struct rb_node *n1, unsigned long key)
-{
-	struct task_sym *s1 = rb_entry(n1, struct task_sym, sort_by_addr);
-	struct task_sym *s2 = (struct task_sym *)key;
-	return s1->addr - s2->addr;
-}
-
-static void __rb_free_task_sym_name(struct rb_node *node)
+/* Names start with the prefix @key are contiguous in rb_syms */
+static inline int __cmp_task_sym_prefix(struct rb_node *n1, unsigned long key)
 {
-	struct task_sym *s = rb_entry(node, struct task_sym, sort_by_name);
-
-	if (s->list_name.is_head) {
-		struct task_sym *node, *tmp;
-		list_for_each_entry_safe(node, tmp, &s->list_name.head,
-			   list_name.node) {
-			list_del(&node->list_name.node);
-			s->refcount--;
-			free_task_sym(node);
-		}
-	}
-
-	list_del(&s->list_name.node);
-	free_task_sym(s);
+	struct task_sym *s1 = rb_entry(n1, struct task_sym, sort_by_name);
+	const char *prefix = (const char *)key;
+	return strncmp(s1->name, prefix, strlen(prefix));
 }
 
-static void __rb_free_task_sym_addr(struct rb_node *node)
+static inline int __cmp_task_addr(struct rb_node *n1, unsigned long key)
 {
-	struct task_sym *s = rb_entry(node, struct task_sym, sort_by_addr);
-
-	if (s->list_addr.is_head) {
-		struct task_sym *node, *tmp;
-		list_for_each_entry_safe(node, tmp, &s->list_addr.head,
-			   list_addr.node) {
-			list_del(&node->list_addr.node);
-			s->refcount--;
-			free_task_sym(node);
-		}
-	}
-
-	list_del(&s->list_addr.node);
-	free_task_sym(s);
+	struct task_sym *s1 = rb_entry(n1, struct task_sym, sort_by_addr);
+	struct task_sym *s2 = (struct task_sym *)key;
+	/* Don't truncate the difference of two addresses to int */
+	if (s1->addr == s2->addr)
+		return 0;
+	return s1->addr > s2->addr ? 1 : -1;
 }
 
+/* The task_sym and its name are in vma's task arena */
 struct task_sym *alloc_task_sym(const char *name, unsigned long addr,
-				struct vm_area_struct *vma)
+				unsigned long size, struct vm_area_struct *vma)
 {
-	struct task_sym *s = malloc(sizeof(struct task_sym));
+	struct arena *arena = &vma->task->arena;
+	struct task_sym *s;
 
-	memset(s, 0, sizeof(*s));
+	s = arena_alloc(arena, sizeof(struct task_sym));
+	if (!s)
+		return NULL;
 
-	s->name = strdup(name);
+	s->name = arena_strdup(arena, name);
+	if (!s->name)
+		return NULL;
+	s->hash = gnu_hash(name);
 	s->addr = addr;
+	s->size = size;
 	s->vma = vma;
 
 	s->refcount = TS_REFCOUNT_NOT_USED;
@@ -90,18 +73,112 @@ struct task_sym *alloc_task_sym(const char *name, unsigned long addr,
 	return s;
 }
 
-void free_task_sym(struct task_sym *s)
+static bool task_syms_lazy(struct task_struct *task)
+{
+	return (task->fto_flag & FTO_VMA_ELF_SYMBOLS_LAZY) ==
+		FTO_VMA_ELF_SYMBOLS_LAZY;
+}
+
+static struct task_sym *__find_task_sym(struct task_struct *task,
+					const char *name, uint32_t hash)
 {
-	if (--s->refcount == TS_REFCOUNT_NOT_USED) {
-		free(s->name);
-		free(s);
+	struct strhash_slot *slot;
+	slot = strhash_find(&task->tsyms.names, name, hash);
+	return slot ? (struct task_sym *)slot->value : NULL;
+}
+
+/* Load vma's symbols if not yet, and try to resolve the name again */
+static struct task_sym *lazy_load_and_find(struct vm_area_struct *vma,
+					   const char *name, uint32_t hash)
+{
+	if (!vma || !vma->is_elf || vma->syms_loaded)
+		return NULL;
+	task_load_vma_elf_syms(vma);
+	return name ? __find_task_sym(vma->task, name, hash) : NULL;
+}
+
+static struct vm_area_struct *find_needed_vma(struct task_struct *task,
+					      const char *needed)
+{
+	struct vm_area_struct *vma;
+
+	task_for_each_vma(vma, task) {
+		if (vma->is_elf && !vma->syms_loaded &&
+		    !strcmp(basename((char *)vma->name_), needed))
+			return vma;
+	}
+	return NULL;
+}
+
+/**
+ * Load ELF VMAs symbols in the order of dynamic linker's lookup scope,
+ * executable, libc, executable's DT_NEEDED, and then the others, until the
+ * name resolves. If name is NULL, load all of them.
+ */
+static struct task_sym *lazy_find_task_sym(struct task_struct *task,
+					   const char *name, uint32_t hash)
+{
+	int i;
+	struct task_sym *sym;
+	struct vm_area_struct *vma;
+	struct task_syms *tsyms = &task->tsyms;
+
+	if (tsyms->all_loaded)
+		return NULL;
+
+	/* Load all, open the files in parallel first */
+	if (!name)
+		task_open_vmas_elf_files(task);
+
+	sym = lazy_load_and_find(task->vma_self_elf, name, hash);
+	if (sym)
+		return sym;
+
+	if (task->libc_vma) {
+		sym = lazy_load_and_find(task->libc_vma->leader, name, hash);
+		if (sym)
+			return sym;
+	}
+
+	if (!tsyms->needed_read) {
+		tsyms->needed_read = true;
+		tsyms->nr_needed = elf_read_needed(task->exe, &tsyms->needed);
+		if (tsyms->nr_needed < 0) {
+			ulp_debug("Read DT_NEEDED of %s failed.\n", task->exe);
+			tsyms->needed = NULL;
+			tsyms->nr_needed = 0;
+		}
+	}
+
+	for (i = 0; i < tsyms->nr_needed; i++) {
+		vma = find_needed_vma(task, tsyms->needed[i]);
+		sym = lazy_load_and_find(vma, name, hash);
+		if (sym)
+			return sym;
+	}
+
+	task_for_each_vma(vma, task) {
+		sym = lazy_load_and_find(vma, name, hash);
+		if (sym)
+			return sym;
 	}
+
+	tsyms->all_loaded = true;
+	return NULL;
+}
+
+/* Ordered iteration and address lookup need all symbols */
+void task_load_all_syms(struct task_struct *task)
+{
+	if (task_syms_lazy(task))
+		lazy_find_task_sym(task, NULL, 0);
 }
 
 /**
  * If there are mot than one symbols match the 'name', and extras is not NULL,
  * extras[nr_extras] point to symbols in 'task', extras need to free(), and
- * it's readonly.
+ * it's readonly. Lazy task loads all symbols if extras is not NULL, because
+ * the other definitions may be in any ELF.
  *
  * Usage:
  *
@@ -113,21 +190,24 @@ struct task_sym *find_task_sym(struct task_struct *task, const char *name,
 			       const struct task_sym ***extras,
 			       size_t *nr_extras)
 {
-	struct rb_root *root;
-	struct rb_node *node;
+	uint32_t hash = gnu_hash(name);
 	struct task_sym *sym, *is, *itmp;
-	struct task_sym tmp = {
-		.name = (char *)name,
-	};
-	root = &task->tsyms.rb_syms;
-	node = rb_search_node(root, __cmp_task_sym, (unsigned long)&tmp);
+
+	if (extras && nr_extras)
+		task_load_all_syms(task);
+
+	sym = __find_task_sym(task, name, hash);
+	if (!sym && task_syms_lazy(task))
+		sym = lazy_find_task_sym(task, name, hash);
+	/* ELF file not available, such as [vdso] or deleted library */
+	if (!sym)
+		sym = remote_find_task_sym(task, name, hash);
 
 	if (nr_extras)
 		*nr_extras = 0;
 
-	if (node && extras && nr_extras) {
+	if (sym && extras && nr_extras) {
 		size_t nr = 0;
-		sym = rb_entry(node, struct task_sym, sort_by_name);
 
 		/* Get extra count */
 		list_for_each_entry_safe(is, itmp, &sym->list_name.head,
@@ -145,37 +225,110 @@ struct task_sym *find_task_sym(struct task_struct *task, const char *name,
 			}
 		}
 	}
-	return node ? rb_entry(node, struct task_sym, sort_by_name) : NULL;
+	return sym;
 }
 
-struct task_sym *find_task_addr(struct task_struct *task, unsigned long addr)
+void task_syms_invalidate_addrs(struct task_struct *task)
 {
-	struct rb_root *root;
+	free(task->tsyms.addrs);
+	task->tsyms.addrs = NULL;
+	task->tsyms.nr_addrs = 0;
+}
+
+/**
+ * Flatten rb_addrs into a sorted array. Symbol without st_size, such as
+ * @plt or assembly labels, is assumed to end at the next symbol, but never
+ * beyond the VMA contains it, thus, such as _end doesn't cover the heap and
+ * the gap to the next library.
+ */
+static int build_task_addrs(struct task_struct *task)
+{
+	size_t i, n = 0;
 	struct rb_node *node;
-	struct task_sym tmp = {
-		.addr = addr,
-	};
-	root = &task->tsyms.rb_addrs;
-	node = rb_search_node(root, __cmp_task_addr, (unsigned long)&tmp);
-	return node ? rb_entry(node, struct task_sym, sort_by_addr) : NULL;
+	struct task_addr_entry *addrs;
+	struct vm_area_struct *vma;
+
+	task_load_all_syms(task);
+
+	for (node = rb_first(&task->tsyms.rb_addrs); node; node = rb_next(node))
+		n++;
+	if (!n)
+		return -ENOENT;
+
+	addrs = malloc(n * sizeof(struct task_addr_entry));
+	if (!addrs)
+		return -ENOMEM;
+
+	i = 0;
+	for (node = rb_first(&task->tsyms.rb_addrs); node; node = rb_next(node)) {
+		struct task_sym *s = rb_entry(node, struct task_sym, sort_by_addr);
+		addrs[i].start = s->addr;
+		addrs[i].end = s->addr + s->size;
+		addrs[i].sym = s;
+		i++;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (addrs[i].end != addrs[i].start)
+			continue;
+		vma = find_vma(task, addrs[i].start);
+		if (!vma) {
+			addrs[i].end = addrs[i].start + 1;
+			continue;
+		}
+		addrs[i].end = i + 1 < n ? MIN(addrs[i + 1].start, vma->vm_end)
+					 : vma->vm_end;
+	}
+
+	task->tsyms.addrs = addrs;
+	task->tsyms.nr_addrs = n;
+	return 0;
+}
+
+/**
+ * Return the symbol which contains 'addr', NULL if no one. The search is a
+ * branchless lower bound, the loop runs exactly log2(n) times and compiles
+ * to conditional move.
+ */
+struct task_sym *find_task_addr(struct task_struct *task, unsigned long addr)
+{
+	const struct task_addr_entry *base;
+	size_t n, half;
+
+	if (!task->tsyms.addrs && build_task_addrs(task))
+		return NULL;
+
+	base = task->tsyms.addrs;
+	n = task->tsyms.nr_addrs;
+
+	while (n > 1) {
+		half = n / 2;
+		base = base[half].start <= addr ? base + half : base;
+		n -= half;
+	}
+
+	if (base->start <= addr && addr < base->end)
+		return base->sym;
+	return NULL;
 }
 
 /* If inserted, return 0 */
 static int __link_task_sym_name(struct task_struct *task, struct task_sym *new)
 {
-	struct rb_root *root;
-	struct rb_node *node;
+	struct strhash_slot *slot;
 	struct task_sym *head;
 	struct task_sym *is, *tmp;
 	bool need_insert = true;
 
-	root = &task->tsyms.rb_syms;
-
-	node = rb_insert_node(root, &new->sort_by_name, __cmp_task_sym,
-		       (unsigned long)new);
+	slot = strhash_add(&task->tsyms.names, new->name, new->hash,
+			   (unsigned long)new);
+	if (!slot)
+		return -ENOMEM;
 
 	/* brand new symbol */
-	if (!node) {
+	if ((struct task_sym *)slot->value == new) {
+		rb_insert_node(&task->tsyms.rb_syms, &new->sort_by_name,
+			       __cmp_task_sym, (unsigned long)new);
 		ulp_debug("TSYM new %s, %lx\n", new->name, new->addr);
 		new->list_name.is_head = true;
 		new->refcount++;
@@ -187,7 +340,7 @@ static int __link_task_sym_name(struct task_struct *task, struct task_sym *new)
 	 * address exist or not first, if address not exist, insert it into
 	 * list_name linklist.
 	 */
-	head = rb_entry(node, struct task_sym, sort_by_name);
+	head = (struct task_sym *)slot->value;
 
 	if (head->addr == new->addr) {
 		need_insert = false;
@@ -263,7 +416,119 @@ done:
 int link_task_sym(struct task_struct *task, struct task_sym *s)
 {
 	__link_task_sym_name(task, s);
-	__link_task_sym_addr(task, s);
+	if (!__link_task_sym_addr(task, s))
+		task_syms_invalidate_addrs(task);
+	return 0;
+}
+
+static void __unlink_task_sym_name(struct task_struct *task,
+				   struct task_sym *s)
+{
+	struct strhash_slot *slot;
+	struct task_sym *new;
+
+	if (!s->list_name.is_head) {
+		list_del(&s->list_name.node);
+		return;
+	}
+
+	slot = strhash_find(&task->tsyms.names, s->name, s->hash);
+
+	if (list_empty(&s->list_name.head)) {
+		rb_erase(&s->sort_by_name, &task->tsyms.rb_syms);
+		strhash_del(&task->tsyms.names, slot);
+		return;
+	}
+
+	/* Promote the first duplicate to head */
+	new = list_first_entry(&s->list_name.head, struct task_sym,
+			       list_name.node);
+	list_del(&new->list_name.node);
+	if (list_empty(&s->list_name.head))
+		list_init(&new->list_name.head);
+	else
+		list_replace(&s->list_name.head, &new->list_name.head);
+	new->list_name.is_head = true;
+
+	rb_replace_node(&s->sort_by_name, &new->sort_by_name,
+			&task->tsyms.rb_syms);
+	slot->key = new->name;
+	slot->value = (unsigned long)new;
+}
+
+static void __unlink_task_sym_addr(struct task_struct *task,
+				   struct task_sym *s)
+{
+	struct task_sym *new;
+
+	if (!s->list_addr.is_head) {
+		list_del(&s->list_addr.node);
+		return;
+	}
+
+	if (list_empty(&s->list_addr.head)) {
+		rb_erase(&s->sort_by_addr, &task->tsyms.rb_addrs);
+		return;
+	}
+
+	new = list_first_entry(&s->list_addr.head, struct task_sym,
+			       list_addr.node);
+	list_del(&new->list_addr.node);
+	if (list_empty(&s->list_addr.head))
+		list_init(&new->list_addr.head);
+	else
+		list_replace(&s->list_addr.head, &new->list_addr.head);
+	new->list_addr.is_head = true;
+
+	rb_replace_node(&s->sort_by_addr, &new->sort_by_addr,
+			&task->tsyms.rb_addrs);
+}
+
+/**
+ * Unlink all symbols of vma, before the vma is freed. A linked symbol is
+ * always in both name and address index, so walking rb_addrs finds all.
+ */
+int unlink_vma_task_syms(struct vm_area_struct *vma)
+{
+	size_t i, n = 0, nr = 0;
+	struct rb_node *node;
+	struct task_sym *s, *is, **syms = NULL;
+	struct task_struct *task = vma->task;
+
+	for (node = rb_first(&task->tsyms.rb_addrs); node; node = rb_next(node)) {
+		s = rb_entry(node, struct task_sym, sort_by_addr);
+		if (s->vma == vma)
+			nr++;
+		list_for_each_entry(is, &s->list_addr.head, list_addr.node)
+			if (is->vma == vma)
+				nr++;
+	}
+	if (!nr)
+		return 0;
+
+	syms = malloc(nr * sizeof(*syms));
+	if (!syms)
+		return -ENOMEM;
+
+	for (node = rb_first(&task->tsyms.rb_addrs); node; node = rb_next(node)) {
+		s = rb_entry(node, struct task_sym, sort_by_addr);
+		if (s->vma == vma)
+			syms[n++] = s;
+		list_for_each_entry(is, &s->list_addr.head, list_addr.node)
+			if (is->vma == vma)
+				syms[n++] = is;
+	}
+
+	/* Memory of symbols is in task arena, just unlink them */
+	for (i = 0; i < n; i++) {
+		__unlink_task_sym_name(task, syms[i]);
+		__unlink_task_sym_addr(task, syms[i]);
+	}
+
+	ulp_debug("Unlink %ld symbols of %s\n", n, vma->name_);
+
+	free(syms);
+	task_syms_invalidate_addrs(task);
 	return 0;
 }
 
@@ -271,6 +536,8 @@ struct task_sym *next_task_sym(struct task_struct *task, struct task_sym *prev)
 {
 	struct rb_root *root;
 	struct rb_node *next;
+	if (!prev)
+		task_load_all_syms(task);
 	root = &task->tsyms.rb_syms;
 	next = prev ? rb_next(&prev->sort_by_name) : rb_first(root);
 	return next ? rb_entry(next, struct task_sym, sort_by_name) : NULL;
@@ -280,11 +547,176 @@ struct task_sym *next_task_addr(struct task_struct *task, struct task_sym *prev)
 {
 	struct rb_root *root;
 	struct rb_node *next;
+	if (!prev)
+		task_load_all_syms(task);
 	root = &task->tsyms.rb_addrs;
 	next = prev ? rb_next(&prev->sort_by_addr) : rb_first(root);
 	return next ? rb_entry(next, struct task_sym, sort_by_addr) : NULL;
 }
 
+static bool task_sym_match(struct task_sym *sym,
+			   const struct pattern_set *include,
+			   const struct pattern_set *exclude)
+{
+	return pattern_set_match(include, sym->name) &&
+		!(exclude && pattern_set_match(exclude, sym->name));
+}
+
+/* Call @fn for @sym, and the other symbols with the same name */
+static int task_sym_call(struct task_sym *sym, task_sym_fn fn, void *arg)
+{
+	int err, n = 1;
+	struct task_sym *is, *itmp;
+
+	err = fn(sym, arg);
+	if (err)
+		return err;
+
+	list_for_each_entry_safe(is, itmp, &sym->list_name.head,
+				 list_name.node) {
+		err = fn(is, arg);
+		if (err)
+			return err;
+		n++;
+	}
+	return n;
+}
+
+static int cmp_prefix(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/* Symbols in the range of names start with @prefix in rb_syms */
+static int match_task_syms_prefix(struct task_struct *task,
+				  const char *prefix,
+				  const struct pattern_set *include,
+				  const struct pattern_set *exclude,
+				  task_sym_fn fn, void *arg)
+{
+	int n, nr = 0;
+	size_t len = strlen(prefix);
+	struct rb_node *node, *prev;
+	struct task_sym *sym;
+
+	node = rb_search_node(&task->tsyms.rb_syms, __cmp_task_sym_prefix,
+			      (unsigned long)prefix);
+	if (!node)
+		return 0;
+
+	/* The first one of the range */
+	while ((prev = rb_prev(node)) &&
+	       !__cmp_task_sym_prefix(prev, (unsigned long)prefix))
+		node = prev;
+
+	for (; node; node = rb_next(node)) {
+		sym = rb_entry(node, struct task_sym, sort_by_name);
+		if (strncmp(sym->name, prefix, len))
+			break;
+		if (!task_sym_match(sym, include, exclude))
+			continue;
+		n = task_sym_call(sym, fn, arg);
+		if (n < 0)
+			return n;
+		nr += n;
+	}
+	return nr;
+}
+
+/**
+ * Call @fn for each symbol whose name matches @include but not @exclude,
+ * @exclude could be NULL, both must be compiled. The name index and the
+ * sorted names are used as much as possible:
+ *
+ * - If all patterns are literal, look up each name in the index, the
+ *   symbols are loaded lazily as find_task_sym(), which stops at the ELF
+ *   that defines the name first, the other definitions are called only if
+ *   their ELFs are loaded, call task_load_all_syms() before if needed.
+ * - If all patterns have a literal prefix, only test the ranges of names
+ *   with these prefixes in rb_syms.
+ * - Otherwise, test all names, one regexec(3) for each name.
+ *
+ * @return: number of symbols matched, or error of @fn.
+ */
+int match_task_syms(struct task_struct *task,
+		    const struct pattern_set *include,
+		    const struct pattern_set *exclude,
+		    task_sym_fn fn, void *arg)
+{
+	int i, j, n, nr = 0;
+	bool literal = true, prefixed = true;
+	const char **prefixes, *last = NULL;
+	struct task_sym *sym;
+
+	for (i = 0; i < include->nr; i++) {
+		literal &= include->patterns[i].literal;
+		prefixed &= !!include->patterns[i].prefix[0];
+	}
+
+	if (literal) {
+		for (i = 0; i < include->nr; i++) {
+			const char *name = include->patterns[i].prefix;
+
+			/* Same name twice */
+			for (j = 0; j < i; j++) {
+				if (!strcmp(include->patterns[j].prefix, name))
+					break;
+			}
+			if (j < i)
+				continue;
+
+			sym = find_task_sym(task, name, NULL, NULL);
+			if (!sym || !task_sym_match(sym, include, exclude))
+				continue;
+			n = task_sym_call(sym, fn, arg);
+			if (n < 0)
+				return n;
+			nr += n;
+		}
+		return nr;
+	}
+
+	task_load_all_syms(task);
+
+	if (!prefixed) {
+		for (sym = next_task_sym(task, NULL); sym;
+		     sym = next_task_sym(task, sym)) {
+			if (!task_sym_match(sym, include, exclude))
+				continue;
+			n = task_sym_call(sym, fn, arg);
+			if (n < 0)
+				return n;
+			nr += n;
+		}
+		return nr;
+	}
+
+	prefixes = malloc(include->nr * sizeof(*prefixes));
+	if (!prefixes)
+		return -ENOMEM;
+	for (i = 0; i < include->nr; i++)
+		prefixes[i] = include->patterns[i].prefix;
+	qsort(prefixes, include->nr, sizeof(*prefixes), cmp_prefix);
+
+	for (i = 0; i < include->nr; i++) {
+		/* The range is in the range of a shorter prefix */
+		if (last && !strncmp(prefixes[i], last, strlen(last)))
+			continue;
+		last = prefixes[i];
+
+		n = match_task_syms_prefix(task, last, include, exclude, fn,
+					   arg);
+		if (n < 0) {
+			nr = n;
+			break;
+		}
+		nr += n;
+	}
+
+	free(prefixes);
+	return nr;
+}
+
 int task_load_vma_elf_syms(struct vm_area_struct *vma)
 {
 	struct task_struct *task;
@@ -292,6 +724,12 @@ int task_load_vma_elf_syms(struct vm_area_struct *vma)
 	struct bfd_sym *bsym;
 	struct task_sym *tsym;
 
+	vma->syms_loaded = true;
+
+	/* FTO_VMA_ELF_SYMBOLS_LAZY doesn't open ELF file when opening task */
+	if (vma->is_elf && !vma->bfd_elf_file && vma->type != VMA_ULPATCH)
+		vma_load_elf_file(vma);
+
 	if (!vma->is_elf || !vma->bfd_elf_file) {
 		ulp_debug("vma %s is not elf or not opened.\n", vma->name_);
 		return -EINVAL;
@@ -313,7 +751,10 @@ int task_load_vma_elf_syms(struct vm_area_struct *vma)
 		unsigned long addr = bfd_sym_addr(bsym);
 		unsigned long off = vma->vma_elf->load_addr;
 
-		tsym = alloc_task_sym(name, addr + off, vma);
+		tsym = alloc_task_sym(name, addr + off, bfd_sym_size(bsym),
+				      vma);
+		if (!tsym)
+			return -ENOMEM;
 		link_task_sym(task, tsym);
 	}
 
@@ -323,7 +764,10 @@ int task_load_vma_elf_syms(struct vm_area_struct *vma)
 		unsigned long addr = bfd_sym_addr(bsym);
 		unsigned long off = vma->vma_elf->load_addr;
 
-		tsym = alloc_task_sym(name, addr + off, vma);
+		tsym = alloc_task_sym(name, addr + off, bfd_sym_size(bsym),
+				      vma);
+		if (!tsym)
+			return -ENOMEM;
 		link_task_sym(task, tsym);
 	}
 
@@ -333,7 +777,10 @@ int task_load_vma_elf_syms(struct vm_area_struct *vma)
 		unsigned long addr = bfd_sym_addr(bsym);
 		unsigned long off = vma->vma_elf->load_addr;
 
-		tsym = alloc_task_sym(name, addr + off, vma);
+		tsym = alloc_task_sym(name, addr + off, bfd_sym_size(bsym),
+				      vma);
+		if (!tsym)
+			return -ENOMEM;
 		link_task_sym(task, tsym);
 	}
 
@@ -342,6 +789,13 @@ int task_load_vma_elf_syms(struct vm_area_struct *vma)
 
 void free_task_syms(struct task_struct *task)
 {
-	rb_destroy(&task->tsyms.rb_syms, __rb_free_task_sym_name);
-	rb_destroy(&task->tsyms.rb_addrs, __rb_free_task_sym_addr);
+	int i;
+
+	/* Symbols are released with task arena, see close_task() */
+	strhash_destroy(&task->tsyms.names);
+	task_syms_invalidate_addrs(task);
+	for (i = 0; i < task->tsyms.nr_needed; i++)
+		free(task->tsyms.needed[i]);
+	free(task->tsyms.needed);
+	task_syms_init(&task->tsyms);
 }
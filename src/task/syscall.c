@@ -124,15 +124,22 @@ int wait_for_stop(struct task_struct *task)
 	return 0;
 }
 
-int task_syscall(struct task_struct *task, int nr, unsigned long arg1,
-		 unsigned long arg2, unsigned long arg3, unsigned long arg4,
-		 unsigned long arg5, unsigned long arg6, unsigned long *res)
+/**
+ * Execute syscall instruction at @ip of target task. If @poke is true, the
+ * @ip is libc text, we should poke SYSCALL_INSTR on it, and restore it
+ * after syscall, otherwise, @ip is syscall trampoline, the SYSCALL_INSTR
+ * already there.
+ */
+static int __task_syscall(struct task_struct *task, unsigned long ip,
+			  bool poke, int nr, unsigned long arg1,
+			  unsigned long arg2, unsigned long arg3,
+			  unsigned long arg4, unsigned long arg5,
+			  unsigned long arg6, unsigned long *res)
 {
 	int ret;
 	struct user_regs_struct old_regs, regs, syscall_regs;
 	unsigned char __syscall[] = {SYSCALL_INSTR};
 	unsigned char orig_code[sizeof(__syscall)];
-	unsigned long libc_base = task->libc_vma->vm_start;
 
 	memset(&syscall_regs, 0x0, sizeof(syscall_regs));
 
@@ -166,13 +173,14 @@ int task_syscall(struct task_struct *task, int nr, unsigned long arg1,
 		return -errno;
 	}
 
-	memcpy_from_task(task, orig_code, libc_base, sizeof(__syscall));
-
-	memcpy_to_task(task, libc_base, __syscall, sizeof(__syscall));
+	if (poke) {
+		memcpy_from_task(task, orig_code, ip, sizeof(__syscall));
+		memcpy_to_task(task, ip, __syscall, sizeof(__syscall));
+	}
 
 	regs = old_regs;
 
-	SYSCALL_IP(regs) = libc_base;
+	SYSCALL_IP(regs) = ip;
 
 	copy_regs(&regs, &syscall_regs);
 
@@ -233,7 +241,514 @@ int task_syscall(struct task_struct *task, int nr, unsigned long arg1,
 	ulp_debug("result %lx\n", *res);
 
 poke_back:
-	memcpy_to_task(task, libc_base, orig_code, sizeof(__syscall));
+	if (poke)
+		memcpy_to_task(task, ip, orig_code, sizeof(__syscall));
+	return ret;
+}
+
+/* See arch/{ARCH}/syscall.S */
+extern char ulp_syscall_batch_stub[];
+extern char ulp_syscall_batch_stub_end[];
+
+/**
+ * The trampoline, the first page is code, SYSCALL_INSTR and the syscall
+ * batch stub, the second page is writable, the table and data of batch, see
+ * task_syscall_batch().
+ */
+#define TRAMPOLINE_SIZE		(2 * PAGE_SIZE)
+#define TRAMPOLINE_STUB_OFF	16
+#define TRAMPOLINE_DATA_OFF	PAGE_SIZE
+
+/**
+ * If failed, task_syscall_trampoline() is disabled, thus, the later
+ * task_syscall() won't retry and cost another remote mmap each time, they
+ * run on the libc text instead.
+ */
+static int task_syscall_trampoline_install(struct task_struct *task)
+{
+	int ret;
+	unsigned long addr, result;
+	unsigned char __syscall[] = {SYSCALL_INSTR};
+	size_t stub_sz = ulp_syscall_batch_stub_end - ulp_syscall_batch_stub;
+
+	ret = __task_syscall(task, task->libc_vma->vm_start, true, __NR_mmap,
+			     0UL, TRAMPOLINE_SIZE, PROT_READ | PROT_EXEC,
+			     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0, &addr);
+	if (ret < 0 || REMOTE_MMAP_FAILED(addr)) {
+		ulp_error("Failed to mmap syscall trampoline, %ld.\n", addr);
+		task->syscall_trampoline_on = false;
+		return -ENOMEM;
+	}
+
+	/* /proc/PID/mem could write readonly memory */
+	if (memcpy_to_task(task, addr, __syscall, sizeof(__syscall)) !=
+	    sizeof(__syscall) ||
+	    memcpy_to_task(task, addr + TRAMPOLINE_STUB_OFF,
+			   ulp_syscall_batch_stub, stub_sz) != stub_sz ||
+	    __task_syscall(task, addr, false, __NR_mprotect,
+			   addr + TRAMPOLINE_DATA_OFF,
+			   TRAMPOLINE_SIZE - TRAMPOLINE_DATA_OFF,
+			   PROT_READ | PROT_WRITE, 0, 0, 0, &result) < 0 ||
+	    result) {
+		ulp_error("Failed to write syscall trampoline %lx.\n", addr);
+		__task_syscall(task, task->libc_vma->vm_start, true, __NR_munmap,
+			       addr, TRAMPOLINE_SIZE, 0, 0, 0, 0, &result);
+		task->syscall_trampoline_on = false;
+		return -EFAULT;
+	}
+
+	ulp_debug("Install syscall trampoline at %lx\n", addr);
+	task->syscall_trampoline = addr;
+	return 0;
+}
+
+static int task_syscall_trampoline_release(struct task_struct *task)
+{
+	int ret;
+	unsigned long addr = task->syscall_trampoline, result;
+
+	if (!addr)
+		return 0;
+
+	/* Never use trampoline to unmap itself */
+	task->syscall_trampoline = 0;
+
+	/* Not traced by us, or not stopped, we can't unmap it. */
+	errno = 0;
+	if (ptrace(PTRACE_PEEKDATA, task->pid, addr, NULL) == -1 &&
+	    errno == ESRCH) {
+		ulp_warning("Task %d not stopped, leave syscall trampoline %lx.\n",
+			    task->pid, addr);
+		return -ESRCH;
+	}
+
+	ret = __task_syscall(task, task->libc_vma->vm_start, true, __NR_munmap,
+			     addr, TRAMPOLINE_SIZE, 0, 0, 0, 0, &result);
+	if (ret < 0 || result) {
+		ulp_error("Failed to unmap syscall trampoline %lx.\n", addr);
+		return ret < 0 ? ret : -EFAULT;
+	}
+
+	ulp_debug("Release syscall trampoline at %lx\n", addr);
+	return 0;
+}
+
+/**
+ * Opt-in. If enable, the first task_syscall() inject a small executable page
+ * contains SYSCALL_INSTR into target task, and all the later task_syscall()
+ * run on it, instead of poke the libc text every time. task_syscall_batch()
+ * runs on it too, without mapping its stub every time. If disable, the page
+ * is unmapped, thus, should be called before task_detach(), close_task()
+ * will try to unmap it too.
+ */
+int task_syscall_trampoline(struct task_struct *task, bool enable)
+{
+	if (!task) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	task->syscall_trampoline_on = enable;
+
+	if (!enable)
+		return task_syscall_trampoline_release(task);
+	return 0;
+}
+
+int task_syscall(struct task_struct *task, int nr, unsigned long arg1,
+		 unsigned long arg2, unsigned long arg3, unsigned long arg4,
+		 unsigned long arg5, unsigned long arg6, unsigned long *res)
+{
+	if (task->syscall_trampoline_on && !task->syscall_trampoline)
+		task_syscall_trampoline_install(task);
+
+	if (task->syscall_trampoline)
+		return __task_syscall(task, task->syscall_trampoline, false,
+				      nr, arg1, arg2, arg3, arg4, arg5, arg6,
+				      res);
+
+	return __task_syscall(task, task->libc_vma->vm_start, true, nr, arg1,
+			      arg2, arg3, arg4, arg5, arg6, res);
+}
+
+void task_syscall_batch_init(struct task_syscall_batch *b)
+{
+	memset(b, 0x0, sizeof(*b));
+}
+
+void task_syscall_batch_free(struct task_syscall_batch *b)
+{
+	free(b->data);
+	b->data = NULL;
+	b->data_len = 0;
+}
+
+/**
+ * Append a syscall to batch.
+ *
+ * @return: index of the op, or -ENOSPC if batch is full.
+ */
+int task_syscall_batch_add(struct task_syscall_batch *b, int nr,
+			   unsigned long arg1, unsigned long arg2,
+			   unsigned long arg3, unsigned long arg4,
+			   unsigned long arg5, unsigned long arg6)
+{
+	struct task_syscall_op *op;
+
+	if (b->nr_ops >= TASK_SYSCALL_BATCH_MAX) {
+		ulp_error("Too many syscalls in batch, max %d\n",
+			  TASK_SYSCALL_BATCH_MAX);
+		return -ENOSPC;
+	}
+
+	op = &b->ops[b->nr_ops];
+	memset(op, 0x0, sizeof(*op));
+
+	op->nr = nr;
+	op->args[0] = arg1;
+	op->args[1] = arg2;
+	op->args[2] = arg3;
+	op->args[3] = arg4;
+	op->args[4] = arg5;
+	op->args[5] = arg6;
+
+	b->data_mask[b->nr_ops] = 0;
+
+	return b->nr_ops++;
+}
+
+/**
+ * Use the result of previous @ref_op as the @arg argument of @op, such as
+ * the fd that open(2) returned.
+ */
+int task_syscall_batch_ref(struct task_syscall_batch *b, int op, int arg,
+			   int ref_op)
+{
+	if (op < 0 || op >= b->nr_ops || arg < 0 || arg >= 6 ||
+	    ref_op < 0 || ref_op >= op) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	b->ops[op].args[arg] = ref_op;
+	b->ops[op].ref_mask |= 1UL << arg;
+	return 0;
+}
+
+/**
+ * Upload @data with the batch, and use the remote address of it as the @arg
+ * argument of @op, such as pathname of open(2).
+ */
+int task_syscall_batch_data(struct task_syscall_batch *b, int op, int arg,
+			    const void *data, size_t len)
+{
+	void *new_data;
+	size_t off = ROUND_UP(b->data_len, sizeof(unsigned long));
+
+	if (op < 0 || op >= b->nr_ops || arg < 0 || arg >= 6) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	new_data = realloc(b->data, off + len);
+	if (!new_data) {
+		ulp_error("realloc failed.\n");
+		return -ENOMEM;
+	}
+
+	b->data = new_data;
+	memcpy(b->data + off, data, len);
+	b->data_len = off + len;
+
+	b->ops[op].args[arg] = off;
+	b->data_mask[op] |= 1UL << arg;
+	return 0;
+}
+
+/* Append open(2) to batch, the @pathname is uploaded with the batch. */
+int task_syscall_batch_open(struct task_syscall_batch *b, const char *pathname,
+			    int flags, mode_t mode)
+{
+	int op, arg;
+
+#if defined(__x86_64__)
+	op = task_syscall_batch_add(b, __NR_open, 0, flags, mode, 0, 0, 0);
+	arg = 0;
+#elif defined(__aarch64__)
+	op = task_syscall_batch_add(b, __NR_openat, AT_FDCWD, 0, flags, mode,
+				    0, 0);
+	arg = 1;
+#else
+# error "Error arch"
+#endif
+	if (op < 0)
+		return op;
+
+	if (task_syscall_batch_data(b, op, arg, pathname, strlen(pathname) + 1))
+		return -ENOMEM;
+
+	return op;
+}
+
+/* Run the code at @ip of target task until it trap, with one PTRACE_CONT */
+static int task_call_stub(struct task_struct *task, unsigned long ip,
+			  unsigned long arg1)
+{
+	int ret;
+	struct user_regs_struct old_regs, regs;
+
+#if defined(__aarch64__)
+	struct iovec orig_regs_iov, regs_iov;
+
+	orig_regs_iov.iov_base = &old_regs;
+	orig_regs_iov.iov_len = sizeof(old_regs);
+	regs_iov.iov_base = &regs;
+	regs_iov.iov_len = sizeof(regs);
+#endif
+
+#if defined(__x86_64__)
+	ret = ptrace(PTRACE_GETREGS, task->pid, NULL, &old_regs);
+#elif defined(__aarch64__)
+	ret = ptrace(PTRACE_GETREGSET, task->pid, (void *)NT_PRSTATUS,
+		     (void *)&orig_regs_iov);
+#else
+# error "Unsupport architecture"
+#endif
+	if (ret == -1) {
+		ulp_error("ptrace(PTRACE_GETREGS, %d, ...) failed, %m\n",
+			task->pid);
+		return -errno;
+	}
+
+	regs = old_regs;
+
+	/**
+	 * If target stopped in interrupted syscall, the return value may be
+	 * -ERESTARTSYS, kernel will restart syscall on the new IP, clear it.
+	 */
+	SYSCALL_RET(regs) = 0;
+	SYSCALL_IP(regs) = ip;
+	CALL_ARG1(regs) = arg1;
+
+#if defined(__x86_64__)
+	ret = ptrace(PTRACE_SETREGS, task->pid, NULL, &regs);
+#elif defined(__aarch64__)
+	ret = ptrace(PTRACE_SETREGSET, task->pid, (void*)NT_PRSTATUS,
+			(void*)&regs_iov);
+#else
+# error "Unsupport architecture"
+#endif
+	if (ret == -1) {
+		ulp_error("ptrace(PTRACE_SETREGS, %d, ...) failed, %m\n",
+			task->pid);
+		return -errno;
+	}
+
+	ret = wait_for_stop(task);
+	if (ret < 0)
+		ulp_error("failed call to stub %lx\n", ip);
+
+#if defined(__x86_64__)
+	if (ptrace(PTRACE_SETREGS, task->pid, NULL, &old_regs) == -1) {
+#elif defined(__aarch64__)
+	if (ptrace(PTRACE_SETREGSET, task->pid, (void*)NT_PRSTATUS,
+		   (void*)&orig_regs_iov) == -1) {
+#else
+# error "Unsupport architecture"
+#endif
+		ulp_error("ptrace(PTRACE_SETREGS, %d, ...) failed, %m\n",
+			task->pid);
+		return -errno;
+	}
+
+	return ret;
+}
+
+/**
+ * Ptrace stops of a batch on a mapped stub, mmap(2), mprotect(2), the stub
+ * and munmap(2), see task_syscall_batch().
+ */
+#define BATCH_MAPPED_STUB_STOPS	4
+
+/**
+ * Run the syscalls of batch one by one, with the same result as the stub,
+ * the data is uploaded to a remote buffer.
+ */
+static int task_syscall_batch_one_by_one(struct task_struct *task,
+					 struct task_syscall_batch *b)
+{
+	int j, ret = 0;
+	unsigned long data = 0, args[6];
+	struct task_syscall_op *op;
+
+	if (b->data_len) {
+		data = task_malloc(task, b->data_len);
+		if (!data)
+			return -ENOMEM;
+		if (memcpy_to_task(task, data, b->data, b->data_len) !=
+		    b->data_len) {
+			ulp_error("Failed to upload syscall batch data.\n");
+			ret = -EFAULT;
+			goto free;
+		}
+	}
+
+	for (b->nr_done = 0; b->nr_done < b->nr_ops; b->nr_done++) {
+		op = &b->ops[b->nr_done];
+
+		for (j = 0; j < 6; j++) {
+			args[j] = op->args[j];
+			if (op->ref_mask & (1UL << j))
+				args[j] = b->ops[args[j]].ret;
+			else if (b->data_mask[b->nr_done] & (1UL << j))
+				args[j] += data;
+		}
+
+		ret = task_syscall(task, op->nr, args[0], args[1], args[2],
+				   args[3], args[4], args[5], &op->ret);
+		if (ret < 0)
+			break;
+
+		/* -4095 <= ret <= -1 means failed, as the stub */
+		if (op->ret >= -4095UL) {
+			ret = (long)op->ret;
+			break;
+		}
+	}
+
+free:
+	if (data)
+		task_free(task, data, b->data_len);
+	return ret;
+}
+
+/**
+ * Execute all syscalls of batch in target task with one PTRACE_CONT, instead
+ * of one ptrace stop for each syscall. The stub, the syscall table and the
+ * data are uploaded to target task, and the stub stop at the first failed
+ * syscall. The result of each syscall is stored in task_syscall_op::ret.
+ *
+ * If the syscall trampoline is installed and the table and data fit in it,
+ * the stub is there already, see task_syscall_trampoline(). Otherwise, the
+ * stub is mapped writable, then executable, and unmapped for each batch,
+ * three more ptrace stops, thus, a short batch runs the syscalls one by one
+ * instead.
+ *
+ * @return: 0 if all syscalls succeed, otherwise negative errno.
+ */
+int task_syscall_batch(struct task_struct *task, struct task_syscall_batch *b)
+{
+	int i, j, ret = 0;
+	void *buf;
+	struct task_syscall_table *table;
+	size_t stub_sz, stub_len, table_off, table_sz, data_off, len;
+	size_t map_len = 0;
+	unsigned long remote, stub, result;
+
+	if (!task || !b || b->nr_ops <= 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	if (task->syscall_trampoline_on && !task->syscall_trampoline)
+		task_syscall_trampoline_install(task);
+
+	stub_sz = ulp_syscall_batch_stub_end - ulp_syscall_batch_stub;
+	table_sz = sizeof(struct task_syscall_table) +
+		   b->nr_ops * sizeof(struct task_syscall_op);
+
+	/* Layout: table, data in the trampoline, the stub is there already */
+	if (task->syscall_trampoline &&
+	    table_sz + b->data_len <= TRAMPOLINE_SIZE - TRAMPOLINE_DATA_OFF) {
+		stub = task->syscall_trampoline + TRAMPOLINE_STUB_OFF;
+		remote = task->syscall_trampoline + TRAMPOLINE_DATA_OFF;
+		table_off = 0;
+	/* The stub can't save any ptrace stop */
+	} else if (b->nr_ops + (b->data_len ? 2 : 0) <=
+		   BATCH_MAPPED_STUB_STOPS) {
+		return task_syscall_batch_one_by_one(task, b);
+	/* Layout: stub pages, table, data */
+	} else {
+		stub_len = PAGE_UP(stub_sz);
+		table_off = stub_len;
+		map_len = PAGE_UP(table_off + table_sz + b->data_len);
+
+		remote = task_mmap(task, 0UL, map_len, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (REMOTE_MMAP_FAILED(remote)) {
+			ulp_error("Failed to mmap syscall batch, %ld.\n",
+				  remote);
+			return -ENOMEM;
+		}
+		stub = remote;
+
+		/* Never writable and executable at the same time */
+		if (memcpy_to_task(task, stub, ulp_syscall_batch_stub,
+				   stub_sz) != stub_sz ||
+		    task_syscall(task, __NR_mprotect, stub, stub_len,
+				 PROT_READ | PROT_EXEC, 0, 0, 0, &result) < 0 ||
+		    result) {
+			ulp_error("Failed to write syscall batch stub.\n");
+			task_munmap(task, remote, map_len);
+			return -EFAULT;
+		}
+	}
+	data_off = table_off + table_sz;
+	len = table_sz + b->data_len;
+
+	buf = calloc(1, len);
+	if (!buf) {
+		ulp_error("malloc failed.\n");
+		ret = -ENOMEM;
+		goto unmap;
+	}
+
+	table = buf;
+	table->nr_ops = b->nr_ops;
+	table->nr_done = 0;
+	memcpy(table->ops, b->ops, b->nr_ops * sizeof(struct task_syscall_op));
+
+	/* Relocate data arguments */
+	for (i = 0; i < b->nr_ops; i++) {
+		for (j = 0; j < 6; j++) {
+			if (b->data_mask[i] & (1UL << j))
+				table->ops[i].args[j] += remote + data_off;
+		}
+	}
+
+	if (b->data_len)
+		memcpy(buf + table_sz, b->data, b->data_len);
+
+	if (memcpy_to_task(task, remote + table_off, buf, len) != len) {
+		ulp_error("Failed to upload syscall batch.\n");
+		ret = -EFAULT;
+		goto unmap;
+	}
+
+	ret = task_call_stub(task, stub, remote + table_off);
+	if (ret < 0)
+		goto unmap;
+
+	if (memcpy_from_task(task, table, remote + table_off, table_sz) !=
+	    table_sz) {
+		ulp_error("Failed to read syscall batch results.\n");
+		ret = -EFAULT;
+		goto unmap;
+	}
+
+	b->nr_done = table->nr_done;
+	for (i = 0; i < b->nr_ops; i++)
+		b->ops[i].ret = table->ops[i].ret;
+
+	ulp_debug("Syscall batch %d/%d done.\n", b->nr_done, b->nr_ops);
+
+	if (b->nr_done < b->nr_ops)
+		ret = (long)b->ops[b->nr_done].ret;
+
+unmap:
+	if (map_len)
+		task_munmap(task, remote, map_len);
+	free(buf);
 	return ret;
 }
 
@@ -298,12 +813,25 @@ int task_msync_async(struct task_struct *task, unsigned long addr,
 	return task_msync(task, addr, length, MS_ASYNC);
 }
 
+int task_madvise(struct task_struct *task, unsigned long addr, size_t length,
+		 int advice)
+{
+	int ret;
+	unsigned long result;
+
+	ret = task_syscall(task, __NR_madvise, addr, length, advice, 0, 0, 0,
+			   &result);
+	if (ret < 0)
+		return -1;
+	return result;
+}
+
 unsigned long task_malloc(struct task_struct *task, size_t length)
 {
 	unsigned long remote_addr;
 	remote_addr = task_mmap(task, 0UL, length, PROT_READ | PROT_WRITE,
 				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-	if (remote_addr == (unsigned long)MAP_FAILED) {
+	if (REMOTE_MMAP_FAILED(remote_addr)) {
 		ulp_error("Remote malloc failed, %ld\n", remote_addr);
 		return 0UL;
 	}
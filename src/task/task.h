@@ -9,6 +9,7 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/prctl.h>
+#include <sys/syscall.h>
 #include <gelf.h>
 #include <bfd.h>
 
@@ -17,6 +18,10 @@
 #include <utils/util.h>
 #include <utils/bitops.h>
 #include <utils/rbtree.h>
+#include <utils/strpool.h>
+#include <utils/arena.h>
+#include <utils/strhash.h>
+#include <utils/pattern.h>
 #include <utils/list.h>
 #include <utils/compiler.h>
 
@@ -39,6 +44,7 @@ enum vma_type {
 
 
 struct vm_area_struct;
+struct vma_dynsym;
 
 struct vma_elf_mem {
 	GElf_Ehdr ehdr;
@@ -52,8 +58,13 @@ struct vma_elf_mem {
 };
 
 struct vma_ulp {
-	struct ulpatch_strtab strtab;
-	struct ulpatch_info info;
+	/**
+	 * Entries of ULPATCH_INFO(), strtab is malloc, info points to
+	 * elf_mem.
+	 */
+	unsigned int nr_info;
+	struct ulpatch_strtab *strtab;
+	struct ulpatch_info *info;
 
 	/* This is ELF */
 	void *elf_mem;
@@ -79,7 +90,8 @@ struct vm_area_struct {
 	unsigned long vm_start, vm_end, vm_pgoff;
 	unsigned int major, minor;
 	unsigned long inode;
-	char name_[PATH_MAX];
+	/* Interned in task_struct.vma_names, same file vmas share one */
+	const char *name_;
 	char perms[5];
 #define PROT_FMT "%c%c%c"
 #define PROT_ARGS(p) \
@@ -110,6 +122,15 @@ struct vm_area_struct {
 	 * VMA_VDSO, open it as bfd.
 	 */
 	struct bfd_elf_file *bfd_elf_file;
+	/* task_load_vma_elf_syms() was called */
+	bool syms_loaded;
+
+	/**
+	 * .gnu.hash and .dynsym in target memory, NULL if not readable, see
+	 * vma_dynsym_lookup().
+	 */
+	struct vma_dynsym *dynsym;
+	bool dynsym_read;
 
 	/* Only VMA_ULPATCH has it */
 	struct vma_ulp *ulp;
@@ -120,6 +141,12 @@ struct vm_area_struct {
 	struct list_head node_list;
 	/* struct task_struct.vmas_rb */
 	struct rb_node node_rb;
+	/**
+	 * Free gap below this vma, vm_start - prev->vm_end, and the max gap
+	 * of the vmas_rb subtree rooted here, see find_vma_gap().
+	 */
+	unsigned long vm_gap;
+	unsigned long rb_subtree_gap;
 
 	/**
 	 * All same name vma in one list, and the first vma is leader.
@@ -142,8 +169,19 @@ typedef unsigned long long pc_addr_t;
 
 struct thread {
 	pid_t tid;
-	/* TODO */
+	/* IP of stopped thread, see task_threads_in_range() */
 	pc_addr_t ip;
+
+	/* See task_stop_world() */
+	bool seized;
+	bool stopped;
+	/* usecs() when the thread stopped */
+	unsigned long stop_us;
+	/* Duration of the last pause */
+	unsigned long pause_us;
+	/* Frame pointer chain is broken, see thread_in_ranges() */
+	bool no_fp;
+
 	/* struct task_struct.threads_list */
 	struct list_head node;
 };
@@ -161,6 +199,22 @@ struct fd {
 	struct list_head node;
 };
 
+/**
+ * Describe one range of vectored memory copy between ULPatch and target task,
+ * see memcpy_from_task_v() and memcpy_to_task_v().
+ *
+ * @local: buffer in ULPatch address space
+ * @remote: address in target task address space
+ * @len: length of the range
+ * @ret: output, bytes copied of this range, -1 if failed
+ */
+struct remote_iov {
+	void *local;
+	unsigned long remote;
+	size_t len;
+	ssize_t ret;
+};
+
 /**
  * When task opening, what do you want to do?
  *
@@ -204,6 +258,13 @@ struct fd {
  * Open /proc/PID/status.
  */
 #define FTO_STATUS	BIT(8)
+/**
+ * Like FTO_VMA_ELF_SYMBOLS, but ELF VMAs are only registered when opening,
+ * the ELF file of VMA is opened and its symbols are loaded when
+ * find_task_sym() can't resolve a name from loaded ones, see
+ * lazy_find_task_sym().
+ */
+#define FTO_VMA_ELF_SYMBOLS_LAZY	(BIT(9) | FTO_VMA_ELF_SYMBOLS)
 
 #define FTO_ALL 0xffffffff
 
@@ -250,6 +311,8 @@ struct task_sym {
 /* Public */
 	char *name;
 	unsigned long addr;
+	/* ELF st_size, 0 if unknown */
+	unsigned long size;
 	struct vm_area_struct *vma;
 
 /* Private */
@@ -257,6 +320,9 @@ struct task_sym {
 #define TS_REFCOUNT_NOT_USED	0
 	size_t refcount;
 
+	/* gnu_hash(name), see struct task_syms.names */
+	uint32_t hash;
+
 	/* root is struct task_syms.rb_syms */
 	struct rb_node sort_by_name;
 	/* root is struct task_syms.rb_addrs */
@@ -309,11 +375,41 @@ struct task_syms {
 	 * - node is struct task_sym.sort_by_addr
 	 */
 	struct rb_root rb_syms, rb_addrs;
+	/**
+	 * Name index of find_task_sym(), value is the task_sym in rb_syms,
+	 * rb_syms is only for ordered iteration.
+	 */
+	struct strhash names;
+	/**
+	 * Address index of find_task_addr(), flat array sorted by start,
+	 * built from rb_addrs on first lookup, and dropped whenever symbols
+	 * or vmas change, see task_syms_invalidate_addrs().
+	 */
+	struct task_addr_entry {
+		unsigned long start, end;
+		struct task_sym *sym;
+	} *addrs;
+	size_t nr_addrs;
+	/**
+	 * FTO_VMA_ELF_SYMBOLS_LAZY: DT_NEEDED of executable, read on first
+	 * miss, and all ELF VMAs symbols are loaded.
+	 */
+	char **needed;
+	int nr_needed;
+	bool needed_read;
+	bool all_loaded;
 };
 
 static inline void task_syms_init(struct task_syms *tsyms) {
 	rb_init(&tsyms->rb_syms);
 	rb_init(&tsyms->rb_addrs);
+	memset(&tsyms->names, 0, sizeof(tsyms->names));
+	tsyms->addrs = NULL;
+	tsyms->nr_addrs = 0;
+	tsyms->needed = NULL;
+	tsyms->nr_needed = 0;
+	tsyms->needed_read = false;
+	tsyms->all_loaded = false;
 }
 
 /**
@@ -338,9 +434,36 @@ struct task_struct {
 
 	/* open(2) /proc/[PID]/mem */
 	int proc_mem_fd;
+	/**
+	 * process_vm_readv(2)/process_vm_writev(2) may be not permitted, such
+	 * as seccomp or kernel without CONFIG_CROSS_MEMORY_ATTACH, if that,
+	 * all vectored memory copy fallback to /proc/PID/mem.
+	 */
+	bool no_process_vm;
+
+	/**
+	 * Opt-in, see task_syscall_trampoline(), the address of injected page
+	 * that task_syscall() run on, 0 if not installed.
+	 */
+	bool syscall_trampoline_on;
+	unsigned long syscall_trampoline;
+
+	/**
+	 * Task-scoped allocations, vmas, task_syms and their names, threads
+	 * and fds, all released by close_task() at once.
+	 */
+	struct arena arena;
+
+	/**
+	 * Names of all vmas, the str_pool_entry.priv of each name caches its
+	 * enum vma_type.
+	 */
+	struct str_pool vma_names;
 
 	/* struct vm_area_struct.node_list */
 	struct list_head vma_list;
+	/* Recycled by free_vma(), reused by alloc_vma() */
+	struct list_head vma_free_list;
 	/* struct vm_area_struct.node_rb */
 	struct rb_root vmas_rb;
 
@@ -368,12 +491,63 @@ struct task_struct {
 	/* struct thread.node */
 	struct list_head threads_list;
 
+	/* All threads stopped by task_stop_world() */
+	bool world_stopped;
+	/* The longest thread pause of last stop-the-world */
+	unsigned long stw_max_pause_us;
+
 	/* struct fd.node */
 	struct list_head fds_list;
 };
 
 
 int open_pid_maps(pid_t pid);
+
+/* One VMA of /proc/PID/maps, see maps_iter_next() */
+struct maps_entry {
+	unsigned long start, end, off;
+	unsigned int major, minor;
+	unsigned long inode;
+	char perms[5];
+	/* Point to maps_iter buffer, "" if anonymous */
+	const char *name;
+	/* Only PROCMAP_QUERY with maps_iter::build_id, or NULL */
+	const uint8_t *build_id;
+	unsigned int build_id_size;
+};
+
+enum maps_iter_mode {
+	/* PROCMAP_QUERY if kernel supports, or MAPS_ITER_TEXT */
+	MAPS_ITER_AUTO,
+	/* Parse text of /proc/PID/maps */
+	MAPS_ITER_TEXT,
+	/* PROCMAP_QUERY ioctl(2), no [vsyscall] */
+	MAPS_ITER_QUERY,
+};
+
+struct maps_iter {
+	int fd;
+	enum maps_iter_mode mode;
+	bool build_id;
+
+	/* MAPS_ITER_TEXT */
+	char *buf;
+	size_t size, pos, len;
+	bool eof;
+
+	/* Next query address or lowest text address, see maps_iter_seek() */
+	unsigned long addr;
+
+	/* MAPS_ITER_QUERY */
+	char name[PATH_MAX + 64];
+	uint8_t bid[64];
+};
+
+int maps_iter_open(struct maps_iter *it, pid_t pid, enum maps_iter_mode mode,
+		   bool build_id);
+int maps_iter_next(struct maps_iter *it, struct maps_entry *e);
+void maps_iter_seek(struct maps_iter *it, unsigned long addr);
+void maps_iter_close(struct maps_iter *it);
 int __open_pid_mem(pid_t pid, int flags);
 int open_pid_mem_ro(pid_t pid);
 int open_pid_mem_rw(pid_t pid);
@@ -381,6 +555,7 @@ int open_pid_mem_rw(pid_t pid);
 bool proc_pid_exist(pid_t pid);
 char *get_proc_pid_exe(pid_t pid, char *buf, size_t bufsz);
 char *get_proc_pid_cwd(pid_t pid, char *buf, size_t bufsz);
+int proc_find_pids(const char *exe, const char *build_id, pid_t **pids);
 
 struct vm_area_struct *next_vma(struct task_struct *task,
 				struct vm_area_struct *prev);
@@ -404,10 +579,32 @@ struct vm_area_struct *next_vma(struct task_struct *task,
 
 enum vma_type get_vma_type(pid_t pid, const char *exe, const char *name);
 
+/* Lowest vma overlap [start, end) */
+struct vm_area_struct *find_vma_intersection(const struct task_struct *task,
+					     unsigned long start,
+					     unsigned long end);
+/* For each vma of task overlap [start, end) */
+#define task_for_each_vma_overlap(vma, task, start, end)		\
+	for (vma = find_vma_intersection(task, start, end);		\
+	     vma && vma->vm_start < (end);				\
+	     vma = next_vma(task, vma))
+
+/**
+ * Find a free page aligned [addr, addr + size) in [lo, hi), the lowest one,
+ * or the highest one if topdown, 0 if not found.
+ */
+unsigned long find_vma_gap(const struct task_struct *task, size_t size,
+			   unsigned long lo, unsigned long hi, bool topdown);
+/* Free area closest to addr, within [addr - range, addr + range) */
+unsigned long find_vma_gap_near(const struct task_struct *task, size_t size,
+				unsigned long addr, unsigned long range);
 /* Find a span area between two vma */
 unsigned long find_vma_span_area(struct task_struct *task, size_t size,
 				 unsigned long base);
-int read_task_vmas(struct task_struct *task, bool update_ulp);
+int read_task_vmas(struct task_struct *task);
+int refresh_task_vmas(struct task_struct *task, unsigned long start,
+		      unsigned long end);
+/* Refresh all vmas, see refresh_task_vmas() */
 int update_task_vmas_ulp(struct task_struct *task);
 int free_task_vmas(struct task_struct *task);
 
@@ -434,6 +631,7 @@ void print_fd(FILE *fp, struct task_struct *task, struct fd *fd);
 
 int alloc_ulp(struct vm_area_struct *vma);
 void free_ulp(struct vm_area_struct *vma);
+int vma_reload_ulp(struct vm_area_struct *vma);
 
 int print_task_auxv(FILE *fp, const struct task_struct *task);
 int print_task_status(FILE *fp, const struct task_struct *task);
@@ -453,17 +651,55 @@ bool task_is_pie(struct task_struct *task);
 int task_attach(pid_t pid);
 int task_detach(pid_t pid);
 
+/* Max backoff of task_stop_world_safe() retry */
+#define ULP_SAFE_POINT_MAX_BACKOFF_US	(100 * 1000)
+
+/* Stop and resume all threads of task */
+int task_stop_world(struct task_struct *task, unsigned long budget_us);
+int task_resume_world(struct task_struct *task);
+void task_release_threads(struct task_struct *task);
+int task_threads_in_range(struct task_struct *task, unsigned long start,
+			  unsigned long end);
+int task_stop_world_safe(struct task_struct *task, unsigned long start,
+			 unsigned long end, unsigned long budget_us,
+			 unsigned long deadline_us);
+
+/* [start, end) in target address space */
+struct addr_range {
+	unsigned long start, end;
+};
+
+/* Same as above, but safe for all the ranges at once */
+int task_threads_in_ranges(struct task_struct *task,
+			   const struct addr_range *ranges, int nr);
+int task_stop_world_safe_ranges(struct task_struct *task,
+				const struct addr_range *ranges, int nr,
+				unsigned long budget_us,
+				unsigned long deadline_us);
+
 int memcpy_to_task(struct task_struct *task,
 		unsigned long remote_dst, void *src, ssize_t size);
 int memcpy_from_task(struct task_struct *task,
 		void *dst, unsigned long remote_src, ssize_t size);
+ssize_t memcpy_from_task_v(struct task_struct *task,
+			   struct remote_iov *riov, int n);
+ssize_t memcpy_to_task_v(struct task_struct *task,
+			 struct remote_iov *riov, int n);
+ssize_t strncpy_from_task(struct task_struct *task, char *dst,
+			  unsigned long task_src, size_t size);
 char *strcpy_from_task(struct task_struct *task, char *dst,
 		       unsigned long task_src);
 char *strcpy_to_task(struct task_struct *task, unsigned long task_dst,
 		     char *src);
 
 /* syscalls based on task_syscall() */
-/* if mmap file, need to update_task_vmas_ulp() manual */
+/**
+ * The remote mmap(2) returns -errno as the raw syscall, not MAP_FAILED, 0 if
+ * task_syscall() failed.
+ */
+#define REMOTE_MMAP_FAILED(addr)	\
+	(!(addr) || (unsigned long)(addr) >= -4095UL)
+/* if mmap file, need to refresh_task_vmas() the range manual */
 unsigned long task_mmap(struct task_struct *task, unsigned long addr,
 			size_t length, int prot, int flags, int fd,
 			off_t offset);
@@ -476,6 +712,8 @@ int task_msync_sync(struct task_struct *task, unsigned long addr,
 		    size_t length);
 int task_msync_async(struct task_struct *task, unsigned long addr,
 		     size_t length);
+int task_madvise(struct task_struct *task, unsigned long addr, size_t length,
+		 int advice);
 unsigned long task_malloc(struct task_struct *task, size_t length);
 int task_free(struct task_struct *task, unsigned long addr, size_t length);
 int task_open(struct task_struct *task, char *pathname, int flags, mode_t mode);
@@ -486,16 +724,63 @@ int task_fstat(struct task_struct *task, int remote_fd, struct stat *statbuf);
 int task_prctl(struct task_struct *task, int option, unsigned long arg2,
 	       unsigned long arg3, unsigned long arg4, unsigned long arg5);
 
+/**
+ * Remote syscall batch, see task_syscall_batch(). The layout of
+ * task_syscall_op and task_syscall_table is used by arch syscall batch stub,
+ * see arch/{ARCH}/syscall.S, DON'T change it.
+ */
+struct task_syscall_op {
+	unsigned long nr;
+	unsigned long args[6];
+	/* If bit N set, args[N] is index of previous op, use it's result */
+	unsigned long ref_mask;
+	unsigned long ret;
+};
+
+struct task_syscall_table {
+	unsigned long nr_ops;
+	/* The stub stop at the first failed op */
+	unsigned long nr_done;
+	struct task_syscall_op ops[];
+};
+
+#define TASK_SYSCALL_BATCH_MAX	16
+
+struct task_syscall_batch {
+	int nr_ops;
+	int nr_done;
+	struct task_syscall_op ops[TASK_SYSCALL_BATCH_MAX];
+	/* If bit N set, args[N] is offset of data, see task_syscall_batch_data() */
+	unsigned long data_mask[TASK_SYSCALL_BATCH_MAX];
+	/* Data upload with the table, such as pathname */
+	void *data;
+	size_t data_len;
+};
+
 /* Execute a syscall(2) in target task */
 int task_syscall(struct task_struct *task, int nr,
 		unsigned long arg1, unsigned long arg2, unsigned long arg3,
 		unsigned long arg4, unsigned long arg5, unsigned long arg6,
 		unsigned long *res);
+int task_syscall_trampoline(struct task_struct *task, bool enable);
+
+void task_syscall_batch_init(struct task_syscall_batch *b);
+void task_syscall_batch_free(struct task_syscall_batch *b);
+int task_syscall_batch_add(struct task_syscall_batch *b, int nr,
+			   unsigned long arg1, unsigned long arg2,
+			   unsigned long arg3, unsigned long arg4,
+			   unsigned long arg5, unsigned long arg6);
+int task_syscall_batch_ref(struct task_syscall_batch *b, int op, int arg,
+			   int ref_op);
+int task_syscall_batch_data(struct task_syscall_batch *b, int op, int arg,
+			    const void *data, size_t len);
+int task_syscall_batch_open(struct task_syscall_batch *b, const char *pathname,
+			    int flags, mode_t mode);
+int task_syscall_batch(struct task_struct *task, struct task_syscall_batch *b);
 
 /* Task symbol APIs */
 struct task_sym *alloc_task_sym(const char *name, unsigned long addr,
-				struct vm_area_struct *vma);
-void free_task_sym(struct task_sym *s);
+				unsigned long size, struct vm_area_struct *vma);
 
 struct task_sym *find_task_sym(struct task_struct *task, const char *name,
 			       const struct task_sym ***extras,
@@ -503,11 +788,29 @@ struct task_sym *find_task_sym(struct task_struct *task, const char *name,
 struct task_sym *find_task_addr(struct task_struct *task, unsigned long addr);
 
 int link_task_sym(struct task_struct *task, struct task_sym *s);
+int unlink_vma_task_syms(struct vm_area_struct *vma);
+void task_syms_invalidate_addrs(struct task_struct *task);
 
+void task_load_all_syms(struct task_struct *task);
 struct task_sym *next_task_sym(struct task_struct *task, struct task_sym *prev);
 struct task_sym *next_task_addr(struct task_struct *task,
 				struct task_sym *prev);
 
+typedef int (*task_sym_fn)(struct task_sym *sym, void *arg);
+int match_task_syms(struct task_struct *task,
+		    const struct pattern_set *include,
+		    const struct pattern_set *exclude,
+		    task_sym_fn fn, void *arg);
+
+/* Resolve with dynamic symbols in target memory, see dynsym.c */
+int vma_dynsym_lookup(struct vm_area_struct *vma, const char *name,
+		      uint32_t hash, GElf_Sym *sym);
+struct task_sym *remote_find_task_sym(struct task_struct *task,
+				      const char *name, uint32_t hash);
+
+int vma_load_elf_file(struct vm_area_struct *vma);
+int task_open_vmas_elf_files(struct task_struct *task);
+void vma_free_elf(struct vm_area_struct *vma);
 int task_load_vma_elf_syms(struct vm_area_struct *vma);
 void free_task_syms(struct task_struct *task);
 
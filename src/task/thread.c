@@ -0,0 +1,617 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2022-2025 Rong Tao */
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sched.h>
+#include <elf.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
+
+#include <utils/log.h>
+#include <utils/util.h>
+#include <task/task.h>
+
+#if defined(__x86_64__)
+#include <arch/x86_64/regs.h>
+#elif defined(__aarch64__)
+#include <arch/aarch64/regs.h>
+#endif
+
+/* Max depth of frame pointer stack walk */
+#define MAX_STACK_FRAMES	128
+/* Max bytes of conservative stack scan, see thread_scan_stack() */
+#define MAX_STACK_SCAN		(1024 * 1024)
+
+/* Wait the threads interrupted but not stopped when closing task */
+#define THREAD_RELEASE_TIMEOUT_US	(1000 * 1000)
+
+
+static struct thread *find_thread(struct task_struct *task, pid_t tid)
+{
+	struct thread *thread;
+
+	list_for_each_entry(thread, &task->threads_list, node) {
+		if (thread->tid == tid)
+			return thread;
+	}
+	return NULL;
+}
+
+static struct thread *alloc_thread(struct task_struct *task, pid_t tid)
+{
+	struct thread *thread;
+
+	thread = arena_alloc(&task->arena, sizeof(struct thread));
+	if (!thread)
+		return NULL;
+
+	thread->tid = tid;
+	thread->no_fp = false;
+	list_init(&thread->node);
+	list_add(&thread->node, &task->threads_list);
+	return thread;
+}
+
+/**
+ * Reap the PTRACE_INTERRUPT stop of seized thread without blocking. Signals
+ * that arrive before the interrupt stop are injected back, the interrupt is
+ * still pending.
+ *
+ * @return: 1 if stopped, 0 if not yet, -ESRCH if thread exit, other negative
+ *          errno.
+ */
+static int reap_thread_interrupted(pid_t tid)
+{
+	int ret, status, sig;
+
+	ret = waitpid(tid, &status, __WALL | WNOHANG);
+	if (ret < 0) {
+		ulp_error("waitpid %d failed, %m\n", tid);
+		return -errno;
+	}
+	if (ret == 0)
+		return 0;
+
+	if (WIFEXITED(status) || WIFSIGNALED(status))
+		return -ESRCH;
+
+	if (!WIFSTOPPED(status))
+		return 0;
+
+	if (status >> 16 == PTRACE_EVENT_STOP)
+		return 1;
+
+	/* signal-delivery-stop, inject it back */
+	sig = WSTOPSIG(status);
+	ulp_debug("Thread %d got signal %d before interrupt.\n", tid, sig);
+	if (ptrace(PTRACE_CONT, tid, NULL, (void *)(uintptr_t)sig) < 0)
+		return -errno;
+	return 0;
+}
+
+/**
+ * Reap the stops of all interrupted threads in any order, until all of
+ * them stopped, or @deadline_us passed, 0 means no deadline. The stop time
+ * of each thread is the time it's reaped.
+ *
+ * @return: number of new stopped threads, -ETIMEDOUT, or other negative
+ *          errno.
+ */
+static int wait_threads_interrupted(struct task_struct *task,
+				    unsigned long deadline_us)
+{
+	int ret, nr_new = 0, nr_pending;
+	struct thread *thread;
+
+	while (1) {
+		nr_pending = 0;
+
+		list_for_each_entry(thread, &task->threads_list, node) {
+			if (!thread->seized || thread->stopped)
+				continue;
+
+			ret = reap_thread_interrupted(thread->tid);
+			if (ret == -ESRCH) {
+				ulp_debug("Thread %d exit.\n", thread->tid);
+				thread->seized = false;
+				continue;
+			} else if (ret < 0)
+				return ret;
+
+			if (ret == 0) {
+				nr_pending++;
+				continue;
+			}
+
+			thread->stopped = true;
+			thread->stop_us = usecs();
+			nr_new++;
+		}
+
+		if (!nr_pending)
+			return nr_new;
+
+		if (deadline_us && usecs() > deadline_us) {
+			ulp_error("%d threads of %d not stopped before deadline.\n",
+				  nr_pending, task->pid);
+			return -ETIMEDOUT;
+		}
+
+		/* The interrupt stop is quick, unless thread in D state */
+		sched_yield();
+	}
+}
+
+/**
+ * Seize and interrupt all threads in /proc/PID/task that not stopped yet,
+ * we interrupt all of them first, and then wait, thus, all threads stop in
+ * parallel. See wait_threads_interrupted() for @deadline_us.
+ *
+ * @return: number of new stopped threads, or negative errno.
+ */
+static int stop_new_threads(struct task_struct *task, unsigned long deadline_us)
+{
+	DIR *dir;
+	struct dirent *entry;
+	struct thread *thread;
+	char proc_task_dir[] = {"/proc/1234567890abc/task"};
+	sprintf(proc_task_dir, "/proc/%d/task/", task->pid);
+	dir = opendir(proc_task_dir);
+	if (!dir) {
+		ulp_error("opendir %s failed.\n", proc_task_dir);
+		return -errno;
+	}
+
+	while ((entry = readdir(dir)) != NULL) {
+		pid_t tid;
+
+		if (!strcmp(entry->d_name , ".") ||
+		    !strcmp(entry->d_name, ".."))
+			continue;
+
+		tid = atoi(entry->d_name);
+
+		/* Interrupted already, maybe by last stop over deadline */
+		thread = find_thread(task, tid);
+		if (thread && (thread->stopped || thread->seized))
+			continue;
+
+		if (ptrace(PTRACE_SEIZE, tid, NULL, NULL) < 0) {
+			/* Thread exit already */
+			if (errno == ESRCH)
+				continue;
+			ulp_error("ptrace(PTRACE_SEIZE, %d) failed, %m\n", tid);
+			closedir(dir);
+			return -errno;
+		}
+
+		if (!thread)
+			thread = alloc_thread(task, tid);
+		if (!thread) {
+			ptrace(PTRACE_DETACH, tid, NULL, NULL);
+			closedir(dir);
+			return -ENOMEM;
+		}
+
+		thread->seized = true;
+
+		if (ptrace(PTRACE_INTERRUPT, tid, NULL, NULL) < 0)
+			ulp_warning("ptrace(PTRACE_INTERRUPT, %d) failed, %m\n",
+				    tid);
+	}
+	closedir(dir);
+
+	return wait_threads_interrupted(task, deadline_us);
+}
+
+/**
+ * Stop all threads of target task, threads that created during seizing are
+ * stopped too, until no new thread. If seizing takes longer than @budget_us,
+ * give up and resume all threads at once, without waiting the slow ones.
+ * @budget_us equal to 0 means no budget.
+ *
+ * Pause duration of each thread is recorded in struct thread, see
+ * task_resume_world().
+ */
+int task_stop_world(struct task_struct *task, unsigned long budget_us)
+{
+	int ret, nr, nr_stopped = 0;
+	unsigned long start_us = usecs();
+	unsigned long deadline_us = budget_us ? start_us + budget_us : 0;
+
+	if (!task) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	if (task->world_stopped) {
+		ulp_warning("Task %d is already stopped.\n", task->pid);
+		return 0;
+	}
+
+	task->stw_max_pause_us = 0;
+
+	do {
+		nr = stop_new_threads(task, deadline_us);
+		if (nr < 0) {
+			ret = nr;
+			goto failed;
+		}
+		nr_stopped += nr;
+
+		if (budget_us && usecs() - start_us > budget_us) {
+			ulp_error("Stop %d threads of %d over budget %ldus.\n",
+				  nr_stopped, task->pid, budget_us);
+			ret = -ETIMEDOUT;
+			goto failed;
+		}
+	} while (nr > 0);
+
+	task->world_stopped = true;
+
+	ulp_debug("Stop %d threads of %d in %ldus.\n", nr_stopped, task->pid,
+		  usecs() - start_us);
+	return 0;
+
+failed:
+	task->world_stopped = true;
+	task_resume_world(task);
+	errno = -ret;
+	return ret;
+}
+
+/**
+ * Resume all threads that stopped by task_stop_world(), and record pause
+ * duration of each thread.
+ */
+int task_resume_world(struct task_struct *task)
+{
+	int ret = 0, stop;
+	unsigned long now;
+	struct thread *thread, *tmp;
+
+	if (!task || !task->world_stopped) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	list_for_each_entry_safe(thread, tmp, &task->threads_list, node) {
+		if (!thread->seized)
+			continue;
+
+		/**
+		 * Interrupted but not stopped, it can't be detached until the
+		 * stop, see task_release_threads().
+		 */
+		if (!thread->stopped) {
+			stop = reap_thread_interrupted(thread->tid);
+			if (stop == -ESRCH)
+				thread->seized = false;
+			if (stop <= 0)
+				continue;
+			thread->stopped = true;
+			thread->stop_us = usecs();
+		}
+
+		if (ptrace(PTRACE_DETACH, thread->tid, NULL, NULL) < 0) {
+			ulp_error("ptrace(PTRACE_DETACH, %d) failed, %m\n",
+				  thread->tid);
+			ret = -errno;
+		}
+
+		now = usecs();
+		if (thread->stopped) {
+			thread->pause_us = now - thread->stop_us;
+			task->stw_max_pause_us = MAX(task->stw_max_pause_us,
+						     thread->pause_us);
+		}
+
+		thread->seized = false;
+		thread->stopped = false;
+	}
+
+	task->world_stopped = false;
+
+	ulp_debug("Resume %d, max pause %ldus.\n", task->pid,
+		  task->stw_max_pause_us);
+	return ret;
+}
+
+/**
+ * Detach the threads interrupted by task_stop_world() but not stopped when
+ * it gave up, wait them for a while. If the thread never stops, it's
+ * detached when we exit.
+ */
+void task_release_threads(struct task_struct *task)
+{
+	int ret;
+	struct thread *thread;
+	unsigned long deadline_us = usecs() + THREAD_RELEASE_TIMEOUT_US;
+
+	list_for_each_entry(thread, &task->threads_list, node) {
+		if (!thread->seized || thread->stopped)
+			continue;
+
+		while ((ret = reap_thread_interrupted(thread->tid)) == 0 &&
+		       usecs() < deadline_us)
+			usleep(1000);
+
+		if (ret == 1)
+			ptrace(PTRACE_DETACH, thread->tid, NULL, NULL);
+		else
+			ulp_warning("Thread %d of %d is not stopped, leave it.\n",
+				    thread->tid, task->pid);
+		thread->seized = false;
+	}
+}
+
+static int thread_get_regs(pid_t tid, struct user_regs_struct *regs)
+{
+	int ret;
+
+#if defined(__x86_64__)
+	ret = ptrace(PTRACE_GETREGS, tid, NULL, regs);
+#elif defined(__aarch64__)
+	struct iovec regs_iov = {
+		.iov_base = regs,
+		.iov_len = sizeof(*regs),
+	};
+	ret = ptrace(PTRACE_GETREGSET, tid, (void *)NT_PRSTATUS,
+		     (void *)&regs_iov);
+#else
+# error "Unsupport architecture"
+#endif
+	if (ret == -1) {
+		ulp_error("ptrace(PTRACE_GETREGS, %d, ...) failed, %m\n", tid);
+		return -errno;
+	}
+	return 0;
+}
+
+static inline bool addr_in_ranges(unsigned long addr,
+				  const struct addr_range *ranges, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (addr >= ranges[i].start && addr < ranges[i].end)
+			return true;
+	}
+	return false;
+}
+
+/**
+ * Without frame pointers, scan the stack from SP to the end of its VMA, any
+ * word in ranges may be a return address. A stale word is a false positive,
+ * it only costs a retry, see task_stop_world_safe_ranges(). .eh_frame is not
+ * used, if the stack is too big or unreadable, the thread is taken as in
+ * ranges.
+ */
+static int thread_scan_stack(struct task_struct *task, struct thread *thread,
+			     unsigned long sp, const struct addr_range *ranges,
+			     int nr)
+{
+	int ret = 0;
+	size_t i, len;
+	unsigned long *words;
+	struct vm_area_struct *vma;
+
+	vma = find_vma(task, sp);
+	if (!vma || vma->vm_end - sp > MAX_STACK_SCAN) {
+		ulp_warning("Thread %d stack %lx can't be scanned, take it as in range.\n",
+			    thread->tid, sp);
+		return 1;
+	}
+
+	len = vma->vm_end - sp;
+	words = malloc(len);
+	if (!words)
+		return -ENOMEM;
+
+	if (memcpy_from_task(task, words, sp, len) != len) {
+		ulp_warning("Thread %d stack %lx unreadable, take it as in range.\n",
+			    thread->tid, sp);
+		ret = 1;
+		goto free;
+	}
+
+	for (i = 0; i < len / sizeof(*words); i++) {
+		if (addr_in_ranges(words[i], ranges, nr)) {
+			ulp_debug("Thread %d stack %lx may return to %lx in range.\n",
+				  thread->tid, sp + i * sizeof(*words),
+				  words[i]);
+			ret = 1;
+			break;
+		}
+	}
+
+free:
+	free(words);
+	return ret;
+}
+
+/**
+ * Check the thread is executing in any of ranges or not, or has a return
+ * address in it. The stack is walked by frame pointers, the chain ends with
+ * a zero frame pointer, see _start and clone(2). If the code compiled
+ * without frame pointers, the chain is broken, and the stack is scanned
+ * conservatively instead, see thread_scan_stack().
+ */
+static int thread_in_ranges(struct task_struct *task, struct thread *thread,
+			    const struct addr_range *ranges, int nr)
+{
+	int ret, depth;
+	unsigned long fp, frame[2];
+	struct user_regs_struct regs;
+	struct vm_area_struct *vma;
+
+	ret = thread_get_regs(thread->tid, &regs);
+	if (ret)
+		return ret;
+
+	thread->ip = SYSCALL_IP(regs);
+
+	if (addr_in_ranges(thread->ip, ranges, nr)) {
+		ulp_debug("Thread %d ip %llx in range.\n", thread->tid,
+			  thread->ip);
+		return 1;
+	}
+
+#if defined(LINK_REGISTER)
+	/* The return address of leaf function is in link register */
+	if (addr_in_ranges(LINK_REGISTER(regs), ranges, nr)) {
+		ulp_debug("Thread %d lr %lx in range.\n", thread->tid,
+			  (unsigned long)LINK_REGISTER(regs));
+		return 1;
+	}
+#endif
+
+	fp = FRAME_POINTER(regs);
+
+	/* frame[0] is the previous frame pointer, frame[1] is return address */
+	for (depth = 0; depth < MAX_STACK_FRAMES; depth++) {
+		if (!fp || fp & (sizeof(unsigned long) - 1))
+			break;
+
+		vma = find_vma(task, fp);
+		if (!vma || (vma->prot & (PROT_READ | PROT_WRITE)) !=
+				(PROT_READ | PROT_WRITE))
+			break;
+
+		if (memcpy_from_task(task, frame, fp, sizeof(frame)) !=
+		    sizeof(frame))
+			break;
+
+		if (addr_in_ranges(frame[1], ranges, nr)) {
+			ulp_debug("Thread %d frame #%d return address %lx in range.\n",
+				  thread->tid, depth, frame[1]);
+			return 1;
+		}
+
+		/* The stack grows down, the caller's frame must be higher */
+		if (frame[0] && frame[0] <= fp)
+			break;
+		fp = frame[0];
+	}
+
+	/* A zero frame pointer at depth 0 is a register reused, not an end */
+	if (!fp && depth)
+		return 0;
+
+	if (!thread->no_fp) {
+		ulp_warning("Thread %d frame pointer chain broken at #%d, compiled "
+			    "with -fomit-frame-pointer? scan the stack instead.\n",
+			    thread->tid, depth);
+		thread->no_fp = true;
+	}
+	return thread_scan_stack(task, thread, STACK_POINTER(regs), ranges,
+				 nr);
+}
+
+/**
+ * Check all stopped threads, see thread_in_ranges().
+ *
+ * @return: the number of threads in ranges, or negative errno.
+ */
+int task_threads_in_ranges(struct task_struct *task,
+			   const struct addr_range *ranges, int nr)
+{
+	int i, ret, n = 0;
+	struct thread *thread;
+
+	if (!task || !task->world_stopped || !ranges || nr <= 0) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	for (i = 0; i < nr; i++) {
+		if (ranges[i].start >= ranges[i].end) {
+			errno = EINVAL;
+			return -EINVAL;
+		}
+	}
+
+	list_for_each_entry(thread, &task->threads_list, node) {
+		if (!thread->stopped)
+			continue;
+		ret = thread_in_ranges(task, thread, ranges, nr);
+		if (ret < 0)
+			return ret;
+		n += ret;
+	}
+
+	return n;
+}
+
+int task_threads_in_range(struct task_struct *task, unsigned long start,
+			  unsigned long end)
+{
+	struct addr_range range = { start, end };
+	return task_threads_in_ranges(task, &range, 1);
+}
+
+/**
+ * Stop the world at a safe point, that is no thread is executing in any of
+ * the ranges or has a return address in it. If not safe, resume all
+ * threads, back off and retry, the backoff is doubled each time, until
+ * @deadline_us passed.
+ *
+ * @budget_us: see task_stop_world()
+ * @return: 0 if all threads stopped at safe point, -EBUSY if deadline
+ *          passed, or other negative errno.
+ */
+int task_stop_world_safe_ranges(struct task_struct *task,
+				const struct addr_range *ranges, int nr,
+				unsigned long budget_us,
+				unsigned long deadline_us)
+{
+	int ret, retry = 0;
+	unsigned long backoff_us = 1000, now;
+	unsigned long deadline = usecs() + deadline_us;
+
+	while (1) {
+		ret = task_stop_world(task, budget_us);
+		if (ret)
+			return ret;
+
+		ret = task_threads_in_ranges(task, ranges, nr);
+		if (ret == 0) {
+			ulp_debug("Safe point of %d after %d retries.\n",
+				  task->pid, retry);
+			return 0;
+		}
+
+		task_resume_world(task);
+		if (ret < 0)
+			return ret;
+
+		now = usecs();
+		if (now >= deadline) {
+			ulp_error("%d threads of %d in %d ranges, give up after %d retries.\n",
+				  ret, task->pid, nr, retry);
+			errno = EBUSY;
+			return -EBUSY;
+		}
+
+		ulp_debug("%d threads of %d in %d ranges, retry after %ldus.\n",
+			  ret, task->pid, nr, backoff_us);
+
+		usleep(MIN(backoff_us, deadline - now));
+		backoff_us = MIN(backoff_us * 2, ULP_SAFE_POINT_MAX_BACKOFF_US);
+		retry++;
+	}
+}
+
+int task_stop_world_safe(struct task_struct *task, unsigned long start,
+			 unsigned long end, unsigned long budget_us,
+			 unsigned long deadline_us)
+{
+	struct addr_range range = { start, end };
+	return task_stop_world_safe_ranges(task, &range, 1, budget_us,
+					   deadline_us);
+}
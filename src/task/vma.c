@@ -30,14 +30,21 @@ struct vm_area_struct *alloc_vma(struct task_struct *task)
 {
 	struct vm_area_struct *vma;
 
-	vma = malloc(sizeof(struct vm_area_struct));
-	if (!vma) {
-		ulp_error("Malloc vma failed.\n");
-		return NULL;
+	if (!list_empty(&task->vma_free_list)) {
+		vma = list_first_entry(&task->vma_free_list,
+				       struct vm_area_struct, node_list);
+		list_del(&vma->node_list);
+		memset(vma, 0x00, sizeof(struct vm_area_struct));
+	} else {
+		vma = arena_alloc(&task->arena, sizeof(struct vm_area_struct));
+		if (!vma) {
+			ulp_error("Alloc vma failed.\n");
+			return NULL;
+		}
 	}
-	memset(vma, 0x00, sizeof(struct vm_area_struct));
 
 	vma->task = task;
+	vma->name_ = "";
 	vma->type = VMA_NONE;
 	vma->leader = NULL;
 	vma->ulp = NULL;
@@ -67,25 +74,95 @@ static inline int __vma_rb_cmp(struct rb_node *node, unsigned long key)
 	return 0;
 }
 
+#define vma_rb_entry(rb) rb_entry_safe(rb, struct vm_area_struct, node_rb)
+
+/**
+ * The free gap below vma is [vma_gap_start(vma), vma->vm_start).
+ */
+static inline unsigned long vma_gap_start(const struct vm_area_struct *vma)
+{
+	return vma->vm_start - vma->vm_gap;
+}
+
+static inline unsigned long
+vma_compute_subtree_gap(struct vm_area_struct *vma)
+{
+	unsigned long max = vma->vm_gap;
+	struct vm_area_struct *child;
+
+	child = vma_rb_entry(vma->node_rb.rb_left);
+	if (child && child->rb_subtree_gap > max)
+		max = child->rb_subtree_gap;
+	child = vma_rb_entry(vma->node_rb.rb_right);
+	if (child && child->rb_subtree_gap > max)
+		max = child->rb_subtree_gap;
+	return max;
+}
+
+RB_DECLARE_CALLBACKS(static, vma_gap_callbacks, struct vm_area_struct, node_rb,
+		     unsigned long, rb_subtree_gap, vma_compute_subtree_gap)
+
+/**
+ * Recompute vma's gap from the previous vma in address order and propagate
+ * the subtree max gap to the root.
+ */
+static void vma_gap_update(struct vm_area_struct *vma,
+			   struct vm_area_struct *prev)
+{
+	vma->vm_gap = vma->vm_start - (prev ? prev->vm_end : 0);
+	vma_gap_callbacks.propagate(&vma->node_rb, NULL);
+}
+
 void insert_vma(struct task_struct *task, struct vm_area_struct *vma,
 		struct vm_area_struct *prev)
 {
-	if (prev && strcmp(prev->name_, vma->name_) == 0) {
+	struct rb_node *exist;
+	struct vm_area_struct *next;
+
+	/* Names are interned, same file vmas share one */
+	if (prev && prev->name_ == vma->name_) {
 		struct vm_area_struct *leader = prev->leader;
 		vma->leader = leader;
 		list_add(&vma->siblings, &leader->siblings);
 	}
 
 	list_add(&vma->node_list, &task->vma_list);
-	rb_insert_node(&task->vmas_rb, &vma->node_rb, __vma_rb_cmp,
-			(unsigned long)vma);
+	task_syms_invalidate_addrs(task);
+	/* New vma's symbols are not loaded, see lazy_find_task_sym() */
+	task->tsyms.all_loaded = false;
+
+	/**
+	 * Link with zero gap, which never changes ancestors' subtree gap,
+	 * then set the real gaps of vma and the next vma.
+	 */
+	vma->vm_gap = 0;
+	vma->rb_subtree_gap = 0;
+	exist = rb_insert_node_augmented(&task->vmas_rb, &vma->node_rb,
+					 __vma_rb_cmp, (unsigned long)vma,
+					 &vma_gap_callbacks);
+	if (exist)
+		return;
+
+	vma_gap_update(vma, vma_rb_entry(rb_prev(&vma->node_rb)));
+	next = vma_rb_entry(rb_next(&vma->node_rb));
+	if (next)
+		vma_gap_update(next, vma);
 }
 
 void unlink_vma(struct task_struct *task, struct vm_area_struct *vma)
 {
+	struct vm_area_struct *prev, *next;
+
+	prev = vma_rb_entry(rb_prev(&vma->node_rb));
+	next = vma_rb_entry(rb_next(&vma->node_rb));
+
 	list_del(&vma->node_list);
-	rb_erase(&vma->node_rb, &task->vmas_rb);
+	rb_erase_augmented(&vma->node_rb, &task->vmas_rb, &vma_gap_callbacks);
 	list_del(&vma->siblings);
+	task_syms_invalidate_addrs(task);
+
+	if (next)
+		vma_gap_update(next, prev);
 }
 
 void free_vma(struct vm_area_struct *vma)
@@ -93,7 +170,8 @@ void free_vma(struct vm_area_struct *vma)
 	if (!vma)
 		return;
 	free_ulp(vma);
-	free(vma);
+	/* Memory belongs to task arena, recycle it */
+	list_add(&vma->node_list, &vma->task->vma_free_list);
 }
 
 static inline int __find_vma_cmp(struct rb_node *node, unsigned long vaddr)
@@ -130,13 +208,163 @@ struct vm_area_struct *next_vma(struct task_struct *task,
 	return  next ? rb_entry(next, struct vm_area_struct, node_rb) : NULL;
 }
 
+struct vm_area_struct *find_vma_intersection(const struct task_struct *task,
+					     unsigned long start,
+					     unsigned long end)
+{
+	struct rb_node *rnode = task->vmas_rb.rb_node;
+	struct vm_area_struct *vma = NULL, *tmp;
+
+	/* Lowest vma that ends above start */
+	while (rnode) {
+		tmp = rb_entry(rnode, struct vm_area_struct, node_rb);
+		if (tmp->vm_end > start) {
+			vma = tmp;
+			if (tmp->vm_start <= start)
+				break;
+			rnode = rnode->rb_left;
+		} else
+			rnode = rnode->rb_right;
+	}
+
+	if (vma && vma->vm_start < end)
+		return vma;
+	errno = ENOENT;
+	return NULL;
+}
+
+/**
+ * Place size bytes in vma's gap clipped to [lo, hi), return the lowest or
+ * the highest page aligned address, 0 if not fit.
+ */
+static unsigned long vma_gap_fit(const struct vm_area_struct *vma,
+				 size_t size, unsigned long lo,
+				 unsigned long hi, bool topdown)
+{
+	unsigned long start = vma_gap_start(vma), end = vma->vm_start;
+	unsigned long addr;
+
+	if (start < lo)
+		start = lo;
+	if (end > hi)
+		end = hi;
+	if (end <= start || end - start < size)
+		return 0;
+
+	if (topdown) {
+		addr = PAGE_DOWN(end - size);
+		return addr >= start ? addr : 0;
+	}
+
+	addr = PAGE_UP(start);
+	return (addr >= start && addr <= end - size) ? addr : 0;
+}
+
+/**
+ * Gaps in the left subtree end below vma_gap_start(vma), gaps in the right
+ * subtree start above vma->vm_end, skip the subtree if it's out of [lo, hi)
+ * or its max gap is less than size.
+ */
+static unsigned long vma_gap_lowest(struct rb_node *rnode, size_t size,
+				    unsigned long lo, unsigned long hi)
+{
+	struct vm_area_struct *vma = vma_rb_entry(rnode);
+	unsigned long addr;
+
+	if (!vma || vma->rb_subtree_gap < size)
+		return 0;
+
+	if (lo < vma_gap_start(vma)) {
+		addr = vma_gap_lowest(rnode->rb_left, size, lo, hi);
+		if (addr)
+			return addr;
+	}
+
+	if (vma->vm_gap >= size) {
+		addr = vma_gap_fit(vma, size, lo, hi, false);
+		if (addr)
+			return addr;
+	}
+
+	if (vma->vm_end < hi)
+		return vma_gap_lowest(rnode->rb_right, size, lo, hi);
+	return 0;
+}
+
+static unsigned long vma_gap_highest(struct rb_node *rnode, size_t size,
+				     unsigned long lo, unsigned long hi)
+{
+	struct vm_area_struct *vma = vma_rb_entry(rnode);
+	unsigned long addr;
+
+	if (!vma || vma->rb_subtree_gap < size)
+		return 0;
+
+	if (vma->vm_end < hi) {
+		addr = vma_gap_highest(rnode->rb_right, size, lo, hi);
+		if (addr)
+			return addr;
+	}
+
+	if (vma->vm_gap >= size) {
+		addr = vma_gap_fit(vma, size, lo, hi, true);
+		if (addr)
+			return addr;
+	}
+
+	if (lo < vma_gap_start(vma))
+		return vma_gap_highest(rnode->rb_left, size, lo, hi);
+	return 0;
+}
+
+unsigned long find_vma_gap(const struct task_struct *task, size_t size,
+			   unsigned long lo, unsigned long hi, bool topdown)
+{
+	struct rb_node *root = task->vmas_rb.rb_node;
+
+	if (!size || lo >= hi)
+		return 0;
+
+	if (topdown)
+		return vma_gap_highest(root, size, lo, hi);
+	return vma_gap_lowest(root, size, lo, hi);
+}
+
+unsigned long find_vma_gap_near(const struct task_struct *task, size_t size,
+				unsigned long addr, unsigned long range)
+{
+	unsigned long lo, hi, mid, below, above;
+
+	lo = addr > range ? addr - range : 0;
+	if (lo < MIN_ULP_START_VMA_ADDR)
+		lo = MIN_ULP_START_VMA_ADDR;
+	hi = ULONG_MAX - addr > range ? addr + range : ULONG_MAX;
+
+	/* Highest start address not above addr */
+	mid = ULONG_MAX - addr > size ? addr + size : ULONG_MAX;
+	below = find_vma_gap(task, size, lo, mid < hi ? mid : hi, true);
+	/* Lowest start address not below addr */
+	above = find_vma_gap(task, size, addr > lo ? addr : lo, hi, false);
+
+	if (!below)
+		return above;
+	if (!above)
+		return below;
+	return addr - below <= above - addr ? below : above;
+}
+
 unsigned long find_vma_span_area(struct task_struct *task, size_t size,
 				 unsigned long base)
 {
-	struct vm_area_struct *ivma, *first_vma, *next_vma;
-	struct rb_node *first, *next, *rnode;
+	struct vm_area_struct *first_vma;
+	struct rb_node *first;
+	unsigned long addr;
 
 	first = rb_first(&task->vmas_rb);
+	if (!first) {
+		ulp_error("No vma in target process, pid %d\n", task->pid);
+		return 0;
+	}
 	first_vma = rb_entry(first, struct vm_area_struct, node_rb);
 
 	/**
@@ -148,23 +376,14 @@ unsigned long find_vma_span_area(struct task_struct *task, size_t size,
 		return base;
 
 	/**
-	 * For each vma to find span area.
+	 * Lowest gap between two vmas, the gap below the first vma is
+	 * excluded by starting from it.
 	 */
-	for (rnode = first; rnode; rnode = rb_next(rnode)) {
-		ivma = rb_entry(rnode, struct vm_area_struct, node_rb);
-		next = rb_next(rnode);
-		if (!next)
-			return 0;
-
-		ulp_debug("vma: %lx-%lx %s\n", ivma->vm_start, ivma->vm_end,
-			ivma->name_);
-
-		next_vma = rb_entry(next, struct vm_area_struct, node_rb);
-		if (next_vma->vm_start - ivma->vm_end >= size)
-			return ivma->vm_end;
-	}
-	ulp_error("No space fatal in target process, pid %d\n", task->pid);
-	return 0;
+	addr = find_vma_gap(task, size, first_vma->vm_start, ULONG_MAX, false);
+	if (!addr)
+		ulp_error("No space fatal in target process, pid %d\n",
+			  task->pid);
+	return addr;
 }
 
 unsigned int vma_perms2prot(char *perms)
@@ -271,7 +490,7 @@ const char *vma_type_name(enum vma_type type)
 
 bool elf_vma_is_interp_exception(struct vm_area_struct *vma)
 {
-	char *name = vma->name_;
+	const char *name = vma->name_;
 
 	/* libc */
 	if (!strncmp(name, "libc", 4) &&
@@ -299,92 +518,260 @@ bool elf_vma_is_interp_exception(struct vm_area_struct *vma)
 }
 
 /**
- * @update_ulp: if patch to target process, we need to insert the new vma to
- *              list.
+ * get_vma_type() only depends on the name for one task, classify each
+ * interned name once.
  */
-int read_task_vmas(struct task_struct *task, bool update_ulp)
+static enum vma_type task_vma_type(struct task_struct *task, const char *name)
+{
+	struct str_pool_entry *entry = str_pool_entry(name);
+
+	if (entry->priv < 0)
+		entry->priv = get_vma_type(task->pid, task->exe, name);
+	return (enum vma_type)entry->priv;
+}
+
+/* Alloc a vma of maps entry, name is interned, the caller inserts it */
+static struct vm_area_struct *alloc_maps_vma(struct task_struct *task,
+					     const struct maps_entry *e,
+					     const char *name)
+{
+	struct vm_area_struct *vma;
+
+	vma = alloc_vma(task);
+	if (!vma)
+		return NULL;
+
+	vma->vm_start = e->start;
+	vma->vm_end = e->end;
+	memcpy(vma->perms, e->perms, sizeof(vma->perms));
+	vma->prot = vma_perms2prot(vma->perms);
+	vma->vm_pgoff = (e->off >> PAGE_SHIFT);
+	vma->major = e->major;
+	vma->minor = e->minor;
+	vma->inode = e->inode;
+	vma->name_ = name;
+	vma->type = task_vma_type(task, vma->name_);
+
+	/* Find libc.so */
+	if (!task->libc_vma && vma->type == VMA_LIBC &&
+	    vma->prot & PROT_EXEC) {
+		ulp_debug("Get x libc: 0x%lx\n", vma->vm_start);
+		task->libc_vma = vma;
+	}
+
+	/* Find [stack] */
+	if (!task->stack && vma->type == VMA_STACK)
+		task->stack = vma;
+
+	vma->leader = vma;
+
+	return vma;
+}
+
+int read_task_vmas(struct task_struct *task)
 {
 	struct vm_area_struct *vma, *prev = NULL;
-	int mapsfd;
-	FILE *mapsfp;
-
-	/* open(2) /proc/[PID]/maps */
-	mapsfd = open_pid_maps(task->pid);
-	if (mapsfd <= 0)
-		return -errno;
-	lseek(mapsfd, 0, SEEK_SET);
-
-	mapsfp = fdopen(mapsfd, "r");
-	fseek(mapsfp, 0, SEEK_SET);
-	do {
-		unsigned long start, end, off;
-		unsigned int major, minor;
-		unsigned long inode;
-		char perms[5], name_[256];
-		int r;
-		char line[1024];
-		struct vm_area_struct __unused *old;
-
-		start = end = off = major = minor = inode = 0;
-
-		memset(perms, 0, sizeof(perms));
-		memset(name_, 0, sizeof(name_));
-		memset(line, 0, sizeof(line));
-
-		if (!fgets(line, sizeof(line), mapsfp))
+	struct maps_iter it;
+	struct maps_entry e;
+	const char *name;
+	int ret;
+
+	ret = maps_iter_open(&it, task->pid, MAPS_ITER_TEXT, false);
+	if (ret)
+		return ret;
+
+	while ((ret = maps_iter_next(&it, &e)) > 0) {
+		name = str_pool_intern(&task->vma_names, e.name);
+		if (!name) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		vma = alloc_maps_vma(task, &e, name);
+		if (!vma) {
+			ret = -ENOMEM;
+			break;
+		}
+
+		insert_vma(task, vma, prev);
+		prev = vma;
+	}
+
+	maps_iter_close(&it);
+	return ret < 0 ? ret : 0;
+}
+
+/**
+ * The vma is gone from target, unlink it and release what it owns. If it's
+ * a leader, the lowest sibling leads the rest.
+ */
+static void drop_task_vma(struct task_struct *task, struct vm_area_struct *vma)
+{
+	struct vm_area_struct *sibling, *leader = NULL;
+
+	ulp_debug("Drop vma %lx-%lx %s\n", vma->vm_start, vma->vm_end,
+		  vma->name_);
+
+	if (vma->leader == vma) {
+		list_for_each_entry(sibling, &vma->siblings, siblings) {
+			if (!leader || sibling->vm_start < leader->vm_start)
+				leader = sibling;
+		}
+		list_for_each_entry(sibling, &vma->siblings, siblings)
+			sibling->leader = leader;
+	}
+
+	if (vma->is_elf) {
+		unlink_vma_task_syms(vma);
+		if (vma->bfd_elf_file) {
+			if (task->exe_bfd == vma->bfd_elf_file)
+				task->exe_bfd = NULL;
+			if (task->libc_bfd == vma->bfd_elf_file)
+				task->libc_bfd = NULL;
+			bfd_elf_close(vma->bfd_elf_file);
+		}
+		if (vma->vma_elf)
+			vma_free_elf(vma);
+	}
+
+	if (task->libc_vma == vma)
+		task->libc_vma = NULL;
+	if (task->stack == vma)
+		task->stack = NULL;
+	if (task->vma_self_elf == vma)
+		task->vma_self_elf = NULL;
+
+	unlink_vma(task, vma);
+	free_vma(vma);
+}
+
+/* Same start of the same file, kernel only split or merged it */
+static bool vma_same_mapping(const struct vm_area_struct *vma,
+			     const struct maps_entry *e, const char *name)
+{
+	return vma->vm_start == e->start && vma->name_ == name &&
+	       vma->inode == e->inode &&
+	       vma->vm_pgoff == (e->off >> PAGE_SHIFT);
+}
+
+/**
+ * Merge the current /proc/PID/maps into the vma tree, in one linear pass
+ * over both sorted sequences instead of re-reading all vmas. Unchanged vmas
+ * keep their ELF and symbols, the ones the kernel split, merged or
+ * mprotect(2)ed are updated in place, the others are inserted or dropped.
+ *
+ * @start, @end: range a known syscall touched, such as mmap(2) or
+ *               munmap(2), only vmas overlap it, and the neighbours kernel
+ *               merged with, are refreshed. [0, ULONG_MAX) for all.
+ */
+int refresh_task_vmas(struct task_struct *task, unsigned long start,
+		      unsigned long end)
+{
+	int ret, nr_new = 0, nr_update = 0, nr_drop = 0;
+	struct vm_area_struct *old, *prev = NULL, *next, *vma;
+	enum maps_iter_mode mode;
+	struct maps_iter it;
+	struct maps_entry e;
+	const char *name;
+	bool first = true;
+
+	/* Old vmas partly in range may be split or unmapped, cover them all */
+	old = find_vma_intersection(task, start, end);
+	if (old && old->vm_start < start)
+		start = old->vm_start;
+	if (end != ULONG_MAX) {
+		vma = find_vma(task, end - 1);
+		if (vma && vma->vm_end > end)
+			end = vma->vm_end;
+	}
+
+	/* PROCMAP_QUERY only reads the range, but it has no [vsyscall] */
+	mode = end == ULONG_MAX ? MAPS_ITER_TEXT : MAPS_ITER_AUTO;
+	ret = maps_iter_open(&it, task->pid, mode, false);
+	if (ret)
+		return ret;
+	maps_iter_seek(&it, start);
+
+	while ((ret = maps_iter_next(&it, &e)) > 0) {
+		if (e.start >= end)
 			break;
 
-		r = sscanf(line, "%lx-%lx %s %lx %x:%x %ld %255s", &start,
-			   &end, perms, &off, &major, &minor, &inode, name_);
-		if (r <= 0) {
-			ulp_error("sscanf failed.\n");
-			return -1;
+		name = str_pool_intern(&task->vma_names, e.name);
+		if (!name) {
+			ret = -ENOMEM;
+			break;
 		}
-#if 1
-		if (update_ulp) {
-			old = find_vma(task, start + 1);
-			/* Skip if alread exist. */
-			if (old && old->vm_start == start &&
-			    old->vm_end == end) {
-				ulp_warning("vma %s alread exist.\n", name_);
-				continue;
-			} else
-				ulp_warning("insert vma %s.\n", name_);
+
+		/* Kernel may merge the new mapping into the lower vma */
+		if (first) {
+			old = find_vma_intersection(task, MIN(start, e.start),
+						    ULONG_MAX);
+			prev = vma_rb_entry(old ? rb_prev(&old->node_rb)
+						: rb_last(&task->vmas_rb));
+			first = false;
 		}
-#endif
 
-		vma = alloc_vma(task);
-
-		vma->vm_start = start;
-		vma->vm_end = end;
-		memcpy(vma->perms, perms, sizeof(vma->perms));
-		vma->prot = vma_perms2prot(perms);
-		vma->vm_pgoff = (off >> PAGE_SHIFT);
-		vma->major = major;
-		vma->minor = minor;
-		vma->inode = inode;
-		strncpy(vma->name_, name_, sizeof(vma->name_));
-		vma->type = get_vma_type(task->pid, task->exe, name_);
-
-		/* Find libc.so */
-		if (!task->libc_vma && vma->type == VMA_LIBC &&
-		    vma->prot & PROT_EXEC) {
-			ulp_debug("Get x libc: 0x%lx\n", vma->vm_start);
-			task->libc_vma = vma;
+		/* The old ones below the entry are unmapped */
+		while (old && old->vm_end <= e.start) {
+			next = next_vma(task, old);
+			drop_task_vma(task, old);
+			old = next;
+			nr_drop++;
 		}
 
-		/* Find [stack] */
-		if (!task->stack && vma->type == VMA_STACK)
-			task->stack = vma;
+		if (old && vma_same_mapping(old, &e, name)) {
+			vma = old;
+			old = next_vma(task, old);
+		} else
+			vma = NULL;
+
+		/* Overlapped, but not the same one */
+		while (old && old->vm_start < e.end) {
+			next = next_vma(task, old);
+			drop_task_vma(task, old);
+			old = next;
+			nr_drop++;
+		}
 
-		vma->leader = vma;
+		if (vma) {
+			if (vma->vm_end != e.end ||
+			    strcmp(vma->perms, e.perms)) {
+				vma->vm_end = e.end;
+				memcpy(vma->perms, e.perms, sizeof(vma->perms));
+				vma->prot = vma_perms2prot(vma->perms);
+				if (old)
+					vma_gap_update(old, vma);
+				task_syms_invalidate_addrs(task);
+				nr_update++;
+			}
+			prev = vma;
+			continue;
+		}
 
+		vma = alloc_maps_vma(task, &e, name);
+		if (!vma) {
+			ret = -ENOMEM;
+			break;
+		}
 		insert_vma(task, vma, prev);
 		prev = vma;
-	} while (1);
+		nr_new++;
+	}
+
+	maps_iter_close(&it);
+	if (ret < 0)
+		return ret;
+
+	/* The rest in range are unmapped */
+	while (old && old->vm_start < end) {
+		next = next_vma(task, old);
+		drop_task_vma(task, old);
+		old = next;
+		nr_drop++;
+	}
 
-	fclose(mapsfp);
-	close(mapsfd);
+	ulp_debug("Refresh vmas [%lx, %lx): %d new, %d updated, %d dropped\n",
+		  start, end, nr_new, nr_update, nr_drop);
 	return 0;
 }
 
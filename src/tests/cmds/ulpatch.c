@@ -1,8 +1,16 @@
 // SPDX-License-Identifier: GPL-2.0-or-later
 /* Copyright (C) 2024-2025 Rong Tao */
+#include <errno.h>
+#include <stdio.h>
+#include <sys/wait.h>
+
 #include <utils/log.h>
 #include <utils/cmds.h>
 
+#include <elf/elf-api.h>
+#include <task/task.h>
+#include <patch/patch.h>
+
 #include <tests/test-api.h>
 
 TEST_STUB(cmds_ulpatch);
@@ -14,3 +22,244 @@ TEST(ulpatch, display, 0)
 	ret += ulpatch(2, argv);
 	return ret;
 }
+
+#define NR_FLEET	4
+
+struct fleet_children {
+	pid_t pids[NR_FLEET];
+	struct task_notify notify[NR_FLEET];
+};
+
+/* Fork copies of ulpatch_test, they wait until fleet_wait_children() */
+static void fleet_fork_children(struct fleet_children *c)
+{
+	int i;
+
+	for (i = 0; i < NR_FLEET; i++) {
+		task_notify_init(&c->notify[i], NULL);
+
+		c->pids[i] = fork();
+		if (c->pids[i] == 0) {
+			char *argv[] = {
+				(char *)ulpatch_test_path,
+				"--role", "sleeper,trigger,sleeper,wait",
+				"--msgq", c->notify[i].tmpfile,
+				NULL
+			};
+			execvp(argv[0], argv);
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < NR_FLEET; i++)
+		task_notify_wait(&c->notify[i]);
+}
+
+static int fleet_wait_children(struct fleet_children *c)
+{
+	int i, status, ret = 0;
+
+	for (i = 0; i < NR_FLEET; i++) {
+		task_notify_trigger(&c->notify[i]);
+		waitpid(c->pids[i], &status, __WALL);
+		if (status != 0)
+			ret = -EINVAL;
+		task_notify_destroy(&c->notify[i]);
+	}
+	return ret;
+}
+
+static bool pid_in(pid_t pid, const pid_t *pids, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (pids[i] == pid)
+			return true;
+	return false;
+}
+
+/* Number of ULPATCH_INFO() entries patched in the process */
+static int nr_patched(pid_t pid)
+{
+	int n = 0;
+	struct vma_ulp *ulp;
+	struct task_struct *task;
+
+	task = open_task(pid, FTO_ALL & ~FTO_RDWR);
+	if (!task)
+		return -ENOENT;
+
+	list_for_each_entry(ulp, &task->ulp_list, node)
+		n += ulp->nr_info;
+
+	close_task(task);
+	return n;
+}
+
+TEST(ulpatch, fleet_discover, 0)
+{
+	int i, nr, n, ret = 0;
+	pid_t *pids;
+	uint8_t bid[64];
+	char str_bid[sizeof(bid) * 2 + 1];
+	struct fleet_children c;
+
+	fleet_fork_children(&c);
+
+	nr = proc_find_pids(ulpatch_test_path, NULL, &pids);
+	for (i = 0; i < NR_FLEET; i++) {
+		if (nr <= 0 || !pid_in(c.pids[i], pids, nr)) {
+			ulp_error("Not found %d by exe.\n", c.pids[i]);
+			ret = -ENOENT;
+		}
+	}
+	if (nr > 0) {
+		if (pid_in(getpid(), pids, nr))
+			ret = -EINVAL;
+		free(pids);
+	}
+
+	n = elf_read_build_id(ulpatch_test_path, bid, sizeof(bid));
+	if (n > 0) {
+		elf_strbuildid(bid, n, str_bid, sizeof(str_bid));
+		nr = proc_find_pids(NULL, str_bid, &pids);
+		for (i = 0; i < NR_FLEET; i++) {
+			if (nr <= 0 || !pid_in(c.pids[i], pids, nr)) {
+				ulp_error("Not found %d by build id.\n",
+					  c.pids[i]);
+				ret = -ENOENT;
+			}
+		}
+		if (nr > 0)
+			free(pids);
+	}
+
+	ret |= fleet_wait_children(&c);
+	return ret;
+}
+
+/**
+ * Only the children, --exe patches all ulpatch_test processes of the host,
+ * append "-p PID" of each child to @argv.
+ */
+static int fleet_children_argv(const struct fleet_children *c, char *argv[],
+			       int argc, char pids[][16])
+{
+	int i;
+
+	for (i = 0; i < NR_FLEET; i++) {
+		snprintf(pids[i], sizeof(pids[i]), "%d", c->pids[i]);
+		argv[argc++] = "-p";
+		argv[argc++] = pids[i];
+	}
+	return argc;
+}
+
+TEST(ulpatch, fleet, 0)
+{
+	int i, argc_patch, argc_unpatch, ret = 0;
+	struct fleet_children c;
+	struct fleet_result results[NR_FLEET];
+	struct prepared_patch pp;
+	char pids[NR_FLEET][16];
+	char *argv_patch[5 + 2 * NR_FLEET] = {
+		"ulpatch", "--patch", ULPATCH_TEST_ULP_MULTI_PATH, "-j", "2",
+	};
+	char *argv_unpatch[2 + 2 * NR_FLEET] = {
+		"ulpatch", "--unpatch",
+	};
+
+	/* The patch is not built */
+	if (!fexist(ULPATCH_TEST_ULP_MULTI_PATH))
+		return TEST_RET_SKIP;
+
+	ret = prepare_patch(ULPATCH_TEST_ULP_MULTI_PATH, &pp);
+	if (ret)
+		return ret;
+
+	fleet_fork_children(&c);
+
+	/* Library API */
+	for (i = 0; i < NR_FLEET; i++)
+		results[i].pid = c.pids[i];
+
+	ret = fleet_patch(&pp, results, NR_FLEET, 2);
+	for (i = 0; i < NR_FLEET; i++) {
+		if (nr_patched(c.pids[i]) != pp.info.nr_ulp) {
+			ulp_error("%d is not patched.\n", c.pids[i]);
+			ret = -EINVAL;
+		}
+	}
+
+	ret |= fleet_unpatch(results, NR_FLEET, 2);
+	for (i = 0; i < NR_FLEET; i++) {
+		if (nr_patched(c.pids[i]) != 0) {
+			ulp_error("%d is not unpatched.\n", c.pids[i]);
+			ret = -EINVAL;
+		}
+	}
+
+	/* Command */
+	argc_patch = fleet_children_argv(&c, argv_patch, 5, pids);
+	argc_unpatch = fleet_children_argv(&c, argv_unpatch, 2, pids);
+
+	ret |= ulpatch(argc_patch, argv_patch);
+	for (i = 0; i < NR_FLEET; i++) {
+		if (nr_patched(c.pids[i]) != pp.info.nr_ulp)
+			ret = -EINVAL;
+	}
+	ret |= ulpatch(argc_unpatch, argv_unpatch);
+	for (i = 0; i < NR_FLEET; i++) {
+		if (nr_patched(c.pids[i]) != 0)
+			ret = -EINVAL;
+	}
+
+	release_prepared_patch(&pp);
+	ret |= fleet_wait_children(&c);
+	return ret;
+}
+
+TEST(ulpatch, fleet_rollback, 0)
+{
+	int i, status, ret = 0;
+	pid_t dead;
+	struct fleet_children c;
+	struct fleet_result results[NR_FLEET + 1];
+	struct prepared_patch pp;
+
+	/* The patch is not built */
+	if (!fexist(ULPATCH_TEST_ULP_MULTI_PATH))
+		return TEST_RET_SKIP;
+
+	ret = prepare_patch(ULPATCH_TEST_ULP_MULTI_PATH, &pp);
+	if (ret)
+		return ret;
+
+	/* A process that not exist any more */
+	dead = fork();
+	if (dead == 0)
+		exit(0);
+	waitpid(dead, &status, __WALL);
+
+	fleet_fork_children(&c);
+
+	for (i = 0; i < NR_FLEET; i++)
+		results[i].pid = c.pids[i];
+	results[NR_FLEET].pid = dead;
+
+	/* The dead one failed, all others must be rolled back */
+	if (fleet_patch(&pp, results, NR_FLEET + 1, 2) != 1)
+		ret = -EINVAL;
+
+	for (i = 0; i < NR_FLEET; i++) {
+		if (!results[i].rollback || nr_patched(c.pids[i]) != 0) {
+			ulp_error("%d is not rolled back.\n", c.pids[i]);
+			ret = -EINVAL;
+		}
+	}
+
+	release_prepared_patch(&pp);
+	ret |= fleet_wait_children(&c);
+	return ret;
+}
@@ -1,6 +1,11 @@
 // SPDX-License-Identifier: GPL-2.0-or-later
 /* Copyright (C) 2022-2025 Rong Tao */
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
 #include <string.h>
+#include <stdlib.h>
 
 #include <utils/log.h>
 #include <utils/list.h>
@@ -8,6 +13,7 @@
 #include <elf/elf-api.h>
 
 #include <utils/util.h>
+#include <utils/workpool.h>
 #include <tests/test-api.h>
 
 TEST_STUB(elf_symbol_bfd);
@@ -153,6 +159,142 @@ TEST(Bfd_sym, for_each_sym, 0)
 	return ret;
 }
 
+struct sym_snapshot {
+	int nr;
+	unsigned long sum;
+};
+
+static void snapshot_syms(struct bfd_elf_file *file, struct sym_snapshot *ss)
+{
+	struct bfd_sym *symbol;
+
+	memset(ss, 0, sizeof(*ss));
+
+#define SNAPSHOT(next)							\
+	for (symbol = next(file, NULL); symbol;				\
+	     symbol = next(file, symbol)) {				\
+		const char *name = bfd_sym_name(symbol);		\
+		ss->nr++;						\
+		ss->sum += bfd_sym_addr(symbol) * 31 + bfd_sym_size(symbol); \
+		ss->sum += name[0] + strlen(name);			\
+	}
+	SNAPSHOT(bfd_next_text_sym);
+	SNAPSHOT(bfd_next_plt_sym);
+	SNAPSHOT(bfd_next_data_sym);
+#undef SNAPSHOT
+}
+
+TEST(Bfd_sym, symcache, 0)
+{
+	int ret = 0, i;
+	struct bfd_elf_file *file;
+	struct sym_snapshot cold, warm;
+	unsigned long us_cold, us_warm;
+
+	for (i = 0; i < ARRAY_SIZE(test_files); i++) {
+
+		MODIFY_TEST_FILES(i);
+
+		if (!fexist(test_files[i]))
+			continue;
+
+		bfd_elf_uncache(test_files[i]);
+
+		us_cold = usecs();
+		file = bfd_elf_open(test_files[i]);
+		us_cold = usecs() - us_cold;
+		if (!file) {
+			ret = -1;
+			continue;
+		}
+		/* Still opened by someone, can't reload */
+		if (bfd_elf_file_refcount(file) != 1) {
+			bfd_elf_close(file);
+			continue;
+		}
+		if (bfd_elf_file_cached(file))
+			ret = -1;
+		snapshot_syms(file, &cold);
+		bfd_elf_close(file);
+
+		us_warm = usecs();
+		file = bfd_elf_open(test_files[i]);
+		us_warm = usecs() - us_warm;
+		if (!file) {
+			ret = -1;
+			continue;
+		}
+		/* No Build ID, no cache */
+		if (!bfd_elf_file_cached(file))
+			ulp_warning("%s not cached.\n", test_files[i]);
+		snapshot_syms(file, &warm);
+		bfd_elf_close(file);
+
+		if (cold.nr != warm.nr || cold.sum != warm.sum) {
+			ulp_error("%s: cache mismatch, %d/%d syms\n",
+				  test_files[i], cold.nr, warm.nr);
+			ret = -1;
+		}
+
+		printf("%s: %d syms, bfd %ldus, cache %ldus\n", test_files[i],
+		       cold.nr, us_cold, us_warm);
+	}
+
+	return ret;
+}
+
+#define NR_PARALLEL_OPEN	8
+
+static void __parallel_open(size_t idx, void *arg)
+{
+	struct bfd_elf_file **files = arg;
+	files[idx] = bfd_elf_open(test_files[idx / NR_PARALLEL_OPEN]);
+}
+
+TEST(Bfd_sym, parallel_open, 0)
+{
+	int ret = 0, i, j;
+	struct bfd_elf_file *files[ARRAY_SIZE(test_files) * NR_PARALLEL_OPEN];
+	struct bfd_elf_file *file;
+
+	for (i = 0; i < ARRAY_SIZE(test_files); i++) {
+		MODIFY_TEST_FILES(i);
+	}
+
+	/* Open every file NR_PARALLEL_OPEN times concurrently */
+	workpool_run(workpool_nr_workers() * 2, ARRAY_SIZE(files),
+		     __parallel_open, files);
+
+	for (i = 0; i < ARRAY_SIZE(test_files); i++) {
+		file = files[i * NR_PARALLEL_OPEN];
+
+		for (j = 0; j < NR_PARALLEL_OPEN; j++) {
+			if (files[i * NR_PARALLEL_OPEN + j] != file) {
+				ulp_error("%s opened as different files\n",
+					  test_files[i]);
+				ret = -1;
+			}
+		}
+
+		if (!file) {
+			if (fexist(test_files[i]))
+				ret = -1;
+			continue;
+		}
+
+		if (bfd_elf_file_refcount(file) < NR_PARALLEL_OPEN) {
+			ulp_error("%s refcount %d\n", test_files[i],
+				  bfd_elf_file_refcount(file));
+			ret = -1;
+		}
+
+		for (j = 0; j < NR_PARALLEL_OPEN; j++)
+			bfd_elf_close(file);
+	}
+
+	return ret;
+}
+
 static int objdump_plt_sym(struct bfd_elf_file *efile, const char *file)
 {
 	FILE *fp;
@@ -245,3 +387,192 @@ TEST(Bfd_sym, objdump_plt_sym_addr, 0)
 	return ret;
 }
 
+
+struct sym_entry {
+	char *name;
+	unsigned long addr;
+	unsigned long size;
+};
+
+struct sym_list {
+	int nr;
+	struct sym_entry *syms;
+};
+
+#define NR_SYM_LISTS	3
+
+static struct bfd_sym *(*next_syms[NR_SYM_LISTS])(struct bfd_elf_file *,
+						    struct bfd_sym *) = {
+	bfd_next_text_sym,
+	bfd_next_plt_sym,
+	bfd_next_data_sym,
+};
+
+static void free_sym_lists(struct sym_list *lists)
+{
+	int t, i;
+
+	for (t = 0; t < NR_SYM_LISTS; t++) {
+		for (i = 0; i < lists[t].nr; i++)
+			free(lists[t].syms[i].name);
+		free(lists[t].syms);
+		lists[t].nr = 0;
+		lists[t].syms = NULL;
+	}
+}
+
+/* Symbols are iterated in name order, no need to sort */
+static int load_sym_lists(const char *elf, enum bfd_elf_backend backend,
+			  struct sym_list *lists)
+{
+	int t, n;
+	struct bfd_elf_file *file;
+	struct bfd_sym *symbol;
+
+	bfd_elf_set_backend(backend);
+	file = bfd_elf_open(elf);
+	if (!file)
+		return -ENOENT;
+
+	/* Opened by someone else with another backend */
+	if (bfd_elf_file_refcount(file) != 1) {
+		bfd_elf_close(file);
+		return -EBUSY;
+	}
+
+	/* bfd_elf_open() falls back to BFD silently */
+	if (bfd_elf_file_backend(file) != backend) {
+		ulp_error("%s: loaded by backend %d, not %d\n", elf,
+			  bfd_elf_file_backend(file), backend);
+		bfd_elf_close(file);
+		return -EPROTO;
+	}
+
+	for (t = 0; t < NR_SYM_LISTS; t++) {
+		n = 0;
+		for (symbol = next_syms[t](file, NULL); symbol;
+		     symbol = next_syms[t](file, symbol))
+			n++;
+
+		lists[t].nr = 0;
+		lists[t].syms = calloc(n ?: 1, sizeof(struct sym_entry));
+
+		for (symbol = next_syms[t](file, NULL); symbol;
+		     symbol = next_syms[t](file, symbol)) {
+			struct sym_entry *e = &lists[t].syms[lists[t].nr++];
+			e->name = strdup(bfd_sym_name(symbol));
+			e->addr = bfd_sym_addr(symbol);
+			e->size = bfd_sym_size(symbol);
+		}
+	}
+
+	bfd_elf_close(file);
+	return 0;
+}
+
+static int diff_sym_lists(const char *elf, struct sym_list *bfd,
+			  struct sym_list *libelf)
+{
+	int t, i, ret = 0;
+	static const char *types[NR_SYM_LISTS] = { "text", "plt", "data" };
+
+	for (t = 0; t < NR_SYM_LISTS; t++) {
+		if (bfd[t].nr != libelf[t].nr) {
+			ulp_error("%s: %s syms bfd %d, libelf %d\n", elf,
+				  types[t], bfd[t].nr, libelf[t].nr);
+			ret = -1;
+		}
+
+		for (i = 0; i < bfd[t].nr && i < libelf[t].nr; i++) {
+			struct sym_entry *e1 = &bfd[t].syms[i];
+			struct sym_entry *e2 = &libelf[t].syms[i];
+
+			if (strcmp(e1->name, e2->name) || e1->addr != e2->addr ||
+			    e1->size != e2->size) {
+				ulp_error("%s: %s bfd %s %#lx %ld, libelf %s %#lx %ld\n",
+					  elf, types[t], e1->name, e1->addr,
+					  e1->size, e2->name, e2->addr, e2->size);
+				ret = -1;
+				break;
+			}
+		}
+	}
+
+	return ret;
+}
+
+/* The files that libelf backend reads, others always fall back to BFD */
+static bool libelf_backend_file(const char *elf)
+{
+	int fd;
+	bool ret = false;
+	Elf *e;
+	GElf_Ehdr ehdr;
+
+	fd = open(elf, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	elf_version(EV_CURRENT);
+	e = elf_begin(fd, ELF_C_READ, NULL);
+	if (e && gelf_getehdr(e, &ehdr))
+		ret = (ehdr.e_type == ET_EXEC || ehdr.e_type == ET_DYN) &&
+		      (ehdr.e_machine == EM_X86_64 ||
+		       ehdr.e_machine == EM_AARCH64);
+	if (e)
+		elf_end(e);
+	close(fd);
+	return ret;
+}
+
+/**
+ * The libelf backend must produce exactly the same symbols as the BFD
+ * backend, check every ELF file under /usr/lib64.
+ */
+TEST(Bfd_sym, backend_diff, 0)
+{
+	int ret = 0, nr_files = 0;
+	DIR *dir;
+	struct dirent *ent;
+	const char *lib64 = "/usr/lib64";
+	char path[PATH_MAX];
+	struct sym_list bfd[NR_SYM_LISTS] = {}, libelf[NR_SYM_LISTS] = {};
+
+	dir = opendir(lib64);
+	if (!dir) {
+		ulp_warning("%s not exist, skip.\n", lib64);
+		return 0;
+	}
+
+	/* Don't compare the cache with itself */
+	bfd_elf_set_symcache(false);
+
+	while ((ent = readdir(dir)) != NULL) {
+		snprintf(path, sizeof(path), "%s/%s", lib64, ent->d_name);
+
+		if (!fregular(path) || !(ftype(path) & FILE_ELF) ||
+		    !libelf_backend_file(path))
+			continue;
+
+		if (load_sym_lists(path, BFD_ELF_BACKEND_BFD, bfd))
+			continue;
+
+		if (load_sym_lists(path, BFD_ELF_BACKEND_LIBELF, libelf)) {
+			ulp_error("%s: libelf backend open failed\n", path);
+			ret = -1;
+		} else if (diff_sym_lists(path, bfd, libelf))
+			ret = -1;
+
+		free_sym_lists(bfd);
+		free_sym_lists(libelf);
+		nr_files++;
+	}
+
+	closedir(dir);
+
+	bfd_elf_set_backend(BFD_ELF_BACKEND_LIBELF);
+	bfd_elf_set_symcache(true);
+
+	printf("Compared %d ELF files in %s\n", nr_files, lib64);
+	return ret;
+}
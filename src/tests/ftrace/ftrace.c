@@ -220,7 +220,7 @@ int mcount_entry(unsigned long *parent_loc, unsigned long child,
 	return 0;
 }
 
-unsigned long mcount_exit(long *retval)
+unsigned long mcount_exit(long *retval, unsigned long fp)
 {
 	/* TODO */
 	return 0;
@@ -0,0 +1,425 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <utils/log.h>
+#include <utils/util.h>
+#include <task/task.h>
+#include <patch/patch.h>
+#include <patch/ftrace.h>
+
+#include <tests/test-api.h>
+
+TEST_STUB(ftrace_ring);
+
+/**
+ * This file is compiled with -pg, every call of this function calls mcount(),
+ * see launch_tracee().
+ */
+__opt_O0 unsigned long ftrace_tracee_func(unsigned long a, unsigned long b)
+{
+	return a + b;
+}
+
+/* The tracee keeps calling until we kill it */
+#define TRACEE_USEC		(60 * 1000 * 1000)
+#define TRACE_USEC		(1000 * 1000)
+#define MIN_EVENTS_PER_SEC	(1000 * 1000)
+
+struct ring_stat {
+	pid_t tid;
+	unsigned long nr;
+	unsigned long bad;
+};
+
+static int count_record(const struct ulftrace_record *rec, void *arg)
+{
+	struct ring_stat *stat = arg;
+
+	/* See launch_tracee(), arguments are (i, i + 1) */
+	if (rec->tid != stat->tid || rec->args[0] + 1 != rec->args[1])
+		stat->bad++;
+	stat->nr++;
+	return 0;
+}
+
+static pid_t launch_tracee(struct task_notify *notify)
+{
+	pid_t pid;
+	char usec[32];
+
+	snprintf(usec, sizeof(usec), "%d", TRACEE_USEC);
+	task_notify_init(notify, NULL);
+
+	pid = fork();
+	if (pid == 0) {
+		char *argv[] = {
+			(char *)ulpatch_test_path,
+			"--role", "trigger,tracee",
+			"--msgq", notify->tmpfile,
+			"--usecond", usec,
+			NULL
+		};
+		execvp(argv[0], argv);
+		exit(1);
+	}
+
+	task_notify_wait(notify);
+	return pid;
+}
+
+static void kill_tracee(pid_t pid, struct task_notify *notify)
+{
+	int status;
+
+	kill(pid, SIGKILL);
+	waitpid(pid, &status, __WALL);
+	task_notify_destroy(notify);
+}
+
+/**
+ * The ftrace object is not built, or the compiler doesn't support -pg, the
+ * tracee never calls mcount, nothing to test.
+ */
+static bool ftrace_unsupported(struct task_struct *task)
+{
+	if (!fexist(ULPATCH_OBJ_FTRACE_MCOUNT_PATH)) {
+		ulp_warning("Not found %s.\n", ULPATCH_OBJ_FTRACE_MCOUNT_PATH);
+		return true;
+	}
+	if (!find_task_sym(task, MCOUNT_NAME, NULL, NULL)) {
+		ulp_warning("Not found %s in %d.\n", MCOUNT_NAME, task->pid);
+		return true;
+	}
+	return false;
+}
+
+/* The tracee and its ftrace session, see ftrace_setup() */
+struct ftrace_test {
+	pid_t pid;
+	struct task_notify notify;
+	struct task_struct *task;
+	/* ftrace_tracee_func() in tracee */
+	struct addr_range range;
+	struct ftrace_session fs;
+	bool opened;
+};
+
+/**
+ * Launch the tracee, and open a ftrace session of it with @nr_records
+ * records per ring, no filter. Call ftrace_teardown() anyway.
+ *
+ * @return: 0, TEST_RET_SKIP if ftrace is unsupported, or -errno.
+ */
+static int ftrace_setup(struct ftrace_test *t, unsigned int nr_records)
+{
+	int ret;
+	struct task_sym *tsym;
+
+	memset(t, 0, sizeof(*t));
+	t->pid = launch_tracee(&t->notify);
+
+	t->task = open_task(t->pid, FTO_ULFTRACE);
+	if (!t->task)
+		return -ENOENT;
+
+	if (ftrace_unsupported(t->task))
+		return TEST_RET_SKIP;
+
+	tsym = find_task_sym(t->task, "ftrace_tracee_func", NULL, NULL);
+	if (!tsym || !tsym->size) {
+		ulp_error("Not found ftrace_tracee_func in %d.\n", t->pid);
+		return -ENOENT;
+	}
+	t->range.start = tsym->addr;
+	t->range.end = tsym->addr + tsym->size;
+
+	ret = ftrace_open(&t->fs, t->task, ULPATCH_OBJ_FTRACE_MCOUNT_PATH,
+			  ULFTRACE_DEF_RINGS, nr_records);
+	if (ret)
+		return ret;
+	t->opened = true;
+
+	return 0;
+}
+
+/* Close the ftrace session only, the tracee keeps running */
+static int ftrace_test_close(struct ftrace_test *t)
+{
+	if (!t->opened)
+		return 0;
+	t->opened = false;
+	return ftrace_close(&t->fs) ? -EFAULT : 0;
+}
+
+/* @return: 0, or -EFAULT if closing the ftrace session failed */
+static int ftrace_teardown(struct ftrace_test *t)
+{
+	int ret = ftrace_test_close(t);
+
+	if (t->task)
+		close_task(t->task);
+	kill_tracee(t->pid, &t->notify);
+	return ret;
+}
+
+TEST(Ftrace, ring_buffer, 0)
+{
+	int ret;
+	unsigned long start, us, rate;
+	struct ftrace_test t;
+	struct ring_stat stat = {};
+
+	ret = ftrace_setup(&t, 1U << 16);
+	if (ret)
+		goto out;
+
+	ftrace_set_filter(&t.fs, t.range.start, t.range.end);
+
+	stat.tid = t.pid;
+	start = usecs();
+	while (usecs() - start < TRACE_USEC)
+		ftrace_consume(&t.fs, count_record, &stat);
+	us = usecs() - start;
+
+	rate = stat.nr * 1000000UL / us;
+	ulp_info("%lu events in %luus, %lu lost, %lu bad, %lu events/s\n",
+		 stat.nr, us, ftrace_lost(&t.fs), stat.bad, rate);
+
+	ret = ftrace_test_close(&t);
+
+	if (stat.bad || rate < MIN_EVENTS_PER_SEC) {
+		ulp_error("Expect >= %d events/s without bad record.\n",
+			  MIN_EVENTS_PER_SEC);
+		ret = -EINVAL;
+	}
+
+out:
+	return ftrace_teardown(&t) ?: ret;
+}
+
+struct site_stat {
+	struct addr_range range;
+	unsigned long nr;
+	unsigned long bad;
+};
+
+static int count_in_range(const struct ulftrace_record *rec, void *arg)
+{
+	struct site_stat *stat = arg;
+
+	if (rec->child < stat->range.start || rec->child >= stat->range.end)
+		stat->bad++;
+	stat->nr++;
+	return 0;
+}
+
+/* Count records published in @usec */
+static void consume_for(struct ftrace_session *fs, struct site_stat *stat,
+			unsigned long usec)
+{
+	unsigned long start = usecs();
+
+	while (usecs() - start < usec)
+		ftrace_consume(fs, count_in_range, stat);
+}
+
+TEST(Ftrace, call_sites, 0)
+{
+	int ret, n;
+	char text[MCOUNT_INSN_MAX];
+	struct ftrace_test t;
+	struct ftrace_site site = {};
+	struct site_stat stat = {};
+	struct addr_range *range = &stat.range;
+	struct ftrace_session *fs = &t.fs;
+	size_t i;
+
+	ret = ftrace_setup(&t, 1U << 16);
+	if (ret)
+		goto out;
+	*range = t.range;
+
+	ret = ftrace_load_sites(fs);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < fs->nr_sites; i++) {
+		if (fs->sites[i].ip >= range->start &&
+		    fs->sites[i].ip < range->end)
+			site = fs->sites[i];
+	}
+	ulp_info("%zu call sites, ftrace_tracee_func's at %lx\n",
+		 fs->nr_sites, site.ip);
+	if (!site.ip) {
+		ret = -ENOENT;
+		goto out;
+	}
+
+	/* No filter, only the call sites decide */
+	/* NOP out all sites, nothing is traced */
+	n = ftrace_select_sites(fs, range, 0);
+	memcpy_from_task(t.task, text, site.ip, site.len);
+	if (n != 0 || memcmp(text, ftrace_nop_insn(site.len), site.len)) {
+		ulp_error("Expect NOP at %lx.\n", site.ip);
+		ret = -EINVAL;
+		goto out;
+	}
+	consume_for(fs, &stat, TRACE_USEC / 10);
+	stat.nr = stat.bad = 0;
+	consume_for(fs, &stat, TRACE_USEC / 10);
+	if (stat.nr) {
+		ulp_error("Expect no record, but %lu.\n", stat.nr);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/* Enable ftrace_tracee_func() only */
+	n = ftrace_select_sites(fs, range, 1);
+	memcpy_from_task(t.task, text, site.ip, site.len);
+	if (n != 1 || memcmp(text, site.insn, site.len)) {
+		ulp_error("Expect original call at %lx.\n", site.ip);
+		ret = -EINVAL;
+		goto out;
+	}
+	consume_for(fs, &stat, TRACE_USEC / 10);
+	ulp_info("%lu records, %lu bad\n", stat.nr, stat.bad);
+	if (!stat.nr || stat.bad)
+		ret = -EINVAL;
+
+out:
+	return ftrace_teardown(&t) ?: ret;
+}
+
+/* Trace ftrace_tracee_func() only in @mode */
+static void ftrace_trace_tracee(struct ftrace_test *t,
+				enum ulftrace_mode mode)
+{
+	ftrace_set_filter(&t->fs, t->range.start, t->range.end);
+	ftrace_set_mode(&t->fs, mode);
+	if (!ftrace_load_sites(&t->fs))
+		ftrace_select_sites(&t->fs, &t->range, 1);
+}
+
+TEST(Ftrace, graph, 0)
+{
+	int ret, n, i, b;
+	unsigned long nr_hist;
+	struct ftrace_test t;
+	struct ulftrace_func *func = NULL;
+	struct ulftrace_slow slow[ULFTRACE_NR_SLOW];
+	struct addr_range *range = &t.range;
+
+	ret = ftrace_setup(&t, 64);
+	if (ret)
+		goto out;
+
+	ftrace_trace_tracee(&t, ULFTRACE_MODE_GRAPH);
+
+	usleep(TRACE_USEC / 5);
+
+	for (i = 0; i < t.fs.shm->nr_funcs; i++) {
+		func = ulftrace_func(t.fs.shm, i);
+		if (func->child >= range->start && func->child < range->end)
+			break;
+		func = NULL;
+	}
+	if (!func) {
+		ulp_error("Not found ftrace_tracee_func statistics.\n");
+		ret = -ENOENT;
+		goto out;
+	}
+
+	/* Stop aggregating, then the statistics are stable */
+	ftrace_set_filter(&t.fs, 1, 1);
+	usleep(TRACE_USEC / 100);
+
+	for (b = 0, nr_hist = 0; b < ULFTRACE_HIST_BUCKETS; b++)
+		nr_hist += func->hist[b];
+
+	n = ftrace_slowest(&t.fs, slow, ULFTRACE_NR_SLOW);
+	ulp_info("%lu calls, max %lu cycles, max depth %lu, %d slowest\n",
+		 func->count, func->max, func->max_depth, n);
+
+	if (!func->count || nr_hist != func->count || func->max_depth < 1 ||
+	    n <= 0) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (slow[i].child < range->start ||
+		    slow[i].child >= range->end || slow[i].tid != t.pid ||
+		    (i && slow[i].duration > slow[i - 1].duration)) {
+			ulp_error("Bad slowest call %d.\n", i);
+			ret = -EINVAL;
+		}
+	}
+
+	ret = ftrace_test_close(&t) ?: ret;
+
+	/* The hooked return addresses must be restored */
+	if (kill(t.pid, 0)) {
+		ulp_error("Tracee %d died.\n", t.pid);
+		ret = -ESRCH;
+	}
+
+out:
+	return ftrace_teardown(&t) ?: ret;
+}
+
+TEST(Ftrace, aggregate, 0)
+{
+	int ret;
+	long n, i;
+	unsigned long nr = 0;
+	struct ftrace_test t;
+	struct ulftrace_agg *aggs;
+	struct addr_range *range = &t.range;
+
+	ret = ftrace_setup(&t, 64);
+	if (ret)
+		goto out;
+
+	ftrace_trace_tracee(&t, ULFTRACE_MODE_AGGREGATE);
+
+	usleep(TRACE_USEC / 5);
+
+	n = ftrace_aggregate(&t.fs, &aggs, true);
+	for (i = 0; i < n; i++) {
+		if (aggs[i].child < range->start ||
+		    aggs[i].child >= range->end) {
+			ulp_error("Unexpected child %lx.\n", aggs[i].child);
+			ret = -EINVAL;
+		}
+		nr += aggs[i].count;
+	}
+	if (n > 0)
+		free(aggs);
+	ulp_info("%ld functions, %lu calls\n", n, nr);
+
+	if (n != 1 || !nr) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/* Nothing counted after stop and reset */
+	ftrace_set_filter(&t.fs, 1, 1);
+	n = ftrace_aggregate(&t.fs, &aggs, true);
+	if (n > 0)
+		free(aggs);
+	usleep(TRACE_USEC / 100);
+	n = ftrace_aggregate(&t.fs, &aggs, true);
+	if (n > 0)
+		free(aggs);
+	if (n != 0) {
+		ulp_error("Expect no call after reset, but %ld.\n", n);
+		ret = -EINVAL;
+	}
+
+out:
+	return ftrace_teardown(&t) ?: ret;
+}
@@ -69,7 +69,8 @@ static void __ctor(TEST_PRIO_START) __init_test_list(void)
 
 #define STAT_IDX_SUCCESS	0
 #define STAT_IDX_FAILED		1
-static unsigned long stat_count[2] = {0};
+#define STAT_IDX_SKIPPED	2
+static unsigned long stat_count[3] = {0};
 
 static unsigned long total_spent_us = 0;
 
@@ -99,6 +100,7 @@ static enum who {
 	ROLE_PRINTER, // printer
 	ROLE_MULTI_THREADS, // multi-threads
 	ROLE_LISTENER, // listener
+	ROLE_TRACEE, // call a -pg function in loop
 	ROLE_MIX, // mix: sleeper, waiting, trigger
 	ROLE_MAX,
 } role = ROLE_TESTER;
@@ -112,6 +114,7 @@ static const char *role_string[ROLE_MAX] = {
 	[ROLE_PRINTER] = "printer",
 	[ROLE_MULTI_THREADS] = "multi-threads",
 	[ROLE_LISTENER] = "listener",
+	[ROLE_TRACEE] = "tracee",
 	[ROLE_MIX] = "mix",
 };
 
@@ -262,6 +265,7 @@ static void print_help(void)
 	"                     '%s' i will startup a multi-thread printer process.\n"
 	"                           number or threads set by --nr-threads, default: %d\n"
 	"                     '%s' i will wait on msgrcv(2) with request, specify by -m.\n"
+	"                     '%s' i will call a -pg function in loop for -s useconds.\n"
 	"                     MIX:\n"
 	"                       -r sleeper,sleeper, will launch sleeper twice\n"
 	"\n",
@@ -273,7 +277,8 @@ static void print_help(void)
 	role_string[ROLE_PRINTER],
 	role_string[ROLE_MULTI_THREADS],
 	nr_threads,
-	role_string[ROLE_LISTENER]
+	role_string[ROLE_LISTENER],
+	role_string[ROLE_TRACEE]
 	);
 	printf(
 	"   %s and %s arguments:\n"
@@ -509,7 +514,7 @@ static bool should_skip(struct test *test)
 
 static int execute_one_test(struct test *test)
 {
-	bool failed = false;
+	bool failed = false, skipped = false;
 	int verbose;
 
 	errno = 0;
@@ -542,7 +547,12 @@ static int execute_one_test(struct test *test)
 	enable_verbose(verbose);
 
 done_test:
-	if (test->real_ret == test->expect_ret || test->expect_ret == TEST_RET_SKIP) {
+	/* The test returns TEST_RET_SKIP if its prerequisite is missing */
+	if (test->real_ret == TEST_RET_SKIP &&
+	    test->expect_ret != TEST_RET_SKIP) {
+		stat_count[STAT_IDX_SKIPPED]++;
+		skipped = true;
+	} else if (test->real_ret == test->expect_ret || test->expect_ret == TEST_RET_SKIP) {
 		stat_count[STAT_IDX_SUCCESS]++;
 	} else {
 		stat_count[STAT_IDX_FAILED]++;
@@ -562,8 +572,8 @@ done_test:
 
 	test_log("\033[2m%ldus\033[m %s%-8s%s %s ret:%d:%d\n",
 		test->spend_us,
-		failed ? "\033[31m" : "\033[32m",
-		failed ? "Failed: " : "OK",
+		failed ? "\033[31m" : skipped ? "\033[33m" : "\033[32m",
+		failed ? "Failed: " : skipped ? "Skip" : "OK",
 		failed ? (
 				str_special_ret(test->real_ret) ?: strerror(errno)
 			) : "",
@@ -639,16 +649,19 @@ print_stat:
 	}
 
 	unsigned long total = stat_count[STAT_IDX_SUCCESS]
-				+ stat_count[STAT_IDX_FAILED];
+				+ stat_count[STAT_IDX_FAILED]
+				+ stat_count[STAT_IDX_SKIPPED];
 	fprintf(stderr,
 		"=========================================\n"
 		"=== Total %ld tested\n"
 		"===  Success %ld\n"
 		"===  Failed %ld\n"
+		"===  Skipped %ld\n"
 		"===  Spend %ldms %.2lfms/per\n",
 		total,
 		stat_count[STAT_IDX_SUCCESS],
 		stat_count[STAT_IDX_FAILED],
+		stat_count[STAT_IDX_SKIPPED],
 		total_spent_us / 1000,
 		total_spent_us * 1.0f / total / 1000.0f
 	);
@@ -746,6 +759,7 @@ int printer_print_hello(int nloop, const char *content)
 			__stringify(printer_print_hello), printer_print_hello,
 			__stringify(static_func1), static_func1);
 	hello_world();
+	goodbye_world();
 	return ret;
 }
 
@@ -759,6 +773,18 @@ static void launch_printer(void)
 	}
 }
 
+/* ftrace_tracee_func() is compiled with -pg, see tests/ftrace/ring.c */
+static void launch_tracee(void)
+{
+	unsigned long i, start = usecs();
+
+	for (i = 0; ; i++) {
+		ftrace_tracee_func(i, i + 1);
+		if ((i & 0xfff) == 0 && usecs() - start >= sleep_usec)
+			break;
+	}
+}
+
 static void launch_listener(void);
 
 static void launch_mix_role(enum who r)
@@ -779,6 +805,9 @@ static void launch_mix_role(enum who r)
 	case ROLE_LISTENER:
 		launch_listener();
 		break;
+	case ROLE_TRACEE:
+		launch_tracee();
+		break;
 	case ROLE_MIX:
 	case ROLE_TESTER:
 		fprintf(stderr, "Not support %s in mix role.\n", role_string[r]);
@@ -960,6 +989,7 @@ void never_called_stub(void)
 	CALL_TEST_STUB(elf_symbol);
 	CALL_TEST_STUB(elf_symbol_bfd);
 	CALL_TEST_STUB(ftrace_ftrace);
+	CALL_TEST_STUB(ftrace_ring);
 	CALL_TEST_STUB(patch_asm);
 	CALL_TEST_STUB(patch_meta);
 	CALL_TEST_STUB(patch_object);
@@ -970,8 +1000,10 @@ void never_called_stub(void)
 	CALL_TEST_STUB(task_current);
 	CALL_TEST_STUB(task_proc);
 	CALL_TEST_STUB(task_symbol);
+	CALL_TEST_STUB(task_thread);
 	CALL_TEST_STUB(task_vma);
 	CALL_TEST_STUB(utils_ansi);
+	CALL_TEST_STUB(utils_arena);
 	CALL_TEST_STUB(utils_backtrace);
 	CALL_TEST_STUB(utils_disasm);
 	CALL_TEST_STUB(utils_file);
@@ -979,10 +1011,14 @@ void never_called_stub(void)
 	CALL_TEST_STUB(utils_init);
 	CALL_TEST_STUB(utils_list);
 	CALL_TEST_STUB(utils_log);
+	CALL_TEST_STUB(utils_pattern);
 	CALL_TEST_STUB(utils_rbtree);
 	CALL_TEST_STUB(utils_string);
+	CALL_TEST_STUB(utils_strhash);
+	CALL_TEST_STUB(utils_strpool);
 	CALL_TEST_STUB(utils_utils);
 	CALL_TEST_STUB(utils_version);
+	CALL_TEST_STUB(utils_workpool);
 }
 
 static void ulpatch_test_args_reset_stub(void)
@@ -1026,6 +1062,7 @@ int main(int argc, char *argv[])
 	case ROLE_TRIGGER:
 	case ROLE_PRINTER:
 	case ROLE_LISTENER:
+	case ROLE_TRACEE:
 		launch_mix_role(role);
 		break;
 	case ROLE_MIX:
@@ -25,6 +25,10 @@ const struct ulpatch_object ulpatch_objs[] = {
 		.type = ULPATCH_OBJ_TYPE_ULP,
 		.path = ULPATCH_TEST_ULP_PRINTF_PATH
 	},
+	{
+		.type = ULPATCH_OBJ_TYPE_ULP,
+		.path = ULPATCH_TEST_ULP_MULTI_PATH
+	},
 };
 
 int nr_ulpatch_objs(void)
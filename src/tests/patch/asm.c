@@ -1,6 +1,10 @@
 // SPDX-License-Identifier: GPL-2.0-or-later
 /* Copyright (C) 2024-2025 Rong Tao */
 #include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <sys/wait.h>
 
 #include <utils/log.h>
@@ -43,3 +47,70 @@ TEST(Patch_asm, exit, 0)
 
 	return ret;
 }
+
+TEST(Patch_asm, abort, 0)
+{
+	int pid, status;
+
+	pid = fork();
+	if (pid == 0)
+		__ulp_builtin_abort();
+
+	waitpid(pid, &status, 0);
+	if (!WIFSIGNALED(status) || WTERMSIG(status) != SIGABRT)
+		return -1;
+
+	/* Handled SIGABRT returns, then exit */
+	pid = fork();
+	if (pid == 0) {
+		signal(SIGABRT, SIG_IGN);
+		__ulp_builtin_abort();
+		exit(0);
+	}
+
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 128 + SIGABRT)
+		return -1;
+	return 0;
+}
+
+TEST(Patch_asm, getpid, 0)
+{
+	int pid, status;
+
+	if (__ulp_builtin_getpid() != getpid())
+		return -1;
+
+	/* The child must not see the parent's pid */
+	pid = fork();
+	if (pid == 0)
+		exit(__ulp_builtin_getpid() == getpid() ? 0 : 1);
+
+	waitpid(pid, &status, 0);
+	return WEXITSTATUS(status);
+}
+
+TEST(Patch_asm, getcpu, 0)
+{
+	int cpu, ret = 0;
+	cpu_set_t set, old;
+
+	if (sched_getaffinity(0, sizeof(old), &old))
+		return -errno;
+
+	/* Pin on current CPU, then it's stable */
+	cpu = sched_getcpu();
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		return -errno;
+
+	if (__ulp_builtin_getcpu() != cpu) {
+		ulp_error("getcpu %d, but sched_getcpu %d\n",
+			  __ulp_builtin_getcpu(), cpu);
+		ret = -EINVAL;
+	}
+
+	sched_setaffinity(0, sizeof(old), &old);
+	return ret;
+}
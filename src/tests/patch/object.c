@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-2.0-or-later
 /* Copyright (C) 2022-2025 Rong Tao */
 #include <errno.h>
+#include <string.h>
 
 #include <utils/log.h>
 #include <utils/list.h>
@@ -16,6 +17,7 @@ TEST_STUB(patch_object);
 TEST(Patch_object, check, 0)
 {
 	int i, ret = 0;
+	unsigned int j;
 
 	for (i = 0; i < nr_ulpatch_objs(); i++) {
 		struct load_info info = {};
@@ -34,22 +36,30 @@ TEST(Patch_object, check, 0)
 			return ret;
 		}
 
-		setup_load_info(&info);
+		ret = setup_load_info(&info);
+		if (ret) {
+			ulp_error("Setup %s failed.\n", obj);
+			release_load_info(&info);
+			fremove(tmpfile);
+			return ret;
+		}
 
 		/**
-		 * Check patch info, see ULPATCH_INFO() macro
+		 * Check patch info of every entry, see ULPATCH_INFO() macro
 		 */
-		if (info.ulp_info->version != ULPATCH_FILE_VERSION) {
-			ulp_error("Wrong version %d, must be %d\n",
-				info.ulp_info->version, ULPATCH_FILE_VERSION);
-			ret++;
-		}
-		if (info.ulp_info->pad[0] != 0x11 || \
-			info.ulp_info->pad[1] != 0x22 || \
-			info.ulp_info->pad[2] != 0x33 || \
-			info.ulp_info->pad[3] != 0x44) {
-			ulp_error("Get wrong pad 0-3.\n");
-			ret++;
+		for (j = 0; j < info.nr_ulp; j++) {
+			struct ulpatch_info *inf = &info.ulp_info[j];
+
+			if (inf->version != ULPATCH_FILE_VERSION) {
+				ulp_error("Wrong version %d, must be %d\n",
+					inf->version, ULPATCH_FILE_VERSION);
+				ret++;
+			}
+			if (inf->pad[0] != 0x11 || inf->pad[1] != 0x22 ||
+			    inf->pad[2] != 0x33 || inf->pad[3] != 0x44) {
+				ulp_error("Get wrong pad 0-3.\n");
+				ret++;
+			}
 		}
 
 		release_load_info(&info);
@@ -59,3 +69,44 @@ TEST(Patch_object, check, 0)
 	return ret;
 }
 
+
+TEST(Patch_object, multi, 0)
+{
+	int ret = 0;
+	struct load_info info = {};
+	char *obj = ULPATCH_TEST_ULP_MULTI_PATH;
+	char *tmpfile = "copy.obj";
+
+	if (!fexist(obj)) {
+		ulp_error("\n%s is not exist, maybe: make install\n", obj);
+		return -EEXIST;
+	}
+
+	ret = alloc_patch_file(obj, tmpfile, &info);
+	if (ret)
+		return ret;
+
+	ret = setup_load_info(&info);
+	if (ret)
+		goto release;
+
+	/* See tests/ulpatches/multi.c */
+	if (info.nr_ulp != 2) {
+		ulp_error("%s has %d entries, must be 2.\n", obj, info.nr_ulp);
+		ret = -EINVAL;
+		goto release;
+	}
+
+	if (strcmp(info.ulp_strtab[0].src_func, "multi_hello_world") ||
+	    strcmp(info.ulp_strtab[0].dst_func, "hello_world") ||
+	    strcmp(info.ulp_strtab[1].src_func, "multi_goodbye_world") ||
+	    strcmp(info.ulp_strtab[1].dst_func, "goodbye_world")) {
+		ulp_error("Wrong entries of %s.\n", obj);
+		ret = -EINVAL;
+	}
+
+release:
+	release_load_info(&info);
+	fremove(tmpfile);
+	return ret;
+}
@@ -1,6 +1,7 @@
 // SPDX-License-Identifier: GPL-2.0-or-later
 /* Copyright (C) 2022-2025 Rong Tao */
 #include <errno.h>
+#include <stdlib.h>
 #include <fcntl.h>
 #include <sys/wait.h>
 #include <sys/types.h>
@@ -156,6 +157,113 @@ TEST(Task, copy_to_task, 0)
 	return ret;
 }
 
+TEST(Task, copy_from_task_v, 0)
+{
+	char data0[] = "ABCDEFGH";
+	char data1[] = "0123456789";
+	char buf0[64] = {}, buf1[64] = {}, buf2[64] = {}, buf3[64] = {};
+	struct remote_iov riov[4];
+	ssize_t n, expect;
+	int i, ret = 0;
+	char *none;
+
+	/* PROT_NONE memory must be read via /proc/PID/mem */
+	none = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (none == MAP_FAILED)
+		return -1;
+	strcpy(none, "PROT_NONE");
+	mprotect(none, getpagesize(), PROT_NONE);
+
+	struct task_struct *task = open_task(getpid(), FTO_NONE);
+
+	riov[0] = (struct remote_iov){ buf0, (unsigned long)data0, sizeof(data0) };
+	riov[1] = (struct remote_iov){ buf1, (unsigned long)data1, sizeof(data1) };
+	riov[2] = (struct remote_iov){ buf2, (unsigned long)none, 10 };
+	riov[3] = (struct remote_iov){ buf3, (unsigned long)data0, 0 };
+
+	expect = sizeof(data0) + sizeof(data1) + 10;
+
+	n = memcpy_from_task_v(task, riov, 4);
+	if (n != expect)
+		ret = -1;
+
+	for (i = 0; i < 4; i++) {
+		if (riov[i].ret != riov[i].len)
+			ret = -1;
+	}
+
+	if (strcmp(buf0, data0) || strcmp(buf1, data1) ||
+	    strcmp(buf2, "PROT_NONE") || buf3[0] != '\0')
+		ret = -1;
+
+	/* Must be the same as /proc/PID/mem */
+	memset(buf2, 0, sizeof(buf2));
+	memcpy_from_task(task, buf2, (unsigned long)data1, sizeof(data1));
+	if (memcmp(buf1, buf2, sizeof(data1)))
+		ret = -1;
+
+	close_task(task);
+	munmap(none, getpagesize());
+	return ret;
+}
+
+TEST(Task, copy_from_task_v_hole, 0)
+{
+	struct remote_iov riov;
+	int ret = 0;
+	char *mem, *buf;
+	size_t ps = getpagesize();
+
+	/* The middle VMA of range is not readable by process_vm_readv(2) */
+	mem = mmap(NULL, ps * 3, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	buf = calloc(1, ps * 3);
+	if (mem == MAP_FAILED || !buf)
+		return -1;
+	memset(mem, 'A', ps * 3);
+	mprotect(mem + ps, ps, PROT_NONE);
+
+	struct task_struct *task = open_task(getpid(), FTO_NONE);
+
+	riov = (struct remote_iov){ buf, (unsigned long)mem, ps * 3 };
+
+	if (memcpy_from_task_v(task, &riov, 1) != riov.len ||
+	    riov.ret != riov.len || memcmp(buf, mem, ps) ||
+	    buf[ps] != 'A' || buf[ps * 3 - 1] != 'A')
+		ret = -1;
+
+	close_task(task);
+	munmap(mem, ps * 3);
+	free(buf);
+	return ret;
+}
+
+TEST(Task, copy_to_task_v, 0)
+{
+	char data0[] = "ABCDEFG";
+	char data1[] = "0123456";
+	char buf0[64] = "XXXXXX", buf1[64] = "YYYYYY";
+	struct remote_iov riov[2];
+	int ret = 0;
+	ssize_t n;
+
+	struct task_struct *task = open_task(getpid(), FTO_RDWR);
+
+	riov[0] = (struct remote_iov){ data0, (unsigned long)buf0, sizeof(data0) };
+	riov[1] = (struct remote_iov){ data1, (unsigned long)buf1, sizeof(data1) };
+
+	n = memcpy_to_task_v(task, riov, 2);
+	if (n != sizeof(data0) + sizeof(data1))
+		ret = -1;
+
+	if (strcmp(data0, buf0) || strcmp(data1, buf1))
+		ret = -1;
+
+	close_task(task);
+	return ret;
+}
+
 TEST(Task, task_strcpy, 0)
 {
 	char data[] = "ABCDEFGH\0";
@@ -178,6 +286,111 @@ TEST(Task, task_strcpy, 0)
 	return ret;
 }
 
+TEST(Task, task_strncpy, 0)
+{
+	char data[] = "ABCDEFGH";
+	char buf[64];
+	char small[4];
+	int ret = 0;
+	ssize_t n;
+
+	struct task_struct *task = open_task(getpid(), FTO_NONE);
+
+	n = strncpy_from_task(task, buf, (unsigned long)data, sizeof(buf));
+	if (n != strlen(data) || strcmp(data, buf))
+		ret = -1;
+
+	/* Truncated */
+	n = strncpy_from_task(task, small, (unsigned long)data, sizeof(small));
+	if (n != sizeof(small) - 1 || strncmp(data, small, n) || small[n])
+		ret = -1;
+
+	close_task(task);
+	return ret;
+}
+
+/* The old one, read string byte by byte */
+static char *strcpy_from_task_bytewise(struct task_struct *task, char *dst,
+				       unsigned long task_src, size_t size)
+{
+	int i;
+	for (i = 0; i < size - 1; i++) {
+		memcpy_from_task(task, &dst[i], task_src + i, 1);
+		if (dst[i] == '\0')
+			break;
+	}
+	dst[i] = '\0';
+	return dst;
+}
+
+TEST(Task, task_strcpy_bench, 0)
+{
+#define STR_BENCH_LEN	4096
+#define STR_BENCH_LOOP	16
+	char *data, *buf;
+	unsigned long us_old, us_new;
+	int i, ret = 0;
+
+	data = malloc(STR_BENCH_LEN);
+	buf = malloc(STR_BENCH_LEN + 1);
+
+	memset(data, 'A', STR_BENCH_LEN - 1);
+	data[STR_BENCH_LEN - 1] = '\0';
+
+	struct task_struct *task = open_task(getpid(), FTO_NONE);
+
+	us_old = usecs();
+	for (i = 0; i < STR_BENCH_LOOP; i++)
+		strcpy_from_task_bytewise(task, buf, (unsigned long)data,
+					  STR_BENCH_LEN + 1);
+	us_old = usecs() - us_old;
+	if (strcmp(data, buf))
+		ret = -1;
+
+	memset(buf, 0, STR_BENCH_LEN + 1);
+
+	us_new = usecs();
+	for (i = 0; i < STR_BENCH_LOOP; i++)
+		strncpy_from_task(task, buf, (unsigned long)data,
+				  STR_BENCH_LEN + 1);
+	us_new = usecs() - us_new;
+	if (strcmp(data, buf))
+		ret = -1;
+
+	printf("strcpy %d bytes string %d times: bytewise %ldus, chunked %ldus\n",
+	       STR_BENCH_LEN, STR_BENCH_LOOP, us_old, us_new);
+
+	close_task(task);
+	free(data);
+	free(buf);
+	return ret;
+}
+
+TEST(Task, open_close_bench, 0)
+{
+#define OPEN_CLOSE_LOOP	10
+	int i, ret = 0;
+	unsigned long us_open = 0, us_close = 0, us;
+	struct task_struct *task;
+
+	for (i = 0; i < OPEN_CLOSE_LOOP; i++) {
+		us = usecs();
+		task = open_task(getpid(), FTO_VMA_ELF_SYMBOLS | FTO_THREADS |
+					   FTO_FD);
+		us_open += usecs() - us;
+		if (!task)
+			return -1;
+
+		us = usecs();
+		ret |= close_task(task);
+		us_close += usecs() - us;
+	}
+
+	printf("open_task %ldus, close_task %ldus on average\n",
+	       us_open / OPEN_CLOSE_LOOP, us_close / OPEN_CLOSE_LOOP);
+	return ret;
+}
+
 TEST(Task, mmap_malloc, 0)
 {
 	int ret = -1;
@@ -237,6 +450,225 @@ TEST(Task, mmap_malloc, 0)
 	return ret;
 }
 
+static int task_syscall_bench(struct task_struct *task, bool trampoline)
+{
+#define SYSCALL_BENCH_LOOP	1000
+	int i;
+	unsigned long us, result;
+
+	task_syscall_trampoline(task, trampoline);
+
+	us = usecs();
+	for (i = 0; i < SYSCALL_BENCH_LOOP; i++) {
+		if (task_syscall(task, __NR_getpid, 0, 0, 0, 0, 0, 0, &result) ||
+		    result != task->pid)
+			return -1;
+	}
+	us = usecs() - us;
+
+	printf("%s trampoline: %d syscalls %ldus, %.0f syscalls/sec\n",
+	       trampoline ? "With" : "Without", SYSCALL_BENCH_LOOP, us,
+	       SYSCALL_BENCH_LOOP * 1000000.0 / (us ?: 1));
+
+	/* Unmap trampoline before detach */
+	return task_syscall_trampoline(task, false);
+}
+
+TEST(Task, syscall_trampoline_bench, 0)
+{
+	int ret = 0;
+	int status = 0;
+	struct task_notify notify;
+
+	task_notify_init(&notify, NULL);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		char *argv[] = {
+			(char*)ulpatch_test_path,
+			"--role", "sleeper,trigger,sleeper,wait",
+			"--msgq", notify.tmpfile,
+			NULL
+		};
+		ret = execvp(argv[0], argv);
+		if (ret == -1) {
+			exit(1);
+		}
+	}
+
+	/* Parent */
+	task_notify_wait(&notify);
+
+	struct task_struct *task = open_task(pid, FTO_RDWR);
+
+	task_attach(pid);
+
+	if (task_syscall_bench(task, false))
+		ret = -1;
+	if (task_syscall_bench(task, true))
+		ret = -1;
+
+	if (task_detach(pid))
+		ret = -1;
+	task_notify_trigger(&notify);
+	waitpid(pid, &status, __WALL);
+	if (status != 0)
+		ret = -EINVAL;
+	close_task(task);
+
+	task_notify_destroy(&notify);
+
+	return ret;
+}
+
+/* voluntary_ctxt_switches + nonvoluntary_ctxt_switches of task */
+static unsigned long task_ctxt_switches(pid_t pid)
+{
+	FILE *fp;
+	char path[PATH_MAX], line[256];
+	unsigned long n, sum = 0;
+
+	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	fp = fopen(path, "r");
+	if (!fp)
+		return 0;
+
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "voluntary_ctxt_switches: %lu", &n) == 1 ||
+		    sscanf(line, "nonvoluntary_ctxt_switches: %lu", &n) == 1)
+			sum += n;
+	}
+
+	fclose(fp);
+	return sum;
+}
+
+TEST(Task, syscall_batch, 0)
+{
+	int i, ret = 0;
+	int status = 0;
+	struct task_notify notify;
+	char tmpfile[] = "/tmp/ulpatch-batch-XXXXXX";
+	size_t len = 4096;
+	unsigned long nr_ctxt, map_v;
+	int fd, op_open, op_ftruncate, op_mmap, op_close;
+	struct task_syscall_batch batch;
+
+	fd = mkstemp(tmpfile);
+	if (fd == -1)
+		return -1;
+	close(fd);
+
+	task_notify_init(&notify, NULL);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		char *argv[] = {
+			(char*)ulpatch_test_path,
+			"--role", "sleeper,trigger,sleeper,wait",
+			"--msgq", notify.tmpfile,
+			NULL
+		};
+		ret = execvp(argv[0], argv);
+		if (ret == -1) {
+			exit(1);
+		}
+	}
+
+	/* Parent */
+	task_notify_wait(&notify);
+
+	struct task_struct *task = open_task(pid, FTO_RDWR);
+
+	task_attach(pid);
+
+	/* One ptrace stop for each syscall */
+	nr_ctxt = task_ctxt_switches(pid);
+	fd = task_open(task, tmpfile, O_RDWR, 0644);
+	task_ftruncate(task, fd, len);
+	map_v = task_mmap(task, 0UL, len, PROT_READ, MAP_SHARED, fd, 0);
+	task_close(task, fd);
+	nr_ctxt = task_ctxt_switches(pid) - nr_ctxt;
+	if (!map_v || map_v == (unsigned long)MAP_FAILED)
+		ret = -1;
+	else
+		task_munmap(task, map_v, len);
+
+	printf("task_syscall: open,ftruncate,mmap,close %ld context switches\n",
+	       nr_ctxt);
+
+	/* One ptrace stop for all syscalls */
+	task_syscall_batch_init(&batch);
+	op_open = task_syscall_batch_open(&batch, tmpfile, O_RDWR, 0644);
+	op_ftruncate = task_syscall_batch_add(&batch, __NR_ftruncate, 0, len,
+					      0, 0, 0, 0);
+	task_syscall_batch_ref(&batch, op_ftruncate, 0, op_open);
+	op_mmap = task_syscall_batch_add(&batch, __NR_mmap, 0, len, PROT_READ,
+					 MAP_SHARED, 0, 0);
+	task_syscall_batch_ref(&batch, op_mmap, 4, op_open);
+	op_close = task_syscall_batch_add(&batch, __NR_close, 0, 0, 0, 0, 0, 0);
+	task_syscall_batch_ref(&batch, op_close, 0, op_open);
+
+	nr_ctxt = task_ctxt_switches(pid);
+	if (task_syscall_batch(task, &batch) || batch.nr_done != batch.nr_ops)
+		ret = -1;
+	nr_ctxt = task_ctxt_switches(pid) - nr_ctxt;
+
+	printf("task_syscall_batch: open,ftruncate,mmap,close %ld context switches\n",
+	       nr_ctxt);
+
+	map_v = batch.ops[op_mmap].ret;
+	if (!map_v || map_v == (unsigned long)MAP_FAILED)
+		ret = -1;
+	else
+		task_munmap(task, map_v, len);
+
+	task_syscall_batch_free(&batch);
+
+	/**
+	 * The batch stop at the first failed syscall, too short to map the
+	 * stub, run one by one.
+	 */
+	task_syscall_batch_init(&batch);
+	task_syscall_batch_add(&batch, __NR_getpid, 0, 0, 0, 0, 0, 0);
+	task_syscall_batch_add(&batch, __NR_close, -1, 0, 0, 0, 0, 0);
+	task_syscall_batch_add(&batch, __NR_getpid, 0, 0, 0, 0, 0, 0);
+	if (task_syscall_batch(task, &batch) != -EBADF ||
+	    batch.nr_done != 1 || batch.ops[0].ret != pid)
+		ret = -1;
+	task_syscall_batch_free(&batch);
+
+	/* The stub is resident in the trampoline, only one ptrace stop */
+	task_syscall_trampoline(task, true);
+	task_syscall_batch_init(&batch);
+	task_syscall_batch_add(&batch, __NR_getpid, 0, 0, 0, 0, 0, 0);
+	task_syscall_batch_add(&batch, __NR_getppid, 0, 0, 0, 0, 0, 0);
+	for (i = 0; i < 2; i++) {
+		nr_ctxt = task_ctxt_switches(pid);
+		if (task_syscall_batch(task, &batch) ||
+		    batch.ops[0].ret != pid || batch.ops[1].ret != getpid())
+			ret = -1;
+		nr_ctxt = task_ctxt_switches(pid) - nr_ctxt;
+		printf("task_syscall_batch: trampoline %ld context switches\n",
+		       nr_ctxt);
+	}
+	task_syscall_batch_free(&batch);
+	if (task_syscall_trampoline(task, false))
+		ret = -1;
+
+	task_detach(pid);
+	task_notify_trigger(&notify);
+	waitpid(pid, &status, __WALL);
+	if (status != 0)
+		ret = -EINVAL;
+	close_task(task);
+
+	task_notify_destroy(&notify);
+	unlink(tmpfile);
+
+	return ret;
+}
+
 TEST(Task, fstat, 0)
 {
 	int ret = 0;
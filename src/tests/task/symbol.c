@@ -2,6 +2,8 @@
 /* Copyright (C) 2022-2025 Rong Tao */
 #include <errno.h>
 #include <fcntl.h>
+#include <fnmatch.h>
+#include <stdlib.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/mman.h>
@@ -127,3 +129,387 @@ TEST(Task_sym, find_task_symbol_value, 0)
 	return ret;
 }
 
+
+static int __cmp_sym_name(struct rb_node *node, unsigned long key)
+{
+	struct task_sym *s = rb_entry(node, struct task_sym, sort_by_name);
+	return strcmp(s->name, (const char *)key);
+}
+
+TEST(Task_sym, find_task_sym_bench, 0)
+{
+#define SYM_BENCH_NAMES	10000
+	int i, n = 0, ret = 0;
+	unsigned long us_rb, us_hash;
+	const char **names;
+	struct task_struct *task;
+	struct task_sym *tsym;
+	struct vm_area_struct *leader;
+	struct rb_node *node;
+
+	names = malloc(sizeof(char *) * SYM_BENCH_NAMES);
+	if (!names)
+		return -ENOMEM;
+
+	task = open_task(getpid(), FTO_VMA_ELF_SYMBOLS);
+
+	/* Symbols of libc and exe, repeat if not enough */
+	while (n < SYM_BENCH_NAMES) {
+		for (tsym = next_task_sym(task, NULL);
+		     tsym && n < SYM_BENCH_NAMES;
+		     tsym = next_task_sym(task, tsym)) {
+			leader = tsym->vma->leader ?: tsym->vma;
+			if (leader == task->libc_vma ||
+			    leader == task->vma_self_elf)
+				names[n++] = tsym->name;
+		}
+		if (!n)
+			break;
+	}
+
+	us_rb = usecs();
+	for (i = 0; i < n; i++) {
+		node = rb_search_node(&task->tsyms.rb_syms, __cmp_sym_name,
+				      (unsigned long)names[i]);
+		if (!node)
+			ret = -1;
+	}
+	us_rb = usecs() - us_rb;
+
+	us_hash = usecs();
+	for (i = 0; i < n; i++) {
+		tsym = find_task_sym(task, names[i], NULL, NULL);
+		if (!tsym || strcmp(tsym->name, names[i]))
+			ret = -1;
+	}
+	us_hash = usecs() - us_hash;
+
+	printf("Resolve %d names in %d symbols: rbtree %ldus, hash %ldus\n",
+	       n, task->tsyms.names.nr, us_rb, us_hash);
+
+	free(names);
+	close_task(task);
+	return ret;
+}
+
+TEST(Task_sym, find_task_addr, 0)
+{
+	int ret = 0;
+	struct task_struct *task;
+	struct task_sym *tsym, *found;
+	/* Big enough to be an anonymous mmap(2), see mallopt(3) */
+	void *anon = malloc(1 << 20);
+
+	task = open_task(getpid(), FTO_VMA_ELF_SYMBOLS);
+
+	tsym = find_task_sym(task, "ulp_log", NULL, NULL);
+	if (!tsym || !tsym->size) {
+		ulp_error("Not found ulp_log or size is zero.\n");
+		ret = -1;
+		goto close;
+	}
+
+	/* Any address inside the function resolve to the function */
+	found = find_task_addr(task, tsym->addr + tsym->size / 2);
+	if (!found || found->addr != tsym->addr) {
+		ulp_error("ulp_log %lx, but found %s %lx\n", tsym->addr,
+			  found ? found->name : "(null)",
+			  found ? found->addr : 0);
+		ret = -1;
+	}
+
+	found = find_task_addr(task, tsym->addr + tsym->size - 1);
+	if (!found || found->addr != tsym->addr)
+		ret = -1;
+
+	if (find_task_addr(task, 0))
+		ret = -1;
+
+	/* Symbol without size, such as _end, never covers other VMAs */
+	found = find_task_addr(task, (unsigned long)anon);
+	if (found) {
+		ulp_error("Anonymous %p resolve to %s %lx\n", anon,
+			  found->name, found->addr);
+		ret = -1;
+	}
+
+close:
+	close_task(task);
+	free(anon);
+	return ret;
+}
+
+TEST(Task_sym, find_task_addr_bench, 0)
+{
+#define ADDR_BENCH_LOOKUPS	1000000
+	int i, ret = 0;
+	unsigned long us, lo, hi, addr;
+	struct task_struct *task;
+	struct task_sym *tsym, *found;
+
+	task = open_task(getpid(), FTO_VMA_ELF_SYMBOLS);
+
+	tsym = next_task_addr(task, NULL);
+	if (!tsym) {
+		ret = -1;
+		goto close;
+	}
+	lo = tsym->addr;
+	hi = tsym->addr;
+	for (; tsym; tsym = next_task_addr(task, tsym))
+		hi = tsym->addr;
+
+	/* First lookup build the address index */
+	find_task_addr(task, lo);
+
+	srandom(0x20251017);
+
+	us = usecs();
+	for (i = 0; i < ADDR_BENCH_LOOKUPS; i++) {
+		addr = lo + random() % (hi - lo + 1);
+		found = find_task_addr(task, addr);
+		if (found && (addr < found->addr))
+			ret = -1;
+	}
+	us = usecs() - us;
+
+	printf("Symbolize %d addresses in %zu symbols: %ldus\n",
+	       ADDR_BENCH_LOOKUPS, task->tsyms.nr_addrs, us);
+
+close:
+	close_task(task);
+	return ret;
+}
+
+static int nr_syms_loaded_vmas(struct task_struct *task)
+{
+	int n = 0;
+	struct vm_area_struct *vma;
+
+	task_for_each_vma(vma, task) {
+		if (vma->syms_loaded)
+			n++;
+	}
+	return n;
+}
+
+TEST(Task_sym, lazy_load, 0)
+{
+	int ret = 0;
+	struct task_struct *task, *eager;
+	struct task_sym *tsym, *etsym;
+
+	eager = open_task(getpid(), FTO_VMA_ELF_SYMBOLS);
+	task = open_task(getpid(), FTO_VMA_ELF_SYMBOLS_LAZY);
+
+	if (nr_syms_loaded_vmas(task) != 0) {
+		ulp_error("Lazy task loaded symbols when opening.\n");
+		ret = -1;
+	}
+
+	/* ulp_log is in executable, the first one to load */
+	tsym = find_task_sym(task, "ulp_log", NULL, NULL);
+	etsym = find_task_sym(eager, "ulp_log", NULL, NULL);
+	if (!tsym || !etsym || tsym->addr != etsym->addr) {
+		ulp_error("Lazy resolve ulp_log failed.\n");
+		ret = -1;
+	}
+	if (nr_syms_loaded_vmas(task) != 1) {
+		ulp_error("Lazy task loaded %d vmas symbols.\n",
+			  nr_syms_loaded_vmas(task));
+		ret = -1;
+	}
+
+	/* Not exist, load everything */
+	if (find_task_sym(task, "ulpatch_no_such_symbol", NULL, NULL))
+		ret = -1;
+	if (!task->tsyms.all_loaded)
+		ret = -1;
+
+	if (task->tsyms.names.nr != eager->tsyms.names.nr) {
+		ulp_error("Lazy %d symbols, eager %d symbols\n",
+			  task->tsyms.names.nr, eager->tsyms.names.nr);
+		ret = -1;
+	}
+
+	close_task(task);
+	close_task(eager);
+	return ret;
+}
+
+TEST(Task_sym, lazy_extras, 0)
+{
+	int i, ret = 0;
+	size_t nr_lazy = 0, nr_eager = 0;
+	const struct task_sym **extras = NULL;
+	struct task_struct *task, *eager;
+	/* Defined in almost every ELF */
+	const char *names[] = { "_init", "_fini", "_edata", "_end" };
+
+	eager = open_task(getpid(), FTO_VMA_ELF_SYMBOLS);
+	task = open_task(getpid(), FTO_VMA_ELF_SYMBOLS_LAZY);
+
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		find_task_sym(eager, names[i], &extras, &nr_eager);
+		free((void *)extras);
+		extras = NULL;
+
+		/* All other definitions, not only the first one resolved */
+		find_task_sym(task, names[i], &extras, &nr_lazy);
+		free((void *)extras);
+		extras = NULL;
+
+		if (nr_lazy != nr_eager) {
+			ulp_error("%s: lazy %zu extras, eager %zu extras\n",
+				  names[i], nr_lazy, nr_eager);
+			ret = -1;
+		}
+	}
+
+	close_task(task);
+	close_task(eager);
+	return ret;
+}
+
+static unsigned long libc_sym_addr(struct task_struct *task, const char *name)
+{
+	size_t i, nr_extras = 0;
+	const struct task_sym **extras = NULL;
+	struct task_sym *sym;
+	unsigned long addr = 0;
+
+	sym = find_task_sym(task, name, &extras, &nr_extras);
+	if (sym && sym->vma->type == VMA_LIBC)
+		addr = sym->addr;
+	for (i = 0; !addr && i < nr_extras; i++) {
+		if (extras[i]->vma->type == VMA_LIBC)
+			addr = extras[i]->addr;
+	}
+	free((void *)extras);
+	return addr;
+}
+
+TEST(Task_sym, remote_dynsym, 0)
+{
+	int i, ret = 0;
+	struct task_struct *task, *eager;
+	struct task_sym *tsym;
+	const char *names[] = { "fopen", "malloc", "pthread_create" };
+#if defined(__x86_64__)
+	const char *vdso_sym = "__vdso_clock_gettime";
+#elif defined(__aarch64__)
+	const char *vdso_sym = "__kernel_clock_gettime";
+#endif
+
+	/* Don't open any ELF file, only peek ELF in memory */
+	task = open_task(getpid(), FTO_VMA_ELF);
+	eager = open_task(getpid(), FTO_VMA_ELF_SYMBOLS);
+
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		unsigned long addr = libc_sym_addr(eager, names[i]);
+
+		tsym = find_task_sym(task, names[i], NULL, NULL);
+		if (!tsym || tsym->addr != addr) {
+			ulp_error("Remote resolve %s: %#lx, bfd %#lx\n", names[i],
+				  tsym ? tsym->addr : 0, addr);
+			ret = -1;
+			continue;
+		}
+		/* Linked, resolved by name index */
+		if (find_task_sym(task, names[i], NULL, NULL) != tsym)
+			ret = -1;
+	}
+
+	if (find_task_sym(task, "ulpatch_no_such_symbol", NULL, NULL))
+		ret = -1;
+
+	/* aarch64 [vdso] may only have DT_HASH */
+	tsym = find_task_sym(task, vdso_sym, NULL, NULL);
+	if (tsym && tsym->vma->type != VMA_VDSO) {
+		ulp_error("%s not in [vdso]\n", vdso_sym);
+		ret = -1;
+	} else if (!tsym)
+		ulp_warning("Not found %s in [vdso]\n", vdso_sym);
+
+	close_task(task);
+	close_task(eager);
+	return ret;
+}
+
+static int count_sym(struct task_sym *sym, void *arg)
+{
+	(*(int *)arg)++;
+	return 0;
+}
+
+/* Count symbols matched by fnmatch(3), one by one */
+static int count_fnmatch(struct task_struct *task, const char *glob,
+			 const char *exclude)
+{
+	int n = 0;
+	struct task_sym *tsym, *s, *tmp;
+
+	for (tsym = next_task_sym(task, NULL); tsym;
+	     tsym = next_task_sym(task, tsym)) {
+		if (fnmatch(glob, tsym->name, 0) ||
+		    (exclude && !fnmatch(exclude, tsym->name, 0)))
+			continue;
+		n++;
+		list_for_each_entry_safe(s, tmp, &tsym->list_name.head,
+					 list_name.node)
+			n++;
+	}
+	return n;
+}
+
+TEST(Task_sym, match_task_syms, 0)
+{
+	int ret = 0, n, nr;
+	struct task_struct *task;
+	struct pattern_set include, exclude, regex;
+
+	task = open_task(getpid(), FTO_VMA_ELF_SYMBOLS);
+
+	pattern_set_init(&include, PATTERN_GLOB);
+	pattern_set_init(&exclude, PATTERN_GLOB);
+	pattern_set_init(&regex, PATTERN_REGEX);
+
+	/* Literal, look up the name index */
+	pattern_set_add(&include, "ulp_log");
+	pattern_set_compile(&include);
+	nr = 0;
+	n = match_task_syms(task, &include, NULL, count_sym, &nr);
+	if (n < 1 || n != nr) {
+		ulp_error("ulp_log matched %d.\n", n);
+		ret = -1;
+	}
+	pattern_set_destroy(&include);
+
+	/* Prefixes, one contains the other */
+	pattern_set_add(&include, "ulp_*");
+	pattern_set_add(&include, "ulp_log*");
+	pattern_set_add(&exclude, "ulp_log*");
+	pattern_set_compile(&include);
+	pattern_set_compile(&exclude);
+	n = match_task_syms(task, &include, &exclude, count_sym, &nr);
+	nr = count_fnmatch(task, "ulp_*", "ulp_log*");
+	ulp_info("ulp_* but not ulp_log*: %d, expect %d\n", n, nr);
+	if (n < 1 || n != nr)
+		ret = -1;
+
+	/* No prefix, test all names */
+	pattern_set_add(&regex, "_log$");
+	pattern_set_compile(&regex);
+	n = match_task_syms(task, &regex, NULL, count_sym, &nr);
+	nr = count_fnmatch(task, "*_log", NULL);
+	ulp_info("_log$: %d, expect %d\n", n, nr);
+	if (n < 1 || n != nr)
+		ret = -1;
+
+	pattern_set_destroy(&include);
+	pattern_set_destroy(&exclude);
+	pattern_set_destroy(&regex);
+	close_task(task);
+	return ret;
+}
+
@@ -0,0 +1,230 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2022-2025 Rong Tao */
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <utils/log.h>
+#include <utils/list.h>
+#include <task/task.h>
+#include <tests/test-api.h>
+
+TEST_STUB(task_thread);
+
+#define NR_THREADS	8
+
+/* Count threads of @pid, and threads in tracing stop if @stopped not NULL */
+static int count_threads(pid_t pid, int *stopped)
+{
+	DIR *dir;
+	FILE *fp;
+	struct dirent *entry;
+	char path[PATH_MAX], state;
+	int n = 0;
+
+	snprintf(path, sizeof(path), "/proc/%d/task/", pid);
+	dir = opendir(path);
+	if (!dir)
+		return -1;
+
+	if (stopped)
+		*stopped = 0;
+
+	while ((entry = readdir(dir)) != NULL) {
+		if (!strcmp(entry->d_name , ".") ||
+		    !strcmp(entry->d_name, ".."))
+			continue;
+		n++;
+
+		if (!stopped)
+			continue;
+
+		snprintf(path, sizeof(path), "/proc/%d/task/%s/stat", pid,
+			 entry->d_name);
+		fp = fopen(path, "r");
+		if (!fp)
+			continue;
+		/* The comm may has space, the state is after the last ')' */
+		if (fscanf(fp, "%*d (%*[^)]) %c", &state) == 1 && state == 't')
+			(*stopped)++;
+		fclose(fp);
+	}
+
+	closedir(dir);
+	return n;
+}
+
+TEST(Task_thread, stop_world, 0)
+{
+	int ret = 0, i, n, nr_stopped;
+	int status = 0;
+	char nr_threads[16];
+	struct thread *thread;
+	struct task_struct *task;
+
+	snprintf(nr_threads, sizeof(nr_threads), "%d", NR_THREADS);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		char *argv[] = {
+			(char*)ulpatch_test_path,
+			"--role", "multi-threads",
+			"--nr-threads", nr_threads,
+			"--print-nloop", "100000",
+			"--print-usec", "1000",
+			NULL
+		};
+		/* Don't mess up the test output */
+		int fd = open("/dev/null", O_WRONLY);
+		dup2(fd, STDOUT_FILENO);
+		ret = execvp(argv[0], argv);
+		if (ret == -1) {
+			exit(1);
+		}
+	}
+
+	/* Wait all threads created, main thread included */
+	for (i = 0; i < 1000; i++) {
+		if (count_threads(pid, NULL) == NR_THREADS + 1)
+			break;
+		usleep(1000);
+	}
+
+	task = open_task(pid, FTO_THREADS);
+	if (!task) {
+		kill(pid, SIGKILL);
+		waitpid(pid, &status, __WALL);
+		return -1;
+	}
+
+	if (task_stop_world(task, 0))
+		ret = -1;
+
+	n = count_threads(pid, &nr_stopped);
+	if (n != nr_stopped || n != NR_THREADS + 1) {
+		ulp_error("%d threads, %d stopped.\n", n, nr_stopped);
+		ret = -1;
+	}
+
+	/* Keep stopped a while */
+	usleep(10000);
+
+	if (task_resume_world(task))
+		ret = -1;
+
+	n = count_threads(pid, &nr_stopped);
+	if (nr_stopped != 0)
+		ret = -1;
+
+	list_for_each_entry(thread, &task->threads_list, node) {
+		if (thread->stopped || thread->pause_us < 10000)
+			ret = -1;
+	}
+
+	dump_task_threads(stdout, task, true);
+	printf("Max pause %ldus\n", task->stw_max_pause_us);
+
+	close_task(task);
+
+	kill(pid, SIGKILL);
+	waitpid(pid, &status, __WALL);
+
+	return ret;
+}
+
+TEST(Task_thread, safe_point, 0)
+{
+	int ret = 0, i, n;
+	int status = 0;
+	char nr_threads[16];
+	unsigned long ip = 0, start_us;
+	struct vm_area_struct *vma;
+	struct thread *thread;
+	struct task_struct *task;
+
+	snprintf(nr_threads, sizeof(nr_threads), "%d", NR_THREADS);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		char *argv[] = {
+			(char*)ulpatch_test_path,
+			"--role", "multi-threads",
+			"--nr-threads", nr_threads,
+			"--print-nloop", "100000",
+			"--print-usec", "1000",
+			NULL
+		};
+		/* Don't mess up the test output */
+		int fd = open("/dev/null", O_WRONLY);
+		dup2(fd, STDOUT_FILENO);
+		ret = execvp(argv[0], argv);
+		if (ret == -1) {
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < 1000; i++) {
+		if (count_threads(pid, NULL) == NR_THREADS + 1)
+			break;
+		usleep(1000);
+	}
+
+	task = open_task(pid, FTO_NONE);
+	if (!task) {
+		kill(pid, SIGKILL);
+		waitpid(pid, &status, __WALL);
+		return -1;
+	}
+
+	/* No thread executing in the zero page */
+	if (task_stop_world_safe(task, 0x0, 0x1000, 0, 1000))
+		ret = -1;
+
+	n = task_threads_in_range(task, 0x0, 0x1000);
+	if (n != 0)
+		ret = -1;
+
+	/* Someone is here */
+	list_for_each_entry(thread, &task->threads_list, node) {
+		if (thread->stopped) {
+			ip = thread->ip;
+			break;
+		}
+	}
+	n = task_threads_in_range(task, ip, ip + 1);
+	if (n < 1)
+		ret = -1;
+
+	task_resume_world(task);
+
+	/**
+	 * The thread's IP is in the IP's VMA, sleeping in libc most likely,
+	 * thus, retry until deadline.
+	 */
+	vma = find_vma(task, ip);
+	if (!vma) {
+		ret = -1;
+		goto done;
+	}
+
+	start_us = usecs();
+	n = task_stop_world_safe(task, vma->vm_start, vma->vm_end, 0, 20000);
+	if (n != -EBUSY)
+		ret = -1;
+	if (usecs() - start_us < 20000)
+		ret = -1;
+	if (task->world_stopped)
+		ret = -1;
+
+done:
+	close_task(task);
+
+	kill(pid, SIGKILL);
+	waitpid(pid, &status, __WALL);
+
+	return ret;
+}
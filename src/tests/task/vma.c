@@ -87,3 +87,468 @@ TEST(Task, dump_task_vma_to_file, 0)
 	return ret;
 }
 
+
+#define NR_SYNTH_VMAS	50000
+#define GAP_CHECK_LOOP	100
+#define GAP_BENCH_LOOP	1000
+
+/* The old find_vma_span_area(), walk all vmas */
+static unsigned long linear_vma_gap(struct task_struct *task, size_t size,
+				    unsigned long lo, unsigned long hi,
+				    bool topdown)
+{
+	struct vm_area_struct *vma;
+	unsigned long prev_end = 0, start, end, addr, found = 0;
+
+	task_for_each_vma(vma, task) {
+		start = prev_end > lo ? prev_end : lo;
+		end = vma->vm_start < hi ? vma->vm_start : hi;
+		prev_end = vma->vm_end;
+		if (end <= start || end - start < size)
+			continue;
+		if (!topdown) {
+			addr = PAGE_UP(start);
+			if (addr <= end - size)
+				return addr;
+			continue;
+		}
+		addr = PAGE_DOWN(end - size);
+		if (addr >= start)
+			found = addr;
+	}
+	return found;
+}
+
+static struct task_struct *alloc_synth_task(struct vm_area_struct **vmas,
+					    int nr)
+{
+	int i, j;
+	unsigned long addr = MIN_ULP_START_VMA_ADDR;
+	struct vm_area_struct *tmp;
+	struct task_struct *task = calloc(1, sizeof(struct task_struct));
+
+	list_init(&task->vma_list);
+	list_init(&task->vma_free_list);
+	rb_init(&task->vmas_rb);
+
+	srandom(0x20251017);
+
+	/* Mostly adjacent vmas, small gaps, and a few big ones */
+	for (i = 0; i < nr; i++) {
+		vmas[i] = alloc_vma(task);
+		if (random() % 4 == 0)
+			addr += PAGE_SIZE * (1 + random() % 8);
+		if (random() % 10000 == 0)
+			addr += PAGE_SIZE * 1024;
+		vmas[i]->vm_start = addr;
+		addr += PAGE_SIZE * (1 + random() % 16);
+		vmas[i]->vm_end = addr;
+	}
+
+	/* Insert in random order to exercise rebalance */
+	for (i = nr - 1; i > 0; i--) {
+		j = random() % (i + 1);
+		tmp = vmas[i];
+		vmas[i] = vmas[j];
+		vmas[j] = tmp;
+	}
+	for (i = 0; i < nr; i++)
+		insert_vma(task, vmas[i], NULL);
+
+	return task;
+}
+
+static void free_synth_task(struct task_struct *task,
+			    struct vm_area_struct **vmas, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		if (!vmas[i])
+			continue;
+		unlink_vma(task, vmas[i]);
+		free_vma(vmas[i]);
+	}
+	arena_destroy(&task->arena);
+	free(task);
+}
+
+static int check_vma_gaps(struct task_struct *task)
+{
+	int i, ret = 0;
+	size_t size;
+	unsigned long lo, hi, last = 0, a, b;
+	struct vm_area_struct *vma;
+
+	task_for_each_vma(vma, task)
+		last = vma->vm_end;
+
+	for (i = 0; i < GAP_CHECK_LOOP; i++) {
+		size = PAGE_SIZE * (1 + random() % 64);
+		lo = MIN_ULP_START_VMA_ADDR + random() % last;
+		hi = lo + random() % (last / 4);
+
+		a = linear_vma_gap(task, size, lo, hi, i % 2);
+		b = find_vma_gap(task, size, lo, hi, i % 2);
+		if (a != b) {
+			fprintf(stderr, "gap [%lx, %lx) size %lx: %lx != %lx\n",
+				lo, hi, size, a, b);
+			ret = -1;
+		}
+
+		task_for_each_vma(vma, task)
+			if (vma->vm_end > lo)
+				break;
+		if (vma && vma->vm_start >= hi)
+			vma = NULL;
+		if (vma != find_vma_intersection(task, lo, hi)) {
+			fprintf(stderr, "overlap [%lx, %lx) mismatch\n", lo, hi);
+			ret = -1;
+		}
+	}
+	return ret;
+}
+
+TEST(Task, vma_gap, 0)
+{
+	int i, ret = 0;
+	size_t size;
+	unsigned long addr, near, dist;
+	struct vm_area_struct **vmas, *vma, *first;
+	struct task_struct *task;
+
+	vmas = calloc(NR_SYNTH_VMAS, sizeof(*vmas));
+	task = alloc_synth_task(vmas, NR_SYNTH_VMAS);
+
+	if (check_vma_gaps(task))
+		ret = -1;
+
+	/* Unlink some vmas, merge gaps and check again */
+	for (i = 0; i < NR_SYNTH_VMAS; i += 7) {
+		unlink_vma(task, vmas[i]);
+		free_vma(vmas[i]);
+		vmas[i] = NULL;
+	}
+	if (check_vma_gaps(task))
+		ret = -1;
+
+	/**
+	 * Closest free area must not overlap any vma, and no free area is
+	 * closer than it.
+	 */
+	size = PAGE_SIZE * 4;
+	first = first_vma(task);
+	for (i = 0; i < GAP_CHECK_LOOP; i++) {
+		addr = PAGE_DOWN(first->vm_start + random() % (1UL << 28));
+		near = find_vma_gap_near(task, size, addr, 1UL << 31);
+		if (!near) {
+			ret = -1;
+			continue;
+		}
+		task_for_each_vma_overlap(vma, task, near, near + size)
+			ret = -1;
+
+		dist = near > addr ? near - addr : addr - near;
+		if (dist && (linear_vma_gap(task, size, addr - dist + 1,
+					    addr + size, true) ||
+			     linear_vma_gap(task, size, addr,
+					    addr + dist - 1 + size, false))) {
+			fprintf(stderr, "%lx is not the closest to %lx\n",
+				near, addr);
+			ret = -1;
+		}
+	}
+
+	free_synth_task(task, vmas, NR_SYNTH_VMAS);
+	free(vmas);
+	return ret;
+}
+
+TEST(Task, vma_gap_bench, 0)
+{
+	int i, ret = 0;
+	size_t size;
+	unsigned long us_old, us_new, lo, a = 0, b = 0;
+	struct vm_area_struct **vmas;
+	struct task_struct *task;
+
+	vmas = calloc(NR_SYNTH_VMAS, sizeof(*vmas));
+	task = alloc_synth_task(vmas, NR_SYNTH_VMAS);
+	lo = first_vma(task)->vm_start;
+
+	/* Big size, only the few big gaps fit */
+	size = PAGE_SIZE * 512;
+
+	us_old = usecs();
+	for (i = 0; i < GAP_BENCH_LOOP; i++)
+		a = linear_vma_gap(task, size, lo, ULONG_MAX, false);
+	us_old = usecs() - us_old;
+
+	us_new = usecs();
+	for (i = 0; i < GAP_BENCH_LOOP; i++)
+		b = find_vma_gap(task, size, lo, ULONG_MAX, false);
+	us_new = usecs() - us_new;
+
+	if (!a || a != b)
+		ret = -1;
+
+	printf("Find %ld bytes gap in %d vmas %d times: linear %ldus, augmented rbtree %ldus\n",
+	       size, NR_SYNTH_VMAS, GAP_BENCH_LOOP, us_old, us_new);
+
+	free_synth_task(task, vmas, NR_SYNTH_VMAS);
+	free(vmas);
+	return ret;
+}
+
+#define NR_MANY_VMAS	30000
+
+static long self_rss_kb(void)
+{
+	long pages = -1;
+	FILE *fp = fopen("/proc/self/statm", "r");
+
+	if (!fp)
+		return -1;
+	if (fscanf(fp, "%*d %ld", &pages) != 1)
+		pages = -1;
+	fclose(fp);
+	return pages * (PAGE_SIZE / 1024);
+}
+
+TEST(Task, many_vmas_rss, 0)
+{
+	int i, nr = 0, ret = 0;
+	long rss;
+	char *mem;
+	size_t len = PAGE_SIZE * NR_MANY_VMAS * 2;
+	struct task_struct *task;
+	struct vm_area_struct *vma;
+
+	/* Every other page readable, split into many anonymous vmas */
+	mem = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		return -1;
+	for (i = 0; i < NR_MANY_VMAS; i++)
+		mprotect(mem + PAGE_SIZE * 2 * i, PAGE_SIZE, PROT_READ);
+
+	rss = self_rss_kb();
+	task = open_task(getpid(), FTO_NONE);
+	rss = self_rss_kb() - rss;
+
+	task_for_each_vma(vma, task)
+		nr++;
+	if (nr < NR_MANY_VMAS)
+		ret = -1;
+
+	printf("Open task with %d vmas: sizeof(vma) %ld, host RSS +%ldKiB, names %ldKiB\n",
+	       nr, sizeof(struct vm_area_struct), rss,
+	       task->vma_names.arena.size / 1024);
+
+	close_task(task);
+	munmap(mem, len);
+	return ret;
+}
+
+#define NR_MAPS_BENCH	20000
+#define MAPS_BENCH_LOOP	5
+
+/* The original fgets(3) and sscanf(3) parser of read_task_vmas() */
+static int legacy_read_maps(pid_t pid)
+{
+	int n = 0;
+	FILE *fp;
+	char path[64];
+
+	snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+	fp = fopen(path, "r");
+	if (!fp)
+		return -errno;
+
+	while (1) {
+		unsigned long start, end, off, inode;
+		unsigned int major, minor;
+		char perms[5], name_[256], line[1024];
+
+		memset(perms, 0, sizeof(perms));
+		memset(name_, 0, sizeof(name_));
+		memset(line, 0, sizeof(line));
+
+		if (!fgets(line, sizeof(line), fp))
+			break;
+
+		if (sscanf(line, "%lx-%lx %s %lx %x:%x %ld %255s", &start,
+			   &end, perms, &off, &major, &minor, &inode,
+			   name_) <= 0)
+			break;
+		n++;
+	}
+
+	fclose(fp);
+	return n;
+}
+
+static int iter_read_maps(pid_t pid, enum maps_iter_mode mode, bool build_id)
+{
+	int n = 0, ret;
+	struct maps_iter it;
+	struct maps_entry e;
+
+	ret = maps_iter_open(&it, pid, mode, build_id);
+	if (ret)
+		return ret;
+
+	while ((ret = maps_iter_next(&it, &e)) > 0)
+		n++;
+
+	maps_iter_close(&it);
+	return ret < 0 ? ret : n;
+}
+
+TEST(Task, maps_parse_bench, 0)
+{
+	int i, ret = 0, n_legacy = 0, n_text = 0, n_query = 0;
+	unsigned long us_legacy, us_text, us_query;
+	size_t len = PAGE_SIZE * NR_MAPS_BENCH * 2;
+	char *mem;
+
+	/* Every other page readable, split into many anonymous vmas */
+	mem = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		return -1;
+	for (i = 0; i < NR_MAPS_BENCH; i++)
+		mprotect(mem + PAGE_SIZE * 2 * i, PAGE_SIZE, PROT_READ);
+
+	us_legacy = usecs();
+	for (i = 0; i < MAPS_BENCH_LOOP; i++)
+		n_legacy = legacy_read_maps(getpid());
+	us_legacy = (usecs() - us_legacy) / MAPS_BENCH_LOOP;
+
+	us_text = usecs();
+	for (i = 0; i < MAPS_BENCH_LOOP; i++)
+		n_text = iter_read_maps(getpid(), MAPS_ITER_TEXT, false);
+	us_text = (usecs() - us_text) / MAPS_BENCH_LOOP;
+
+	us_query = usecs();
+	for (i = 0; i < MAPS_BENCH_LOOP; i++)
+		n_query = iter_read_maps(getpid(), MAPS_ITER_QUERY, true);
+	us_query = (usecs() - us_query) / MAPS_BENCH_LOOP;
+
+	if (n_legacy < NR_MAPS_BENCH || n_text != n_legacy)
+		ret = -1;
+	/* Old kernel has no PROCMAP_QUERY */
+	if (n_query != -EOPNOTSUPP && n_query < NR_MAPS_BENCH)
+		ret = -1;
+
+	printf("Read %d maps: fgets+sscanf %ldus, parser %ldus, PROCMAP_QUERY %ldus (%d)\n",
+	       n_text, us_legacy, us_text, us_query, n_query);
+
+	munmap(mem, len);
+	return ret;
+}
+
+/* Compare vmas overlap [lo, hi) of the refreshed task and a fresh one */
+static int vmas_equal(struct task_struct *task, unsigned long lo,
+		      unsigned long hi)
+{
+	int ret = 0;
+	struct vm_area_struct *a, *b;
+	struct task_struct *fresh = open_task(getpid(), FTO_NONE);
+
+	a = find_vma_intersection(task, lo, hi);
+	b = find_vma_intersection(fresh, lo, hi);
+
+	for (; a && b && a->vm_start < hi && b->vm_start < hi;
+	     a = next_vma(task, a), b = next_vma(fresh, b)) {
+		if (a->vm_start != b->vm_start || a->vm_end != b->vm_end ||
+		    strcmp(a->perms, b->perms) || a->vm_gap != b->vm_gap) {
+			print_vma(stdout, true, a, false);
+			print_vma(stdout, false, b, false);
+			ret = -1;
+		}
+	}
+	if ((a && a->vm_start < hi) != (b && b->vm_start < hi))
+		ret = -1;
+
+	close_task(fresh);
+	return ret;
+}
+
+#define NR_REFRESH_MMAP	50
+
+TEST(Task, vma_refresh, 0)
+{
+	int i, ret = 0;
+	unsigned long lo, hi, us_range, us_full;
+	size_t len = PAGE_SIZE * 64;
+	char *mem, *maps[NR_REFRESH_MMAP];
+	struct task_struct *task = open_task(getpid(), FTO_NONE);
+
+	mem = mmap(NULL, len, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (mem == MAP_FAILED)
+		return -1;
+	lo = (unsigned long)mem;
+	hi = lo + len;
+
+	refresh_task_vmas(task, lo, hi);
+	if (vmas_equal(task, lo, hi))
+		ret = -1;
+
+	/* Split and merge */
+	mprotect(mem + PAGE_SIZE * 8, PAGE_SIZE * 8, PROT_READ | PROT_WRITE);
+	refresh_task_vmas(task, lo + PAGE_SIZE * 8, lo + PAGE_SIZE * 16);
+	if (vmas_equal(task, lo, hi))
+		ret = -1;
+
+	mprotect(mem + PAGE_SIZE * 8, PAGE_SIZE * 8, PROT_READ);
+	refresh_task_vmas(task, lo + PAGE_SIZE * 8, lo + PAGE_SIZE * 16);
+	if (vmas_equal(task, lo, hi))
+		ret = -1;
+
+	/* Hole and fill it */
+	munmap(mem + PAGE_SIZE * 20, PAGE_SIZE * 4);
+	refresh_task_vmas(task, lo + PAGE_SIZE * 20, lo + PAGE_SIZE * 24);
+	if (vmas_equal(task, lo, hi))
+		ret = -1;
+
+	mmap(mem + PAGE_SIZE * 20, PAGE_SIZE * 4, PROT_READ | PROT_EXEC,
+	     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+	refresh_task_vmas(task, lo + PAGE_SIZE * 20, lo + PAGE_SIZE * 24);
+	if (vmas_equal(task, lo, hi))
+		ret = -1;
+
+	/* Unmap all */
+	munmap(mem, len);
+	refresh_task_vmas(task, lo, hi);
+	if (find_vma_intersection(task, lo, hi))
+		ret = -1;
+
+	/* mmap(2) many times, like patching many functions */
+	us_range = usecs();
+	for (i = 0; i < NR_REFRESH_MMAP; i++) {
+		maps[i] = mmap(NULL, PAGE_SIZE, PROT_READ,
+			       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		refresh_task_vmas(task, (unsigned long)maps[i],
+				  (unsigned long)maps[i] + PAGE_SIZE);
+		if (!find_vma(task, (unsigned long)maps[i]))
+			ret = -1;
+	}
+	us_range = usecs() - us_range;
+
+	us_full = usecs();
+	for (i = 0; i < NR_REFRESH_MMAP; i++) {
+		struct task_struct *t = open_task(getpid(), FTO_NONE);
+		close_task(t);
+	}
+	us_full = usecs() - us_full;
+
+	printf("Refresh vmas after %d mmap: range %ldus, re-read all %ldus\n",
+	       NR_REFRESH_MMAP, us_range, us_full);
+
+	for (i = 0; i < NR_REFRESH_MMAP; i++)
+		munmap(maps[i], PAGE_SIZE);
+	if (update_task_vmas_ulp(task))
+		ret = -1;
+
+	close_task(task);
+	return ret;
+}
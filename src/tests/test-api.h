@@ -121,7 +121,8 @@ extern struct test *current_test;
 
 /**
  * Define a test
- * If Ret = TEST_RET_SKIP, the test will success anyway.
+ * If Ret = TEST_RET_SKIP, the test will success anyway. A test returns
+ * TEST_RET_SKIP if its prerequisite is missing, it's skipped, not failed.
  */
 #define __TEST(Category, Name, Prio, Ret) \
 	extern int test_ ##Category ##_##Name(void);	\
@@ -257,3 +258,5 @@ const char *str_special_ret(test_special_ret val);
  * Test target functions.
  */
 void hello_world(void);
+void goodbye_world(void);
+unsigned long ftrace_tracee_func(unsigned long a, unsigned long b);
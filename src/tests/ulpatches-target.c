@@ -9,3 +9,8 @@ void hello_world(void)
 {
 	printf("Hello World.\n");
 }
+
+void goodbye_world(void)
+{
+	printf("Goodbye World.\n");
+}
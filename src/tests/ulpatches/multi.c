@@ -0,0 +1,21 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#ifndef __ULP_DEV
+#define __ULP_DEV
+#endif
+#include <stdio.h>
+#include <patch/asm.h>
+#include <patch/meta.h>
+
+/* One ulp file patches multi functions */
+void multi_hello_world(void)
+{
+	printf("Hello World from multi ulpatch.\n");
+}
+ULPATCH_INFO(multi_hello_world, hello_world, "Rong Tao");
+
+void multi_goodbye_world(void)
+{
+	printf("Goodbye World from multi ulpatch.\n");
+}
+ULPATCH_INFO(multi_goodbye_world, goodbye_world, "Rong Tao");
@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#include <utils/log.h>
+#include <utils/arena.h>
+#include <tests/test-api.h>
+
+TEST_STUB(utils_arena);
+
+TEST(Utils_arena, alloc, 0)
+{
+	int i, j, ret = 0;
+	char *p, *s;
+	struct arena arena;
+
+	arena_init(&arena, 4096);
+
+	for (i = 1; i < 1000; i++) {
+		p = arena_alloc(&arena, i);
+		if (!p || (unsigned long)p % 16)
+			ret = -1;
+		/* Zeroed */
+		for (j = 0; j < i; j++)
+			if (p[j])
+				ret = -1;
+		memset(p, 0xff, i);
+	}
+
+	/* Bigger than chunk size */
+	p = arena_alloc(&arena, 4096 * 4);
+	if (!p)
+		ret = -1;
+	memset(p, 0xff, 4096 * 4);
+
+	s = arena_strdup(&arena, "Hello ULPatch");
+	if (!s || strcmp(s, "Hello ULPatch"))
+		ret = -1;
+
+	if (arena.size < 4096 * 4)
+		ret = -1;
+
+	arena_destroy(&arena);
+	if (arena.chunks || arena.size)
+		ret = -1;
+	return ret;
+}
@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#include <errno.h>
+#include <string.h>
+
+#include <utils/log.h>
+#include <utils/util.h>
+#include <utils/pattern.h>
+#include <tests/test-api.h>
+
+TEST_STUB(utils_pattern);
+
+static const struct {
+	const char *str;
+	bool glob, regex;
+} pattern_tests[] = {
+	{ "http_get",    true,  false },
+	{ "xhttp_get",   false, false },
+	{ "ssl_read",    true,  true  },
+	{ "ssl_do_read", false, true  },
+	{ "a.b",         true,  false },
+	{ "axb",         false, false },
+	{ "x_y",         true,  false },
+	{ "x1y",         false, false },
+	{ "abbc",        false, true  },
+	{ "fwrite",      false, true  },
+};
+
+TEST(Utils_pattern, match, 0)
+{
+	int ret = 0;
+	size_t i;
+	struct pattern_set glob, regex;
+	const char *globs[] = { "http_*", "ssl_?ead", "a.b", "x[!0-9]y" };
+	const char *regexs[] = { "^ssl_.*read$", "^ab*c$", "write" };
+
+	pattern_set_init(&glob, PATTERN_GLOB);
+	pattern_set_init(&regex, PATTERN_REGEX);
+
+	for (i = 0; i < ARRAY_SIZE(globs); i++)
+		pattern_set_add(&glob, globs[i]);
+	for (i = 0; i < ARRAY_SIZE(regexs); i++)
+		pattern_set_add(&regex, regexs[i]);
+
+	if (pattern_set_compile(&glob) || pattern_set_compile(&regex))
+		return -1;
+
+	for (i = 0; i < ARRAY_SIZE(pattern_tests); i++) {
+		if (pattern_set_match(&glob, pattern_tests[i].str) !=
+		    pattern_tests[i].glob ||
+		    pattern_set_match(&regex, pattern_tests[i].str) !=
+		    pattern_tests[i].regex) {
+			ulp_error("Match %s failed.\n", pattern_tests[i].str);
+			ret = -1;
+		}
+	}
+
+	/* Literal prefix of each pattern */
+	if (strcmp(glob.patterns[0].prefix, "http_") ||
+	    glob.patterns[0].literal ||
+	    strcmp(glob.patterns[2].prefix, "a.b") ||
+	    !glob.patterns[2].literal ||
+	    strcmp(regex.patterns[1].prefix, "a") ||
+	    strcmp(regex.patterns[2].prefix, ""))
+		ret = -1;
+
+	/* Can't add after compile */
+	if (pattern_set_add(&glob, "foo") != -EINVAL)
+		ret = -1;
+
+	pattern_set_destroy(&glob);
+	pattern_set_destroy(&regex);
+
+	/* Bad regex */
+	pattern_set_add(&regex, "(");
+	if (pattern_set_compile(&regex) != -EINVAL)
+		ret = -1;
+	pattern_set_destroy(&regex);
+
+	return ret;
+}
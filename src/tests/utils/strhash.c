@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#include <utils/log.h>
+#include <utils/strhash.h>
+#include <tests/test-api.h>
+
+TEST_STUB(utils_strhash);
+
+TEST(Utils_strhash, gnu_hash, 0)
+{
+	/* Values from the DT_GNU_HASH of glibc */
+	if (gnu_hash("") != 0x00001505 ||
+	    gnu_hash("printf") != 0x156b2bb8 ||
+	    gnu_hash("exit") != 0x7c967e3f)
+		return -1;
+	return 0;
+}
+
+TEST(Utils_strhash, add_find, 0)
+{
+#define NR_KEYS	10000
+	int i, ret = 0;
+	char **keys;
+	struct strhash h = {};
+	struct strhash_slot *slot;
+
+	keys = malloc(sizeof(char *) * NR_KEYS);
+
+	for (i = 0; i < NR_KEYS; i++) {
+		keys[i] = malloc(32);
+		snprintf(keys[i], 32, "sym_%d", i);
+		slot = strhash_add(&h, keys[i], gnu_hash(keys[i]), i);
+		if (!slot || slot->value != i)
+			ret = -1;
+	}
+
+	/* Exist one is not replaced */
+	slot = strhash_add(&h, "sym_1", gnu_hash("sym_1"), 100);
+	if (!slot || slot->value != 1 || h.nr != NR_KEYS)
+		ret = -1;
+
+	for (i = 0; i < NR_KEYS; i++) {
+		slot = strhash_find(&h, keys[i], gnu_hash(keys[i]));
+		if (!slot || slot->value != i)
+			ret = -1;
+	}
+
+	if (strhash_find(&h, "not_exist", gnu_hash("not_exist")))
+		ret = -1;
+
+	strhash_destroy(&h);
+	for (i = 0; i < NR_KEYS; i++)
+		free(keys[i]);
+	free(keys);
+	return ret;
+}
+
+TEST(Utils_strhash, del, 0)
+{
+	int i, ret = 0;
+	char **keys;
+	struct strhash h = {};
+	struct strhash_slot *slot;
+
+	keys = malloc(sizeof(char *) * NR_KEYS);
+
+	for (i = 0; i < NR_KEYS; i++) {
+		keys[i] = malloc(32);
+		snprintf(keys[i], 32, "sym_%d", i);
+		strhash_add(&h, keys[i], gnu_hash(keys[i]), i);
+	}
+
+	/* Delete odd ones, the probe runs must not break */
+	for (i = 1; i < NR_KEYS; i += 2) {
+		slot = strhash_find(&h, keys[i], gnu_hash(keys[i]));
+		if (!slot) {
+			ret = -1;
+			continue;
+		}
+		strhash_del(&h, slot);
+	}
+
+	if (h.nr != NR_KEYS / 2)
+		ret = -1;
+
+	for (i = 0; i < NR_KEYS; i++) {
+		slot = strhash_find(&h, keys[i], gnu_hash(keys[i]));
+		if (i % 2 ? slot != NULL : (!slot || slot->value != i))
+			ret = -1;
+	}
+
+	strhash_destroy(&h);
+	for (i = 0; i < NR_KEYS; i++)
+		free(keys[i]);
+	free(keys);
+	return ret;
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#include <utils/log.h>
+#include <utils/strpool.h>
+#include <tests/test-api.h>
+
+TEST_STUB(utils_strpool);
+
+TEST(Utils_strpool, intern, 0)
+{
+	int i, ret = 0;
+	char buf[64];
+	const char *s1, *s2, **strs;
+	struct str_pool pool;
+
+#define NR_STRS	10000
+
+	if (str_pool_init(&pool))
+		return -1;
+
+	s1 = str_pool_intern(&pool, "/usr/lib64/libc.so.6");
+	strcpy(buf, "/usr/lib64/libc.so.6");
+	s2 = str_pool_intern(&pool, buf);
+	if (!s1 || s1 != s2 || strcmp(s1, buf))
+		ret = -1;
+
+	if (str_pool_entry(s1)->priv != -1)
+		ret = -1;
+	str_pool_entry(s1)->priv = 2;
+
+	/* Empty string is a string too */
+	if (str_pool_intern(&pool, "") != str_pool_intern(&pool, ""))
+		ret = -1;
+
+	/* Grow buckets and chunks */
+	strs = malloc(sizeof(char *) * NR_STRS);
+	for (i = 0; i < NR_STRS; i++) {
+		snprintf(buf, sizeof(buf), "/tmp/ulpatch/%d", i);
+		strs[i] = str_pool_intern(&pool, buf);
+	}
+	for (i = 0; i < NR_STRS; i++) {
+		snprintf(buf, sizeof(buf), "/tmp/ulpatch/%d", i);
+		if (strs[i] != str_pool_intern(&pool, buf) ||
+		    strcmp(strs[i], buf))
+			ret = -1;
+	}
+
+	/* 10000 strings, /usr/lib64/libc.so.6 and "" */
+	if (pool.nr_strs != NR_STRS + 2)
+		ret = -1;
+	if (str_pool_entry(s1)->priv != 2)
+		ret = -1;
+
+	free(strs);
+	str_pool_destroy(&pool);
+	return ret;
+}
@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/log.h>
+#include <utils/workpool.h>
+#include <tests/test-api.h>
+
+TEST_STUB(utils_workpool);
+
+static void count_item(size_t idx, void *arg)
+{
+	int *hits = arg;
+	__atomic_fetch_add(&hits[idx], 1, __ATOMIC_RELAXED);
+}
+
+TEST(Utils_workpool, run, 0)
+{
+#define NR_ITEMS	10000
+	int ret = 0;
+	unsigned int w;
+	size_t i;
+	int *hits = malloc(sizeof(int) * NR_ITEMS);
+
+	/* One, some, more than max, and default workers */
+	unsigned int nr_workers[] = { 1, 4, WORKPOOL_MAX_WORKERS + 10,
+				      workpool_nr_workers() };
+
+	for (w = 0; w < ARRAY_SIZE(nr_workers); w++) {
+		memset(hits, 0, sizeof(int) * NR_ITEMS);
+
+		if (workpool_run(nr_workers[w], NR_ITEMS, count_item, hits))
+			ret = -1;
+
+		/* Every item run exactly once */
+		for (i = 0; i < NR_ITEMS; i++) {
+			if (hits[i] != 1) {
+				ulp_error("item %ld run %d times with %u workers\n",
+					  i, hits[i], nr_workers[w]);
+				ret = -1;
+				break;
+			}
+		}
+	}
+
+	if (workpool_run(4, 0, count_item, hits))
+		ret = -1;
+
+	free(hits);
+	return ret;
+}
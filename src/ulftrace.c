@@ -6,6 +6,9 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <elf/elf-api.h>
 
@@ -20,11 +23,25 @@
 #include <args-common.c>
 
 static pid_t target_pid = -1;
-static const char *target_func = NULL;
+/* -f and --exclude, see build_patterns() */
+static const char **func_strs = NULL;
+static int nr_func_strs = 0;
+static const char **exclude_strs = NULL;
+static int nr_exclude_strs = 0;
+static enum pattern_type match_type = PATTERN_GLOB;
+static const char *target_module = NULL;
 static struct task_struct *target_task = NULL;
 
 static const char *patch_object_file = NULL;
 
+static unsigned int nr_records = ULFTRACE_DEF_RECORDS;
+static unsigned long duration_sec = 0;
+static enum ulftrace_mode trace_mode = ULFTRACE_MODE_RECORD;
+static int nr_lines = 10;
+static unsigned long interval_sec = 1;
+
+static volatile sig_atomic_t ulftrace_stop = 0;
+
 /* This is ftrace object file path, during 'make install' install to
  * /usr/share/ulpatch/, this macro is a absolute path of LSB relocatable file.
  *
@@ -36,12 +53,32 @@ static const char *patch_object_file = NULL;
 
 static const char *prog_name = "ulftrace";
 
+enum {
+	ARG_MIN = ARG_COMMON_MAX,
+	ARG_EXCLUDE,
+	ARG_MODULE,
+	ARG_MATCH,
+};
+
 static void ulftrace_args_reset(void)
 {
 	target_pid = -1;
-	target_func = NULL;
+	free(func_strs);
+	func_strs = NULL;
+	nr_func_strs = 0;
+	free(exclude_strs);
+	exclude_strs = NULL;
+	nr_exclude_strs = 0;
+	match_type = PATTERN_GLOB;
+	target_module = NULL;
 	target_task = NULL;
 	patch_object_file = NULL;
+	nr_records = ULFTRACE_DEF_RECORDS;
+	duration_sec = 0;
+	trace_mode = ULFTRACE_MODE_RECORD;
+	nr_lines = 10;
+	interval_sec = 1;
+	ulftrace_stop = 0;
 }
 
 static int print_help(void)
@@ -59,26 +96,84 @@ static int print_help(void)
 	"\n"
 	" Ftrace argument:\n"
 	"\n"
-	"  -f, --function [NAME]     tracing funtion specified by this argument.\n"
+	"  -f, --function [PATTERN]  tracing funtions match the PATTERN, could be\n"
+	"                            specified multiple times, optional with\n"
+	"                            --aggregate, default all.\n"
+	"\n"
+	"  --exclude [PATTERN]       don't trace funtions match the PATTERN, could\n"
+	"                            be specified multiple times.\n"
+	"\n"
+	"  --module [NAME]           only trace funtions of the ELF file, such as\n"
+	"                            libfoo.so or the absolute path.\n"
+	"\n"
+	"  --match [TYPE]            PATTERN type of --function and --exclude,\n"
+	"                            glob or regex(POSIX extended), default: glob\n"
 	"\n"
 	"  -j, --patch-obj [FILE]    input a ELF 64-bit LSB relocatable object file.\n"
 	"                            actually, this input is not necessary,\n"
 	"                            unless you know how to generate a ftrace\n"
 	"                            relocatable object.\n"
 	"                            default: %s\n"
+	"\n"
+	"  -b, --buffer-size [NUM]   records of each thread's ring buffer, power\n"
+	"                            of 2, default: %u\n"
+	"\n"
+	"  -d, --duration [SEC]      stop tracing after SEC seconds, default\n"
+	"                            trace until Ctrl-C.\n"
+	"\n"
+	"  -g, --graph               function graph mode, hook the return of\n"
+	"                            traced function, print latency histogram,\n"
+	"                            nested depth and the slowest calls instead\n"
+	"                            of each call.\n"
+	"\n"
+	"  -a, --aggregate           aggregation mode, count calls of each\n"
+	"                            function in the process, print the top\n"
+	"                            functions periodically.\n"
+	"\n"
+	"  -i, --interval [SEC]      print interval of aggregation mode,\n"
+	"                            default: 1\n"
+	"\n"
+	"  -n, --lines [NUM]         print NUM slowest calls in function graph\n"
+	"                            mode, at most %d, or NUM top functions in\n"
+	"                            aggregation mode, default: 10\n"
 	"\n",
-	ULPATCH_OBJ_FTRACE_MCOUNT_PATH);
+	ULPATCH_OBJ_FTRACE_MCOUNT_PATH,
+	ULFTRACE_DEF_RECORDS,
+	ULFTRACE_NR_SLOW);
 	print_usage_common(prog_name);
 	cmd_exit_success();
 	return 0;
 }
 
+static int strs_add(const char ***strs, int *nr, const char *str)
+{
+	const char **tmp;
+
+	tmp = realloc(*strs, (*nr + 1) * sizeof(*tmp));
+	if (!tmp) {
+		fprintf(stderr, "Malloc failed.\n");
+		return -ENOMEM;
+	}
+	tmp[(*nr)++] = str;
+	*strs = tmp;
+	return 0;
+}
+
 static int parse_config(int argc, char *argv[])
 {
 	struct option options[] = {
 		{ "pid",            required_argument,  0, 'p' },
 		{ "function",       required_argument,  0, 'f' },
+		{ "exclude",        required_argument,  0, ARG_EXCLUDE },
+		{ "module",         required_argument,  0, ARG_MODULE },
+		{ "match",          required_argument,  0, ARG_MATCH },
 		{ "patch-obj",      required_argument,  0, 'j' },
+		{ "buffer-size",    required_argument,  0, 'b' },
+		{ "duration",       required_argument,  0, 'd' },
+		{ "graph",          no_argument,        0, 'g' },
+		{ "aggregate",      no_argument,        0, 'a' },
+		{ "interval",       required_argument,  0, 'i' },
+		{ "lines",          required_argument,  0, 'n' },
 		COMMON_OPTIONS
 		{ NULL }
 	};
@@ -86,7 +181,7 @@ static int parse_config(int argc, char *argv[])
 	while (1) {
 		int c;
 		int option_index = 0;
-		c = getopt_long(argc, argv, "p:f:j:"COMMON_GETOPT_OPTSTRING,
+		c = getopt_long(argc, argv, "p:f:j:b:d:gai:n:"COMMON_GETOPT_OPTSTRING,
 				options, &option_index);
 		if (c < 0)
 			break;
@@ -96,11 +191,45 @@ static int parse_config(int argc, char *argv[])
 			target_pid = atoi(optarg);
 			break;
 		case 'f':
-			target_func = optarg;
+			if (strs_add(&func_strs, &nr_func_strs, optarg))
+				cmd_exit(1);
+			break;
+		case ARG_EXCLUDE:
+			if (strs_add(&exclude_strs, &nr_exclude_strs, optarg))
+				cmd_exit(1);
+			break;
+		case ARG_MODULE:
+			target_module = optarg;
+			break;
+		case ARG_MATCH:
+			if (str2pattern_type(optarg) < 0) {
+				fprintf(stderr, "Unknown match type %s.\n",
+					optarg);
+				cmd_exit(1);
+			}
+			match_type = str2pattern_type(optarg);
 			break;
 		case 'j':
 			patch_object_file = optarg;
 			break;
+		case 'b':
+			nr_records = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			duration_sec = strtoul(optarg, NULL, 0);
+			break;
+		case 'g':
+			trace_mode = ULFTRACE_MODE_GRAPH;
+			break;
+		case 'a':
+			trace_mode = ULFTRACE_MODE_AGGREGATE;
+			break;
+		case 'i':
+			interval_sec = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			nr_lines = atoi(optarg);
+			break;
 		COMMON_GETOPT_CASES(prog_name, print_help, argv)
 		default:
 			print_help();
@@ -114,11 +243,30 @@ static int parse_config(int argc, char *argv[])
 		cmd_exit(1);
 	}
 
-	if (!target_func) {
+	if (!nr_func_strs && trace_mode != ULFTRACE_MODE_AGGREGATE) {
 		fprintf(stderr, "Specify target function to trace with -f, --function.\n");
 		cmd_exit(1);
 	}
 
+	if (nr_records < 64 || nr_records > ULFTRACE_MAX_RECORDS ||
+	    (nr_records & (nr_records - 1))) {
+		fprintf(stderr, "Buffer size must be power of 2 in [64, %u].\n",
+			ULFTRACE_MAX_RECORDS);
+		cmd_exit(1);
+	}
+
+	if (nr_lines < 0 || (trace_mode == ULFTRACE_MODE_GRAPH &&
+			     nr_lines > ULFTRACE_NR_SLOW)) {
+		fprintf(stderr, "Slowest calls must be in [0, %d].\n",
+			ULFTRACE_NR_SLOW);
+		cmd_exit(1);
+	}
+
+	if (!interval_sec) {
+		fprintf(stderr, "Interval must be at least 1 second.\n");
+		cmd_exit(1);
+	}
+
 	if (!proc_pid_exist(target_pid)) {
 		fprintf(stderr, "pid %d not exist.\n", target_pid);
 		cmd_exit(1);
@@ -158,10 +306,259 @@ static int parse_config(int argc, char *argv[])
 }
 
 
+static void sig_stop(int signum)
+{
+	ulftrace_stop = 1;
+}
+
+static void fprint_addr(FILE *fp, unsigned long addr)
+{
+	struct task_sym *tsym = find_task_addr(target_task, addr);
+
+	if (tsym)
+		fprintf(fp, "%s+%#lx", tsym->name, addr - tsym->addr);
+	else
+		fprintf(fp, "%#lx", addr);
+}
+
+/* The record points to shared memory, no copy */
+static int print_record(const struct ulftrace_record *rec, void *arg)
+{
+	struct ftrace_session *fs = arg;
+	unsigned long ns = ftrace_cycles_to_ns(fs, rec->cycles);
+
+	fprintf(stdout, "%lu.%06lu %6d ", ns / 1000000000UL,
+		(ns % 1000000000UL) / 1000, rec->tid);
+	fprint_addr(stdout, rec->child);
+	fprintf(stdout, " <- ");
+	fprint_addr(stdout, rec->parent);
+	fprintf(stdout, " (%#lx, %#lx, %#lx, %#lx, %#lx, %#lx)\n",
+		rec->args[0], rec->args[1], rec->args[2],
+		rec->args[3], rec->args[4], rec->args[5]);
+	return 0;
+}
+
+#define HIST_BAR_WIDTH	40
+
+static void print_hist(struct ftrace_session *fs,
+		       const struct ulftrace_func *func)
+{
+	int b, first = -1, last = -1;
+	unsigned long max = 0, lo, hi;
+
+	for (b = 0; b < ULFTRACE_HIST_BUCKETS; b++) {
+		if (!func->hist[b])
+			continue;
+		if (first < 0)
+			first = b;
+		last = b;
+		max = func->hist[b] > max ? func->hist[b] : max;
+	}
+
+	if (first < 0)
+		return;
+
+	fprintf(stdout, "  %23s : %-10s distribution\n", "ns", "count");
+	for (b = first; b <= last; b++) {
+		/* See ulftrace_hist_bucket() */
+		lo = b ? (1UL << (b - 1)) * fs->ns_per_cycle : 0;
+		hi = ((1UL << b) - 1) * fs->ns_per_cycle;
+
+		fprintf(stdout, "  %10lu -> %-10lu : %-10lu |%-*.*s|\n", lo, hi,
+			func->hist[b], HIST_BAR_WIDTH,
+			(int)(func->hist[b] * HIST_BAR_WIDTH / max),
+			"****************************************");
+	}
+}
+
+/* Print statistics of function graph, return the number of calls */
+static unsigned long print_graph(struct ftrace_session *fs)
+{
+	int i, n;
+	unsigned long nr_calls = 0;
+	struct ulftrace_func *func;
+	struct ulftrace_slow slow[ULFTRACE_NR_SLOW];
+
+	for (i = 0; i < fs->shm->nr_funcs; i++) {
+		func = ulftrace_func(fs->shm, i);
+		if (!func->child || !func->count)
+			continue;
+
+		nr_calls += func->count;
+
+		fprintf(stdout, "\n");
+		fprint_addr(stdout, func->child);
+		fprintf(stdout, ": %lu calls, avg %.3fus, max %.3fus, "
+			"max depth %lu\n", func->count,
+			func->total * fs->ns_per_cycle / func->count / 1000.0,
+			func->max * fs->ns_per_cycle / 1000.0,
+			func->max_depth);
+		print_hist(fs, func);
+	}
+
+	if (!nr_lines)
+		return nr_calls;
+
+	n = ftrace_slowest(fs, slow, nr_lines);
+	if (n <= 0)
+		return nr_calls;
+
+	fprintf(stdout, "\nSlowest %d calls:\n", n);
+	fprintf(stdout, "  %14s %7s %5s  %s\n", "duration(us)", "tid", "depth",
+		"function <- caller");
+	for (i = 0; i < n; i++) {
+		fprintf(stdout, "  %14.3f %7d %5u  ",
+			slow[i].duration * fs->ns_per_cycle / 1000.0,
+			slow[i].tid, slow[i].depth);
+		fprint_addr(stdout, slow[i].child);
+		fprintf(stdout, " <- ");
+		fprint_addr(stdout, slow[i].parent);
+		fprintf(stdout, "\n");
+	}
+
+	return nr_calls;
+}
+
+/* Print the top functions in last @us, return the number of calls */
+static unsigned long print_aggregate(struct ftrace_session *fs,
+				     unsigned long us)
+{
+	long i, n;
+	unsigned long nr_calls = 0;
+	struct ulftrace_agg *aggs;
+
+	n = ftrace_aggregate(fs, &aggs, true);
+	if (n < 0) {
+		fprintf(stderr, "aggregate failed, %s\n", strerror(-n));
+		return 0;
+	}
+
+	for (i = 0; i < n; i++)
+		nr_calls += aggs[i].count;
+
+	us = us ?: 1;
+	fprintf(stdout, "\n%ld functions, %.0f calls/s\n", n,
+		nr_calls * 1000000.0 / us);
+	if (n && nr_lines)
+		fprintf(stdout, "  %14s  %s\n", "calls/s", "function");
+	for (i = 0; i < n && i < nr_lines; i++) {
+		fprintf(stdout, "  %14.0f  ", aggs[i].count * 1000000.0 / us);
+		fprint_addr(stdout, aggs[i].child);
+		fprintf(stdout, "\n");
+	}
+	fflush(stdout);
+
+	free(aggs);
+	return nr_calls;
+}
+
+/* The matched functions */
+struct func_ranges {
+	struct addr_range *ranges;
+	int nr, alloc;
+	/* Size of any function is unknown */
+	bool unsized;
+};
+
+static bool sym_in_module(struct task_sym *sym)
+{
+	const char *name;
+
+	if (!target_module)
+		return true;
+	if (!sym->vma)
+		return false;
+
+	name = sym->vma->name_;
+	return !strcmp(name, target_module) ||
+		!strcmp(basename((char *)name), target_module);
+}
+
+static int add_func_range(struct task_sym *sym, void *arg)
+{
+	struct func_ranges *funcs = arg;
+	struct addr_range *range;
+
+	if (!sym_in_module(sym))
+		return 0;
+
+	if (funcs->nr == funcs->alloc) {
+		funcs->alloc = funcs->alloc ? funcs->alloc * 2 : 64;
+		range = realloc(funcs->ranges,
+				funcs->alloc * sizeof(*range));
+		if (!range)
+			return -ENOMEM;
+		funcs->ranges = range;
+	}
+
+	/* The child address is in the function, after mcount call */
+	range = &funcs->ranges[funcs->nr++];
+	range->start = sym->addr;
+	range->end = sym->addr + (sym->size ?: MCOUNT_SCAN_BYTES);
+	funcs->unsized |= !sym->size;
+
+	ulp_debug("Match %s %#lx\n", sym->name, sym->addr);
+	return 0;
+}
+
+/**
+ * Find functions match -f, but not --exclude, in --module. All patterns are
+ * compiled once, see match_task_syms().
+ */
+static int match_funcs(struct func_ranges *funcs)
+{
+	int i, err = 0;
+	struct pattern_set include, exclude;
+
+	pattern_set_init(&include, match_type);
+	pattern_set_init(&exclude, match_type);
+
+	for (i = 0; !err && i < nr_func_strs; i++)
+		err = pattern_set_add(&include, func_strs[i]);
+	/* Only --module */
+	if (!err && !nr_func_strs)
+		err = pattern_set_add(&include, match_type == PATTERN_GLOB ?
+				      "*" : ".*");
+	for (i = 0; !err && i < nr_exclude_strs; i++)
+		err = pattern_set_add(&exclude, exclude_strs[i]);
+
+	if (!err)
+		err = pattern_set_compile(&include);
+	if (!err && exclude.nr)
+		err = pattern_set_compile(&exclude);
+
+	/**
+	 * A literal name is looked up lazily, loading stops at the first
+	 * definition, which may be in another ELF loaded before --module, such
+	 * as the executable or libc.
+	 */
+	if (!err && target_module)
+		task_load_all_syms(target_task);
+
+	if (!err) {
+		err = match_task_syms(target_task, &include,
+				      exclude.nr ? &exclude : NULL,
+				      add_func_range, funcs);
+		err = err < 0 ? err : 0;
+	}
+
+	pattern_set_destroy(&include);
+	pattern_set_destroy(&exclude);
+	return err;
+}
+
 int ulftrace(int argc, char *argv[])
 {
-	int ret = 0;
-	struct task_sym *tsym;
+	int i, ret = 0, nr_sites;
+	long n;
+	unsigned long start, now, last, us, nr_events = 0;
+	unsigned long filter_start, filter_end;
+	bool trace_all;
+	struct func_ranges funcs = {};
+	struct ftrace_session fs;
+	struct sigaction sa = {
+		.sa_handler = sig_stop,
+	}, old_int, old_term;
 
 	COMMON_RESET_BEFORE_PARSE_ARGS(ulftrace_args_reset);
 
@@ -183,21 +580,144 @@ int ulftrace(int argc, char *argv[])
 		return 1;
 	}
 
-	tsym = find_task_sym(target_task, target_func, NULL, NULL);
-	if (!tsym) {
-		fprintf(stderr, "couldn't found symbol '%s'\n", target_func);
-		errno = ENOENT;
+	/* Without -f and --module, trace all functions */
+	trace_all = !nr_func_strs && !target_module;
+	if (!trace_all) {
+		ret = match_funcs(&funcs);
+		if (ret)
+			fprintf(stderr, "match functions failed, %s\n",
+				strerror(-ret));
+		else if (!funcs.nr)
+			fprintf(stderr, "couldn't found any function matches\n");
+		if (ret || !funcs.nr) {
+			errno = ENOENT;
+			ret = 1;
+			goto done;
+		}
+		fprintf(stderr, "%d functions matched.\n", funcs.nr);
+	}
+
+	/* No record is written in function graph and aggregation mode */
+	ret = ftrace_open(&fs, target_task, patch_object_file,
+			  ULFTRACE_DEF_RINGS,
+			  trace_mode == ULFTRACE_MODE_RECORD ? nr_records : 64);
+	if (ret) {
+		fprintf(stderr, "ftrace %d failed, %s\n", target_pid,
+			strerror(-ret));
 		ret = 1;
 		goto done;
 	}
 
-	init_patch(target_task, ULPATCH_OBJ_FTRACE_MCOUNT_PATH);
+	/**
+	 * Only trace child in the matched functions, the range contains other
+	 * functions between them, but their call sites are NOP below. If no
+	 * call site found, the filter still works.
+	 */
+	if (funcs.nr && !funcs.unsized) {
+		filter_start = funcs.ranges[0].start;
+		filter_end = funcs.ranges[0].end;
+		for (i = 1; i < funcs.nr; i++) {
+			if (funcs.ranges[i].start < filter_start)
+				filter_start = funcs.ranges[i].start;
+			if (funcs.ranges[i].end > filter_end)
+				filter_end = funcs.ranges[i].end;
+		}
+		ftrace_set_filter(&fs, filter_start, filter_end);
+	} else if (funcs.nr)
+		fprintf(stderr, "WARNING: size of some functions is unknown, "
+			"trace all.\n");
+
+	/**
+	 * Replace all calls of mcount with NOP except the matched functions',
+	 * all of them are changed in one stop-the-world.
+	 */
+	ret = ftrace_load_sites(&fs);
+	if (ret)
+		fprintf(stderr, "WARNING: load call sites of %s failed, %s\n",
+			MCOUNT_NAME, strerror(-ret));
+	else {
+		nr_sites = ftrace_select_sites(&fs,
+					       trace_all ? NULL : funcs.ranges,
+					       funcs.nr);
+		if (nr_sites == 0)
+			fprintf(stderr, "WARNING: %s doesn't call %s, not "
+				"compiled with -pg?\n",
+				trace_all ? "process" : "matched functions",
+				MCOUNT_NAME);
+		else if (nr_sites < 0) {
+			fprintf(stderr, "WARNING: select call sites failed, %s\n",
+				strerror(-nr_sites));
+			ret = nr_sites;
+		}
+	}
 
-	// MORE
+	/**
+	 * Without call site control, the filter above is the only thing that
+	 * limits tracing, and the range of several functions contains all
+	 * functions between them, maybe the whole executable.
+	 */
+	if (ret && funcs.nr > 1) {
+		fprintf(stderr, "can't trace %d functions without call site "
+			"control, specify only one\n", funcs.nr);
+		ftrace_close(&fs);
+		errno = -ret;
+		ret = 1;
+		goto done;
+	}
+	ret = 0;
+
+	ftrace_set_mode(&fs, trace_mode);
+
+	sigaction(SIGINT, &sa, &old_int);
+	sigaction(SIGTERM, &sa, &old_term);
+
+	start = last = usecs();
+	while (!ulftrace_stop) {
+		n = 0;
+		if (trace_mode == ULFTRACE_MODE_RECORD)
+			n = ftrace_consume(&fs, print_record, &fs);
+		nr_events += n;
+
+		now = usecs();
+		if (trace_mode == ULFTRACE_MODE_AGGREGATE &&
+		    now - last >= interval_sec * 1000000UL) {
+			nr_events += print_aggregate(&fs, now - last);
+			last = now;
+		}
 
-	delete_patch(target_task);
+		if (duration_sec && now - start >= duration_sec * 1000000UL)
+			break;
+		/* Nothing published, give producers some time */
+		if (!n)
+			usleep(1000);
+	}
+
+	sigaction(SIGINT, &old_int, NULL);
+	sigaction(SIGTERM, &old_term, NULL);
+
+	/* Empty range, stop producing, and then drain the rings */
+	ftrace_set_filter(&fs, 1, 1);
+	switch (trace_mode) {
+	case ULFTRACE_MODE_GRAPH:
+		nr_events = print_graph(&fs);
+		break;
+	case ULFTRACE_MODE_AGGREGATE:
+		nr_events += print_aggregate(&fs, usecs() - last);
+		break;
+	default:
+		nr_events += ftrace_consume(&fs, print_record, &fs);
+		break;
+	}
+	us = usecs() - start;
+
+	fprintf(stderr, "%lu events, %lu lost, %.0f events/s\n", nr_events,
+		ftrace_lost(&fs), us ? nr_events * 1000000.0 / us : 0.0);
+
+	if (ftrace_close(&fs))
+		ret = 1;
 
 done:
+	free(funcs.ranges);
 	close_task(target_task);
 
 	return ret;
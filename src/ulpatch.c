@@ -6,6 +6,7 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <errno.h>
+#include <string.h>
 
 #include <elf/elf-api.h>
 
@@ -16,6 +17,8 @@
 #include <utils/compiler.h>
 #include <task/task.h>
 #include <utils/cmds.h>
+#include <utils/workpool.h>
+#include <utils/ansi.h>
 
 #include <args-common.c>
 
@@ -31,22 +34,42 @@ static pid_t target_pid = -1;
 static struct task_struct *target_task = NULL;
 static char *patch_file = NULL;
 
+/* Fleet mode, all processes of the executable or Build ID, or -p more than once */
+static pid_t *target_pids = NULL;
+static int nr_target_pids = 0;
+static char *target_exe = NULL;
+static char *target_build_id = NULL;
+static unsigned int nr_jobs = 0;
+
 enum {
 	ARG_MIN = ARG_COMMON_MAX,
 	ARG_PATCH,
 	ARG_UNPATCH,
 	ARG_MAP_PFX,
+	ARG_EXE,
+	ARG_BUILD_ID,
 };
 
 static const char *prog_name = "ulpatch";
 
+static bool fleet_mode(void)
+{
+	return target_exe || target_build_id || nr_target_pids > 1;
+}
+
 int check_patch_file(const char *file);
 
 static void ulpatch_args_reset(void)
 {
 	target_pid = -1;
+	free(target_pids);
+	target_pids = NULL;
+	nr_target_pids = 0;
 	target_task = NULL;
 	patch_file = NULL;
+	target_exe = NULL;
+	target_build_id = NULL;
+	nr_jobs = 0;
 }
 
 static int print_help(void)
@@ -61,7 +84,17 @@ static int print_help(void)
 	"\n"
 	" Option argument:\n"
 	"\n"
-	"  -p, --pid [PID]     specify a process identifier(pid_t)\n"
+	"  -p, --pid [PID]     specify a process identifier(pid_t), could be\n"
+	"                      specified more than once to patch all of them\n"
+	"                      like --exe.\n"
+	"  --exe [PATH]        all processes of the executable file.\n"
+	"  --build-id [ID]     all processes whose executable has Build ID.\n"
+	"                      --exe and --build-id could be used together,\n"
+	"                      the first process is patched alone, then others\n"
+	"                      concurrently, if any one failed, all patched\n"
+	"                      ones are unpatched.\n"
+	"  -j, --jobs [NUM]    patch NUM processes concurrently, default is\n"
+	"                      number of online CPUs, at most %d.\n"
 	"\n"
 	" Operate argument:\n"
 	"\n"
@@ -73,6 +106,7 @@ static int print_help(void)
 	"\n"
 	"  --map-pfx           display /proc/PID/maps prefix: '%s'.\n"
 	"\n",
+	WORKPOOL_MAX_WORKERS,
 	PATCH_VMA_TEMP_PREFIX);
 	print_usage_common(prog_name);
 	cmd_exit_success();
@@ -82,9 +116,13 @@ static int print_help(void)
 static int parse_config(int argc, char *argv[])
 {
 	int ret;
+	pid_t *pids;
 
 	struct option options[] = {
 		{ "pid",            required_argument, 0, 'p' },
+		{ "exe",            required_argument, 0, ARG_EXE },
+		{ "build-id",       required_argument, 0, ARG_BUILD_ID },
+		{ "jobs",           required_argument, 0, 'j' },
 		{ "patch",          required_argument, 0, ARG_PATCH },
 		{ "unpatch",        no_argument,       0, ARG_UNPATCH },
 		{ "map-pfx",        no_argument,       0, ARG_MAP_PFX },
@@ -95,7 +133,7 @@ static int parse_config(int argc, char *argv[])
 	while (1) {
 		int c;
 		int option_index = 0;
-		c = getopt_long(argc, argv, "p:"COMMON_GETOPT_OPTSTRING,
+		c = getopt_long(argc, argv, "p:j:"COMMON_GETOPT_OPTSTRING,
 				options, &option_index);
 		if (c < 0)
 			break;
@@ -103,6 +141,23 @@ static int parse_config(int argc, char *argv[])
 		switch (c) {
 		case 'p':
 			target_pid = atoi(optarg);
+			pids = realloc(target_pids,
+				       (nr_target_pids + 1) * sizeof(pid_t));
+			if (!pids) {
+				fprintf(stderr, "Out of memory.\n");
+				cmd_exit(1);
+			}
+			target_pids = pids;
+			target_pids[nr_target_pids++] = target_pid;
+			break;
+		case ARG_EXE:
+			target_exe = optarg;
+			break;
+		case ARG_BUILD_ID:
+			target_build_id = optarg;
+			break;
+		case 'j':
+			nr_jobs = atoi(optarg);
 			break;
 		case ARG_PATCH:
 			command_type = CMD_PATCH;
@@ -128,12 +183,15 @@ static int parse_config(int argc, char *argv[])
 		cmd_exit(1);
 	}
 
-	if (target_pid == -1) {
-		fprintf(stderr, "Specify pid with -p, --pid.\n");
+	if (target_exe || target_build_id) {
+		if (target_pid != -1) {
+			fprintf(stderr, "-p, --pid conflicts with --exe, --build-id.\n");
+			cmd_exit(1);
+		}
+	} else if (target_pid == -1) {
+		fprintf(stderr, "Specify pid with -p, --pid, or --exe, --build-id.\n");
 		cmd_exit(1);
-	}
-
-	if (!proc_pid_exist(target_pid)) {
+	} else if (!fleet_mode() && !proc_pid_exist(target_pid)) {
 		fprintf(stderr, "pid %d not exist.\n", target_pid);
 		cmd_exit(1);
 	}
@@ -175,7 +233,8 @@ int check_patch_file(const char *file)
 		goto release;
 	}
 
-	if (strcmp(info.ulp_strtab.magic, SEC_ULPATCH_MAGIC)) {
+	/* setup_load_info() checked magic of every entry */
+	if (strcmp(info.ulp_strtab[0].magic, SEC_ULPATCH_MAGIC)) {
 		ulp_debug("%s is not ulpatch file.\n", file);
 		err = -ENODATA;
 	}
@@ -195,6 +254,132 @@ static int command_unpatch(void)
 	return delete_patch(target_task);
 }
 
+static int cmp_ulong(const void *a, const void *b)
+{
+	unsigned long x = *(const unsigned long *)a;
+	unsigned long y = *(const unsigned long *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest rank percentile of sorted array */
+static unsigned long percentile(const unsigned long *sorted, int nr, int pct)
+{
+	int rank = (nr * pct + 99) / 100;
+	return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void print_fleet_results(const struct fleet_result *results, int nr,
+				unsigned long total_us)
+{
+	int i, nr_us = 0, nr_ok = 0, nr_failed = 0, nr_rollback = 0;
+	unsigned long *us;
+	const char *stat;
+
+	fpansi_bold(stdout);
+	fpansi_reverse(stdout);
+	printf("%-8s %-10s %-12s", "PID", "RESULT", "TIME(us)");
+	fpansi_reset(stdout);
+	printf("\n");
+
+	us = malloc(sizeof(unsigned long) * nr);
+
+	for (i = 0; i < nr; i++) {
+		const struct fleet_result *r = &results[i];
+
+		if (r->err == -ECANCELED)
+			stat = "SKIPPED";
+		else if (r->err)
+			stat = "FAILED";
+		else if (r->rollback)
+			stat = "ROLLBACK";
+		else
+			stat = "OK";
+
+		printf("%-8d %-10s %-12ld", r->pid, stat, r->us);
+		if (r->err && r->err != -ECANCELED)
+			printf(" %s", strerror(-r->err));
+		printf("\n");
+
+		if (r->err)
+			nr_failed++;
+		else if (r->rollback)
+			nr_rollback++;
+		else
+			nr_ok++;
+
+		/* Skipped ones are not counted */
+		if (us && r->err != -ECANCELED)
+			us[nr_us++] = r->us;
+	}
+
+	printf("%d processes, %d ok, %d failed, %d rollback, in %ldus\n",
+	       nr, nr_ok, nr_failed, nr_rollback, total_us);
+
+	if (us && nr_us) {
+		qsort(us, nr_us, sizeof(unsigned long), cmp_ulong);
+		printf("Latency(us): p50 %ld, p90 %ld, p99 %ld, max %ld\n",
+		       percentile(us, nr_us, 50), percentile(us, nr_us, 90),
+		       percentile(us, nr_us, 99), us[nr_us - 1]);
+	}
+
+	free(us);
+}
+
+/* Patch or unpatch all processes of --exe and/or --build-id, or all -p */
+static int command_fleet(void)
+{
+	int i, nr, ret;
+	pid_t *pids;
+	unsigned long start;
+	unsigned int nr_workers;
+	struct fleet_result *results;
+	struct prepared_patch pp;
+
+	if (target_exe || target_build_id) {
+		nr = proc_find_pids(target_exe, target_build_id, &pids);
+		if (nr <= 0) {
+			fprintf(stderr, "Not found any process of %s.\n",
+				target_exe ?: target_build_id);
+			return nr ?: -ENOENT;
+		}
+	} else {
+		nr = nr_target_pids;
+		pids = target_pids;
+	}
+
+	results = calloc(nr, sizeof(struct fleet_result));
+	if (!results) {
+		if (pids != target_pids)
+			free(pids);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nr; i++)
+		results[i].pid = pids[i];
+	if (pids != target_pids)
+		free(pids);
+
+	nr_workers = nr_jobs ?: workpool_nr_workers();
+
+	start = usecs();
+	if (command_type == CMD_PATCH) {
+		ret = prepare_patch(patch_file, &pp);
+		if (ret) {
+			fprintf(stderr, "Prepare %s failed.\n", patch_file);
+			goto free;
+		}
+		ret = fleet_patch(&pp, results, nr, nr_workers);
+		release_prepared_patch(&pp);
+	} else
+		ret = fleet_unpatch(results, nr, nr_workers);
+
+	print_fleet_results(results, nr, usecs() - start);
+
+free:
+	free(results);
+	return ret;
+}
+
 int ulpatch(int argc, char *argv[])
 {
 	int ret;
@@ -213,6 +398,13 @@ int ulpatch(int argc, char *argv[])
 
 	ulpatch_init();
 
+	if (fleet_mode()) {
+		ret = command_fleet();
+		if (patch_file)
+			free(patch_file);
+		return ret;
+	}
+
 	target_task = open_task(target_pid, FTO_ALL);
 
 	if (!target_task) {
@@ -92,7 +92,8 @@ static int parse_config(int argc, char *argv[])
 int show_patch_info(void)
 {
 	int err;
-	struct load_info info;
+	unsigned int i;
+	struct load_info info = {0};
 	char *tmp_ulp = "temp.ulp";
 
 	if (!patch_file) {
@@ -110,18 +111,26 @@ int show_patch_info(void)
 		return err;
 	}
 
-	setup_load_info(&info);
+	err = setup_load_info(&info);
+	if (err) {
+		ulp_error("Load %s failed.\n", patch_file);
+		goto release;
+	}
 
 	fprintf(stdout, "\tFile: %s\n", patch_file);
-	print_ulp_strtab(stdout, "\t", &info.ulp_strtab);
-	print_ulp_info(stdout, "\t", info.ulp_info);
+	for (i = 0; i < info.nr_ulp; i++) {
+		fprintf(stdout, "\tEntry      : %d/%d\n", i + 1, info.nr_ulp);
+		print_ulp_strtab(stdout, "\t", &info.ulp_strtab[i]);
+		print_ulp_info(stdout, "\t", &info.ulp_info[i]);
+	}
 	fprintf(stdout, "\tBuildID    : %s\n", info.str_build_id);
 
+release:
 	release_load_info(&info);
 
 	fremove(tmp_ulp);
 
-	return 0;
+	return err;
 }
 
 int show_task_patch_info(pid_t pid)
@@ -156,21 +165,29 @@ int show_task_patch_info(pid_t pid)
 	printf("\n");
 
 	list_for_each_entry_safe(ulp, tmpulp, &task->ulp_list, node) {
+		unsigned int j;
 		struct vm_area_struct *vma = ulp->vma;
-		printf("%-4d %-4d %-20s %#016lx %-16s",
-			i, ulp->info.ulp_id, ulp_info_strftime(&ulp->info),
-			vma->vm_start, ulp->strtab.dst_func);
 
-		if (is_verbose())
-			printf(" %-41s", ulp->str_build_id);
+		/* One line for each entry of ulp */
+		for (j = 0; j < ulp->nr_info; j++) {
+			printf("%-4d %-4d %-20s %#016lx %-16s",
+				i, ulp->info[j].ulp_id,
+				ulp_info_strftime(&ulp->info[j]),
+				vma->vm_start, ulp->strtab[j].dst_func);
+
+			if (is_verbose())
+				printf(" %-41s", ulp->str_build_id);
 
-		printf("\n");
+			printf("\n");
+		}
 
 		if (is_verbose()) {
 			fpansi_gray(stdout);
 			print_vma(stdout, false, vma, 0);
-			print_ulp_strtab(stdout, "\t", &ulp->strtab);
-			print_ulp_info(stdout, "\t", &ulp->info);
+			for (j = 0; j < ulp->nr_info; j++) {
+				print_ulp_strtab(stdout, "\t", &ulp->strtab[j]);
+				print_ulp_info(stdout, "\t", &ulp->info[j]);
+			}
 			fprintf(stdout, "\n");
 			fpansi_reset(stdout);
 		}
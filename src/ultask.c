@@ -573,9 +573,9 @@ static int mmap_a_file(void)
 {
 	int ret = 0;
 	ssize_t map_len = fsize(map_file);
-	unsigned long map_v;
-	int map_fd;
 	const char *filename = map_file;
+	int op_open, op_ftruncate, op_mmap, op_close;
+	struct task_syscall_batch batch;
 	int prot;
 	unsigned long addr = 0UL;
 
@@ -598,20 +598,6 @@ static int mmap_a_file(void)
 		addr = map_addr;
 	}
 
-	task_attach(task->pid);
-
-	map_fd = task_open2(task, (char *)filename, O_RDWR);
-	if (map_fd <= 0) {
-		fprintf(stderr, "ERROR: remote open failed.\n");
-		return -1;
-	}
-
-	ret = task_ftruncate(task, map_fd, map_len);
-	if (ret != 0) {
-		fprintf(stderr, "ERROR: remote ftruncate failed.\n");
-		goto close_ret;
-	}
-
 	prot = PROT_READ | PROT_WRITE | PROT_EXEC;
 
 	if (map_ro)
@@ -620,17 +606,51 @@ static int mmap_a_file(void)
 	if (map_noexec)
 		prot &= ~PROT_EXEC;
 
-	map_v = task_mmap(task, addr, map_len, prot, MAP_PRIVATE, map_fd, 0);
-	if (!map_v) {
+	/* open, ftruncate, mmap and close in one ptrace stop */
+	task_syscall_batch_init(&batch);
+	op_open = task_syscall_batch_open(&batch, filename, O_RDWR, 0);
+	op_ftruncate = task_syscall_batch_add(&batch, __NR_ftruncate, 0,
+					      map_len, 0, 0, 0, 0);
+	op_mmap = task_syscall_batch_add(&batch, __NR_mmap, addr, map_len,
+					 prot, MAP_PRIVATE, 0, 0);
+	op_close = task_syscall_batch_add(&batch, __NR_close, 0, 0, 0, 0, 0,
+					  0);
+	/* Nothing runs in target task yet, no fd to close */
+	if (op_open < 0 || op_ftruncate < 0 || op_mmap < 0 || op_close < 0 ||
+	    task_syscall_batch_ref(&batch, op_ftruncate, 0, op_open) ||
+	    task_syscall_batch_ref(&batch, op_mmap, 4, op_open) ||
+	    task_syscall_batch_ref(&batch, op_close, 0, op_open)) {
+		fprintf(stderr, "ERROR: build remote syscall batch failed.\n");
+		task_syscall_batch_free(&batch);
+		return -EINVAL;
+	}
+
+	task_attach(task->pid);
+
+	ret = task_syscall_batch(task, &batch);
+	if (batch.nr_done <= op_open) {
+		fprintf(stderr, "ERROR: remote open failed.\n");
+		ret = -1;
+	} else if (batch.nr_done <= op_ftruncate) {
+		fprintf(stderr, "ERROR: remote ftruncate failed.\n");
+	} else if (batch.nr_done <= op_mmap) {
 		fprintf(stderr, "ERROR: remote mmap failed.\n");
-		goto close_ret;
+	} else if (ret) {
+		fprintf(stderr, "ERROR: remote close failed.\n");
 	}
 
-close_ret:
-	task_close(task, map_fd);
-	task_detach(task->pid);
+	/* The stub stop before close(2), close the fd */
+	if (batch.nr_done > op_open && batch.nr_done < op_close)
+		task_close(task, batch.ops[op_open].ret);
 
-	update_task_vmas_ulp(task);
+	/* Only the new mapping changed */
+	if (batch.nr_done > op_mmap) {
+		addr = batch.ops[op_mmap].ret;
+		refresh_task_vmas(task, addr, addr + map_len);
+	}
+
+	task_syscall_batch_free(&batch);
+	task_detach(task->pid);
 
 	return ret;
 }
@@ -703,7 +723,7 @@ static void list_all_symbols(void)
 		int len = strlen(tsym->name);
 		if (max_name_len < len)
 			max_name_len = len;
-		len = strlen(basename(tsym->vma->name_));
+		len = strlen(basename((char *)tsym->vma->name_));
 		if (max_vma_len < len)
 			max_vma_len = len;
 	}
@@ -713,7 +733,7 @@ static void list_all_symbols(void)
 	{
 #define PRINT_TSYM(tasksym)	\
 		printf("%-*s %-*s %#016lx\n",	\
-			max_vma_len, basename(tasksym->vma->name_),	\
+			max_vma_len, basename((char *)tasksym->vma->name_),	\
 			max_name_len, tasksym->name,	\
 			tasksym->addr);
 		PRINT_TSYM(tsym);
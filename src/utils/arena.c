@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/log.h>
+#include <utils/util.h>
+#include <utils/arena.h>
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	size_t size;
+	size_t used;
+	/* Keep objects aligned as malloc(3) does */
+	char data[] __attribute__((aligned(16)));
+};
+
+void arena_init(struct arena *arena, size_t chunk_size)
+{
+	memset(arena, 0, sizeof(*arena));
+	arena->chunk_size = chunk_size;
+}
+
+void arena_destroy(struct arena *arena)
+{
+	struct arena_chunk *chunk, *next;
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+	arena->chunks = NULL;
+	arena->size = 0;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	struct arena_chunk *chunk = arena->chunks;
+	size_t chunk_size;
+	void *p;
+
+	size = ROUND_UP(size, 16);
+
+	if (!chunk || chunk->size - chunk->used < size) {
+		chunk_size = arena->chunk_size ?: ARENA_CHUNK_SIZE;
+		if (chunk_size < size + sizeof(struct arena_chunk))
+			chunk_size = size + sizeof(struct arena_chunk);
+
+		chunk = malloc(chunk_size);
+		if (!chunk) {
+			ulp_error("Malloc arena chunk failed.\n");
+			errno = ENOMEM;
+			return NULL;
+		}
+		chunk->size = chunk_size - sizeof(struct arena_chunk);
+		chunk->used = 0;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+		arena->size += chunk_size;
+	}
+
+	p = chunk->data + chunk->used;
+	chunk->used += size;
+	memset(p, 0, size);
+	return p;
+}
+
+char *arena_strdup(struct arena *arena, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *p;
+
+	p = arena_alloc(arena, len);
+	if (p)
+		memcpy(p, str, len);
+	return p;
+}
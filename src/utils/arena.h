@@ -0,0 +1,27 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#pragma once
+#include <stddef.h>
+
+/**
+ * Bump allocator, objects are never freed one by one, all chunks released by
+ * arena_destroy() at once. A zeroed struct arena is ready to use.
+ */
+struct arena_chunk;
+
+struct arena {
+	/* The first one is current */
+	struct arena_chunk *chunks;
+	/* 0 means ARENA_CHUNK_SIZE */
+	size_t chunk_size;
+	/* Bytes of all chunks */
+	size_t size;
+};
+
+#define ARENA_CHUNK_SIZE	(64 * 1024)
+
+void arena_init(struct arena *arena, size_t chunk_size);
+void arena_destroy(struct arena *arena);
+/* Return zeroed memory, NULL and set errno if failed */
+void *arena_alloc(struct arena *arena, size_t size);
+char *arena_strdup(struct arena *arena, const char *str);
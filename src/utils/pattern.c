@@ -0,0 +1,208 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/log.h>
+#include <utils/pattern.h>
+
+#define GLOB_META	"*?[\\"
+#define REGEX_META	".[]()*+?{}|^$\\"
+
+void pattern_set_init(struct pattern_set *set, enum pattern_type type)
+{
+	memset(set, 0, sizeof(*set));
+	set->type = type;
+}
+
+int str2pattern_type(const char *str)
+{
+	if (!strcmp(str, "glob"))
+		return PATTERN_GLOB;
+	if (!strcmp(str, "regex"))
+		return PATTERN_REGEX;
+	return -EINVAL;
+}
+
+/* The literal prefix of pattern, see struct pattern */
+static int pattern_prefix(struct pattern *p, enum pattern_type type)
+{
+	const char *s = p->str;
+	size_t len;
+
+	switch (type) {
+	case PATTERN_GLOB:
+		len = strcspn(s, GLOB_META);
+		p->literal = !s[len];
+		break;
+	case PATTERN_REGEX:
+		/* Top level alternation has no common prefix */
+		if (s[0] != '^' || strchr(s, '|')) {
+			len = 0;
+			break;
+		}
+		s++;
+		len = strcspn(s, REGEX_META);
+		p->literal = s[len] == '$' && !s[len + 1];
+		/* The quantifier applies to the last character */
+		if (len && s[len] && strchr("*?{", s[len]))
+			len--;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	p->prefix = strndup(s, len);
+	return p->prefix ? 0 : -ENOMEM;
+}
+
+int pattern_set_add(struct pattern_set *set, const char *str)
+{
+	int err;
+	struct pattern *p;
+
+	if (set->compiled || !str || !str[0])
+		return -EINVAL;
+
+	p = realloc(set->patterns, (set->nr + 1) * sizeof(*p));
+	if (!p)
+		return -ENOMEM;
+	set->patterns = p;
+
+	p = &set->patterns[set->nr];
+	memset(p, 0, sizeof(*p));
+	p->str = strdup(str);
+	if (!p->str)
+		return -ENOMEM;
+
+	err = pattern_prefix(p, set->type);
+	if (err) {
+		free(p->str);
+		return err;
+	}
+
+	set->nr++;
+	return 0;
+}
+
+/* Convert glob to anchored regex, @re must be at least 2 * strlen + 1 */
+static void glob_to_regex(const char *glob, char *re)
+{
+	const char *s, *end;
+
+	for (s = glob; *s; s++) {
+		switch (*s) {
+		case '*':
+			*re++ = '.';
+			*re++ = '*';
+			break;
+		case '?':
+			*re++ = '.';
+			break;
+		case '[':
+			/* ']' right after '[' or '[!' is a member */
+			end = s + 1;
+			if (*end == '!')
+				end++;
+			if (*end == ']')
+				end++;
+			end = strchr(end, ']');
+			if (!end) {
+				*re++ = '\\';
+				*re++ = '[';
+				break;
+			}
+			*re++ = '[';
+			s++;
+			if (*s == '!') {
+				*re++ = '^';
+				s++;
+			}
+			while (s < end)
+				*re++ = *s++;
+			*re++ = ']';
+			break;
+		case '\\':
+			if (s[1])
+				s++;
+			/* fallthrough */
+		default:
+			if (strchr(REGEX_META, *s))
+				*re++ = '\\';
+			*re++ = *s;
+			break;
+		}
+	}
+	*re = '\0';
+}
+
+/* No pattern could be added after compile */
+int pattern_set_compile(struct pattern_set *set)
+{
+	int i, err;
+	size_t len = 1;
+	char *re, *p, errbuf[128];
+
+	if (set->compiled)
+		return 0;
+	if (!set->nr)
+		return -EINVAL;
+
+	/* "|^(...)$" for glob, or "|(...)" for regex */
+	for (i = 0; i < set->nr; i++)
+		len += 2 * strlen(set->patterns[i].str) + 6;
+
+	re = malloc(len);
+	if (!re)
+		return -ENOMEM;
+
+	for (i = 0, p = re; i < set->nr; i++) {
+		if (i)
+			*p++ = '|';
+		if (set->type == PATTERN_GLOB) {
+			p = stpcpy(p, "^(");
+			glob_to_regex(set->patterns[i].str, p);
+			p = stpcpy(p + strlen(p), ")$");
+		} else {
+			*p++ = '(';
+			p = stpcpy(p, set->patterns[i].str);
+			*p++ = ')';
+		}
+	}
+	*p = '\0';
+
+	err = regcomp(&set->regex, re, REG_EXTENDED | REG_NOSUB);
+	if (err) {
+		regerror(err, &set->regex, errbuf, sizeof(errbuf));
+		ulp_error("Compile pattern '%s' failed, %s\n", re, errbuf);
+		free(re);
+		return -EINVAL;
+	}
+
+	ulp_debug("Compiled %d patterns: %s\n", set->nr, re);
+	free(re);
+	set->compiled = true;
+	return 0;
+}
+
+bool pattern_set_match(const struct pattern_set *set, const char *str)
+{
+	if (!set->compiled)
+		return false;
+	return !regexec(&set->regex, str, 0, NULL, 0);
+}
+
+void pattern_set_destroy(struct pattern_set *set)
+{
+	int i;
+
+	for (i = 0; i < set->nr; i++) {
+		free(set->patterns[i].str);
+		free(set->patterns[i].prefix);
+	}
+	free(set->patterns);
+	if (set->compiled)
+		regfree(&set->regex);
+	pattern_set_init(set, set->type);
+}
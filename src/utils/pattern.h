@@ -0,0 +1,42 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#pragma once
+#include <stdbool.h>
+#include <regex.h>
+
+enum pattern_type {
+	/* glob(7), match the whole string */
+	PATTERN_GLOB,
+	/* POSIX extended regex, match any substring unless anchored */
+	PATTERN_REGEX,
+};
+
+struct pattern {
+	char *str;
+	/**
+	 * Every matched string starts with this prefix, "" if unknown, see
+	 * match_task_syms().
+	 */
+	char *prefix;
+	/* No meta character, the pattern only matches itself */
+	bool literal;
+};
+
+/**
+ * A set of patterns compiled into one regex, thus, matching a string costs
+ * one regexec(3) no matter how many patterns there are.
+ */
+struct pattern_set {
+	enum pattern_type type;
+	struct pattern *patterns;
+	int nr;
+	regex_t regex;
+	bool compiled;
+};
+
+void pattern_set_init(struct pattern_set *set, enum pattern_type type);
+int pattern_set_add(struct pattern_set *set, const char *str);
+int pattern_set_compile(struct pattern_set *set);
+bool pattern_set_match(const struct pattern_set *set, const char *str);
+void pattern_set_destroy(struct pattern_set *set);
+int str2pattern_type(const char *str);
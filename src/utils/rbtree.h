@@ -120,6 +120,73 @@ static inline void rb_link_node(struct rb_node *node, struct rb_node *parent,
 
 /* include/linux/rbtree_augmented.h */
 
+/*
+ * Please note - only struct rb_augment_callbacks and the prototypes for
+ * rb_insert_augmented() and rb_erase_augmented() are intended to be public.
+ * The rest are implementation details you are not expected to depend on.
+ */
+
+struct rb_augment_callbacks {
+	void (*propagate)(struct rb_node *node, struct rb_node *stop);
+	void (*copy)(struct rb_node *old, struct rb_node *new);
+	void (*rotate)(struct rb_node *old, struct rb_node *new);
+};
+
+extern void __rb_insert_augmented(struct rb_node *node, struct rb_root *root,
+	void (*augment_rotate)(struct rb_node *old, struct rb_node *new));
+
+/*
+ * Fixup the rbtree and update the augmented information when rebalancing.
+ *
+ * On insertion, the user must update the augmented information on the path
+ * leading to the inserted node, then call rb_link_node() as usual and
+ * rb_insert_augmented() instead of the usual rb_insert_color() call.
+ * If rb_insert_augmented() rebalances the rbtree, it will callback into
+ * a user provided function to update the augmented information on the
+ * affected subtrees.
+ */
+static inline void
+rb_insert_augmented(struct rb_node *node, struct rb_root *root,
+		    const struct rb_augment_callbacks *augment)
+{
+	__rb_insert_augmented(node, root, augment->rotate);
+}
+
+#define RB_DECLARE_CALLBACKS(rbstatic, rbname, rbstruct, rbfield,	\
+			     rbtype, rbaugmented, rbcompute)		\
+static inline void							\
+rbname ## _propagate(struct rb_node *rb, struct rb_node *stop)		\
+{									\
+	while (rb != stop) {						\
+		rbstruct *node = rb_entry(rb, rbstruct, rbfield);	\
+		rbtype augmented = rbcompute(node);			\
+		if (node->rbaugmented == augmented)			\
+			break;						\
+		node->rbaugmented = augmented;				\
+		rb = rb_parent(&node->rbfield);				\
+	}								\
+}									\
+static inline void							\
+rbname ## _copy(struct rb_node *rb_old, struct rb_node *rb_new)		\
+{									\
+	rbstruct *old = rb_entry(rb_old, rbstruct, rbfield);		\
+	rbstruct *new = rb_entry(rb_new, rbstruct, rbfield);		\
+	new->rbaugmented = old->rbaugmented;				\
+}									\
+static void								\
+rbname ## _rotate(struct rb_node *rb_old, struct rb_node *rb_new)	\
+{									\
+	rbstruct *old = rb_entry(rb_old, rbstruct, rbfield);		\
+	rbstruct *new = rb_entry(rb_new, rbstruct, rbfield);		\
+	new->rbaugmented = old->rbaugmented;				\
+	old->rbaugmented = rbcompute(old);				\
+}									\
+rbstatic const struct rb_augment_callbacks rbname = {			\
+	.propagate = rbname ## _propagate,				\
+	.copy = rbname ## _copy,					\
+	.rotate = rbname ## _rotate					\
+};
+
 #define RB_RED          0
 #define RB_BLACK        1
 
@@ -156,10 +223,12 @@ __rb_change_child(struct rb_node *old, struct rb_node *new,
                 WRITE_ONCE(root->rb_node, new);
 }
 
-extern void __rb_erase_color(struct rb_node *parent, struct rb_root *root);
+extern void __rb_erase_color(struct rb_node *parent, struct rb_root *root,
+	void (*augment_rotate)(struct rb_node *old, struct rb_node *new));
 
 static __always_inline struct rb_node *
-__rb_erase(struct rb_node *node, struct rb_root *root)
+__rb_erase_augmented(struct rb_node *node, struct rb_root *root,
+		     const struct rb_augment_callbacks *augment)
 {
 	struct rb_node *child = node->rb_right;
 	struct rb_node *tmp = node->rb_left;
@@ -206,6 +275,8 @@ __rb_erase(struct rb_node *node, struct rb_root *root)
 			 */
 			parent = successor;
 			child2 = successor->rb_right;
+
+			augment->copy(node, successor);
 		} else {
 			/*
 			 * Case 3: node's successor is leftmost under
@@ -230,6 +301,9 @@ __rb_erase(struct rb_node *node, struct rb_root *root)
 			WRITE_ONCE(parent->rb_left, child2);
 			WRITE_ONCE(successor->rb_right, child);
 			rb_set_parent(child, successor);
+
+			augment->copy(node, successor);
+			augment->propagate(parent, successor);
 		}
 
 		tmp = node->rb_left;
@@ -252,9 +326,19 @@ __rb_erase(struct rb_node *node, struct rb_root *root)
 		tmp = successor;
 	}
 
+	augment->propagate(tmp, NULL);
 	return rebalance;
 }
 
+static __always_inline void
+rb_erase_augmented(struct rb_node *node, struct rb_root *root,
+		   const struct rb_augment_callbacks *augment)
+{
+	struct rb_node *rebalance = __rb_erase_augmented(node, root, augment);
+	if (rebalance)
+		__rb_erase_color(rebalance, root, augment->rotate);
+}
+
 
 /* LibCare API */
 
@@ -323,6 +407,40 @@ struct rb_node *rb_insert_node(struct rb_root *root,
         return NULL;
 }
 
+/**
+ * Same as rb_insert_node(), but keep the augmented information of @augment
+ * up to date while rebalancing. The new node's own augmented value must not
+ * raise any ancestor's value, the caller should update it and propagate
+ * after insertion.
+ */
+static inline
+struct rb_node *rb_insert_node_augmented(struct rb_root *root,
+					 struct rb_node *new_node,
+					 rb_cmp_fn_t cmp_fn,
+					 unsigned long key,
+					 const struct rb_augment_callbacks *augment)
+{
+	int cmp_res;
+	struct rb_node **node = &root->rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*node) {
+		parent = *node;
+		cmp_res = cmp_fn(*node, key);
+		if (cmp_res < 0)
+			node = &(*node)->rb_left;
+		else if (cmp_res > 0)
+			node = &(*node)->rb_right;
+		else
+			return *node;
+	}
+
+	rb_link_node(new_node, parent, node);
+	rb_insert_augmented(new_node, root, augment);
+
+	return NULL;
+}
+
 static inline
 void rb_destroy(struct rb_root *root, void(*free_node_cb)(struct rb_node *))
 {
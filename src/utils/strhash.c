@@ -0,0 +1,115 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/log.h>
+#include <utils/strhash.h>
+
+#define STRHASH_MIN_SIZE	64
+
+void strhash_destroy(struct strhash *h)
+{
+	free(h->slots);
+	memset(h, 0, sizeof(*h));
+}
+
+static struct strhash_slot *__strhash_slot(struct strhash_slot *slots,
+					   unsigned int size,
+					   const char *key, uint32_t hash)
+{
+	unsigned int i = hash & (size - 1);
+
+	while (slots[i].key) {
+		if (slots[i].hash == hash && !strcmp(slots[i].key, key))
+			break;
+		i = (i + 1) & (size - 1);
+	}
+	return &slots[i];
+}
+
+/* Keep load factor under 1/2 */
+static int strhash_grow(struct strhash *h)
+{
+	struct strhash_slot *slots, *slot;
+	unsigned int i, size;
+
+	size = h->size ? h->size * 2 : STRHASH_MIN_SIZE;
+	slots = calloc(size, sizeof(*slots));
+	if (!slots) {
+		ulp_error("Malloc strhash slots failed.\n");
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < h->size; i++) {
+		if (!h->slots[i].key)
+			continue;
+		slot = __strhash_slot(slots, size, h->slots[i].key,
+				      h->slots[i].hash);
+		*slot = h->slots[i];
+	}
+
+	free(h->slots);
+	h->slots = slots;
+	h->size = size;
+	return 0;
+}
+
+struct strhash_slot *strhash_add(struct strhash *h, const char *key,
+				 uint32_t hash, unsigned long value)
+{
+	struct strhash_slot *slot;
+
+	if ((h->nr + 1) * 2 > h->size && strhash_grow(h)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	slot = __strhash_slot(h->slots, h->size, key, hash);
+	if (!slot->key) {
+		slot->key = key;
+		slot->hash = hash;
+		slot->value = value;
+		h->nr++;
+	}
+	return slot;
+}
+
+struct strhash_slot *strhash_find(const struct strhash *h, const char *key,
+				  uint32_t hash)
+{
+	struct strhash_slot *slot;
+
+	if (!h->size)
+		return NULL;
+
+	slot = __strhash_slot(h->slots, h->size, key, hash);
+	return slot->key ? slot : NULL;
+}
+
+/**
+ * Backward shift deletion, move the following entries of the probe run to
+ * the hole if their home slot allows, no tombstone is left.
+ */
+void strhash_del(struct strhash *h, struct strhash_slot *slot)
+{
+	unsigned int i, j, home, mask = h->size - 1;
+
+	i = j = slot - h->slots;
+
+	while (1) {
+		j = (j + 1) & mask;
+		if (!h->slots[j].key)
+			break;
+		home = h->slots[j].hash & mask;
+		/* Can't move if home is in (i, j] cyclically */
+		if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+			continue;
+		h->slots[i] = h->slots[j];
+		i = j;
+	}
+
+	memset(&h->slots[i], 0, sizeof(h->slots[i]));
+	h->nr--;
+}
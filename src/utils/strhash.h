@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#pragma once
+#include <stdint.h>
+
+/**
+ * Open addressing hash index keyed by string, linear probing. The keys are
+ * not copied, they must live as long as the index. A zeroed struct strhash
+ * is an empty index.
+ */
+struct strhash_slot {
+	/* NULL if slot is empty */
+	const char *key;
+	uint32_t hash;
+	unsigned long value;
+};
+
+struct strhash {
+	struct strhash_slot *slots;
+	/* Power of 2 */
+	unsigned int size;
+	unsigned int nr;
+};
+
+/* Same as dl_new_hash() in glibc, the hash of DT_GNU_HASH */
+static inline uint32_t gnu_hash(const char *s)
+{
+	uint32_t h = 5381;
+	unsigned char c;
+
+	while ((c = *s++) != '\0')
+		h = h * 33 + c;
+	return h;
+}
+
+void strhash_destroy(struct strhash *h);
+/**
+ * Add key if not exist, hash must be gnu_hash(key).
+ *
+ * @return: the slot of key, old one if exist, NULL if failed.
+ */
+struct strhash_slot *strhash_add(struct strhash *h, const char *key,
+				 uint32_t hash, unsigned long value);
+struct strhash_slot *strhash_find(const struct strhash *h, const char *key,
+				  uint32_t hash);
+/* Remove the slot returned by strhash_find() or strhash_add() */
+void strhash_del(struct strhash *h, struct strhash_slot *slot);
@@ -0,0 +1,107 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <utils/log.h>
+#include <utils/strpool.h>
+
+#define STR_POOL_MIN_BUCKETS	256
+
+/* FNV-1a */
+static unsigned int str_hash(const char *str, size_t *len)
+{
+	const unsigned char *p = (const unsigned char *)str;
+	unsigned int hash = 2166136261U;
+
+	while (*p) {
+		hash ^= *p++;
+		hash *= 16777619U;
+	}
+	*len = (const char *)p - str;
+	return hash;
+}
+
+int str_pool_init(struct str_pool *pool)
+{
+	memset(pool, 0, sizeof(*pool));
+	arena_init(&pool->arena, 0);
+
+	pool->buckets = calloc(STR_POOL_MIN_BUCKETS, sizeof(*pool->buckets));
+	if (!pool->buckets) {
+		ulp_error("Malloc string pool buckets failed.\n");
+		return -ENOMEM;
+	}
+	pool->nr_buckets = STR_POOL_MIN_BUCKETS;
+	return 0;
+}
+
+void str_pool_destroy(struct str_pool *pool)
+{
+	arena_destroy(&pool->arena);
+	free(pool->buckets);
+	memset(pool, 0, sizeof(*pool));
+}
+
+/* Keep load factor under 1 */
+static void str_pool_grow(struct str_pool *pool)
+{
+	struct str_pool_entry **buckets, *entry, *next;
+	unsigned int i, nr = pool->nr_buckets * 2;
+
+	buckets = calloc(nr, sizeof(*buckets));
+	if (!buckets)
+		return;
+
+	for (i = 0; i < pool->nr_buckets; i++) {
+		for (entry = pool->buckets[i]; entry; entry = next) {
+			next = entry->next;
+			entry->next = buckets[entry->hash & (nr - 1)];
+			buckets[entry->hash & (nr - 1)] = entry;
+		}
+	}
+
+	free(pool->buckets);
+	pool->buckets = buckets;
+	pool->nr_buckets = nr;
+}
+
+const char *str_pool_intern(struct str_pool *pool, const char *str)
+{
+	struct str_pool_entry *entry, **bucket;
+	unsigned int hash;
+	size_t len;
+
+	if (!pool->buckets || !str) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	hash = str_hash(str, &len);
+	bucket = &pool->buckets[hash & (pool->nr_buckets - 1)];
+
+	for (entry = *bucket; entry; entry = entry->next) {
+		if (entry->hash == hash && entry->len == len &&
+		    !memcmp(entry->str, str, len))
+			return entry->str;
+	}
+
+	entry = arena_alloc(&pool->arena,
+			    sizeof(struct str_pool_entry) + len + 1);
+	if (!entry)
+		return NULL;
+
+	entry->hash = hash;
+	entry->len = len;
+	entry->priv = -1;
+	memcpy(entry->str, str, len + 1);
+
+	entry->next = *bucket;
+	*bucket = entry;
+
+	if (++pool->nr_strs > pool->nr_buckets)
+		str_pool_grow(pool);
+
+	return entry->str;
+}
@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#pragma once
+#include <stddef.h>
+
+#include <utils/util.h>
+#include <utils/arena.h>
+
+/**
+ * String intern pool, each different string is stored once in the arena,
+ * and interned strings live until str_pool_destroy(), so they could be
+ * compared by pointer.
+ */
+struct str_pool_entry {
+	/* Hash chain of str_pool.buckets */
+	struct str_pool_entry *next;
+	unsigned int hash;
+	unsigned int len;
+	/* Caller private cache of this string, -1 if not set */
+	long priv;
+	char str[];
+};
+
+struct str_pool {
+	struct str_pool_entry **buckets;
+	/* Power of 2 */
+	unsigned int nr_buckets;
+	unsigned int nr_strs;
+	struct arena arena;
+};
+
+int str_pool_init(struct str_pool *pool);
+void str_pool_destroy(struct str_pool *pool);
+/* Return interned copy of str, NULL and set errno if failed */
+const char *str_pool_intern(struct str_pool *pool, const char *str);
+
+/* Only for strings returned by str_pool_intern() */
+static inline struct str_pool_entry *str_pool_entry(const char *str)
+{
+	return container_of(str, struct str_pool_entry, str);
+}
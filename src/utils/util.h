@@ -133,6 +133,8 @@
 
 /* all output need file store here, mkdir(2) it before running. */
 #define ULP_PROC_ROOT_DIR	"/tmp/ulpatch"
+/* ELF symbols cache, file name is Build ID, see symbol-bfd.c */
+#define ULP_SYMCACHE_DIR	ULP_PROC_ROOT_DIR "/symcache"
 
 #define MODE_0777 (S_IRUSR | S_IWUSR | S_IXUSR | \
 		   S_IRGRP | S_IWGRP | S_IXGRP | \
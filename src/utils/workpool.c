@@ -0,0 +1,75 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#include <errno.h>
+#include <pthread.h>
+#include <sys/sysinfo.h>
+
+#include <utils/log.h>
+#include <utils/workpool.h>
+
+struct workpool {
+	size_t next;
+	size_t nr_items;
+	workpool_fn fn;
+	void *arg;
+};
+
+/* Online CPUs, at most WORKPOOL_MAX_WORKERS */
+unsigned int workpool_nr_workers(void)
+{
+	int n = get_nprocs();
+
+	if (n < 1)
+		return 1;
+	return n > WORKPOOL_MAX_WORKERS ? WORKPOOL_MAX_WORKERS : n;
+}
+
+static void *workpool_worker(void *data)
+{
+	struct workpool *wp = data;
+	size_t idx;
+
+	while ((idx = __atomic_fetch_add(&wp->next, 1, __ATOMIC_RELAXED))
+	       < wp->nr_items)
+		wp->fn(idx, wp->arg);
+
+	return NULL;
+}
+
+int workpool_run(unsigned int nr_workers, size_t nr_items, workpool_fn fn,
+		 void *arg)
+{
+	unsigned int i, nr_threads = 0;
+	pthread_t threads[WORKPOOL_MAX_WORKERS];
+	struct workpool wp = {
+		.next = 0,
+		.nr_items = nr_items,
+		.fn = fn,
+		.arg = arg,
+	};
+
+	if (!fn)
+		return -EINVAL;
+
+	if (nr_workers > WORKPOOL_MAX_WORKERS)
+		nr_workers = WORKPOOL_MAX_WORKERS;
+	if (nr_workers > nr_items)
+		nr_workers = nr_items;
+
+	/* The caller is the first worker */
+	for (i = 1; i < nr_workers; i++) {
+		if (pthread_create(&threads[nr_threads], NULL, workpool_worker,
+				   &wp)) {
+			ulp_warning("Create worker failed, %m\n");
+			break;
+		}
+		nr_threads++;
+	}
+
+	workpool_worker(&wp);
+
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	return 0;
+}
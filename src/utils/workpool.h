@@ -0,0 +1,17 @@
+// SPDX-License-Identifier: GPL-2.0-or-later
+/* Copyright (C) 2025 Rong Tao */
+#pragma once
+#include <stddef.h>
+
+/**
+ * Fixed size worker pool, workers pull item index from a shared counter
+ * until all items are consumed. The caller is one of the workers, and
+ * workpool_run() returns when all items are done.
+ */
+#define WORKPOOL_MAX_WORKERS	64
+
+typedef void (*workpool_fn)(size_t idx, void *arg);
+
+unsigned int workpool_nr_workers(void);
+int workpool_run(unsigned int nr_workers, size_t nr_items, workpool_fn fn,
+		 void *arg);
@@ -179,6 +179,7 @@ popd
 
 %files devel
 %{_includedir}/ulpatch/asm.h
+%{_includedir}/ulpatch/ftrace.h
 %{_includedir}/ulpatch/meta.h
 %{_bindir}/ulpconfig
 %{_mandir}/man8/ulpconfig.8.gz
@@ -187,6 +188,7 @@ popd
 %{_bindir}/ulpatch_test
 %{_datadir}/ulpatch/ulpatches/empty.ulp
 %{_datadir}/ulpatch/ulpatches/printf.ulp
+%{_datadir}/ulpatch/ulpatches/multi.ulp
 
 %changelog
 * Thu Jan 02 2025 Rong Tao <rtoax@foxmail.com> - 0.5.12-3